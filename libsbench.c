@@ -0,0 +1,275 @@
+/*
+ * Simple Benchmarks: the tests as a library, to run them in-process
+ * (like a monitoring agent running cheap probes at high frequency)
+ * instead of forking sbench for each one.
+ *
+ * A context is opened once and then runs tests again and again: the
+ * threads and the page-aligned buffers of the tests are created by the
+ * first test that needs them and kept for the next ones, until the last
+ * context is closed. The errors of a test are returned as a code
+ * (enum sbenchError) with its message on sbenchLastError, the program
+ * isn't ended. The command line is a client of it.
+ *
+ * sbenchMeasure gives just the main value of a test, the one that
+ * the thresholds of the command line apply to, and allocates nothing.
+ * sbenchRun adds its metrics and text to a result like the command
+ * line prints.
+ *
+ * @since 20161027
+ * @author zoquero@gmail.com
+ */
+
+#include <stdio.h>        // snprintf
+#include <stdlib.h>       // calloc, free
+#include <string.h>       // strcpy
+#include <limits.h>       // PATH_MAX
+#include <pthread.h>      // pthread_mutex_t
+#include <curl/curl.h>    // curl_global_init
+
+#include "sbenchfuncs.h"
+#include "sbenchpool.h"
+#include "sbenchresult.h"
+#include "libsbench.h"
+
+struct sbench_ctx {
+  /** why the last test failed, "" if it didn't */
+  char             error[PATH_MAX + 200];
+  /** latency of the blocks of an open-loop disk test */
+  latencyHistogram latency;
+};
+
+/** messages of the error codes, indexed by enum sbenchError */
+static const char *errorNames[SBENCH_ERRORS] = {"ok", "wrong parameters", "out of memory",
+  "can't create the threads", "can't access the file", "I/O error", "HTTP error",
+  "content differs from the reference", "test not available on the library",
+  "can't run in realtime", "no replies", "network error"};
+
+/* the tests of all the contexts run one at a time: they share the pool,
+   the sampler and the perf counters, and at once they'd measure each other */
+static pthread_mutex_t libLock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int    nContexts;
+
+
+/**
+  * Opens a context to run tests.
+  * @return NULL if it can't be allocated
+  */
+sbench_ctx *sbenchOpen() {
+  sbench_ctx *ctx = (sbench_ctx *) calloc(1, sizeof(sbench_ctx));
+
+  if(ctx == NULL)
+    return NULL;
+  pthread_mutex_lock(&libLock);
+  // once, not on every http_get
+  if(nContexts++ == 0)
+    curl_global_init(CURL_GLOBAL_ALL);
+  pthread_mutex_unlock(&libLock);
+  return ctx;
+}
+
+
+/**
+  * Closes a context, the last one finishes the threads and frees the
+  * buffers that the tests kept.
+  */
+void sbenchClose(sbench_ctx *ctx) {
+  if(ctx == NULL)
+    return;
+  pthread_mutex_lock(&libLock);
+  if(--nContexts == 0) {
+    sbenchFreePool();
+    curl_global_cleanup();
+  }
+  pthread_mutex_unlock(&libLock);
+  free(ctx);
+}
+
+
+/**
+  * Why the last test of the context failed, "" if it didn't.
+  */
+const char *sbenchLastError(sbench_ctx *ctx) {
+  return ctx->error;
+}
+
+
+const char *sbenchStrError(int code) {
+  return code >= 0 && code < SBENCH_ERRORS ? errorNames[code] : "unknown error";
+}
+
+
+/**
+  * The params that the test needs, the ones that the command line
+  * checks when parsing "-p".
+  */
+static int checkTest(const sbench_test *t) {
+  switch(t->type) {
+    case CPU:
+      if(t->times == 0 || t->nThreads == 0)
+        return sbenchFailTest(SBENCH_ERR_PARAMS, "cpu needs times and threads");
+      return SBENCH_OK;
+    case MEM:
+      if(t->times == 0 || t->sizeInBytes == 0)
+        return sbenchFailTest(SBENCH_ERR_PARAMS, "mem needs times and size");
+      return SBENCH_OK;
+    case DISK_W:
+    case DISK_R_SEQ:
+    case DISK_R_RAN:
+      if(t->times == 0 || t->sizeInBytes == 0 || t->nThreads == 0 || t->path == NULL || t->rate < 0)
+        return sbenchFailTest(SBENCH_ERR_PARAMS, "disk tests need times, size, threads and path");
+      return SBENCH_OK;
+    case HTTP_GET:
+      if(t->url == NULL || t->httpRefFileBasename == NULL)
+        return sbenchFailTest(SBENCH_ERR_PARAMS, "http_get needs the URL and its reference");
+      return SBENCH_OK;
+    default:
+      return sbenchFailTest(SBENCH_ERR_UNSUPPORTED, "The library runs cpu, mem, disk_w, disk_r_seq, disk_r_ran and http_get");
+  }
+}
+
+
+/**
+  * Runs a test, holding libLock.
+  * @param delta return value, seconds of the test (of each thread)
+  */
+static int runLibraryTest(sbench_ctx *ctx, const sbench_test *t, double *delta, httpResponse *hr, int *different) {
+  int err;
+
+  sbenchClearTestFailure();
+  if((err = checkTest(t)) != SBENCH_OK)
+    return err;
+  switch(t->type) {
+    case CPU:
+      return sbenchDoCpuTest(t->times, t->nThreads, t->verbose, t->realtime, delta);
+    case MEM:
+      return sbenchDoMemTest(t->sizeInBytes, t->times, t->verbose, t->realtime, delta);
+    case DISK_W:
+      return sbenchDoDiskWriteTest(t->sizeInBytes, t->times, t->nThreads, t->path, t->rate, &ctx->latency,
+                                   t->verbose, t->realtime, delta);
+    case DISK_R_SEQ:
+    case DISK_R_RAN:
+      return sbenchDoDiskReadTest(t->type, t->sizeInBytes, t->times, t->nThreads, t->path, t->rate, &ctx->latency,
+                                  t->verbose, t->realtime, delta);
+    default: // HTTP_GET
+      err    = sbenchHttpGet(t->url, t->httpRefFileBasename, different, t->verbose, t->realtime, hr);
+      *delta = hr->phase[HTTP_TOTAL];
+      return err;
+  }
+}
+
+
+/**
+  * The main value of a test: calcs/s of each thread of cpu, the seconds
+  * of the others, or the p99 in ms of an open-loop disk test.
+  */
+static double mainValue(sbench_ctx *ctx, const sbench_test *t, double delta, latencyStats *ls) {
+  if(t->type == CPU)
+    return delta > 0 ? t->times / delta : 0;
+  if(t->type != MEM && t->type != HTTP_GET && t->rate > 0) {
+    sbenchHistogramStats(&ctx->latency, ls);
+    return ls->p99;
+  }
+  return delta;
+}
+
+
+/**
+  * Runs a test and gives its main value, without allocating a result.
+  * A body of http_get that differs from its reference is an error
+  * (SBENCH_ERR_CONTENT) as it has no other way to tell it.
+  * @param value return value, see mainValue
+  * @return SBENCH_OK or why it failed, see sbenchLastError
+  */
+int sbenchMeasure(sbench_ctx *ctx, const sbench_test *t, double *value) {
+  double       delta = 0;
+  int          different = 0, err;
+  httpResponse hr;
+  latencyStats ls;
+
+  pthread_mutex_lock(&libLock);
+  err = runLibraryTest(ctx, t, &delta, &hr, &different);
+  if(err == SBENCH_OK && different)
+    err = sbenchFailTest(SBENCH_ERR_CONTENT, "The body of %s differs from its reference", t->url);
+  if(err == SBENCH_OK)
+    *value = mainValue(ctx, t, delta, &ls);
+  snprintf(ctx->error, sizeof(ctx->error), "%s", err != SBENCH_OK ? sbenchTestFailureMessage() : "");
+  pthread_mutex_unlock(&libLock);
+  return err;
+}
+
+
+/**
+  * Adds the metrics, summary and text of a test that has run.
+  * @param value return value, see mainValue
+  * @return SBENCH_OK or why they couldn't be added
+  */
+static int addTestMetrics(sbench_ctx *ctx, const sbench_test *t, test_result *res, double r,
+                          httpResponse *hr, int different, double *value) {
+  latencyStats ls;
+  double       v = mainValue(ctx, t, r, &ls);
+
+  *value = v;
+
+  switch(t->type) {
+    case CPU:
+      sbenchAddMetric(res, "avg_calcs_per_sec", v, "");
+      sbenchAddMetric(res, "time", r, "s");
+      sprintf(res->summary, "%.2f avg calcs/s per software thread", v);
+      sbenchAppendText(res, "%.2f avg calcs/s per software thread\n", v);
+      break;
+    case MEM:
+      sbenchAddMetric(res, "time", r, "s");
+      sbenchAddMetric(res, "bytes_per_sec", r > 0 ? (double) t->sizeInBytes * t->times / r : 0, "");
+      sprintf(res->summary, "%.2f s", r);
+      sbenchAppendText(res, "%.2f s\n", r);
+      break;
+    case HTTP_GET:
+      sbenchAddMetric(res, "time", r, "s");
+      for(int i = 0; i < HTTP_TOTAL; i++)
+        sbenchAddMetric(res, sbenchHttpPhaseNames[i], hr->phase[i], "s");
+      sbenchAddMetric(res, "speed", hr->speedDownload, "B");
+      sbenchAddMetric(res, "content_differs", different, "");
+      sprintf(res->summary, "%.3f s%s", r, different ? " content differs from reference" : "");
+      sbenchAppendText(res, "%s %.3f s;dns %.6f s;connect %.6f s;tls %.6f s;ttfb %.6f s;"
+                       "transfer %.6f s;%.0f B/s\n", different ? "KO" : "OK", r,
+                       hr->phase[HTTP_DNS], hr->phase[HTTP_CONNECT], hr->phase[HTTP_TLS],
+                       hr->phase[HTTP_TTFB], hr->phase[HTTP_TRANSFER], hr->speedDownload);
+      break;
+    default: // the disk tests, r is the average time of each thread
+      sbenchAddMetric(res, "time", r, "s");
+      sbenchAddMetric(res, "bytes_per_sec", r > 0 ? (double) t->sizeInBytes * t->times * t->nThreads / r : 0, "");
+      sbenchAddMetric(res, "iops", r > 0 ? (double) t->times * t->nThreads / r : 0, "");
+      if(t->rate > 0)
+        // at a given load the time is the load, the latency tells
+        sbenchAddOpenLoopLatency(res, t->rate, &ctx->latency, &ls);
+      else {
+        sprintf(res->summary, t->type == DISK_W ? "%.2f s" : "%.6f s", r);
+        sbenchAppendText(res, t->type == DISK_W ? "%.2f s\n" : "%.6f s\n", r);
+      }
+  }
+  // what couldn't be added, see sbenchFailTest
+  return sbenchTestFailure();
+}
+
+
+/**
+  * Runs a test and adds its metrics, summary and text to a result,
+  * that must be started with sbenchInitResult. Its status is left to the
+  * caller, like the thresholds.
+  * @param value return value, see mainValue, can be NULL
+  * @return SBENCH_OK or why it failed, see sbenchLastError
+  */
+int sbenchRun(sbench_ctx *ctx, const sbench_test *t, test_result *res, double *value) {
+  double       r = 0, v;
+  int          different = 0, err;
+  httpResponse hr;
+
+  pthread_mutex_lock(&libLock);
+  if((err = runLibraryTest(ctx, t, &r, &hr, &different)) == SBENCH_OK)
+    err = addTestMetrics(ctx, t, res, r, &hr, different, &v);
+  snprintf(ctx->error, sizeof(ctx->error), "%s", err != SBENCH_OK ? sbenchTestFailureMessage() : "");
+  pthread_mutex_unlock(&libLock);
+  if(err == SBENCH_OK && value != NULL)
+    *value = v;
+  return err;
+}
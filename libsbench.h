@@ -0,0 +1,46 @@
+/*
+ * Simple Benchmarks: the tests as a library, to run them in-process
+ * (like a monitoring agent running cheap probes at high frequency)
+ * instead of forking sbench for each one.
+ *
+ * @since 20161027
+ * @author zoquero@gmail.com
+ */
+
+#ifndef LIBSBENCH_H
+#define LIBSBENCH_H
+
+#include "sbenchfuncs.h"   // enum btype, enum sbenchError
+#include "sbenchresult.h"  // test_result
+
+/** what the library keeps between tests, opaque */
+typedef struct sbench_ctx sbench_ctx;
+
+/** a test to run, what the "-p" params of the command line say */
+typedef struct {
+  /** CPU, MEM, DISK_W, DISK_R_SEQ, DISK_R_RAN or HTTP_GET */
+  enum btype     type;
+  /** calcs of each thread, allocations, or blocks of each thread */
+  unsigned long  times;
+  /** of each allocation or block */
+  unsigned long  sizeInBytes;
+  unsigned int   nThreads;
+  /** folder of disk_w, file of disk_r_seq and disk_r_ran */
+  char          *path;
+  /** http_get: the URL and its reference on CURL_REFS_FOLDER */
+  char          *url;
+  char          *httpRefFileBasename;
+  /** disk tests: blocks/s of all the threads on an open loop, 0 == as fast as possible */
+  double         rate;
+  int            verbose;
+  int            realtime;
+} sbench_test;
+
+sbench_ctx *sbenchOpen();
+int         sbenchMeasure(sbench_ctx *ctx, const sbench_test *t, double *value);
+int         sbenchRun(sbench_ctx *ctx, const sbench_test *t, test_result *res, double *value);
+const char *sbenchLastError(sbench_ctx *ctx);
+const char *sbenchStrError(int code);
+void        sbenchClose(sbench_ctx *ctx);
+
+#endif // LIBSBENCH_H
@@ -9,6 +9,12 @@
  * * DISK_R_RAN: Shows the time it takes to random read chunks from a file
  * * HTTP_GET: Shows the time it takes to HTTP GET a file
  * * PING: Shows the round-trip time when pinging a host
+ * * MIXED: Loads cpu, memory, disks and network at once
+ * * SCHED_LAT: Shows how late timer threads wake up on each CPU
+ * * CPU_C2C: Shows the time it takes to move a cache line between each pair of CPUs
+ * * CPU_SYNC: Shows how atomics and locks scale as more threads contend for them
+ * 
+ * With "-d" it's a daemon that runs some of them as probes on intervals.
  * 
  * Sources: https://github.com/zoquero/sbench/
  * 
@@ -21,9 +27,89 @@
 #include <ctype.h>        // isprint
 #include <getopt.h>       // getopt
 #include <errno.h>        // errno
+#include <unistd.h>       // sleep
+#include <math.h>         // isnan
 #include <curl/curl.h>    // libcurl
 
 #include "sbenchfuncs.h"
+#include "sbenchnet.h"
+#include "sbenchtime.h"
+#include "sbenchperf.h"
+#include "sbenchresult.h"
+#include "sbenchmixed.h"
+#include "sbenchdaemon.h"
+#include "sbenchstore.h"
+#include "sbenchcoord.h"
+#include "sbenchsample.h"
+#include "sbenchcontext.h"
+#include "sbenchcgroup.h"
+#include "sbenchsched.h"
+#include "sbenchcores.h"
+#include "sbenchfreq.h"
+#include "libsbench.h"
+
+/** the tests of sbenchfuncs.c run on the library, the command line is a client of it */
+static sbench_ctx *lib;
+
+/** names of the tests on "-t", indexed by enum btype */
+const char *typeNames[] = {"cpu", "mem", "disk_w", "disk_r_seq", "disk_r_ran", "http_get", "ping",
+  "tcp_server", "tcp_client", "udp_reflector", "udp_rr", "survey", "tcp_listener", "tcp_connect", "mixed", "sched_lat", "cpu_c2c", "cpu_sync"};
+
+#define MAX_SCENARIO_STEPS 256
+/* "sbench" and the 8 options of a step with their values */
+#define MAX_SCENARIO_ARGS  16
+
+/** a test as asked for on the command line or on a step of a scenario */
+typedef struct {
+  enum btype        thisType;
+  /** the "-p" params and what is parsed from them */
+  char             *params;
+  unsigned long     times;
+  unsigned long     sizeInBytes;
+  /** the pairs sampled on cpu_c2c */
+  unsigned int      nThreads;
+  char              folderName[PATH_MAX-12];
+  char              targetFileName[PATH_MAX];
+  char              url[CURLINFO_EFFECTIVE_URL];
+  char              httpRefFileBasename[PATH_MAX];
+  unsigned long     timeoutInMS;
+  char              dest[HOST_NAME_MAX];
+  char              port[32];
+  unsigned long     rate;
+  /** of ping and survey, in microseconds on sched_lat */
+  unsigned long     intervalMs;
+  int               verbose;
+  int               realtime;
+  int               nagiosPluginOutput;
+  double            warnLevels[MAX_THRESHOLDS];
+  int               nWarn;
+  double            critLevels[MAX_THRESHOLDS];
+  int               nCrit;
+  net_options       netOptions;
+  repetition_params repetitions;
+  /** "--rate": operations per second on an open loop, 0 == closed loop */
+  double            openLoopRate;
+  /** "--sample-interval" in seconds, 0 == no time series */
+  double            sampleInterval;
+  /** "--context": what else the host did while the test ran */
+  int               context;
+  /** "--freq": the clock frequency of the threads of cpu */
+  int               freq;
+  /** seconds to wait after this step of a scenario */
+  unsigned long     cooldown;
+  /** seconds between the runs of this probe of the daemon */
+  unsigned long     interval;
+  /** "--save-baseline", "--compare-baseline" and "--baseline-store" */
+  int               saveBaseline;
+  int               compareBaseline;
+  char             *baselineStore;
+  /** "--secret": file with the secret of the coordinator and its agents */
+  char             *secretFile;
+  /** on --compare-baseline "-w" and "-c" are percents worse than the baseline */
+  int               baselineThresholds;
+  double            baselineWarn;
+  double            baselineCrit;
+} test_options;
 
 void usage() {
   printf("Simple, tunable and lightweight benchmarking tool"
@@ -56,11 +142,96 @@ void usage() {
   printf("sbench (-v) (-r) -t ping       "
          "(-w latencyWarn_lossWarn -c latencyCrit_lossCrit) "
          "-p <times,sizeInBytes,dest>\n");
+  printf("sbench (-v) (-r) -t ping       "
+         "(-w latencyWarn_lossWarn -c latencyCrit_lossCrit) "
+         "-p <times,sizeInBytes,intervalMs,dest>\n");
   printf("sbench (-v) (-r) -t http_get   "
          "(-w warnThreshold -c critThreshold) "
          "-p <httpRef,url>\n");
+  printf("sbench (-v) (-r) -t http_get   "
+         "(-w dns_connect_tls_ttfb_transfer_total "
+         "-c dns_connect_tls_ttfb_transfer_total) "
+         "-p <httpRef,url>\n");
+  printf("sbench (-v) (-r) -t tcp_server (-o netOptions) "
+         "-p <connections,port>\n");
+  printf("sbench (-v) (-r) -t tcp_client (-o netOptions) "
+         "(-w gbpsWarn_retransWarn -c gbpsCrit_retransCrit) "
+         "-p <seconds,numStreams,msgSizeInBytes,port,host>\n");
+  printf("sbench (-v) (-r) -t udp_reflector "
+         "-p <seconds,port>\n");
+  printf("sbench (-v) (-r) -t udp_rr     "
+         "(-w p99MsWarn_lossWarn -c p99MsCrit_lossCrit) "
+         "-p <count,ratePerSec,sizeInBytes,port,host>\n");
+  printf("sbench (-v) (-r) -t survey     "
+         "(-w latencyWarn_lossWarn -c latencyCrit_lossCrit) "
+         "-p <times,intervalMs,target(,target...)>\n");
+  printf("sbench (-v) (-r) -t survey     "
+         "(-w latencyWarn_lossWarn -c latencyCrit_lossCrit) "
+         "-p <times,intervalMs,@targetsFile>\n");
+  printf("sbench (-v) (-r) -t tcp_listener (-o netOptions) "
+         "-p <seconds,port>\n");
+  printf("sbench (-v) (-r) -t tcp_connect (-o netOptions) "
+         "(-w connectsPerSecWarn_p99MsWarn -c connectsPerSecCrit_p99MsCrit) "
+         "-p <seconds,concurrency,ratePerSec,port,host>\n");
+  printf("sbench (-v) (-r) -t mixed      "
+         "(-w p99MsWarn -c p99MsCrit) "
+         "-p <seconds,component(,component...)>\n");
+  printf("sbench (-v) (-r) -t sched_lat  "
+         "(-w p99UsWarn -c p99UsCrit) "
+         "-p <seconds,intervalUs(,numThreads)>\n");
+  printf("sbench (-v) (-r) -t cpu_c2c    "
+         "(-w maxNsWarn -c maxNsCrit) "
+         "-p <roundTrips(,maxPairs)>\n");
+  printf("sbench (-v) (-r) -t cpu_sync   "
+         "(-w efficiencyWarn -c efficiencyCrit) "
+         "-p <msPerStep(,maxThreads)>\n");
+  printf("sbench (-v) (-r) -f scenarioFile\n");
+  printf("sbench (-v) (-r) -d probesFile\n");
+  printf("sbench (-v) (-r) --agent (address:)port --secret file\n");
+  printf("sbench (-v) (-r) --coordinate host:port(,host:port...) --secret file -f scenarioFile\n");
   printf("\n * -v == verbose:\n");
   printf(  " * -r == RealTime:\n");
+  printf(  " * -T == time with the TSC if it's invariant"
+           " (default CLOCK_MONOTONIC_RAW):\n");
+  printf(  " * -P == print the perf_event counters of the test threads:\n"
+           "     cycles, instructions, IPC, cache/branch/TLB misses...\n");
+  printf(  " * -O == output format: text (default, nagios if thresholds are set),\n"
+           "     json, csv or openmetrics\n");
+  printf(  " * -n == repetitions(,warmup): run the test some times\n"
+           "     and report mean, median, stddev and CI95 of its main value\n");
+  printf(  " * -a == ciPercent,maxSeconds: adaptive, repeat until the CI95\n"
+           "     is narrower than ciPercent of the mean or maxSeconds pass\n");
+  printf(  " * -o == netOptions, comma-separated list of:\n"
+           "     sndbuf=bytes rcvbuf=bytes nodelay "
+           "send=write|sendfile|splice|zerocopy reset\n");
+  printf(  " * --rate == opsPerSec: disk_w, disk_r_*, tcp_client and http_get (with -n)\n"
+           "     start their operations on a fixed schedule instead of as fast as\n"
+           "     possible and report their latency from when they should have started\n");
+  printf(  " * --sample-interval == ms: cpu, mem, disk_w, disk_r_* and tcp_client report\n"
+           "     what they did on each interval while running and where it changed\n");
+  printf(  " * --context: report what else the host did while the test ran: cpu\n"
+           "     steal and iowait, pressure stalls, reclaim, swap, the disk of the\n"
+           "     test and tcp/udp errors, from before, during and after it\n");
+  printf(  " * --freq: cpu reports the clock frequency that its threads got while\n"
+           "     running, to tell a slower clock from threads contending for cores\n");
+  printf(  " * auto: numThreads of cpu, disk_w and disk_r_ran, maxThreads of cpu_sync,\n"
+           "     numStreams of tcp_client and sizeInBytes of mem can be \"auto\", what the\n"
+           "     CPUs, the CPU quota and the memory of the cgroup (container, slice) of sbench allow\n");
+  printf(  " * --save-baseline: keep the main value of this run (of each run with -n)\n"
+           "     on the baseline store, for this test with these params on this host\n");
+  printf(  " * --compare-baseline: compare this run with its baseline, with -w and -c\n"
+           "     as percents worse than the baseline that are significant\n");
+  printf(  " * --baseline-store == file: the baseline store (default %s)\n", BASELINE_STORE);
+  printf(  " * -f == scenario: run the tests of its steps one after the other\n"
+           "     and report them together\n");
+  printf(  " * -d == daemon: run the tests of its probes on their intervals and\n"
+           "     serve the aggregates on a unix socket and as OpenMetrics by HTTP\n");
+  printf(  " * --agent == (address:)port: wait for coordinators and run their\n"
+           "     scenarios, on the loopback if there's no address\n");
+  printf(  " * --coordinate == agents: run the steps of the scenario (-f) at once\n"
+           "     on the agents and report each host and all of them merged\n");
+  printf(  " * --secret == file: its first line is the secret that the coordinator\n"
+           "     and its agents share, required with --agent and --coordinate\n");
   printf("\nExamples:\n");
   printf("* To allocate&commit 10 MiB of RAM and memset it 10 times\n"
          "      and get a response in nagios plugin-like format:\n");
@@ -80,10 +251,74 @@ void usage() {
   printf("* Idem but applying latency warning = 5ms, latency crit = 30ms,\n");
   printf("      packet loss warning = 1%%, packet loss critical = 5%%:\n");
   printf("  sbench -t ping -w 5_1 -c 30_5 -p 4,56,www.gnu.org\n\n");
+  printf("* To send 100 ICMP echo requests of 56 bytes every 10ms:\n");
+  printf("  sbench -t ping -p 100,56,10,www.gnu.org\n\n");
   printf("* To download by HTTP GET http://www.test.com/file ,\n");
   printf("      and to compare it with the reference:\n");
-  printf("      file 'my_ref_file' located at %s :\n", CURL_REFS_FOLDER);
+  printf("      file 'my_ref_file' located at %s\n", CURL_REFS_FOLDER);
+  printf("      or its digest 'my_ref_file.sha256' written by sha256sum :\n");
   printf("  sbench -t http_get -p my_ref_file,http://www.test.com/file\n\n");
+  printf("* Idem but warning if the server takes 0.5s to send the first byte\n"
+         "      (ttfb) and critical if it takes 1s or the whole GET takes 5s,\n"
+         "      a negative threshold ignores that phase:\n");
+  printf("  sbench -t http_get -w -1_-1_-1_0.5_-1_-1 -c -1_-1_-1_1_-1_5 \\\n"
+         "     -p my_ref_file,http://www.test.com/file\n\n");
+  printf("* To measure TCP throughput over 4 parallel streams for 10s\n"
+         "      sending 128 KiB messages with sendfile, run on the server:\n");
+  printf("  sbench -t tcp_server -p 4,5201\n");
+  printf("      and on the client:\n");
+  printf("  sbench -t tcp_client -o send=sendfile -p 10,4,131072,5201,server\n");
+  printf("      (tcp_server serves that many connections, 0 == forever)\n\n");
+  printf("* To measure the UDP round-trip time of 1000 datagrams of 64 bytes\n"
+         "      sent at 100 per second, run on the other host for 60s:\n");
+  printf("  sbench -t udp_reflector -p 60,7007\n");
+  printf("      and then:\n");
+  printf("  sbench -t udp_rr -p 1000,100,64,7007,server\n\n");
+  printf("* To survey at once the latency of many hosts, 5 probes every 200ms:\n"
+         "      ICMP echo to 'host', TCP connect to 'host/port',\n"
+         "      or one target per line of a file with '@fileName':\n");
+  printf("  sbench -t survey -p 5,200,www.gnu.org,www.kernel.org/443\n");
+  printf("  sbench -t survey -p 5,200,@/etc/sbench/fleet.txt\n\n");
+  printf("* To open and close as many TCP connections as possible for 10s\n"
+         "      with 64 attempts in flight (ratePerSec 0 == max rate):\n");
+  printf("  sbench -t tcp_listener -p 15,8080\n");
+  printf("  sbench -t tcp_connect -p 10,64,0,8080,server\n\n");
+  printf("* To load at once for 30s 2 CPUs, the memory bandwidth with 2 threads\n"
+         "      copying 64 MiB, and a disk with 4 threads reading random 4k blocks,\n"
+         "      components cpu:threads, mem:threads:bufferSize,\n"
+         "      disk_w:threads:blockSize:folder, disk_r_seq|disk_r_ran:threads:blockSize:file\n"
+         "      and tcp_client:streams:msgSize:port:host (against a tcp_server):\n");
+  printf("  sbench -t mixed -p 30,cpu:2,mem:2:67108864,disk_r_ran:4:4096:/tmp/_sbench.testfile\n\n");
+  printf("* To measure the CPU 10 times after 2 warmup runs and get the\n"
+         "      confidence interval, critical only if it's significant:\n");
+  printf("  sbench -t cpu -n 10,2 -w 1000000 -c 2000000 -p 10000000\n\n");
+  printf("* To repeat a disk read until the CI95 is within 2%% of the mean,\n"
+         "      for 60s at most:\n");
+  printf("  sbench -t disk_r_seq -a 2,60 -p 25600,4096,/tmp/_sbench.testfile\n\n");
+  printf("* To read random 4k blocks at 200 per second, a known load for\n"
+         "      a production host, and get the latency at that load:\n");
+  printf("  sbench -t disk_r_ran --rate 200 -w 5 -c 20 -p 6000,4096,/tmp/_sbench.testfile\n\n");
+  printf("* To write for 10 minutes and see every second the throughput and\n"
+         "      latency, and when it falls as the burst credits of the disk run out:\n");
+  printf("  sbench -t disk_w --sample-interval 1000 -p 600000,65536,/mnt/data/_sbench.d\n\n");
+  printf("* To keep 30 runs of a random read on the idle host as its baseline\n"
+         "      and then be warned if it's 20%% slower, critical if it's 50%%:\n");
+  printf("  sbench -t disk_r_ran -n 30 --save-baseline -p 6000,4096,/tmp/_sbench.testfile\n");
+  printf("  sbench -t disk_r_ran --compare-baseline -w 20 -c 50 -p 6000,4096,/tmp/_sbench.testfile\n\n");
+  printf("* To run the steps of a scenario, one section per step with the\n"
+         "      options as keys (t = cpu, p = 10000000,2, w = ...), and get\n"
+         "      one report of all of them as JSON:\n");
+  printf("  sbench -O json -f /etc/sbench/nightly.ini\n\n");
+  printf("* To probe the host continuously, a section per probe like on a\n"
+         "      scenario with its interval in seconds (interval = 10) and\n"
+         "      where to serve (listen = 9107, socket = /run/sbench.sock),\n"
+         "      and then scrape http://localhost:9107/metrics :\n");
+  printf("  sbench -d /etc/sbench/probes.ini\n\n");
+  printf("* To run a scenario at once on 3 hosts, starting each step within\n"
+         "      a millisecond on all of them, and get the latency of the fleet:\n");
+  printf("  sbench --agent 0.0.0.0:7100 --secret /etc/sbench/secret   (on each host)\n");
+  printf("  sbench --coordinate web1:7100,web2:7100,web3:7100 --secret /etc/sbench/secret \\\n"
+         "      -f /etc/sbench/load.ini\n\n");
   printf("\nzoquero@gmail.com https://github.com/zoquero/sbench\n");
   exit(EXIT_CODE_CRITICAL);
 }
@@ -91,6 +326,7 @@ void usage() {
 unsigned long parseUL(char *str, char *valNameForErrors) {
   unsigned long r;
   char *endptr;
+  errno = 0; // not left over from a previous call
   r = strtol(str, &endptr, 10);
   if((errno == ERANGE && (r == LONG_MAX || r == LONG_MIN)) || (errno != 0 && r == 0)) {
     fprintf(stderr, "Error parsing \"%s\". Probably value too long.\n", valNameForErrors);
@@ -103,7 +339,7 @@ unsigned long parseUL(char *str, char *valNameForErrors) {
   return r;
 }
 
-void parseParams(char *params, enum btype thisType, int verbose, unsigned long *times, unsigned long *sizeInBytes, unsigned int *nThreads, char *folderName, char *targetFileName, char *url, char *httpRefFileBasename, unsigned long *timeoutInMS, char *dest, double warn, double crit) {
+void parseParams(char *params, enum btype thisType, int verbose, unsigned long *times, unsigned long *sizeInBytes, unsigned int *nThreads, char *folderName, char *targetFileName, char *url, char *httpRefFileBasename, unsigned long *timeoutInMS, char *dest, char *port, unsigned long *rate, unsigned long *intervalMs, double warn, double crit) {
   if(thisType == CPU) {
     if(strlen(params) > 19) {
       fprintf(stderr, "Params must be in \"num,num\" format\n");
@@ -170,14 +406,136 @@ void parseParams(char *params, enum btype thisType, int verbose, unsigned long *
   }
 // ifdef OPING_ENABLED
   else if(thisType == PING) {
-    if(sscanf(params, "%lu,%lu,%s", times, sizeInBytes, dest) != 3) {
-      fprintf(stderr, "Params must be in \"times,sizeInBytes,dest\" format\n");
+    if(sscanf(params, "%lu,%lu,%lu,%63s", times, sizeInBytes, intervalMs, dest) != 4) {
+      *intervalMs = 1000;
+      if(sscanf(params, "%lu,%lu,%63s", times, sizeInBytes, dest) != 3) {
+        fprintf(stderr, "Params must be in \"times,sizeInBytes,(intervalMs,)dest\" format\n");
+        usage();
+      }
+    }
+    if(*times == 0) {
+      fprintf(stderr, "It must send at least one echo request\n");
       usage();
     }
     if(verbose)
-      printf("type=ping, sizeInBytes=%lu, times=%lu, dest=%s, verbose=%d\n", *sizeInBytes, *times, dest, verbose);
+      printf("type=ping, sizeInBytes=%lu, times=%lu, intervalMs=%lu, dest=%s, verbose=%d\n", *sizeInBytes, *times, *intervalMs, dest, verbose);
   }
 // endif // OPING_ENABLED
+  else if(thisType == TCP_SERVER) {
+    if(sscanf(params, "%lu,%31s", times, port) != 2) {
+      fprintf(stderr, "Params must be in \"connections,port\" format\n");
+      usage();
+    }
+    if(verbose)
+      printf("type=tcp_server, connections=%lu, port=%s, verbose=%d\n", *times, port, verbose);
+  }
+  else if(thisType == TCP_CLIENT) {
+    if(sscanf(params, "%lu,%u,%lu,%31[^,],%63s", times, nThreads, sizeInBytes, port, dest) != 5 ||
+       *nThreads == 0 || *sizeInBytes == 0) {
+      fprintf(stderr, "Params must be in \"seconds,numStreams,msgSizeInBytes,port,host\" format\n");
+      usage();
+    }
+    if(verbose)
+      printf("type=tcp_client, seconds=%lu, numStreams=%u, msgSizeInBytes=%lu, port=%s, host=%s, warnLevel=%f, critLevel=%f, verbose=%d\n", *times, *nThreads, *sizeInBytes, port, dest, warn, crit, verbose);
+  }
+  else if(thisType == UDP_REFLECTOR) {
+    if(sscanf(params, "%lu,%31s", times, port) != 2) {
+      fprintf(stderr, "Params must be in \"seconds,port\" format\n");
+      usage();
+    }
+    if(verbose)
+      printf("type=udp_reflector, seconds=%lu, port=%s, verbose=%d\n", *times, port, verbose);
+  }
+  else if(thisType == UDP_RR) {
+    if(sscanf(params, "%lu,%lu,%lu,%31[^,],%63s", times, rate, sizeInBytes, port, dest) != 5 ||
+       *times == 0 || *rate == 0) {
+      fprintf(stderr, "Params must be in \"count,ratePerSec,sizeInBytes,port,host\" format\n");
+      usage();
+    }
+    if(verbose)
+      printf("type=udp_rr, count=%lu, ratePerSec=%lu, sizeInBytes=%lu, port=%s, host=%s, warnLevel=%f, critLevel=%f, verbose=%d\n", *times, *rate, *sizeInBytes, port, dest, warn, crit, verbose);
+  }
+  else if(thisType == SURVEY) {
+    if(sscanf(params, "%lu,%lu,%4095s", times, intervalMs, targetFileName) != 3 || *times == 0) {
+      fprintf(stderr, "Params must be in \"times,intervalMs,target(,target...)\" or \"times,intervalMs,@targetsFile\" format\n");
+      usage();
+    }
+    if(verbose)
+      printf("type=survey, times=%lu, intervalMs=%lu, targets=%s, verbose=%d\n", *times, *intervalMs, targetFileName, verbose);
+  }
+  else if(thisType == TCP_LISTENER) {
+    if(sscanf(params, "%lu,%31s", times, port) != 2) {
+      fprintf(stderr, "Params must be in \"seconds,port\" format\n");
+      usage();
+    }
+    if(verbose)
+      printf("type=tcp_listener, seconds=%lu, port=%s, verbose=%d\n", *times, port, verbose);
+  }
+  else if(thisType == TCP_CONNECT) {
+    if(sscanf(params, "%lu,%u,%lu,%31[^,],%63s", times, nThreads, rate, port, dest) != 5 ||
+       *times == 0 || *nThreads == 0) {
+      fprintf(stderr, "Params must be in \"seconds,concurrency,ratePerSec,port,host\" format\n");
+      usage();
+    }
+    if(verbose)
+      printf("type=tcp_connect, seconds=%lu, concurrency=%u, ratePerSec=%lu, port=%s, host=%s, verbose=%d\n", *times, *nThreads, *rate, port, dest, verbose);
+  }
+  else if(thisType == MIXED) {
+    if(sscanf(params, "%lu,%4095s", times, targetFileName) != 2 || *times == 0) {
+      fprintf(stderr, "Params must be in \"seconds,component(,component...)\" format\n");
+      usage();
+    }
+    if(verbose)
+      printf("type=mixed, seconds=%lu, components=%s, verbose=%d\n", *times, targetFileName, verbose);
+  }
+  else if(thisType == SCHED_LAT) {
+    // without threads, one pinned on each CPU
+    if(sscanf(params, "%lu,%lu,%u", times, intervalMs, nThreads) != 3) {
+      *nThreads = 0;
+      if(sscanf(params, "%lu,%lu", times, intervalMs) != 2) {
+        fprintf(stderr, "Params must be in \"seconds,intervalUs(,numThreads)\" format\n");
+        usage();
+      }
+    }
+    if(*times == 0 || *intervalMs == 0) {
+      fprintf(stderr, "sched_lat needs seconds and an interval\n");
+      usage();
+    }
+    if(verbose)
+      printf("type=sched_lat, seconds=%lu, intervalUs=%lu, nThreads=%u, warnLevel=%f, critLevel=%f, verbose=%d\n", *times, *intervalMs, *nThreads, warn, crit, verbose);
+  }
+  else if(thisType == CPU_C2C) {
+    // without maxPairs, all of them
+    if(sscanf(params, "%lu,%u", times, nThreads) != 2) {
+      *nThreads = 0;
+      if(sscanf(params, "%lu", times) != 1) {
+        fprintf(stderr, "Params must be in \"roundTrips(,maxPairs)\" format\n");
+        usage();
+      }
+    }
+    if(*times == 0) {
+      fprintf(stderr, "cpu_c2c needs the round trips of each pair\n");
+      usage();
+    }
+    if(verbose)
+      printf("type=cpu_c2c, roundTrips=%lu, maxPairs=%u, warnLevel=%f, critLevel=%f, verbose=%d\n", *times, *nThreads, warn, crit, verbose);
+  }
+  else if(thisType == CPU_SYNC) {
+    // without maxThreads, as many as CPUs
+    if(sscanf(params, "%lu,%u", times, nThreads) != 2) {
+      *nThreads = 0;
+      if(sscanf(params, "%lu", times) != 1) {
+        fprintf(stderr, "Params must be in \"msPerStep(,maxThreads)\" format\n");
+        usage();
+      }
+    }
+    if(*times == 0) {
+      fprintf(stderr, "cpu_sync needs the ms of each step\n");
+      usage();
+    }
+    if(verbose)
+      printf("type=cpu_sync, msPerStep=%lu, maxThreads=%u, warnLevel=%f, critLevel=%f, verbose=%d\n", *times, *nThreads, warn, crit, verbose);
+  }
   else {
     fprintf(stderr, "Unknown o missing type\n");
     usage();
@@ -185,8 +543,78 @@ void parseParams(char *params, enum btype thisType, int verbose, unsigned long *
 }
 
 
-void getOpts(int argc, char **argv, char **params, enum btype *thisType, int *verbose, int *realtime, int *nagiosPluginOutput, double *warn, double  *crit, double *warn2, double  *crit2) {
+/**
+  * Parses a list of thresholds separated by underscores, like "5" or "5_1"
+  * @return the number of values parsed or 0 if it can't be parsed
+  */
+int parseThresholds(char *str, double *values, int maxValues) {
+  int   n = 0;
+  char *end;
+
+  while(n < maxValues) {
+    values[n] = strtod(str, &end);
+    if(end == str)
+      return 0;
+    n++;
+    if(*end == '\0')
+      return n;
+    if(*end != '_')
+      return 0;
+    str = end + 1;
+  }
+  return 0; // too many values
+}
+
+
+/**
+  * Parses the "-a" adaptive repetition, like "2,60"
+  * (CI95 within 2% of the mean, 60 seconds at most)
+  */
+void parseAdaptive(char *str, repetition_params *rp) {
+  if(sscanf(str, "%lf,%lf", &rp->ciTargetPerCent, &rp->maxSeconds) != 2 ||
+     rp->ciTargetPerCent <= 0 || rp->maxSeconds <= 0) {
+    fprintf(stderr, "Adaptive repetition must be in \"ciPercent,maxSeconds\" format\n");
+    usage();
+  }
+}
+
+
+/**
+  * Parses the "-o" options of the network tests,
+  * like "sndbuf=262144,nodelay,send=zerocopy"
+  */
+void parseNetOptions(char *str, net_options *o) {
+  char *opt, *saveptr;
+
+  for(opt = strtok_r(str, ",", &saveptr); opt != NULL; opt = strtok_r(NULL, ",", &saveptr)) {
+    if(strncmp(opt, "sndbuf=", 7) == 0)
+      o->sndBuf = parseUL(opt + 7, "sndbuf");
+    else if(strncmp(opt, "rcvbuf=", 7) == 0)
+      o->rcvBuf = parseUL(opt + 7, "rcvbuf");
+    else if(strcmp(opt, "nodelay") == 0)
+      o->noDelay = 1;
+    else if(strcmp(opt, "send=write") == 0)
+      o->sendMode = SEND_WRITE;
+    else if(strcmp(opt, "send=sendfile") == 0)
+      o->sendMode = SEND_SENDFILE;
+    else if(strcmp(opt, "send=splice") == 0)
+      o->sendMode = SEND_SPLICE;
+    else if(strcmp(opt, "send=zerocopy") == 0)
+      o->sendMode = SEND_ZEROCOPY;
+    else if(strcmp(opt, "reset") == 0)
+      o->reset = 1;
+    else {
+      fprintf(stderr, "Unknown network option '%s'\n", opt);
+      usage();
+    }
+  }
+}
+
+
+void getOpts(int argc, char **argv, test_options *o, int *useTsc, int *usePerf, enum outputFormat *format, char **scenarioFile, char **probesFile, char **agentPort, char **agents) {
   int c;
+  int typeSet = 0;
+  char *end;
   extern char *optarg;
   extern int optind, opterr, optopt;
   opterr = 0;
@@ -194,12 +622,29 @@ void getOpts(int argc, char **argv, char **params, enum btype *thisType, int *ve
   if(argc == 2 && strcmp(argv[1], "-h") == 0) {
     usage();
   }
-  if(argc < 5) {
+  if(argc < 3) {
     fprintf(stderr, "Missing parameters\n");
     usage();
   }
 
-  while ((c = getopt (argc, argv, ":hrt:p:vw:c:")) != -1) {
+  // long options without a short one
+  enum {OPT_SAVE_BASELINE = 256, OPT_COMPARE_BASELINE, OPT_BASELINE_STORE, OPT_AGENT, OPT_COORDINATE, OPT_SAMPLE_INTERVAL,
+        OPT_CONTEXT, OPT_FREQ, OPT_SECRET};
+  static struct option longOptions[] = {
+    {"rate",             required_argument, NULL, 'R'},
+    {"save-baseline",    no_argument,       NULL, OPT_SAVE_BASELINE},
+    {"compare-baseline", no_argument,       NULL, OPT_COMPARE_BASELINE},
+    {"baseline-store",   required_argument, NULL, OPT_BASELINE_STORE},
+    {"agent",            required_argument, NULL, OPT_AGENT},
+    {"coordinate",       required_argument, NULL, OPT_COORDINATE},
+    {"sample-interval",  required_argument, NULL, OPT_SAMPLE_INTERVAL},
+    {"context",          no_argument,       NULL, OPT_CONTEXT},
+    {"freq",             no_argument,       NULL, OPT_FREQ},
+    {"secret",           required_argument, NULL, OPT_SECRET},
+    {NULL,               0,                 NULL, 0}
+  };
+
+  while ((c = getopt_long (argc, argv, ":hrTPt:p:vw:c:o:n:a:O:f:d:R:", longOptions, NULL)) != -1) {
     switch (c) {
       case 'h':
         usage();
@@ -209,28 +654,62 @@ void getOpts(int argc, char **argv, char **params, enum btype *thisType, int *ve
           fprintf (stderr, "Option -%c requires an argument\n", c);
           usage();
         }
+        typeSet = 1;
         if(strcmp(optarg, "cpu") == 0) {
-          *thisType = CPU;
+          o->thisType = CPU;
         }
         else if(strcmp(optarg, "mem") == 0) {
-          *thisType = MEM;
+          o->thisType = MEM;
         }
         else if(strcmp(optarg, "disk_w") == 0) {
-          *thisType = DISK_W;
+          o->thisType = DISK_W;
         }
         else if(strcmp(optarg, "disk_r_seq") == 0) {
-          *thisType = DISK_R_SEQ;
+          o->thisType = DISK_R_SEQ;
         }
         else if(strcmp(optarg, "disk_r_ran") == 0) {
-          *thisType = DISK_R_RAN;
+          o->thisType = DISK_R_RAN;
         }
 // ifdef OPING_ENABLED
         else if(strcmp(optarg, "ping") == 0) {
-          *thisType = PING;
+          o->thisType = PING;
         }
 // endif // OPING_ENABLED
+        else if(strcmp(optarg, "tcp_server") == 0) {
+          o->thisType = TCP_SERVER;
+        }
+        else if(strcmp(optarg, "tcp_client") == 0) {
+          o->thisType = TCP_CLIENT;
+        }
+        else if(strcmp(optarg, "udp_reflector") == 0) {
+          o->thisType = UDP_REFLECTOR;
+        }
+        else if(strcmp(optarg, "udp_rr") == 0) {
+          o->thisType = UDP_RR;
+        }
+        else if(strcmp(optarg, "survey") == 0) {
+          o->thisType = SURVEY;
+        }
+        else if(strcmp(optarg, "tcp_listener") == 0) {
+          o->thisType = TCP_LISTENER;
+        }
+        else if(strcmp(optarg, "tcp_connect") == 0) {
+          o->thisType = TCP_CONNECT;
+        }
+        else if(strcmp(optarg, "mixed") == 0) {
+          o->thisType = MIXED;
+        }
+        else if(strcmp(optarg, "sched_lat") == 0) {
+          o->thisType = SCHED_LAT;
+        }
+        else if(strcmp(optarg, "cpu_c2c") == 0) {
+          o->thisType = CPU_C2C;
+        }
+        else if(strcmp(optarg, "cpu_sync") == 0) {
+          o->thisType = CPU_SYNC;
+        }
         else if(strcmp(optarg, "http_get") == 0) {
-          *thisType = HTTP_GET;
+          o->thisType = HTTP_GET;
         }
         else {
           fprintf(stderr, "Unknown type '%s'\n", optarg);
@@ -238,32 +717,102 @@ void getOpts(int argc, char **argv, char **params, enum btype *thisType, int *ve
         }
         break;
       case 'p':
-        *params = optarg;
-        if(*params == NULL) {
+        o->params = optarg;
+        if(o->params == NULL) {
           fprintf (stderr, "Option -%c requires an argument\n", c);
           usage();
         }
         break;
       case 'v':
-        *verbose = 1;
+        o->verbose = 1;
+        break;
+      case 'o':
+        parseNetOptions(optarg, &o->netOptions);
         break;
       case 'r':
-        *realtime = 1;
+        o->realtime = 1;
+        break;
+      case 'T':
+        *useTsc = 1;
+        break;
+      case 'P':
+        *usePerf = 1;
+        break;
+      case 'n':
+        if(sscanf(optarg, "%lu,%lu", &o->repetitions.repetitions, &o->repetitions.warmup) < 1 || o->repetitions.repetitions == 0) {
+          fprintf (stderr, "Option -%c must be in \"repetitions(,warmup)\" format\n", c);
+          usage();
+        }
+        break;
+      case 'a':
+        parseAdaptive(optarg, &o->repetitions);
+        break;
+      case 'O':
+        if(strcmp(optarg, "text") == 0)
+          *format = OUTPUT_TEXT;
+        else if(strcmp(optarg, "json") == 0)
+          *format = OUTPUT_JSON;
+        else if(strcmp(optarg, "csv") == 0)
+          *format = OUTPUT_CSV;
+        else if(strcmp(optarg, "openmetrics") == 0)
+          *format = OUTPUT_OPENMETRICS;
+        else {
+          fprintf(stderr, "Unknown output format '%s'\n", optarg);
+          usage();
+        }
+        break;
+      case 'f':
+        *scenarioFile = optarg;
+        break;
+      case 'd':
+        *probesFile = optarg;
+        break;
+      case 'R':
+        if((o->openLoopRate = strtod(optarg, &end)) <= 0 || *end != '\0') {
+          fprintf (stderr, "Option --rate must be a number of operations per second\n");
+          usage();
+        }
+        break;
+      case OPT_SAVE_BASELINE:
+        o->saveBaseline = 1;
+        break;
+      case OPT_COMPARE_BASELINE:
+        o->compareBaseline = 1;
+        break;
+      case OPT_BASELINE_STORE:
+        o->baselineStore = optarg;
+        break;
+      case OPT_AGENT:
+        *agentPort = optarg;
+        break;
+      case OPT_COORDINATE:
+        *agents = optarg;
+        break;
+      case OPT_SAMPLE_INTERVAL:
+        if((o->sampleInterval = strtod(optarg, &end) / 1000) < SAMPLE_MIN_INTERVAL || *end != '\0') {
+          fprintf (stderr, "Option --sample-interval must be %d ms at least\n", (int) (SAMPLE_MIN_INTERVAL * 1000));
+          usage();
+        }
+        break;
+      case OPT_CONTEXT:
+        o->context = 1;
+        break;
+      case OPT_FREQ:
+        o->freq = 1;
+        break;
+      case OPT_SECRET:
+        o->secretFile = optarg;
         break;
       case 'w':
-        if(sscanf(optarg, "%lf_%lf", warn, warn2) != 1) {
-          if(sscanf(optarg, "%lf", warn) != 1) {
-            fprintf (stderr, "Option -%c requires an argument\n", c);
-            usage();
-          }
+        if((o->nWarn = parseThresholds(optarg, o->warnLevels, MAX_THRESHOLDS)) == 0) {
+          fprintf (stderr, "Option -%c requires an argument\n", c);
+          usage();
         }
         break;
       case 'c':
-        if(sscanf(optarg, "%lf_%lf", crit, crit2) != 1) {
-          if(sscanf(optarg, "%lf", crit) != 1) {
-            fprintf (stderr, "Option -%c requires an argument\n", c);
-            usage();
-          }
+        if((o->nCrit = parseThresholds(optarg, o->critLevels, MAX_THRESHOLDS)) == 0) {
+          fprintf (stderr, "Option -%c requires an argument\n", c);
+          usage();
         }
         break;
       case '?':
@@ -280,39 +829,428 @@ void getOpts(int argc, char **argv, char **params, enum btype *thisType, int *ve
         usage();
     }
   }
+  if(*scenarioFile != NULL && *probesFile != NULL) {
+    fprintf(stderr, "Either a scenario (-f) or a daemon (-d)\n");
+    usage();
+  }
+  if(*agentPort != NULL && (*agents != NULL || *scenarioFile != NULL || *probesFile != NULL)) {
+    fprintf(stderr, "An agent (--agent) gets its scenario from the coordinator\n");
+    usage();
+  }
+  if(*agents != NULL && *scenarioFile == NULL) {
+    fprintf(stderr, "A coordinator (--coordinate) runs a scenario (-f) on its agents\n");
+    usage();
+  }
+  if((*agentPort != NULL || *agents != NULL) != (o->secretFile != NULL)) {
+    fprintf(stderr, "The agents (--agent) and their coordinator (--coordinate) need the secret that they share (--secret), and only them\n");
+    usage();
+  }
+  if(o->saveBaseline && o->compareBaseline) {
+    fprintf(stderr, "Either --save-baseline or --compare-baseline, a run compared isn't a baseline\n");
+    usage();
+  }
+  if(*probesFile != NULL && (o->saveBaseline || o->compareBaseline)) {
+    fprintf(stderr, "The probes of a daemon (-d) aren't kept on the baseline\n");
+    usage();
+  }
+  if(*scenarioFile != NULL || *probesFile != NULL || *agentPort != NULL) {
+    // the tests, their thresholds and repetitions are on the steps
+    if(typeSet || o->params != NULL || o->nWarn > 0 || o->nCrit > 0 ||
+       o->repetitions.repetitions > 0 || o->repetitions.ciTargetPerCent > 0 || o->openLoopRate > 0) {
+      fprintf(stderr, "A scenario (-f), a daemon (-d) or an agent (--agent) has -t, -p, -w, -c, -n, -a and --rate on its steps\n");
+      usage();
+    }
+    return;
+  }
+  if(! typeSet || o->params == NULL) {
+    fprintf(stderr, "Missing parameters\n");
+    usage();
+  }
+
   // If you set warn or crit levels then you should set both
-  if( (*warn == -1) != (*crit == -1) ) {
+  if( (o->nWarn == 0) != (o->nCrit == 0) ) {
     fprintf (stderr, "If you set warn level then you must also set critical level and vice versa\n");
     usage();
   }
+
+  if(o->saveBaseline || o->compareBaseline) {
+    // the ones without a main value to keep
+    if(o->thisType == TCP_SERVER || o->thisType == UDP_REFLECTOR || o->thisType == TCP_LISTENER ||
+       o->thisType == SURVEY || o->thisType == MIXED) {
+      fprintf (stderr, "The baseline doesn't apply to servers, survey nor mixed\n");
+      usage();
+    }
+    if(o->baselineStore == NULL)
+      o->baselineStore = BASELINE_STORE;
+  }
+  if(o->compareBaseline && o->nWarn > 0) {
+    // the thresholds are relative to the baseline, not to the test
+    if(o->nWarn != 1 || o->nCrit != 1) {
+      fprintf (stderr, "With --compare-baseline warning and critical levels are one value each,\n"
+                       " the percent worse than the baseline (eg: ... -w 10 -c 25 ...)\n");
+      usage();
+    }
+    o->baselineThresholds = 1;
+    o->baselineWarn       = o->warnLevels[0];
+    o->baselineCrit       = o->critLevels[0];
+    o->nWarn = o->nCrit   = 0;
+  }
   // If you haven't set warn nor crit levels then you don't want a nagios plugin-like output
-  if( (*warn == -1) || (*crit == -1) ) {
-    if(*verbose)
+  if( (o->nWarn == 0) || (o->nCrit == 0) ) {
+    if(o->verbose)
       printf("You prefer simple output, not nagios-like\n");
-    *nagiosPluginOutput=0;
+    o->nagiosPluginOutput=0;
   }
   else {
-    if(*verbose)
+    if(o->verbose)
       printf("You prefer nagios-like output\n");
-    *nagiosPluginOutput=1;
+    o->nagiosPluginOutput=1;
   }
 
-  // PING returns two values, so it needs warn and crit levels for both, if set
-  if(*nagiosPluginOutput == 1 && *thisType == PING &&
-      ((*warn2 == -1) || (*crit2 == -1))) {
-    fprintf (stderr, "Ping warning and critical levels must have two values"
-                     " each\n (latency in ms and percent of packet loss)\n"
+  // PING, UDP_RR, SURVEY and TCP_CONNECT return two values, so they need warn and crit levels for both, if set
+  if(o->nagiosPluginOutput == 1 && (o->thisType == PING || o->thisType == UDP_RR || o->thisType == SURVEY || o->thisType == TCP_CONNECT) &&
+      (o->nWarn != 2 || o->nCrit != 2)) {
+    fprintf (stderr, "Ping, udp_rr and survey warning and critical levels must have two values"
+                     " each\n (latency in ms and percent of packet loss,\n"
+                     " for tcp_connect connects/s and p99 latency in ms)\n"
                      " separated by an underscore \"_\" \n"
                      " eg:  ... -w 5_1 -c 10_5 ...)\n\n");
     usage();
   }
 
+  // HTTP_GET accepts a threshold for the total time or one for each phase
+  if(o->nagiosPluginOutput == 1 && o->thisType == HTTP_GET &&
+      (o->nWarn != o->nCrit || (o->nWarn != 1 && o->nWarn != HTTP_PHASES))) {
+    fprintf (stderr, "HTTP warning and critical levels must have one value"
+                     " each (total time in seconds)\n or %d values"
+                     " separated by an underscore \"_\" for the phases\n"
+                     " dns_connect_tls_ttfb_transfer_total,"
+                     " a negative value skips that phase\n"
+                     " eg:  ... -w -1_-1_-1_0.5_-1_2 -c -1_-1_-1_1_-1_5 ...)\n\n",
+                     HTTP_PHASES);
+    usage();
+  }
+  if(o->nagiosPluginOutput == 1 && o->thisType == HTTP_GET && o->nWarn == 1) {
+    // legacy form, just the total time
+    o->warnLevels[HTTP_TOTAL] = o->warnLevels[0];
+    o->critLevels[HTTP_TOTAL] = o->critLevels[0];
+    for(int i = 0; i < HTTP_TOTAL; i++)
+      o->warnLevels[i] = o->critLevels[i] = -1;
+  }
+
+  // the open loop needs operations to schedule: blocks, messages or GETs
+  if(o->openLoopRate > 0) {
+    if(o->thisType != DISK_W && o->thisType != DISK_R_SEQ && o->thisType != DISK_R_RAN &&
+       o->thisType != TCP_CLIENT && o->thisType != HTTP_GET) {
+      fprintf (stderr, "--rate applies to disk_w, disk_r_seq, disk_r_ran, tcp_client and http_get\n"
+                       " (udp_rr and tcp_connect have their rate on -p)\n");
+      usage();
+    }
+    if(o->thisType == HTTP_GET) {
+      // each GET is a repetition
+      if(o->repetitions.repetitions == 0 && o->repetitions.ciTargetPerCent == 0) {
+        fprintf (stderr, "--rate on http_get schedules the GETs of -n or -a, set one of them\n");
+        usage();
+      }
+      o->repetitions.rate = o->openLoopRate;
+    }
+    else if(o->repetitions.repetitions > 0 || o->repetitions.ciTargetPerCent > 0) {
+      fprintf (stderr, "--rate goes with -n or -a only on http_get\n");
+      usage();
+    }
+  }
+
+  // servers, survey and mixed don't have a single value to repeat
+  if((o->repetitions.repetitions > 0 || o->repetitions.ciTargetPerCent > 0) &&
+     (o->thisType == TCP_SERVER || o->thisType == UDP_REFLECTOR || o->thisType == TCP_LISTENER ||
+      o->thisType == SURVEY || o->thisType == MIXED)) {
+    fprintf (stderr, "Repetitions (-n, -a) don't apply to servers, survey nor mixed\n");
+    usage();
+  }
+  // the runs of http_get are repeated on the total time, its phases aren't kept
+  if((o->repetitions.repetitions > 0 || o->repetitions.ciTargetPerCent > 0) &&
+     o->nagiosPluginOutput == 1 && o->thisType == HTTP_GET) {
+    for(int i = 0; i < HTTP_TOTAL; i++)
+      if(o->warnLevels[i] >= 0 || o->critLevels[i] >= 0) {
+        fprintf (stderr, "With repetitions (-n, -a) http_get thresholds apply to the total time only,"
+                         " skip the phases with -1\n");
+        usage();
+      }
+  }
+  // the others are repeated on their main value, like the latency of
+  // ping and udp_rr, and not on the second one, like their loss
+  else if((o->repetitions.repetitions > 0 || o->repetitions.ciTargetPerCent > 0) &&
+          o->nagiosPluginOutput == 1) {
+    for(int i = 1; i < MAX_THRESHOLDS; i++)
+      if((i < o->nWarn && o->warnLevels[i] >= 0) || (i < o->nCrit && o->critLevels[i] >= 0)) {
+        fprintf (stderr, "With repetitions (-n, -a) the thresholds apply to the main value only,"
+                         " skip the second one with -1 (like -w 5_-1 -c 10_-1)\n");
+        usage();
+      }
+  }
+
   // RealTime choosed
-  if( *realtime && *verbose)
+  if( o->realtime && o->verbose)
     printf("You have choosen *RealTimeChecks*. Take care!\n");
 }
 
 
+/* parameters of a test, to run it again and again */
+typedef struct {
+  enum btype     type;
+  unsigned long  times;
+  unsigned long  sizeInBytes;
+  unsigned int   nThreads;
+  unsigned long  rate;
+  unsigned long  intervalMs;
+  char          *folderName;
+  char          *targetFileName;
+  char          *url;
+  char          *httpRefFileBasename;
+  char          *dest;
+  char          *port;
+  net_options   *netOptions;
+  int            verbose;
+  int            realtime;
+} test_run;
+
+
+/** name on the nagios status line and unit of the main value of each test */
+const char *testName(enum btype type) {
+  switch(type) {
+    case CPU:         return "CPU";
+    case MEM:         return "Mem";
+    case DISK_W:      return "DiskWrite";
+    case DISK_R_SEQ:  return "SeqDiskRead";
+    case DISK_R_RAN:  return "RanDiskRead";
+    case HTTP_GET:    return "HttpGet";
+    case PING:        return "PingRTT";
+    case TCP_CLIENT:  return "TcpThroughput";
+    case UDP_RR:      return "UdpRR";
+    case TCP_CONNECT: return "TcpConnect";
+    case TCP_SERVER:  return "TcpServer";
+    case UDP_REFLECTOR: return "UdpReflector";
+    case SURVEY:      return "Survey";
+    case TCP_LISTENER: return "TcpListener";
+    case MIXED:       return "Mixed";
+    case SCHED_LAT:   return "SchedLat";
+    case CPU_C2C:     return "CpuC2C";
+    case CPU_SYNC:    return "CpuSync";
+    default:          return "Unknown";
+  }
+}
+
+const char *testUnit(enum btype type) {
+  switch(type) {
+    case CPU:         return "avg calcs/s per software thread";
+    case PING:        return "ms";
+    case TCP_CLIENT:  return "Gb/s";
+    case UDP_RR:      return "p99 ms";
+    case TCP_CONNECT: return "connects/s";
+    case SCHED_LAT:   return "worst p99 us";
+    case CPU_C2C:     return "worst round trip ns";
+    case CPU_SYNC:    return "worst efficiency %";
+    default:          return "s";
+  }
+}
+
+/**
+  * If a lower value is worse, like for throughputs.
+  * The same sense than the thresholds of a single run.
+  */
+int lowerIsWorse(enum btype type) {
+  return type == TCP_CLIENT || type == TCP_CONNECT || type == CPU_SYNC;
+}
+
+
+/**
+  * Runs a test once and gives its main value: the one that the
+  * thresholds of the first value apply to.
+  * @param value return value
+  * @return SBENCH_OK or why it failed, like getting no answer
+  *         (SBENCH_ERR_NO_REPLY), see sbenchTestFailureMessage
+  */
+int measureOnce(void *arg, double *value) {
+  test_run *t = (test_run *) arg;
+  int       err;
+
+  sbenchClearTestFailure();
+  switch(t->type) {
+    case CPU:
+    case MEM:
+    case DISK_W:
+    case DISK_R_SEQ:
+    case DISK_R_RAN:
+    case HTTP_GET: {
+      sbench_test lt = {t->type, t->times, t->sizeInBytes, t->nThreads,
+                        t->type == DISK_W ? t->folderName : t->targetFileName,
+                        t->url, t->httpRefFileBasename, 0, t->verbose, t->realtime};
+      return sbenchMeasure(lib, &lt, value);
+    }
+    case PING: {
+      pingResponse pr = sbenchDoPing(t->sizeInBytes, t->times, t->intervalMs, t->dest, t->verbose, t->realtime);
+      if(pr.latencyMs < 0 && sbenchTestFailure() == SBENCH_OK)
+        return sbenchFailTest(SBENCH_ERR_NO_REPLY, "no replies from %s", t->dest);
+      *value = pr.latencyMs;
+      break;
+    }
+    case TCP_CLIENT: {
+      tcpResponse tr = sbenchDoTcpClientTest(t->times, t->nThreads, t->sizeInBytes, 0, t->port, t->dest, t->netOptions, t->verbose, t->realtime);
+      free(tr.streams);
+      *value = tr.gbps;
+      break;
+    }
+    case UDP_RR: {
+      udpRRResponse ur = sbenchDoUdpRRTest(t->times, t->rate, t->sizeInBytes, t->port, t->dest, t->verbose, t->realtime);
+      if(ur.received == 0 && sbenchTestFailure() == SBENCH_OK)
+        return sbenchFailTest(SBENCH_ERR_NO_REPLY, "no replies from %s", t->dest);
+      *value = ur.rtt.p99;
+      break;
+    }
+    case TCP_CONNECT: {
+      tcpConnectResponse cr = sbenchDoTcpConnectTest(t->times, t->nThreads, t->rate, t->port, t->dest, t->netOptions, t->verbose, t->realtime);
+      *value = cr.connectsPerSec;
+      break;
+    }
+    case SCHED_LAT: {
+      schedLatResponse sr;
+      latencyStats     ls;
+      double           worst = 0;
+      if((err = sbenchDoSchedLatTest(t->times, t->intervalMs, t->nThreads, t->verbose, t->realtime, &sr)) != SBENCH_OK)
+        return err;
+      for(unsigned int i = 0; i < sr.nThreads; i++) {
+        sbenchHistogramStats(&sr.threads[i].lateness, &ls);
+        if(ls.p99 * 1000 > worst)
+          worst = ls.p99 * 1000;
+      }
+      free(sr.threads);
+      *value = worst;
+      break;
+    }
+    case CPU_C2C: {
+      c2cResponse cr;
+      double      worst = 0;
+      if((err = sbenchDoC2CTest(t->times, t->nThreads, t->verbose, t->realtime, &cr)) != SBENCH_OK)
+        return err;
+      for(unsigned int i = 0; i < cr.nCpus * cr.nCpus; i++)
+        if(cr.rtt[i] > worst)
+          worst = cr.rtt[i];
+      sbenchFreeC2C(&cr);
+      *value = worst;
+      break;
+    }
+    case CPU_SYNC: {
+      syncResponse sr;
+      double       worst = 100;
+      if((err = sbenchDoSyncTest(t->times, t->nThreads, t->verbose, t->realtime, &sr)) != SBENCH_OK)
+        return err;
+      for(int p = 0; p < SYNC_PRIMITIVES; p++)
+        if(sr.efficiency[p][sr.nSteps - 1] < worst)
+          worst = sr.efficiency[p][sr.nSteps - 1];
+      *value = worst;
+      break;
+    }
+    default:
+      sbenchMyAbort(/* bug */ "Can't repeat this type of test");
+  }
+  // the tests out of the library don't return what failed on their threads
+  return sbenchTestFailure();
+}
+
+
+/**
+  * Status of a value where higher is worse, like a latency
+  */
+int levelOf(double value, double warn, double crit) {
+  if(value >= crit)
+    return EXIT_CODE_CRITICAL;
+  if(value >= warn)
+    return EXIT_CODE_WARNING;
+  return EXIT_CODE_OK;
+}
+
+/**
+  * Status of a value where lower is worse, like a throughput
+  */
+int levelOfLowerIsWorse(double value, double warn, double crit) {
+  if(value <= crit)
+    return EXIT_CODE_CRITICAL;
+  if(value <= warn)
+    return EXIT_CODE_WARNING;
+  return EXIT_CODE_OK;
+}
+
+
+/**
+  * Records on the result that the test failed, instead of ending the
+  * program: Critical if what it tests didn't answer or answered wrong,
+  * Unknown if it couldn't be measured.
+  * @param err enum sbenchError
+  */
+void failResult(test_result *res, int err, const char *why) {
+  res->error  = err;
+  res->status = err == SBENCH_ERR_HTTP || err == SBENCH_ERR_CONTENT || err == SBENCH_ERR_NO_REPLY ?
+                EXIT_CODE_CRITICAL : EXIT_CODE_UNKNOWN;
+  snprintf(res->summary, sizeof(res->summary), "%s", why);
+  sbenchAppendText(res, "%s\n", why);
+}
+
+
+/**
+  * Runs the test with repetitions and reports the statistics of its
+  * main value. With thresholds it's only Warning or Critical if the
+  * whole 95% confidence interval of the mean is beyond the threshold,
+  * so that noise doesn't raise alerts. A run that fails ends it, with
+  * the statistics of the runs until then and the status of the failure.
+  */
+void doRepeatedTest(test_run *t, repetition_params *rp, test_result *res, int nagiosPluginOutput, double warn, double crit) {
+  double *samples;
+  size_t  n;
+  sampleStats ss;
+  int     err;
+  char    why[sizeof(res->summary)];
+
+  err = sbenchRepeatTest(rp, measureOnce, t, &samples, &n, &ss, t->verbose);
+  // for the baseline
+  res->samples  = samples;
+  res->nSamples = n;
+  if(err != SBENCH_OK && n == 0) {
+    failResult(res, err, sbenchTestFailureMessage());
+    return;
+  }
+  sbenchAddMetric(res, "mean",      ss.mean,     "");
+  sbenchAddMetric(res, "median",    ss.median,   "");
+  sbenchAddMetric(res, "stddev",    ss.stddev,   "");
+  sbenchAddMetric(res, "ci95_low",  ss.ciLow,    "");
+  sbenchAddMetric(res, "ci95_high", ss.ciHigh,   "");
+  sbenchAddMetric(res, "min",       ss.min,      "");
+  sbenchAddMetric(res, "max",       ss.max,      "");
+  sbenchAddMetric(res, "samples",   ss.count,    "");
+  sbenchAddMetric(res, "outliers",  ss.outliers, "");
+  sprintf(res->summary, "%.6f %s (CI95 %.6f..%.6f, %zu samples)",
+          ss.mean, testUnit(t->type), ss.ciLow, ss.ciHigh, ss.count);
+  sbenchAppendText(res, "%.6f %s;median %.6f;stddev %.6f;CI95 %.6f..%.6f;%zu samples;%zu outliers\n",
+                   ss.mean, testUnit(t->type), ss.median, ss.stddev, ss.ciLow, ss.ciHigh, ss.count, ss.outliers);
+  if(err != SBENCH_OK) {
+    snprintf(why, sizeof(why), "%s after %zu samples", sbenchTestFailureMessage(), n);
+    failResult(res, err, why);
+    return;
+  }
+
+  if(! nagiosPluginOutput)
+    return;
+  if(lowerIsWorse(t->type))
+    res->status = levelOfLowerIsWorse(ss.ciHigh, warn, crit);
+  else {
+    res->status = levelOf(ss.ciLow, warn, crit);
+    // a negative http threshold skips it, like on a single run
+    if(t->type == HTTP_GET && ((res->status == EXIT_CODE_CRITICAL && crit < 0) ||
+                               (res->status == EXIT_CODE_WARNING  && warn < 0)))
+      res->status = crit >= 0 && ss.ciLow >= crit ? EXIT_CODE_CRITICAL : EXIT_CODE_OK;
+  }
+}
+
+
 /**
   * Main.
   *
@@ -321,174 +1259,1124 @@ void getOpts(int argc, char **argv, char **params, enum btype *thisType, int *ve
   * http://blog.centreon.com/good-practices-how-to-develop-monitoring-plugin-nagios/
   *
   */
-int main (int argc, char *argv[]) {
-  int  verbose = 0;
-  int  realtime = 0;
-  char *params = 0;
-  enum btype thisType;
-  unsigned long sizeInBytes, times;
-  unsigned int  nThreads;
-  char folderName[PATH_MAX-12];
-  char targetFileName[PATH_MAX];
-  char url[CURLINFO_EFFECTIVE_URL];
-  char httpRefFileBasename[PATH_MAX];
-  unsigned long timeoutInMS;
-  int different = 1;
-  char dest[HOST_NAME_MAX];
+/**
+  * Measures the test of a result already begun by runTest, that
+  * leaves on it why it failed if it does.
+  */
+void measureTest(test_options *o, test_result *res) {
   double r;
-  int nagiosPluginOutput = 1;
-  double warn  = -1., crit  = -1.;
-  double warn2 = -1., crit2 = -1.;
+  int different = 1, err;
+  double warn  = o->nWarn > 0 ? o->warnLevels[0] : -1., crit  = o->nCrit > 0 ? o->critLevels[0] : -1.;
+  double warn2 = o->nWarn > 1 ? o->warnLevels[1] : -1., crit2 = o->nCrit > 1 ? o->critLevels[1] : -1.;
 
-  getOpts(argc, argv, &params, &thisType, &verbose, &realtime, &nagiosPluginOutput, &warn, &crit, &warn2, &crit2);
-  parseParams(params, thisType, verbose, &times, &sizeInBytes, &nThreads, folderName, targetFileName, url, httpRefFileBasename, &timeoutInMS, dest, warn, crit);
-  if(thisType == CPU) {
-    r = doCpuTest(times, nThreads, verbose, realtime);
-    double avgCalcsPerSecondPerCpu = times/r;
-    if(nagiosPluginOutput) {
-      if(avgCalcsPerSecondPerCpu >= crit) {
-        printf("CPU Critical = %.2f avg calcs/s per software thread| avg_calcs_per_sec=%.2f\n", avgCalcsPerSecondPerCpu, avgCalcsPerSecondPerCpu);
-        exit(EXIT_CODE_CRITICAL);
-      }
-      else if(avgCalcsPerSecondPerCpu >= warn) {
-        printf("CPU Warning = %.2f avg calcs/s per software thread| avg_calcs_per_sec=%.2f\n", avgCalcsPerSecondPerCpu, avgCalcsPerSecondPerCpu);
-        exit(EXIT_CODE_WARNING);
-      }
-      else {
-        printf("CPU OK = %.2f avg calcs/s per software thread| avg_calcs_per_sec=%.2f\n", avgCalcsPerSecondPerCpu, avgCalcsPerSecondPerCpu);
-        exit(EXIT_CODE_OK);
-      }
+  if(o->repetitions.repetitions > 0 || o->repetitions.ciTargetPerCent > 0) {
+    test_run t = {o->thisType, o->times, o->sizeInBytes, o->nThreads, o->rate, o->intervalMs,
+                  o->folderName, o->targetFileName, o->url, o->httpRefFileBasename,
+                  o->dest, o->port, &o->netOptions, o->verbose, o->realtime};
+    if(o->thisType == HTTP_GET) {
+      warn = o->warnLevels[HTTP_TOTAL];
+      crit = o->critLevels[HTTP_TOTAL];
     }
-    else {
-      printf("%.2f avg calcs/s per software thread\n", avgCalcsPerSecondPerCpu);
-      exit(EXIT_CODE_OK);
+    doRepeatedTest(&t, &o->repetitions, res, o->nagiosPluginOutput, warn, crit);
+  }
+  else if(o->thisType == CPU || o->thisType == MEM || o->thisType == DISK_W ||
+          o->thisType == DISK_R_SEQ || o->thisType == DISK_R_RAN) {
+    sbench_test t = {o->thisType, o->times, o->sizeInBytes, o->nThreads,
+                     o->thisType == DISK_W ? o->folderName : o->targetFileName,
+                     NULL, NULL, o->openLoopRate, o->verbose, o->realtime};
+    // r is the main value: calcs/s, seconds or the p99 with "--rate"
+    if((err = sbenchRun(lib, &t, res, &r)) != SBENCH_OK) {
+      failResult(res, err, sbenchLastError(lib));
+      return;
     }
+    if(o->nagiosPluginOutput)
+      res->status = levelOf(r, warn, crit);
   }
-  else if(thisType == MEM) {
-    r = doMemTest(sizeInBytes, times, verbose, realtime);
-    if(nagiosPluginOutput) {
-      if(r >= crit) {
-        printf("Mem Critical = %.2f s| time=%.2f\n", r, r);
-        exit(EXIT_CODE_CRITICAL);
-      }
-      else if(r >= warn) {
-        printf("Mem Warning = %.2f s| time=%.2f\n", r, r);
-        exit(EXIT_CODE_WARNING);
-      }
-      else {
-        printf("Mem OK = %.2f s| time=%.2f\n", r, r);
-        exit(EXIT_CODE_OK);
+  else if(o->thisType == HTTP_GET) {
+    sbench_test t = {HTTP_GET, 0, 0, 0, NULL, o->url, o->httpRefFileBasename, 0, o->verbose, o->realtime};
+    char breached[256] = "";
+
+    if(o->verbose) printf("getting %s by HTTP GET\n", o->url);
+    if((err = sbenchRun(lib, &t, res, &r)) != SBENCH_OK) {
+      failResult(res, err, sbenchLastError(lib));
+      return;
+    }
+    different = sbenchMetricValue(res, "content_differs") > 0;
+
+    if(o->nagiosPluginOutput) {
+      // the worst of the phases with a threshold gives the status
+      for(int i = 0; i < HTTP_PHASES; i++) {
+        int phaseCode = EXIT_CODE_OK;
+        double phase  = sbenchMetricValue(res, i == HTTP_TOTAL ? "time" : sbenchHttpPhaseNames[i]);
+        if(o->critLevels[i] >= 0 && phase >= o->critLevels[i])
+          phaseCode = EXIT_CODE_CRITICAL;
+        else if(o->warnLevels[i] >= 0 && phase >= o->warnLevels[i])
+          phaseCode = EXIT_CODE_WARNING;
+        if(phaseCode != EXIT_CODE_OK) {
+          sprintf(breached + strlen(breached), "%s%s %.3f s",
+                  breached[0] == '\0' ? " (" : ", ",
+                  sbenchHttpPhaseNames[i], phase);
+          if(phaseCode > res->status)
+            res->status = phaseCode;
+        }
       }
+      if(breached[0] != '\0')
+        strcat(breached, ")");
     }
-    else {
-      printf("%.2f s\n", r);
-      exit(EXIT_CODE_OK);
+    if(different) {
+      res->status = EXIT_CODE_CRITICAL;
+      strcat(breached, " content differs from reference");
     }
+    sprintf(res->summary, "%.3f s%s", r, breached);
   }
-  else if(thisType == DISK_W) {
-    r = doDiskWriteTest(sizeInBytes, times, nThreads, folderName, verbose, realtime);
-    if(nagiosPluginOutput) {
-      if(r >= crit) {
-        printf("DiskWrite Critical = %.2f s| time=%.2f\n", r, r);
-        exit(EXIT_CODE_CRITICAL);
-      }
-      else if(r >= warn) {
-        printf("DiskWrite Warning = %.2f s| time=%.2f\n", r, r);
-        exit(EXIT_CODE_WARNING);
+// ifdef OPING_ENABLED
+  else if(o->thisType == PING) {
+    pingResponse pr; // pr.latencyMs, pr.lossPerCent
+
+    pr = sbenchDoPing(o->sizeInBytes, o->times, o->intervalMs, o->dest, o->verbose, o->realtime);
+    if(sbenchTestFailure() != SBENCH_OK)
+      return;
+    if(o->verbose) printf("  time_ms=%.1fms, warn=%1.f crit=%1.f\n", pr.latencyMs, warn, crit);
+    if(o->verbose) printf("  loss_percent=%.1f%%, warn=%1.f crit=%1.f\n", pr.lossPerCent, warn2, crit2);
+    sbenchAddMetric(res, "time_ms",      pr.latencyMs,   "ms");
+    sbenchAddMetric(res, "loss_percent", pr.lossPerCent, "%");
+    sbenchAddMetric(res, "min_ms",       pr.rtt.min,     "ms");
+    sbenchAddMetric(res, "p50_ms",       pr.rtt.p50,     "ms");
+    sbenchAddMetric(res, "p90_ms",       pr.rtt.p90,     "ms");
+    sbenchAddMetric(res, "p99_ms",       pr.rtt.p99,     "ms");
+    sbenchAddMetric(res, "max_ms",       pr.rtt.max,     "ms");
+    sbenchAddMetric(res, "mdev_ms",      pr.rtt.mdev,    "ms");
+
+    if(pr.latencyMs == -1 && pr.lossPerCent != 100) {
+      // always on nagios format, like it always was
+      o->nagiosPluginOutput = 1;
+      res->status = EXIT_CODE_UNKNOWN;
+      sprintf(res->summary, "Can't parse ping data = %.1f ms, %.1f %%", pr.latencyMs, pr.lossPerCent);
+    }
+    else {
+      sprintf(res->summary, "%.1f ms, %.1f %%", pr.latencyMs, pr.lossPerCent);
+      sbenchAppendText(res, "%.1f ms;%.1f %%;rtt min/avg/p99/max/mdev = %.3f/%.3f/%.3f/%.3f/%.3f ms\n",
+                       pr.latencyMs, pr.lossPerCent, pr.rtt.min, pr.rtt.avg, pr.rtt.p99, pr.rtt.max, pr.rtt.mdev);
+      if(o->nagiosPluginOutput) {
+        int latencyCode = levelOf(pr.latencyMs, warn, crit);
+        int lossCode    = levelOf(pr.lossPerCent, warn2, crit2);
+        res->status = latencyCode > lossCode ? latencyCode : lossCode;
       }
-      else {
-        printf("DiskWrite OK = %.2f s| time=%.2f\n", r, r);
-        exit(EXIT_CODE_OK);
+    }
+  }
+// endif // OPING_ENABLED
+  else if(o->thisType == TCP_SERVER) {
+    r = sbenchDoTcpServer(o->times, o->port, &o->netOptions, o->verbose, o->realtime);
+    sbenchAddMetric(res, "gbps", r, "");
+    sprintf(res->summary, "%.3f Gb/s avg per connection", r);
+    sbenchAppendText(res, "%.3f Gb/s avg per connection\n", r);
+  }
+  else if(o->thisType == TCP_CLIENT) {
+    tcpResponse tr;
+
+    tr = sbenchDoTcpClientTest(o->times, o->nThreads, o->sizeInBytes, o->openLoopRate, o->port, o->dest, &o->netOptions, o->verbose, o->realtime);
+    if(sbenchTestFailure() != SBENCH_OK) {
+      free(tr.streams);
+      return;
+    }
+    sbenchAddMetric(res, "gbps", tr.gbps, "");
+    sbenchAddMetric(res, "retransmits", tr.retransmits, "c");
+    for(int i = 0; i < tr.nStreams; i++) {
+      char stream[24];
+      double gbps = tr.streams[i].delta > 0 ? tr.streams[i].bytesReceived * 8 / tr.streams[i].delta / 1E9 : 0;
+      sprintf(stream, "stream%d", i);
+      sbenchAppendText(res, "stream #%d: %.3f Gb/s, %lu retransmits\n", i, gbps, tr.streams[i].retransmits);
+      sbenchAddLabeledMetric(res, "gbps", gbps, "", "stream", stream);
+      sbenchAddLabeledMetric(res, "retransmits", tr.streams[i].retransmits, "c", "stream", stream);
+    }
+    free(tr.streams);
+
+    sbenchAppendText(res, "%.3f Gb/s;%lu retransmits\n", tr.gbps, tr.retransmits);
+    if(o->openLoopRate > 0)
+      sbenchAddOpenLoopLatency(res, o->openLoopRate, &tr.histogram, &tr.latency);
+    else
+      sprintf(res->summary, "%.3f Gb/s, %lu retransmits", tr.gbps, tr.retransmits);
+    if(o->nagiosPluginOutput) {
+      // throughput: lower is worse, retransmits: higher is worse,
+      // at a given rate the throughput is the rate, latency: higher is worse
+      int gbpsCode    = o->openLoopRate > 0 ? levelOf(tr.latency.p99, warn, crit) : levelOfLowerIsWorse(tr.gbps, warn, crit);
+      int retransCode = o->nCrit > 1 ? levelOf(tr.retransmits, warn2, crit2) : EXIT_CODE_OK;
+      res->status = gbpsCode > retransCode ? gbpsCode : retransCode;
+    }
+  }
+  else if(o->thisType == UDP_REFLECTOR) {
+    r = sbenchDoUdpReflector(o->times, o->port, o->verbose, o->realtime);
+    sbenchAddMetric(res, "reflected", r, "c");
+    sprintf(res->summary, "%.0f datagrams reflected", r);
+    sbenchAppendText(res, "%.0f datagrams reflected\n", r);
+  }
+  else if(o->thisType == UDP_RR) {
+    udpRRResponse ur;
+
+    ur = sbenchDoUdpRRTest(o->times, o->rate, o->sizeInBytes, o->port, o->dest, o->verbose, o->realtime);
+    if(sbenchTestFailure() != SBENCH_OK)
+      return;
+    sbenchAddMetric(res, "min_ms",       ur.rtt.min,    "ms");
+    sbenchAddMetric(res, "avg_ms",       ur.rtt.avg,    "ms");
+    sbenchAddMetric(res, "p50_ms",       ur.rtt.p50,    "ms");
+    sbenchAddMetric(res, "p90_ms",       ur.rtt.p90,    "ms");
+    sbenchAddMetric(res, "p99_ms",       ur.rtt.p99,    "ms");
+    sbenchAddMetric(res, "p999_ms",      ur.rtt.p999,   "ms");
+    sbenchAddMetric(res, "max_ms",       ur.rtt.max,    "ms");
+    sbenchAddMetric(res, "jitter_ms",    ur.jitterMs,   "ms");
+    sbenchAddMetric(res, "loss_percent", ur.lossPerCent, "%");
+    sbenchAddMetric(res, "reordered",    ur.reordered,  "c");
+    sbenchAddMetric(res, "sent",         ur.sent,       "c");
+    sbenchAddMetric(res, "received",     ur.received,   "c");
+    if(o->verbose) printf("  %lu sent, %lu received, %s timestamps\n", ur.sent,
+                       ur.received, ur.kernelTimestamps ? "kernel" : "user space");
+
+    sprintf(res->summary, "p99 %.3f ms, %.1f %%", ur.rtt.p99, ur.lossPerCent);
+    sbenchAppendText(res, "rtt min/avg/p50/p90/p99/p99.9/max = %.3f/%.3f/%.3f/%.3f/%.3f/%.3f/%.3f ms;"
+                     "jitter %.3f ms;%.1f %%;%lu reordered\n",
+                     ur.rtt.min, ur.rtt.avg, ur.rtt.p50, ur.rtt.p90, ur.rtt.p99,
+                     ur.rtt.p999, ur.rtt.max, ur.jitterMs, ur.lossPerCent, ur.reordered);
+    if(o->nagiosPluginOutput) {
+      int latencyCode = ur.received == 0 ? EXIT_CODE_CRITICAL : levelOf(ur.rtt.p99, warn, crit);
+      int lossCode    = levelOf(ur.lossPerCent, warn2, crit2);
+      res->status = latencyCode > lossCode ? latencyCode : lossCode;
+    }
+  }
+  else if(o->thisType == SURVEY) {
+    survey_target *targets;
+    unsigned int   nTargets, nWarning = 0, nCritical = 0;
+
+    targets  = sbenchDoSurvey(o->targetFileName, o->times, o->intervalMs, &nTargets, o->verbose, o->realtime);
+    for(int i = 0; i < nTargets; i++) {
+      survey_target *t = &targets[i];
+      char label[300];
+      sprintf(label, "%s%s%s", t->name, t->port[0] ? "/" : "", t->port);
+      if(t->received == 0 || t->stats.avg >= crit || t->lossPerCent >= crit2)
+        nCritical++;
+      else if(t->stats.avg >= warn || t->lossPerCent >= warn2)
+        nWarning++;
+      // without replies the latency is unknown, not 0
+      if(t->received > 0) {
+        sbenchAddLabeledMetric(res, "ms",     t->stats.avg, "ms", "target", label);
+        sbenchAddLabeledMetric(res, "p99_ms", t->stats.p99, "ms", "target", label);
       }
+      sbenchAddLabeledMetric(res, "loss",   t->lossPerCent, "%", "target", label);
+      if(t->received > 0)
+        sbenchAppendText(res, "%s;%s;%.3f;%.3f;%.3f;%.3f;%.1f\n", label, t->port[0] ? "tcp" : "icmp",
+                         t->stats.min, t->stats.avg, t->stats.p99, t->stats.max, t->lossPerCent);
+      else
+        sbenchAppendText(res, "%s;%s;n/a;n/a;n/a;n/a;%.1f\n", label, t->port[0] ? "tcp" : "icmp", t->lossPerCent);
     }
-    else {
-      printf("%.2f s\n", r);
-      exit(EXIT_CODE_OK);
+    free(targets);
+
+    if(o->nagiosPluginOutput && nCritical > 0) {
+      res->status = EXIT_CODE_CRITICAL;
+      sprintf(res->summary, "%u of %u targets critical, %u warning", nCritical, nTargets, nWarning);
+    }
+    else if(o->nagiosPluginOutput && nWarning > 0) {
+      res->status = EXIT_CODE_WARNING;
+      sprintf(res->summary, "%u of %u targets warning", nWarning, nTargets);
     }
+    else
+      sprintf(res->summary, "%u targets", nTargets);
   }
-  else if(thisType == DISK_R_SEQ || thisType == DISK_R_RAN) {
-    r = doDiskReadTest(thisType, sizeInBytes, times, nThreads, targetFileName, verbose, realtime);
-    if(nagiosPluginOutput) {
-      if(r >= crit) {
-        printf("%sDiskRead Critical = %.6f s| time=%.6f\n", thisType == DISK_R_SEQ ? "Seq" : "Ran", r, r);
-        exit(EXIT_CODE_CRITICAL);
+  else if(o->thisType == TCP_LISTENER) {
+    r = sbenchDoTcpListener(o->times, o->port, &o->netOptions, o->verbose, o->realtime);
+    sbenchAddMetric(res, "accepted", r, "c");
+    sprintf(res->summary, "%.0f connections accepted", r);
+    sbenchAppendText(res, "%.0f connections accepted\n", r);
+  }
+  else if(o->thisType == TCP_CONNECT) {
+    tcpConnectResponse cr;
+
+    cr = sbenchDoTcpConnectTest(o->times, o->nThreads, o->rate, o->port, o->dest, &o->netOptions, o->verbose, o->realtime);
+    if(sbenchTestFailure() != SBENCH_OK)
+      return;
+    sbenchAddMetric(res, "connects_per_sec", cr.connectsPerSec,   "");
+    sbenchAddMetric(res, "min_ms",           cr.handshake.min,    "ms");
+    sbenchAddMetric(res, "avg_ms",           cr.handshake.avg,    "ms");
+    sbenchAddMetric(res, "p50_ms",           cr.handshake.p50,    "ms");
+    sbenchAddMetric(res, "p90_ms",           cr.handshake.p90,    "ms");
+    sbenchAddMetric(res, "p99_ms",           cr.handshake.p99,    "ms");
+    sbenchAddMetric(res, "max_ms",           cr.handshake.max,    "ms");
+    sbenchAddMetric(res, "attempts",         cr.attempts,         "c");
+    sbenchAddMetric(res, "failed",           cr.failed,           "c");
+
+    sprintf(res->summary, "%.1f connects/s, p99 %.3f ms, %lu failed", cr.connectsPerSec, cr.handshake.p99, cr.failed);
+    sbenchAppendText(res, "%.1f connects/s;handshake min/avg/p50/p90/p99/max = %.3f/%.3f/%.3f/%.3f/%.3f/%.3f ms;"
+                     "%lu attempts;%lu failed\n", cr.connectsPerSec, cr.handshake.min, cr.handshake.avg,
+                     cr.handshake.p50, cr.handshake.p90, cr.handshake.p99, cr.handshake.max, cr.attempts, cr.failed);
+    if(o->nagiosPluginOutput) {
+      // connects/s: lower is worse, latency: higher is worse
+      int rateCode    = cr.connected == 0 ? EXIT_CODE_CRITICAL : levelOfLowerIsWorse(cr.connectsPerSec, warn, crit);
+      int latencyCode = levelOf(cr.handshake.p99, warn2, crit2);
+      res->status = rateCode > latencyCode ? rateCode : latencyCode;
+      if(res->status == EXIT_CODE_OK && cr.failed > 0)
+        res->status = EXIT_CODE_WARNING;
+    }
+  }
+  else if(o->thisType == MIXED) {
+    mixed_component *components;
+    mixedResponse    mr;
+    unsigned int     nComponents;
+    char             label[MAX_MIXED_COMPONENTS][24], worst[24] = "";
+    double           worstP99 = 0;
+
+    components = sbenchParseMixedComponents(o->targetFileName, &nComponents);
+    mr = sbenchDoMixedTest(o->times, components, nComponents, &o->netOptions, o->verbose, o->realtime);
+    if(sbenchTestFailure() != SBENCH_OK) {
+      free(mr.intervals);
+      free(components);
+      return;
+    }
+    for(unsigned int i = 0; i < nComponents; i++) {
+      mixed_component *c = &components[i];
+      int repeated = 0;
+      latencyStats ls;
+
+      for(unsigned int j = 0; j < nComponents; j++)
+        repeated |= j != i && components[j].kind == c->kind;
+      // "disk_r_ran" or, if there are two of them, "disk_r_ran#2"
+      if(repeated)
+        sprintf(label[i], "%s#%u", sbenchMixedKindNames[c->kind], i);
+      else
+        sprintf(label[i], "%s", sbenchMixedKindNames[c->kind]);
+
+      sbenchAddLabeledMetric(res, "ops_per_sec", mr.seconds > 0 ? c->ops / mr.seconds : 0, "", "component", label[i]);
+      if(c->kind == MIXED_CPU) {
+        sbenchAppendText(res, "%s: %.0f calcs/s, %u threads\n", label[i], mr.seconds > 0 ? c->ops / mr.seconds : 0, c->nThreads);
+        continue;
       }
-      else if(r >= warn) {
-        printf("%sDiskRead Warning = %.6f s| time=%.6f\n", thisType == DISK_R_SEQ ? "Seq" : "Ran", r, r);
-        exit(EXIT_CODE_WARNING);
+      sbenchHistogramStats(&c->latency, &ls);
+      sbenchAddLabeledMetric(res, "bytes_per_sec", mr.seconds > 0 ? c->bytes / mr.seconds : 0, "", "component", label[i]);
+      sbenchAddLabeledMetric(res, "p50_ms", ls.p50, "ms", "component", label[i]);
+      sbenchAddLabeledMetric(res, "p99_ms", ls.p99, "ms", "component", label[i]);
+      sbenchAddLabeledMetric(res, "max_ms", ls.max, "ms", "component", label[i]);
+      sbenchAppendText(res, "%s: %.0f ops/s, %.0f B/s, latency avg/p50/p99/max = %.3f/%.3f/%.3f/%.3f ms, %u threads\n",
+                       label[i], mr.seconds > 0 ? c->ops / mr.seconds : 0, mr.seconds > 0 ? c->bytes / mr.seconds : 0,
+                       ls.avg, ls.p50, ls.p99, ls.max, c->nThreads);
+      if(ls.p99 >= worstP99) {
+        worstP99 = ls.p99;
+        strcpy(worst, label[i]);
       }
-      else {
-        printf("%sDiskRead OK = %.6f s| time=%.6f\n", thisType == DISK_R_SEQ ? "Seq" : "Ran", r, r);
-        exit(EXIT_CODE_OK);
+    }
+
+    // what each one did every second while the others were running
+    for(unsigned int s = 0; s < mr.nIntervals; s++) {
+      sbenchAppendText(res, "%us", s + 1);
+      for(unsigned int i = 0; i < nComponents; i++) {
+        if(components[i].kind == MIXED_CPU)
+          sbenchAppendText(res, ";%s %.0f calcs/s", label[i], mr.intervals[s].opsPerSec[i]);
+        else
+          sbenchAppendText(res, ";%s %.0f ops/s %.0f B/s avg %.3f ms max %.3f ms", label[i],
+                           mr.intervals[s].opsPerSec[i], mr.intervals[s].bytesPerSec[i],
+                           mr.intervals[s].avgLatencyMs[i], mr.intervals[s].maxLatencyMs[i]);
       }
+      sbenchAppendText(res, "\n");
     }
-    else {
-      printf("%.6f s\n", r);
-      exit(EXIT_CODE_OK);
+    free(mr.intervals);
+    free(components);
+
+    if(worst[0] != '\0')
+      sprintf(res->summary, "%u components, worst p99 %.3f ms (%s)", nComponents, worstP99, worst);
+    else
+      sprintf(res->summary, "%u components", nComponents);
+    if(o->nagiosPluginOutput)
+      res->status = levelOf(worstP99, warn, crit);
+  }
+  else if(o->thisType == SCHED_LAT) {
+    schedLatResponse sr;
+    latencyStats     ls;
+    double           worstP99 = 0;
+    uint64_t         overruns = 0;
+    char             label[16], worst[32] = "", name[32];
+
+    sbenchClearTestFailure();
+    if(sbenchDoSchedLatTest(o->times, o->intervalMs, o->nThreads, o->verbose, o->realtime, &sr) != SBENCH_OK)
+      return;
+    // by CPU when pinned, the histograms in us
+    for(unsigned int i = 0; i < sr.nThreads; i++) {
+      sched_lat_args *a = &sr.threads[i];
+      const char     *labelName = a->cpu >= 0 ? "cpu" : "thread";
+      uint64_t        le = 0;
+      sprintf(label, "%d", a->cpu >= 0 ? a->cpu : (int) i);
+      sbenchHistogramStats(&a->lateness, &ls);
+      if(ls.p99 * 1000 >= worstP99) {
+        worstP99 = ls.p99 * 1000;
+        sprintf(worst, "%s %s", labelName, label);
+      }
+      // of each CPU, too many for the perfdata
+      sbenchAddDetailMetric(res, "avg_us",   ls.avg * 1000, "us", labelName, label);
+      sbenchAddDetailMetric(res, "p99_us",   ls.p99 * 1000, "us", labelName, label);
+      sbenchAddDetailMetric(res, "max_us",   ls.max * 1000, "us", labelName, label);
+      sbenchAddDetailMetric(res, "overruns", a->overruns,   "c",  labelName, label);
+      overruns += a->overruns;
+      sbenchAppendText(res, "%s %s: lateness min/avg/p50/p99/p99.9/max = %.1f/%.1f/%.1f/%.1f/%.1f/%.1f us;%zu wake ups;%lu overruns\n",
+                       labelName, label, ls.min * 1000, ls.avg * 1000, ls.p50 * 1000, ls.p99 * 1000, ls.p999 * 1000,
+                       ls.max * 1000, ls.count, (unsigned long) a->overruns);
+      // cumulative, like the buckets of OpenMetrics
+      sbenchAppendText(res, "%s %s: histogram", labelName, label);
+      for(int b = 0; b < SCHED_LAT_BUCKETS; b++) {
+        le += a->buckets[b];
+        if(b < SCHED_LAT_BUCKETS - 1)
+          sprintf(name, "wakeups_le_%luus", sbenchSchedLatBounds[b]);
+        else
+          strcpy(name, "wakeups");
+        sbenchAddDetailMetric(res, name, le, "c", labelName, label);
+        if(b < SCHED_LAT_BUCKETS - 1)
+          sbenchAppendText(res, "%s<=%lu us %lu", b == 0 ? " " : ";", sbenchSchedLatBounds[b], (unsigned long) le);
+        else
+          sbenchAppendText(res, ";all %lu\n", (unsigned long) le);
+      }
     }
+    sbenchHistogramStats(&sr.all, &ls);
+    free(sr.threads);
+
+    sbenchAddMetric(res, "worst_p99_us", worstP99,      "us");
+    sbenchAddMetric(res, "p99_us",       ls.p99 * 1000, "us");
+    sbenchAddMetric(res, "max_us",       ls.max * 1000, "us");
+    sbenchAddMetric(res, "overruns",     overruns,      "c");
+    sprintf(res->summary, "worst p99 %.1f us (%s), max %.1f us", worstP99, worst, ls.max * 1000);
+    sbenchAppendText(res, "all: lateness avg/p99/max = %.1f/%.1f/%.1f us;worst p99 %.1f us on %s\n",
+                     ls.avg * 1000, ls.p99 * 1000, ls.max * 1000, worstP99, worst);
+    if(o->nagiosPluginOutput)
+      res->status = levelOf(worstP99, warn, crit);
   }
-  else if(thisType == HTTP_GET) {
-    if(verbose) printf("getting %s by HTTP GET\n", url);
-    r = httpGet(url, httpRefFileBasename, &different, verbose, realtime);
+  else if(o->thisType == CPU_C2C) {
+    c2cResponse cr;
+    unsigned int n, minI = 0, minJ = 0, maxI = 0, maxJ = 0, notes = 0;
+    double       minRtt = 0, maxRtt = 0, median, *sorted, v;
+    size_t       nSorted = 0;
+    char         label[32];
+    latencyStats ls;
 
-    if(nagiosPluginOutput) {
-      if(different || r >= crit) {
-        printf("%sHttpGet Critical = %.3f s| time=%.3f\n", thisType == DISK_R_SEQ ? "Seq" : "Ran", r, r);
-        exit(EXIT_CODE_CRITICAL);
+    sbenchClearTestFailure();
+    if(sbenchDoC2CTest(o->times, o->nThreads, o->verbose, o->realtime, &cr) != SBENCH_OK)
+      return;
+    n = cr.nCpus;
+    if((sorted = (double *) malloc(cr.nMeasured * sizeof(double))) == NULL) {
+      sbenchFreeC2C(&cr);
+      sbenchFailTest(SBENCH_ERR_MEMORY, "Can't allocate the round trips");
+      return;
+    }
+    for(unsigned int i = 0; i < n; i++)
+      for(unsigned int j = i + 1; j < n; j++) {
+        if((v = cr.rtt[i * n + j]) == 0)
+          continue;
+        sprintf(label, "%d-%d", cr.cpus[i], cr.cpus[j]);
+        sbenchAddLabeledMetric(res, "rtt_ns", v, "", "cpus", label);
+        sorted[nSorted++] = v;
+        if(minRtt == 0 || v < minRtt) {
+          minRtt = v;
+          minI   = i;
+          minJ   = j;
+        }
+        if(v > maxRtt) {
+          maxRtt = v;
+          maxI   = i;
+          maxJ   = j;
+        }
       }
-      else if(r >= warn) {
-        printf("%sHttpGet Warning = %.3f s| time=%.3f\n", thisType == DISK_R_SEQ ? "Seq" : "Ran", r, r);
-        exit(EXIT_CODE_WARNING);
+    sbenchComputeLatencyStats(sorted, nSorted, &ls);
+    median = ls.p50;
+    free(sorted);
+
+    // the matrix, "-" on the diagonal and on the pairs not sampled
+    sbenchAppendText(res, "round trip ns");
+    for(unsigned int j = 0; j < n; j++)
+      sbenchAppendText(res, "%6d", cr.cpus[j]);
+    sbenchAppendText(res, "\n");
+    for(unsigned int i = 0; i < n; i++) {
+      sbenchAppendText(res, "%13d", cr.cpus[i]);
+      for(unsigned int j = 0; j < n; j++)
+        if(cr.rtt[i * n + j] > 0)
+          sbenchAppendText(res, "%6.0f", cr.rtt[i * n + j]);
+        else
+          sbenchAppendText(res, "%6s", "-");
+      sbenchAppendText(res, "\n");
+    }
+    // what the guest is told against what the cache lines say
+    for(unsigned int i = 0; i < n && notes < C2C_MAX_NOTES; i++)
+      for(unsigned int j = i + 1; j < n && notes < C2C_MAX_NOTES; j++) {
+        int a = cr.cpus[i], b = cr.cpus[j];
+        int samePackage = sbenchCpuTopology(a, "physical_package_id") == sbenchCpuTopology(b, "physical_package_id");
+        int sameCore    = samePackage && sbenchCpuTopology(a, "core_id") == sbenchCpuTopology(b, "core_id");
+        if((v = cr.rtt[i * n + j]) == 0)
+          continue;
+        if(v < median / 2 && ! sameCore) {
+          sbenchAppendText(res, "cpu %d-%d: %.0f ns, under half the median, SMT siblings that the guest sees as different cores?\n", a, b, v);
+          notes++;
+        }
+        else if(v > median * 2 && samePackage) {
+          sbenchAppendText(res, "cpu %d-%d: %.0f ns, over twice the median, on different sockets that the guest sees as one?\n", a, b, v);
+          notes++;
+        }
       }
-      else {
-        printf("%sHttpGet OK = %.3f s| time=%.3f\n", thisType == DISK_R_SEQ ? "Seq" : "Ran", r, r);
-        exit(EXIT_CODE_OK);
+
+    sbenchAddMetric(res, "min_rtt_ns",    minRtt,                "");
+    sbenchAddMetric(res, "median_rtt_ns", median,                "");
+    sbenchAddMetric(res, "avg_rtt_ns",    ls.avg,                "");
+    sbenchAddMetric(res, "max_rtt_ns",    maxRtt,                "");
+    sbenchAddMetric(res, "pairs",         cr.nMeasured,          "c");
+    sprintf(res->summary, "round trip min %.0f ns (cpu %d-%d), median %.0f ns, max %.0f ns (cpu %d-%d)",
+            minRtt, cr.cpus[minI], cr.cpus[minJ], median, maxRtt, cr.cpus[maxI], cr.cpus[maxJ]);
+    sbenchAppendText(res, "%s;%lu of %lu pairs\n", res->summary, cr.nMeasured, cr.nPairs);
+    sbenchFreeC2C(&cr);
+    if(o->nagiosPluginOutput)
+      res->status = levelOf(maxRtt, warn, crit);
+  }
+  else if(o->thisType == CPU_SYNC) {
+    syncResponse sr;
+    unsigned int last, n;
+    double       worst = 100;
+    char         label[48];
+    int          worstP = 0;
+
+    sbenchClearTestFailure();
+    if(sbenchDoSyncTest(o->times, o->nThreads, o->verbose, o->realtime, &sr) != SBENCH_OK)
+      return;
+    last = sr.nSteps - 1;
+    n    = sr.threads[last];
+    // ops/s and efficiency of each primitive by threads
+    for(int table = 0; table < 2; table++) {
+      sbenchAppendText(res, "%-14s", table == 0 ? "ops/s" : "efficiency %");
+      for(unsigned int s = 0; s < sr.nSteps; s++)
+        sbenchAppendText(res, "%12u", sr.threads[s]);
+      sbenchAppendText(res, "\n");
+      for(int p = 0; p < SYNC_PRIMITIVES; p++) {
+        sbenchAppendText(res, "%-14s", sbenchSyncPrimitiveNames[p]);
+        for(unsigned int s = 0; s < sr.nSteps; s++)
+          if(isnan(sr.opsPerSec[p][s]))
+            sbenchAppendText(res, "%12s", "-");
+          else
+            sbenchAppendText(res, table == 0 ? "%12.0f" : "%12.1f", table == 0 ? sr.opsPerSec[p][s] : sr.efficiency[p][s]);
+        sbenchAppendText(res, "\n");
       }
     }
-    else {
-      if(different) {
-        printf("KO %.3f s\n", r);
-        exit(EXIT_CODE_CRITICAL);
+    for(int p = 0; p < SYNC_PRIMITIVES; p++) {
+      for(unsigned int s = 0; s < sr.nSteps; s++) {
+        if(isnan(sr.opsPerSec[p][s]))
+          continue;
+        sprintf(label, "%s-%u", sbenchSyncPrimitiveNames[p], sr.threads[s]);
+        sbenchAddLabeledMetric(res, "ops_per_sec", sr.opsPerSec[p][s], "", "sync", label);
+        sbenchAddLabeledMetric(res, "efficiency_pct", sr.efficiency[p][s], "%", "sync", label);
       }
-      else {
-        printf("OK %.3f s\n", r);
-        exit(EXIT_CODE_OK);
+      // not the futex handoff with 1 thread
+      if(sr.efficiency[p][last] < worst) {
+        worst  = sr.efficiency[p][last];
+        worstP = p;
       }
     }
+    sbenchAddMetric(res, "threads",            n,     "");
+    sbenchAddMetric(res, "min_efficiency_pct", worst, "%");
+    sprintf(res->summary, "with %u threads the worst is %s at %.1f%% of %s", n,
+            sbenchSyncPrimitiveNames[worstP], worst, worstP == SYNC_FUTEX ? "the handoffs of 2 threads" : "one thread each");
+    sbenchAppendText(res, "%s\n", res->summary);
+    if(o->nagiosPluginOutput)
+      res->status = levelOfLowerIsWorse(worst, warn, crit);
   }
-// ifdef OPING_ENABLED
-  else if(thisType == PING) {
-    pingResponse pr; // pr.latencyMs, pr.lossPerCent
-    pr = doPing(sizeInBytes, times, dest, verbose, realtime);
-    if(verbose) printf("  time_ms=%.1fms, warn=%1.f crit=%1.f\n", pr.latencyMs, warn, crit);
-    if(verbose) printf("  loss_percent=%.1f%%, warn=%1.f crit=%1.f\n", pr.lossPerCent, warn2, crit2);
+  else {
+    sbenchMyAbort(/* bug */ "Unknown type");
+    exit(2);
+  }
+}
 
-    if(pr.latencyMs == -1 && pr.lossPerCent != 100) {
-      printf("PingRTT Unknown = Can't parse ping data = %.1f ms, %.1f %%| time_ms=%.1fms loss_percent=%.1f%%\n", pr.latencyMs, pr.lossPerCent, pr.latencyMs, pr.lossPerCent);
-      exit(EXIT_CODE_UNKNOWN);
+
+/**
+  * Runs a test and fills its result. If it can't run, like a missing
+  * file or a host that can't be resolved, the result says why instead
+  * of ending the program, so that the daemon and the scenarios go on.
+  */
+void runTest(test_options *o, test_result *res) {
+  sbenchInitResult(res, typeNames[o->thisType], testName(o->thisType), o->params);
+  memcpy(res->warn, o->warnLevels, o->nWarn * sizeof(double));
+  memcpy(res->crit, o->critLevels, o->nCrit * sizeof(double));
+  res->nWarn = o->nWarn;
+  res->nCrit = o->nCrit;
+  if(o->sampleInterval > 0)
+    sbenchSamplerEnable(o->sampleInterval, o->verbose);
+  if(o->freq && o->thisType == CPU)
+    sbenchFreqEnable(o->verbose);
+  sbenchClearTestFailure();
+  if(o->context &&
+     sbenchContextBegin(o->thisType == DISK_W ? o->folderName :
+                        o->thisType == DISK_R_SEQ || o->thisType == DISK_R_RAN ? o->targetFileName : NULL,
+                        o->verbose) != SBENCH_OK)
+    failResult(res, sbenchTestFailure(), sbenchTestFailureMessage());
+  sbenchCgroupBegin(o->thisType == DISK_W ? o->folderName :
+                    o->thisType == DISK_R_SEQ || o->thisType == DISK_R_RAN ? o->targetFileName : NULL,
+                    o->thisType == CPU || o->thisType == DISK_W || o->thisType == DISK_R_RAN ||
+                    o->thisType == TCP_CLIENT || o->thisType == CPU_SYNC ? o->nThreads : 0, o->verbose);
+
+  if(res->error == SBENCH_OK)
+    measureTest(o, res);
+  // the tests out of the library don't return what failed, even on
+  // their threads like entering realtime
+  if(res->error == SBENCH_OK && sbenchTestFailure() != SBENCH_OK)
+    failResult(res, sbenchTestFailure(), sbenchTestFailureMessage());
+  // with "--sample-interval", what it did on each interval
+  sbenchAddSampleSeries(res);
+  // of cpu, the clock that its threads got
+  sbenchAddFrequency(res);
+  // with "--context", what else the host did meanwhile
+  sbenchContextEnd(res);
+  // the limits of the container and how they throttled the test
+  sbenchCgroupEnd(res);
+}
+
+
+/**
+  * Name of the metric with the main value of a test, the one that
+  * measureOnce returns and that is kept on the baseline.
+  */
+const char *mainMetric(test_options *o) {
+  if(o->openLoopRate > 0 && o->thisType != HTTP_GET)
+    return "p99_ms";
+  switch(o->thisType) {
+    case CPU:         return "avg_calcs_per_sec";
+    case PING:        return "time_ms";
+    case TCP_CLIENT:  return "gbps";
+    case UDP_RR:      return "p99_ms";
+    case TCP_CONNECT: return "connects_per_sec";
+    case SCHED_LAT:   return "worst_p99_us";
+    case CPU_C2C:     return "max_rtt_ns";
+    case CPU_SYNC:    return "min_efficiency_pct";
+    default:          return "time";
+  }
+}
+
+/**
+  * If a lower main value is worse when comparing with the baseline.
+  * Unlike its thresholds, fewer calcs/s is a slower CPU.
+  */
+int mainLowerIsWorse(test_options *o) {
+  if(o->openLoopRate > 0)
+    return 0;
+  return o->thisType == CPU || lowerIsWorse(o->thisType);
+}
+
+
+/**
+  * Keeps the main value of a run on the baseline store, or compares it
+  * with the ones kept for the same test, params and host. Compared
+  * with "-w" and "-c" it's Warning or Critical if it's that percent
+  * worse than the baseline mean and the difference is significant.
+  */
+void applyBaseline(test_options *o, test_result *res) {
+  char     fingerprint[1024], key[PATH_MAX + 1100];
+  double   single, *values = res->samples, *baseline, worse;
+  size_t   n = res->nSamples, nBaseline, len;
+  uint64_t signature;
+  baselineComparison bc;
+
+  // the runs of a test that failed aren't comparable
+  if((! o->saveBaseline && ! o->compareBaseline) || res->error != SBENCH_OK)
+    return;
+  for(size_t i = 0; n == 0 && i < res->nMetrics; i++) {
+    if(strcmp(res->metrics[i].name, mainMetric(o)) == 0 && res->metrics[i].labelValue[0] == '\0') {
+      single = res->metrics[i].value;
+      values = &single;
+      n      = 1;
     }
-    if(nagiosPluginOutput) {
-      if(pr.latencyMs >= crit || pr.lossPerCent >= crit2) {
-        printf("PingRTT Critical = %.1f ms, %.1f %%| time_ms=%.1fms loss_percent=%.1f%%\n", pr.latencyMs, pr.lossPerCent, pr.latencyMs, pr.lossPerCent);
-        exit(EXIT_CODE_CRITICAL);
+  }
+  if(n == 0) {
+    sbenchAppendText(res, "no %s for the baseline\n", mainMetric(o));
+    return;
+  }
+  sbenchHostFingerprint(fingerprint, sizeof(fingerprint));
+  snprintf(key, sizeof(key), "%s|%s|%g|%s", typeNames[o->thisType], o->params, o->openLoopRate, fingerprint);
+  signature = sbenchStoreSignature(key);
+  if(o->verbose)
+    printf("Baseline of %s (%016llx)\n", key, (unsigned long long) signature);
+
+  if(o->saveBaseline) {
+    sbenchStoreAppend(o->baselineStore, signature, res->timestamp, values, n, res->status);
+    sbenchAppendText(res, "%zu samples of %s kept on the baseline %s\n", n, mainMetric(o), o->baselineStore);
+    return;
+  }
+
+  baseline = sbenchStoreLoad(o->baselineStore, signature, &nBaseline);
+  sbenchCompareSamples(baseline, nBaseline, values, n, &bc);
+  free(baseline);
+  len = strlen(res->summary);
+  if(o->baselineThresholds) {
+    o->nagiosPluginOutput = 1;
+    res->warn[0] = o->baselineWarn;
+    res->crit[0] = o->baselineCrit;
+    res->nWarn   = res->nCrit = 1;
+  }
+  if(bc.baseline.count < 2) {
+    snprintf(res->summary + len, sizeof(res->summary) - len, " (no baseline)");
+    sbenchAppendText(res, "no baseline to compare with, %zu samples on %s\n", nBaseline, o->baselineStore);
+    if(o->baselineThresholds && res->status < EXIT_CODE_UNKNOWN)
+      res->status = EXIT_CODE_UNKNOWN;
+    return;
+  }
+
+  worse = mainLowerIsWorse(o) ? -bc.deviationPerCent : bc.deviationPerCent;
+  sbenchAddMetric(res, "baseline_mean",     bc.baseline.mean,    "");
+  sbenchAddMetric(res, "baseline_stddev",   bc.baseline.stddev,  "");
+  sbenchAddMetric(res, "baseline_samples",  bc.baseline.count,   "");
+  sbenchAddMetric(res, "deviation_percent", bc.deviationPerCent, "%");
+  sbenchAddMetric(res, "t_stat",            bc.t,                "");
+  sbenchAddMetric(res, "significant",       bc.significant,      "");
+  snprintf(res->summary + len, sizeof(res->summary) - len, " (%+.1f%% vs baseline%s)",
+           bc.deviationPerCent, bc.significant ? ", significant" : "");
+  sbenchAppendText(res, "%+.2f %% vs baseline mean %.6f (stddev %.6f, %zu samples);t %.3f;%s %s\n",
+                   bc.deviationPerCent, bc.baseline.mean, bc.baseline.stddev, bc.baseline.count, bc.t,
+                   bc.significant ? "significantly" : "not significantly", worse > 0 ? "worse" : "better");
+  if(o->baselineThresholds && bc.significant) {
+    int level = levelOf(worse, o->baselineWarn, o->baselineCrit);
+    if(level > res->status)
+      res->status = level;
+  }
+}
+
+
+/**
+  * Replaces an "auto" on the params with what the cgroup of sbench can
+  * run: the threads of cpu, cpu_sync, disk_w, disk_r_ran and tcp_client,
+  * and the size of mem.
+  * @return the params to parse, allocated if they changed
+  */
+char *expandAuto(char *params, enum btype thisType, int verbose) {
+  int    field, fields = 1;
+  char  *start, *expanded, value[32];
+  size_t len;
+
+  for(char *p = params; *p; p++)
+    fields += *p == ',';
+  if(thisType == CPU || thisType == MEM || thisType == TCP_CLIENT || thisType == CPU_SYNC)
+    field = 1;
+  // their threads are optional
+  else if((thisType == DISK_W || thisType == DISK_R_RAN) && fields >= 4)
+    field = 2;
+  else
+    return params;
+  for(start = params; field > 0 && (start = strchr(start, ',')) != NULL; field--)
+    start++;
+  if(start == NULL || strncmp(start, "auto", 4) != 0 || (start[4] != ',' && start[4] != '\0'))
+    return params;
+
+  if(thisType == MEM)
+    snprintf(value, sizeof(value), "%lu", sbenchCgroupAutoMemSize());
+  else
+    snprintf(value, sizeof(value), "%u", sbenchCgroupAutoThreads());
+  len = strlen(params) - 4 + strlen(value) + 1;
+  if((expanded = (char *) malloc(len)) == NULL)
+    sbenchMyAbort("Can't allocate memory for the params");
+  snprintf(expanded, len, "%.*s%s%s", (int) (start - params), params, value, start + 4);
+  if(verbose)
+    printf("auto params: %s\n", expanded);
+  return expanded;
+}
+
+
+/**
+  * Parses the "-p" params of a test, with its first thresholds
+  * for the verbose output.
+  */
+void parseTestParams(test_options *o) {
+  double warn = o->nWarn > 0 ? o->warnLevels[0] : -1., crit = o->nCrit > 0 ? o->critLevels[0] : -1.;
+  char  *params = expandAuto(o->params, o->thisType, o->verbose);
+
+  parseParams(params, o->thisType, o->verbose, &o->times, &o->sizeInBytes, &o->nThreads,
+              o->folderName, o->targetFileName, o->url, o->httpRefFileBasename, &o->timeoutInMS,
+              o->dest, o->port, &o->rate, &o->intervalMs, warn, crit);
+  if(params != o->params)
+    free(params);
+}
+
+
+/**
+  * Removes the blanks at the beginning and at the end of a string.
+  */
+char *trim(char *s) {
+  char *end;
+
+  while(isspace((unsigned char) *s))
+    s++;
+  end = s + strlen(s);
+  while(end > s && isspace((unsigned char) end[-1]))
+    *--end = '\0';
+  return s;
+}
+
+
+/**
+  * Parses the steps of a scenario and their tests, like the command
+  * line ones. Each step is a section with the name of the step and
+  * the options as keys, without the dash:
+  *
+  *   cooldown = 10        # seconds between steps, for all of them
+  *   [cpu4]
+  *   t = cpu
+  *   p = 100000000,4
+  *   w = 20000000
+  *   c = 10000000
+  *   [seqread]
+  *   t = disk_r_seq
+  *   p = 100,1048576,/tmp/f
+  *   n = 5,1
+  *   cooldown = 30        # after this step
+  *   [gentle]
+  *   t = disk_r_ran
+  *   p = 1000,4096,/tmp/f
+  *   rate = 50            # --rate
+  *
+  * The probes of a daemon are steps too, with an interval instead of
+  * a cooldown, and where to serve goes before them:
+  *
+  *   socket = /run/sbench.sock
+  *   listen = 9107        # HTTP on the loopback, or address:port
+  *   ring = 1024          # samples kept, of all the probes
+  *   interval = 60        # seconds between runs, for all of them
+  *   [cpu]
+  *   t = cpu
+  *   p = 1000000
+  *   interval = 10        # of this probe
+  *
+  * @param defaults global options, like "-v" and "-r"
+  * @param daemon where the daemon serves, NULL for a scenario
+  * @return the tests of the steps, with their names on names
+  */
+test_options *parseScenario(const char *fileName, test_options *defaults, daemon_options *daemon, char ***names, size_t *nSteps) {
+  FILE         *f;
+  char          line[PATH_MAX * 2], msg[PATH_MAX + 100];
+  char         *argvs[MAX_SCENARIO_STEPS][MAX_SCENARIO_ARGS];
+  int           argcs[MAX_SCENARIO_STEPS];
+  unsigned long cooldowns[MAX_SCENARIO_STEPS];
+  unsigned long cooldown = 0;
+  unsigned long intervals[MAX_SCENARIO_STEPS];
+  unsigned long interval = DAEMON_DEFAULT_INTERVAL;
+  int           lineNumber = 0;
+  test_options *steps;
+  int           n = -1;
+
+  if((f = fopen(fileName, "r")) == NULL) {
+    sprintf(msg, "Can't open the scenario %.*s: %s", PATH_MAX, fileName, strerror(errno));
+    sbenchMyAbort(msg);
+  }
+  *names = (char **) malloc(MAX_SCENARIO_STEPS * sizeof(char *));
+  if(*names == NULL)
+    sbenchMyAbort("Can't allocate the scenario");
+
+  while(fgets(line, sizeof(line), f) != NULL) {
+    char *l = line, *key, *value, *end;
+    lineNumber++;
+    if((end = strpbrk(l, "#;")) != NULL)
+      *end = '\0';
+    l = trim(l);
+    if(*l == '\0')
+      continue;
+
+    if(*l == '[') {
+      if((end = strchr(l, ']')) == NULL || end == l + 1) {
+        sprintf(msg, "Wrong step name on line %d of the scenario", lineNumber);
+        sbenchMyAbort(msg);
+      }
+      if(++n == MAX_SCENARIO_STEPS) {
+        sprintf(msg, "A scenario can have up to %d steps", MAX_SCENARIO_STEPS);
+        sbenchMyAbort(msg);
       }
-      else if(pr.latencyMs >= warn || pr.lossPerCent >= warn2) {
-        printf("PingRTT Warning = %.1f ms, %.1f %%| time_ms=%.1fms loss_percent=%.1f%%\n", pr.latencyMs, pr.lossPerCent, pr.latencyMs, pr.lossPerCent);
-        exit(EXIT_CODE_WARNING);
+      *end = '\0';
+      (*names)[n]  = strdup(l + 1);
+      argvs[n][0]  = "sbench";
+      argcs[n]     = 1;
+      cooldowns[n] = cooldown;
+      intervals[n] = interval;
+      continue;
+    }
+
+    if((value = strchr(l, '=')) == NULL) {
+      sprintf(msg, "Missing \"=\" on line %d of the scenario", lineNumber);
+      sbenchMyAbort(msg);
+    }
+    *value++ = '\0';
+    key   = trim(l);
+    value = trim(value);
+    if(daemon == NULL && strcmp(key, "cooldown") == 0) {
+      if(n < 0)
+        cooldown = parseUL(value, "cooldown");
+      else
+        cooldowns[n] = parseUL(value, "cooldown");
+    }
+    else if(daemon != NULL && strcmp(key, "interval") == 0) {
+      if(parseUL(value, "interval") == 0) {
+        sprintf(msg, "The interval on line %d of the probes must be 1 second at least", lineNumber);
+        sbenchMyAbort(msg);
       }
-      else {
-        printf("PingRTT OK = %.1f ms, %.1f %%| time_ms=%.1fms loss_percent=%.1f%%\n", pr.latencyMs, pr.lossPerCent, pr.latencyMs, pr.lossPerCent);
-        exit(EXIT_CODE_OK);
+      if(n < 0)
+        interval = parseUL(value, "interval");
+      else
+        intervals[n] = parseUL(value, "interval");
+    }
+    else if(daemon != NULL && n < 0 && strcmp(key, "socket") == 0)
+      snprintf(daemon->socketPath, sizeof(daemon->socketPath), "%s", value);
+    else if(daemon != NULL && n < 0 && strcmp(key, "listen") == 0)
+      snprintf(daemon->listen, sizeof(daemon->listen), "%s", value);
+    else if(daemon != NULL && n < 0 && strcmp(key, "ring") == 0) {
+      if((daemon->ringSize = parseUL(value, "ring")) == 0)
+        sbenchMyAbort("The ring of the daemon must keep 1 sample at least");
+    }
+    else if(n < 0) {
+      if(daemon == NULL)
+        sprintf(msg, "Line %d of the scenario must be in a step, only cooldown goes before them", lineNumber);
+      else
+        sprintf(msg, "Line %d of the probes must be in a probe, only socket, listen, ring and interval go before them", lineNumber);
+      sbenchMyAbort(msg);
+    }
+    else if(((strlen(key) == 1 && strchr("tpwcona", *key) != NULL) || strcmp(key, "rate") == 0 ||
+             strcmp(key, "sample_interval") == 0) && argcs[n] + 2 < MAX_SCENARIO_ARGS) {
+      char option[24] = {'-', *key, '\0'};
+      if(strcmp(key, "rate") == 0)
+        strcpy(option, "--rate");
+      else if(strcmp(key, "sample_interval") == 0)
+        strcpy(option, "--sample-interval");
+      argvs[n][argcs[n]++] = strdup(option);
+      argvs[n][argcs[n]++] = strdup(value);
+    }
+    else if((strcmp(key, "context") == 0 || strcmp(key, "freq") == 0) && argcs[n] + 1 < MAX_SCENARIO_ARGS) {
+      if(strcmp(value, "yes") != 0) {
+        sprintf(msg, "The %s on line %d of the scenario can only be \"yes\"", key, lineNumber);
+        sbenchMyAbort(msg);
       }
+      argvs[n][argcs[n]++] = strdup(strcmp(key, "context") == 0 ? "--context" : "--freq");
     }
     else {
-      printf("%.1f ms;%.1f %%\n", pr.latencyMs, pr.lossPerCent);
-      exit(EXIT_CODE_OK);
+      sprintf(msg, "Unknown key \"%.32s\" on line %d of the scenario", key, lineNumber);
+      sbenchMyAbort(msg);
     }
   }
-// endif // OPING_ENABLED
+  fclose(f);
+  if(n < 0)
+    sbenchMyAbort("The scenario has no steps");
+
+  *nSteps = n + 1;
+  steps = (test_options *) malloc(*nSteps * sizeof(test_options));
+  if(steps == NULL)
+    sbenchMyAbort("Can't allocate the scenario");
+  for(int i = 0; i <= n; i++) {
+    int   useTsc, usePerf;
+    enum outputFormat format;
+    char *scenarioFile = NULL, *probesFile = NULL, *agentPort = NULL, *agents = NULL;
+
+    if(defaults->verbose)
+      printf("Step [%s]\n", (*names)[i]);
+    memcpy(&steps[i], defaults, sizeof(test_options));
+    // the secret of an agent isn't for its steps
+    steps[i].secretFile = NULL;
+    argvs[i][argcs[i]] = NULL;
+    optind = 0; // getopt again from the beginning
+    getOpts(argcs[i], argvs[i], &steps[i], &useTsc, &usePerf, &format, &scenarioFile, &probesFile, &agentPort, &agents);
+    parseTestParams(&steps[i]);
+    steps[i].cooldown = cooldowns[i];
+    steps[i].interval = intervals[i];
+  }
+  return steps;
+}
+
+
+/** what a scenario has on top of its steps: the command line */
+typedef struct {
+  test_options *defaults;
+  int           usePerf;
+} scenario_defaults;
+
+/** a parsed scenario, for runScenario and for the agents */
+typedef struct {
+  test_options *steps;
+  char        **names;
+  size_t        nSteps;
+  int           usePerf;
+  int           verbose;
+} parsed_scenario;
+
+
+void *scenarioParse(const char *fileName, void *arg, size_t *nSteps) {
+  scenario_defaults *d = (scenario_defaults *) arg;
+  parsed_scenario   *s = (parsed_scenario *) malloc(sizeof(parsed_scenario));
+
+  if(s == NULL)
+    sbenchMyAbort("Can't allocate the scenario");
+  s->steps   = parseScenario(fileName, d->defaults, NULL, &s->names, &s->nSteps);
+  s->usePerf = d->usePerf;
+  s->verbose = d->defaults->verbose;
+  *nSteps    = s->nSteps;
+  return s;
+}
+
+
+void scenarioRunStep(void *scenario, size_t i, test_result *res, int *nagios) {
+  parsed_scenario *s = (parsed_scenario *) scenario;
+
+  if(s->verbose)
+    printf("Running step [%s]\n", s->names[i]);
+  if(s->usePerf)
+    sbenchPerfEnable(s->steps[i].verbose);
+  runTest(&s->steps[i], res);
+  applyBaseline(&s->steps[i], res);
+  res->step = s->names[i];
+  if(s->usePerf)
+    sbenchAddPerfMetrics(res);
+  *nagios = s->steps[i].nagiosPluginOutput;
+}
+
+
+unsigned long scenarioCooldown(void *scenario, size_t i) {
+  return ((parsed_scenario *) scenario)->steps[i].cooldown;
+}
+
+
+void scenarioRelease(void *scenario) {
+  parsed_scenario *s = (parsed_scenario *) scenario;
+
+  for(size_t i = 0; i < s->nSteps; i++)
+    free(s->names[i]);
+  free(s->names);
+  free(s->steps);
+  free(s);
+}
+
+
+scenario_ops scenarioOps = {scenarioParse, scenarioRunStep, scenarioCooldown, scenarioRelease};
+
+
+/**
+  * Runs the steps of a scenario one after the other in this process,
+  * reusing its threads and buffers, and prints them as one report.
+  * @return the worst status of the steps
+  */
+int runScenario(const char *fileName, scenario_defaults *defaults, enum outputFormat format) {
+  void         *scenario;
+  test_result  *results;
+  size_t        nSteps;
+  unsigned long cooldown;
+  int           nagios = 0, stepNagios;
+  int           r;
+
+  scenario = scenarioOps.parse(fileName, defaults, &nSteps);
+  results  = (test_result *) malloc(nSteps * sizeof(test_result));
+  if(results == NULL)
+    sbenchMyAbort("Can't allocate the results of the scenario");
+
+  for(size_t i = 0; i < nSteps; i++) {
+    scenarioOps.runStep(scenario, i, &results[i], &stepNagios);
+    nagios |= stepNagios;
+    if((cooldown = scenarioOps.cooldown(scenario, i)) > 0 && i + 1 < nSteps) {
+      if(defaults->defaults->verbose)
+        printf("Cooling down for %lu s\n", cooldown);
+      sleep(cooldown);
+    }
+  }
+
+  r = sbenchEmitResults(results, nSteps, format, nagios);
+  for(size_t i = 0; i < nSteps; i++)
+    sbenchFreeResult(&results[i]);
+  free(results);
+  scenarioOps.release(scenario);
+  return r;
+}
+
+
+/**
+  * Runs the test of a probe of the daemon.
+  */
+void runProbe(void *test, test_result *res) {
+  runTest((test_options *) test, res);
+}
+
+
+/**
+  * Runs the probes of a file as a daemon, until it's stopped.
+  * @return the exit code
+  */
+int runProbes(const char *fileName, test_options *defaults) {
+  test_options  *steps;
+  daemon_probe  *probes;
+  daemon_options daemon;
+  char         **names;
+  size_t         nProbes;
+  char           msg[300];
+  int            r;
+
+  memset(&daemon, 0, sizeof(daemon));
+  daemon.ringSize = DAEMON_DEFAULT_RING;
+  daemon.verbose  = defaults->verbose;
+  steps  = parseScenario(fileName, defaults, &daemon, &names, &nProbes);
+  probes = (daemon_probe *) malloc(nProbes * sizeof(daemon_probe));
+  if(probes == NULL)
+    sbenchMyAbort("Can't allocate the probes");
+  for(size_t i = 0; i < nProbes; i++) {
+    // the servers wait for their clients, mixed loads the whole host
+    if(steps[i].thisType == TCP_SERVER || steps[i].thisType == UDP_REFLECTOR ||
+       steps[i].thisType == TCP_LISTENER || steps[i].thisType == MIXED) {
+      sprintf(msg, "The probe [%.64s] can't be a %s", names[i], typeNames[steps[i].thisType]);
+      sbenchMyAbort(msg);
+    }
+    probes[i].name     = names[i];
+    probes[i].interval = steps[i].interval;
+    probes[i].test     = &steps[i];
+  }
+
+  r = sbenchRunDaemon(probes, nProbes, runProbe, &daemon);
+  for(size_t i = 0; i < nProbes; i++)
+    free(names[i]);
+  free(names);
+  free(probes);
+  free(steps);
+  return r;
+}
+
+
+int main (int argc, char *argv[]) {
+  int  useTsc = 0;
+  int  usePerf = 0;
+  char *scenarioFile = NULL;
+  char *probesFile = NULL;
+  char *agentPort = NULL;
+  char *agents = NULL;
+  scenario_defaults defaults;
+  enum outputFormat format = OUTPUT_TEXT;
+  test_options o;
+  test_result res;
+  int r;
+
+  memset(&o, 0, sizeof(o));
+  o.netOptions.sendMode = SEND_WRITE;
+  getOpts(argc, argv, &o, &useTsc, &usePerf, &format, &scenarioFile, &probesFile, &agentPort, &agents);
+  if(scenarioFile == NULL && probesFile == NULL && agentPort == NULL)
+    parseTestParams(&o);
+  sbenchInitTimer(useTsc, o.verbose);
+  if((lib = sbenchOpen()) == NULL)
+    sbenchMyAbort("Can't open the library");
+
+  defaults.defaults = &o;
+  defaults.usePerf  = usePerf;
+
+  if(probesFile != NULL)
+    r = runProbes(probesFile, &o);
+  else if(agentPort != NULL)
+    r = sbenchRunAgent(agentPort, o.secretFile, &scenarioOps, &defaults, o.verbose);
+  else if(agents != NULL)
+    r = sbenchCoordinate(agents, o.secretFile, scenarioFile, &scenarioOps, &defaults, format, o.verbose);
+  else if(scenarioFile != NULL)
+    r = runScenario(scenarioFile, &defaults, format);
   else {
-    myAbort(/* bug */ "Unknown type");
-    exit(2);
+    if(usePerf)
+      sbenchPerfEnable(o.verbose);
+    runTest(&o, &res);
+    applyBaseline(&o, &res);
+    if(usePerf)
+      sbenchAddPerfMetrics(&res);
+    sbenchEmitResult(&res, format, o.nagiosPluginOutput);
+    // on plain and nagios output the counters are extra lines
+    if(format == OUTPUT_TEXT)
+      sbenchPrintPerfCounts();
+    r = res.status;
+    sbenchFreeResult(&res);
   }
+
+  sbenchClose(lib);
+  exit(r);
 }
@@ -0,0 +1,446 @@
+/*
+ * Simple Benchmarks: the limits of the cgroup (v1 or v2) where sbench
+ * runs, like a container or a systemd slice, and the throttling that
+ * they cause while a test runs.
+ *
+ * The cgroup of sbench is the one on /proc/self/cgroup, under a single
+ * hierarchy on CGROUP_ROOT (v2) or under one for each controller (v1).
+ * A limit applies also from the ancestors, up to the root, so the lowest
+ * one is taken: the quota of CPU (cpu.max or cpu.cfs_quota_us), the
+ * memory (memory.max or memory.limit_in_bytes) and the limits on the
+ * disk of a disk test, the whole one of a partition (io.max or
+ * blkio.throttle). The cpuset is the affinity of the process.
+ *
+ * The periods that the quota throttled (nr_throttled of cpu.stat) and
+ * the times that the memory limit was hit are taken before and after
+ * each test, and added to its result with the limits, if any.
+ *
+ * @since 20161027
+ * @author zoquero@gmail.com
+ */
+
+#define _GNU_SOURCE       // CPU_COUNT, sched_getaffinity
+#include <stdio.h>        // fopen, fgets, sscanf
+#include <string.h>       // strchr, strrchr, strstr, strtok_r
+#include <limits.h>       // PATH_MAX
+#include <unistd.h>       // access
+#include <sched.h>        // sched_getaffinity
+
+#include "sbenchfuncs.h"
+#include "sbenchcgroup.h"
+
+/** files of the limits on a device, indexed by enum cgroupIo */
+static const char *cgroupIoKeys[CG_IO_LIMITS]   = {"rbps=", "wbps=", "riops=", "wiops="};
+static const char *cgroupIoFiles[CG_IO_LIMITS]  = {"blkio.throttle.read_bps_device",
+  "blkio.throttle.write_bps_device", "blkio.throttle.read_iops_device", "blkio.throttle.write_iops_device"};
+static const char *cgroupIoMetrics[CG_IO_LIMITS] = {"cgroup_io_read_bps", "cgroup_io_write_bps",
+  "cgroup_io_read_iops", "cgroup_io_write_iops"};
+
+/** counters of throttling, at an instant */
+typedef struct {
+  uint64_t nrThrottled;
+  /** in us */
+  uint64_t throttledTime;
+  int      hasCpu;
+  uint64_t limitHits;
+  uint64_t oomKills;
+  int      hasMemory;
+} cgroup_snapshot;
+
+static int             cgroupOn;
+static unsigned int    cgroupThreads;
+static cgroup_limits   limits;
+/** the cgroup whose quota applies, to read its cpu.stat */
+static char            quotaFolder[PATH_MAX];
+static char            memoryFolder[PATH_MAX];
+static char            device[32];
+static uint64_t        ioLimits[CG_IO_LIMITS];
+static cgroup_snapshot before;
+
+
+static int cgroupV2() {
+  return access(CGROUP_ROOT "/cgroup.controllers", F_OK) == 0;
+}
+
+
+/**
+  * The folder of the cgroup of sbench on the hierarchy of a controller
+  * of v1, or on the one of v2.
+  * @param root return value, the root of the hierarchy
+  * @return 0 if it isn't mounted
+  */
+static int cgroupFolder(const char *controller, char *root, char *folder) {
+  char  line[PATH_MAX + 64], *list, *path, *tok, *save;
+  int   v2 = cgroupV2(), found = 0;
+  FILE *f;
+
+  snprintf(root, PATH_MAX, v2 ? "%s" : "%s/%s", CGROUP_ROOT, controller);
+  if(access(root, F_OK) != 0 || (f = fopen("/proc/self/cgroup", "r")) == NULL)
+    return 0;
+  // "hierarchy:controllers:path", v2 is "0::path"
+  while(! found && fgets(line, sizeof(line), f) != NULL) {
+    if((list = strchr(line, ':')) == NULL || (path = strchr(++list, ':')) == NULL)
+      continue;
+    *path++ = '\0';
+    path[strcspn(path, "\n")] = '\0';
+    if(v2)
+      found = *list == '\0';
+    else
+      for(tok = strtok_r(list, ",", &save); tok != NULL && ! found; tok = strtok_r(NULL, ",", &save))
+        found = strcmp(tok, controller) == 0;
+    if(found)
+      snprintf(folder, PATH_MAX, "%s%s", root, strcmp(path, "/") == 0 ? "" : path);
+  }
+  fclose(f);
+  if(! found)
+    return 0;
+  // on its own cgroup namespace the path is of the host
+  if(access(folder, F_OK) != 0)
+    snprintf(folder, PATH_MAX, "%s", root);
+  return 1;
+}
+
+
+/**
+  * Goes up to the parent of a cgroup.
+  * @return 0 if it was the root
+  */
+static int cgroupParent(char *folder, const char *root) {
+  char *slash = strrchr(folder, '/');
+
+  if(strcmp(folder, root) == 0 || slash == NULL || slash - folder < strlen(root))
+    return 0;
+  *slash = '\0';
+  return 1;
+}
+
+
+/**
+  * Reads the first line of a file of a cgroup.
+  * @return 0 if it can't be read, like on a cgroup without that controller
+  */
+static int cgroupRead(const char *folder, const char *file, char *buf, int len) {
+  char  name[PATH_MAX + 64];
+  FILE *f;
+  int   ok;
+
+  snprintf(name, sizeof(name), "%s/%s", folder, file);
+  if((f = fopen(name, "r")) == NULL)
+    return 0;
+  ok = fgets(buf, len, f) != NULL;
+  fclose(f);
+  return ok;
+}
+
+
+/**
+  * Reads a counter of a file of "key value" lines, like cpu.stat.
+  * @return 0 if it isn't there
+  */
+static int cgroupKey(const char *folder, const char *file, const char *key, uint64_t *value) {
+  char  name[PATH_MAX + 64], line[256], k[64];
+  unsigned long long v;
+  int   found = 0;
+  FILE *f;
+
+  snprintf(name, sizeof(name), "%s/%s", folder, file);
+  if((f = fopen(name, "r")) == NULL)
+    return 0;
+  while(! found && fgets(line, sizeof(line), f) != NULL)
+    if(sscanf(line, "%63s %llu", k, &v) == 2 && strcmp(k, key) == 0) {
+      *value = v;
+      found  = 1;
+    }
+  fclose(f);
+  return found;
+}
+
+
+/**
+  * The quota of CPU of a cgroup, in CPUs.
+  * @return 0 if it has none
+  */
+static double cgroupQuota(const char *folder, int v2) {
+  char   buf[64];
+  double quota, period;
+
+  if(v2) {
+    // "max 100000" or "50000 100000"
+    if(! cgroupRead(folder, "cpu.max", buf, sizeof(buf)) || sscanf(buf, "%lf %lf", &quota, &period) != 2)
+      return 0;
+  }
+  else {
+    if(! cgroupRead(folder, "cpu.cfs_quota_us", buf, sizeof(buf)) || sscanf(buf, "%lf", &quota) != 1 ||
+       ! cgroupRead(folder, "cpu.cfs_period_us", buf, sizeof(buf)) || sscanf(buf, "%lf", &period) != 1)
+      return 0;
+  }
+  return quota > 0 && period > 0 ? quota / period : 0;
+}
+
+
+/**
+  * The memory limit of a cgroup, in bytes.
+  * @return 0 if it has none
+  */
+static uint64_t cgroupMemoryMax(const char *folder, int v2) {
+  char buf[64];
+  unsigned long long max;
+
+  if(! cgroupRead(folder, v2 ? "memory.max" : "memory.limit_in_bytes", buf, sizeof(buf)) ||
+     sscanf(buf, "%llu", &max) != 1 || max >= CGROUP_NO_LIMIT)
+    return 0;
+  return max;
+}
+
+
+/**
+  * MemAvailable of /proc/meminfo, in bytes, 0 if it can't be read.
+  */
+static uint64_t hostMemAvailable() {
+  char  line[256];
+  unsigned long long kb = 0;
+  FILE *f;
+
+  if((f = fopen("/proc/meminfo", "r")) == NULL)
+    return 0;
+  while(fgets(line, sizeof(line), f) != NULL)
+    if(sscanf(line, "MemAvailable: %llu kB", &kb) == 1)
+      break;
+  fclose(f);
+  return kb * 1024;
+}
+
+
+/**
+  * Finds the limits of CPU and memory of sbench.
+  */
+static void cgroupLimits(cgroup_limits *l) {
+  char      root[PATH_MAX], folder[PATH_MAX], buf[64];
+  cpu_set_t set;
+  double    quota;
+  uint64_t  max, host;
+  unsigned long long current;
+
+  memset(l, 0, sizeof(*l));
+  l->v2   = cgroupV2();
+  // the cpuset of the cgroup, and any taskset
+  l->cpus = sched_getaffinity(0, sizeof(set), &set) == 0 ? CPU_COUNT(&set) : 1;
+  quotaFolder[0] = memoryFolder[0] = '\0';
+
+  if(cgroupFolder("cpu", root, folder)) {
+    snprintf(quotaFolder, sizeof(quotaFolder), "%s", folder);
+    do {
+      quota = cgroupQuota(folder, l->v2);
+      if(quota > 0 && (l->cpuQuota == 0 || quota < l->cpuQuota)) {
+        l->cpuQuota = quota;
+        snprintf(quotaFolder, sizeof(quotaFolder), "%s", folder);
+      }
+    } while(cgroupParent(folder, root));
+  }
+
+  if(cgroupFolder("memory", root, folder)) {
+    snprintf(memoryFolder, sizeof(memoryFolder), "%s", folder);
+    if(cgroupRead(folder, l->v2 ? "memory.current" : "memory.usage_in_bytes", buf, sizeof(buf)) &&
+       sscanf(buf, "%llu", &current) == 1)
+      l->memoryCurrent = current;
+    do {
+      max = cgroupMemoryMax(folder, l->v2);
+      if(max > 0 && (l->memoryMax == 0 || max < l->memoryMax))
+        l->memoryMax = max;
+    } while(cgroupParent(folder, root));
+  }
+
+  host = hostMemAvailable();
+  l->memoryAvailable = host;
+  if(l->memoryMax > 0) {
+    max = l->memoryMax > l->memoryCurrent ? l->memoryMax - l->memoryCurrent : 0;
+    if(host == 0 || max < host)
+      l->memoryAvailable = max;
+  }
+}
+
+
+/**
+  * The threads that the CPUs and the quota of sbench can run at once,
+  * the "auto" of the params.
+  */
+unsigned int sbenchCgroupAutoThreads() {
+  cgroup_limits l;
+  unsigned int  n;
+
+  cgroupLimits(&l);
+  n = l.cpus;
+  // more threads than the quota are just throttled
+  if(l.cpuQuota > 0 && l.cpuQuota < n)
+    n = (unsigned int) l.cpuQuota;
+  return n > 0 ? n : 1;
+}
+
+
+/**
+  * A size that fits on the memory that sbench can still use,
+  * the "auto" of the params.
+  */
+unsigned long sbenchCgroupAutoMemSize() {
+  cgroup_limits l;
+  uint64_t      size;
+
+  cgroupLimits(&l);
+  size = l.memoryAvailable / CGROUP_AUTO_MEM_SHARE / 4096 * 4096;
+  return size > 4096 ? size : 4096;
+}
+
+
+/**
+  * The limits on a device, the lowest of the cgroup and its ancestors.
+  */
+static void cgroupIoLimits(unsigned int maj, unsigned int min, int v2) {
+  char  root[PATH_MAX], folder[PATH_MAX], name[PATH_MAX + 64], line[256], *value;
+  unsigned int ma, mi;
+  unsigned long long v;
+  FILE *f;
+
+  memset(ioLimits, 0, sizeof(ioLimits));
+  if(! cgroupFolder(v2 ? "io" : "blkio", root, folder))
+    return;
+  do {
+    for(int i = 0; i < (v2 ? 1 : CG_IO_LIMITS); i++) {
+      snprintf(name, sizeof(name), "%s/%s", folder, v2 ? "io.max" : cgroupIoFiles[i]);
+      if((f = fopen(name, "r")) == NULL)
+        continue;
+      // v2 "8:0 rbps=max wbps=1048576 riops=max wiops=max", v1 "8:0 1048576"
+      while(fgets(line, sizeof(line), f) != NULL) {
+        if(sscanf(line, "%u:%u", &ma, &mi) != 2 || ma != maj || mi != min)
+          continue;
+        for(int j = 0; j < CG_IO_LIMITS; j++) {
+          if(v2 && (value = strstr(line, cgroupIoKeys[j])) != NULL)
+            value += strlen(cgroupIoKeys[j]);
+          else if(! v2 && j == i)
+            value = strchr(line, ' ');
+          else
+            continue;
+          if(value != NULL && sscanf(value, "%llu", &v) == 1 && v > 0 &&
+             (ioLimits[j] == 0 || v < ioLimits[j]))
+            ioLimits[j] = v;
+        }
+      }
+      fclose(f);
+    }
+  } while(cgroupParent(folder, root));
+}
+
+
+static void takeCgroupSnapshot(cgroup_snapshot *s, int v2) {
+  uint64_t v;
+
+  memset(s, 0, sizeof(*s));
+  if(quotaFolder[0] && cgroupKey(quotaFolder, "cpu.stat", "nr_throttled", &s->nrThrottled)) {
+    s->hasCpu = 1;
+    if(cgroupKey(quotaFolder, "cpu.stat", "throttled_usec", &v))
+      s->throttledTime = v;
+    else if(cgroupKey(quotaFolder, "cpu.stat", "throttled_time", &v))
+      s->throttledTime = v / 1000; // ns on v1
+  }
+  if(memoryFolder[0]) {
+    if(v2)
+      s->hasMemory = cgroupKey(memoryFolder, "memory.events", "max", &s->limitHits);
+    else {
+      char buf[64];
+      unsigned long long failcnt;
+      if(cgroupRead(memoryFolder, "memory.failcnt", buf, sizeof(buf)) && sscanf(buf, "%llu", &failcnt) == 1) {
+        s->limitHits = failcnt;
+        s->hasMemory = 1;
+      }
+    }
+    cgroupKey(memoryFolder, v2 ? "memory.events" : "memory.oom_control", "oom_kill", &s->oomKills);
+  }
+}
+
+
+/**
+  * Finds the limits of sbench and takes the counters of throttling
+  * before a test.
+  * @param path file or folder of a disk test, NULL if it's not one
+  * @param nThreads threads of the test, 0 if it has none
+  */
+void sbenchCgroupBegin(const char *path, unsigned int nThreads, int verbose) {
+  unsigned int maj, min;
+
+  cgroupOn      = 1;
+  cgroupThreads = nThreads;
+  cgroupLimits(&limits);
+  device[0] = '\0';
+  memset(ioLimits, 0, sizeof(ioLimits));
+  if(path != NULL && sbenchPathDevice(path, &maj, &min)) {
+    // the limits are on the disk, not on its partitions
+    sbenchPartitionDisk(&maj, &min);
+    snprintf(device, sizeof(device), "%u:%u", maj, min);
+    cgroupIoLimits(maj, min, limits.v2);
+  }
+  if(verbose)
+    printf("cgroup v%d: %u CPUs, quota %.2f CPUs, memory limit %lu B, %lu B available\n", limits.v2 ? 2 : 1,
+           limits.cpus, limits.cpuQuota, (unsigned long) limits.memoryMax, (unsigned long) limits.memoryAvailable);
+  takeCgroupSnapshot(&before, limits.v2);
+}
+
+
+/**
+  * Adds the limits of sbench and the throttling during the test to its
+  * result. Nothing if it runs without limits and wasn't throttled.
+  */
+void sbenchCgroupEnd(test_result *res) {
+  cgroup_snapshot after;
+  uint64_t throttled = 0, hits = 0, kills = 0;
+  int      ioLimited = 0;
+
+  if(! cgroupOn)
+    return;
+  cgroupOn = 0;
+  takeCgroupSnapshot(&after, limits.v2);
+
+  if(limits.cpuQuota > 0) {
+    sbenchAddMetric(res, "cgroup_cpu_quota", limits.cpuQuota, "");
+    sbenchAddMetric(res, "cgroup_cpus", limits.cpus, "");
+    sbenchAppendText(res, "cgroup: quota of %.2f CPUs on %u CPUs\n", limits.cpuQuota, limits.cpus);
+    if(cgroupThreads > limits.cpuQuota)
+      sbenchAppendText(res, "cgroup: %u threads on a quota of %.2f CPUs, try \"auto\" threads\n", cgroupThreads, limits.cpuQuota);
+  }
+  if(before.hasCpu && after.hasCpu) {
+    throttled = after.nrThrottled - before.nrThrottled;
+    if(limits.cpuQuota > 0 || throttled > 0) {
+      sbenchAddMetric(res, "cgroup_nr_throttled", throttled, "c");
+      sbenchAddMetric(res, "cgroup_throttled_s", (after.throttledTime - before.throttledTime) / 1e6, "s");
+    }
+    if(throttled > 0)
+      sbenchAppendText(res, "cgroup: throttled on %lu periods for %.3f s, the result is capped by the quota\n",
+                       (unsigned long) throttled, (after.throttledTime - before.throttledTime) / 1e6);
+  }
+
+  if(limits.memoryMax > 0) {
+    sbenchAddMetric(res, "cgroup_memory_max", limits.memoryMax, "B");
+    sbenchAppendText(res, "cgroup: memory limit of %lu B, %lu B used before the test\n",
+                     (unsigned long) limits.memoryMax, (unsigned long) limits.memoryCurrent);
+  }
+  if(before.hasMemory && after.hasMemory) {
+    hits  = after.limitHits - before.limitHits;
+    kills = after.oomKills - before.oomKills;
+    if(limits.memoryMax > 0 || hits > 0 || kills > 0) {
+      sbenchAddMetric(res, "cgroup_memory_limit_hits", hits, "c");
+      sbenchAddMetric(res, "cgroup_oom_kills", kills, "c");
+    }
+    if(hits > 0 || kills > 0)
+      sbenchAppendText(res, "cgroup: the memory limit was hit %lu times and %lu tasks were killed, the result includes reclaim\n",
+                       (unsigned long) hits, (unsigned long) kills);
+  }
+
+  for(int i = 0; i < CG_IO_LIMITS; i++) {
+    if(ioLimits[i] == 0)
+      continue;
+    sbenchAddLabeledMetric(res, cgroupIoMetrics[i], ioLimits[i], i < CG_IO_RIOPS ? "B" : "", "device", device);
+    ioLimited = 1;
+  }
+  if(ioLimited)
+    sbenchAppendText(res, "cgroup: %s limited to read %lu B/s;write %lu B/s;read %lu IOPS;write %lu IOPS (0 == no limit)\n", device,
+                     (unsigned long) ioLimits[CG_IO_RBPS], (unsigned long) ioLimits[CG_IO_WBPS],
+                     (unsigned long) ioLimits[CG_IO_RIOPS], (unsigned long) ioLimits[CG_IO_WIOPS]);
+}
@@ -0,0 +1,43 @@
+/*
+ * Simple Benchmarks: the limits of the cgroup (v1 or v2) where sbench
+ * runs, like a container or a systemd slice, and the throttling that
+ * they cause while a test runs.
+ *
+ * @since 20161027
+ * @author zoquero@gmail.com
+ */
+
+#ifndef SBENCHCGROUP_H
+#define SBENCHCGROUP_H
+
+#include <stdint.h>       // uint64_t
+
+#include "sbenchresult.h"  // test_result
+
+#define CGROUP_ROOT           "/sys/fs/cgroup"
+#define CGROUP_AUTO_MEM_SHARE 4    // "auto" size of mem is this part of the memory available
+#define CGROUP_NO_LIMIT       ((uint64_t) 1 << 62) // v1 says "no limit" with a huge number
+
+/** limits on CPU and memory of the cgroup of sbench, and of its ancestors */
+typedef struct {
+  int      v2;
+  /** CPUs that sbench can run on, the cpuset and the affinity */
+  unsigned int cpus;
+  /** CPUs of time per period of cpu.max or cpu.cfs_quota_us, 0 == no quota */
+  double   cpuQuota;
+  /** bytes, 0 == no limit */
+  uint64_t memoryMax;
+  uint64_t memoryCurrent;
+  /** what a test can still allocate, the lowest of the cgroup and the host */
+  uint64_t memoryAvailable;
+} cgroup_limits;
+
+/** limits of io.max or blkio.throttle on a device, 0 == no limit */
+enum cgroupIo {CG_IO_RBPS, CG_IO_WBPS, CG_IO_RIOPS, CG_IO_WIOPS, CG_IO_LIMITS};
+
+unsigned int  sbenchCgroupAutoThreads();
+unsigned long sbenchCgroupAutoMemSize();
+void          sbenchCgroupBegin(const char *path, unsigned int nThreads, int verbose);
+void          sbenchCgroupEnd(test_result *res);
+
+#endif // SBENCHCGROUP_H
@@ -0,0 +1,405 @@
+/*
+ * Simple Benchmarks: what else the host was doing while a test ran,
+ * to tell a degraded IaaS from a busy host.
+ *
+ * With "--context" the counters of the host are taken before and
+ * after each test, and every second while it runs on a thread of its
+ * own: the time of the CPUs on /proc/stat (steal is what the hypervisor
+ * gave to other guests), the stall time of /proc/pressure, reclaim and
+ * swap on /proc/vmstat, the device of a disk test on /proc/diskstats
+ * and the TCP and UDP errors of /proc/net/snmp. Their deltas over the
+ * test and the worst second of the shares are added to the result.
+ *
+ * @since 20161027
+ * @author zoquero@gmail.com
+ */
+
+#include <stdio.h>        // fopen, fgets, sscanf
+#include <stdlib.h>       // strtoull
+#include <string.h>       // strncmp, strtok_r
+#include <errno.h>        // ETIMEDOUT
+#include <time.h>         // clock_gettime
+#include <pthread.h>      // pthread_create, pthread_cond_timedwait
+
+#include "sbenchfuncs.h"
+#include "sbenchtime.h"
+#include "sbenchcontext.h"
+
+/** names of the resources of /proc/pressure, indexed by enum contextPsi */
+static const char *contextPsiNames[CTX_PSI_RESOURCES] = {"cpu", "memory", "io"};
+
+/** names of the counters of /proc/vmstat, indexed by enum contextVm,
+    the ones ending in _ are prefixes of counters that are added up */
+static const char *contextVmNames[CTX_VM_COUNTERS] = {"pgmajfault", "pswpin", "pswpout",
+  "pgscan_", "allocstall"};
+
+/** names of the counters of /proc/net/snmp, indexed by enum contextNet */
+static const char *contextNetNames[CTX_NET_COUNTERS][2] = {{"Tcp:", "OutSegs"}, {"Tcp:", "RetransSegs"},
+  {"Tcp:", "InErrs"}, {"Tcp:", "OutRsts"}, {"Udp:", "NoPorts"}, {"Udp:", "InErrors"},
+  {"Udp:", "RcvbufErrors"}};
+
+/** metric of each counter of /proc/net/snmp, indexed by enum contextNet */
+static const char *contextNetMetrics[CTX_NET_COUNTERS] = {"ctx_tcp_out_segs", "ctx_tcp_retrans_segs",
+  "ctx_tcp_in_errs", "ctx_tcp_out_rsts", "ctx_udp_no_ports", "ctx_udp_in_errors", "ctx_udp_rcvbuf_errors"};
+
+static int              contextOn;
+static int              contextVerbose;
+/** the device of the disk test, "" if none */
+static char             device[64];
+static unsigned int     deviceMajor, deviceMinor;
+static context_snapshot before, previous;
+/** worst second while the test ran, in percent */
+static double           peakSteal, peakIowait, peakPsi[CTX_PSI_RESOURCES], peakUtil;
+static pthread_t        watcher;
+static int              stopping;
+static pthread_mutex_t  contextLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   contextWake;
+
+
+static void readCpu(context_snapshot *s) {
+  char  line[512];
+  FILE *f = fopen("/proc/stat", "r");
+
+  if(f == NULL)
+    return;
+  if(fgets(line, sizeof(line), f) != NULL)
+    s->hasCpu = sscanf(line, "cpu %lu %lu %lu %lu %lu %lu %lu %lu",
+                       &s->cpu[CTX_USER], &s->cpu[CTX_NICE], &s->cpu[CTX_SYSTEM], &s->cpu[CTX_IDLE],
+                       &s->cpu[CTX_IOWAIT], &s->cpu[CTX_IRQ], &s->cpu[CTX_SOFTIRQ],
+                       &s->cpu[CTX_STEAL]) == CTX_CPU_STATES;
+  fclose(f);
+}
+
+
+static void readPsi(context_snapshot *s) {
+  char  path[64], line[256];
+  FILE *f;
+
+  for(int r = 0; r < CTX_PSI_RESOURCES; r++) {
+    sprintf(path, "/proc/pressure/%s", contextPsiNames[r]);
+    if((f = fopen(path, "r")) == NULL)
+      continue;
+    while(fgets(line, sizeof(line), f) != NULL) {
+      char *total = strstr(line, "total=");
+      if(total == NULL)
+        continue;
+      if(strncmp(line, "some", 4) == 0) {
+        s->psiSome[r] = strtoull(total + 6, NULL, 10);
+        s->hasPsi[r]  = 1;
+      }
+      else if(strncmp(line, "full", 4) == 0)
+        s->psiFull[r] = strtoull(total + 6, NULL, 10);
+    }
+    fclose(f);
+  }
+}
+
+
+static void readVm(context_snapshot *s) {
+  char  name[64];
+  unsigned long long value;
+  FILE *f = fopen("/proc/vmstat", "r");
+
+  if(f == NULL)
+    return;
+  while(fscanf(f, "%63s %llu", name, &value) == 2) {
+    for(int c = 0; c < CTX_VM_COUNTERS; c++) {
+      // the scans of reclaim, not of khugepaged nor the ones by type
+      if(c == CTX_PGSCAN ? strcmp(name, "pgscan_kswapd") == 0 || strcmp(name, "pgscan_direct") == 0
+                         : strncmp(name, contextVmNames[c], strlen(contextVmNames[c])) == 0)
+        s->vm[c] += value;
+    }
+  }
+  s->hasVm = 1;
+  fclose(f);
+}
+
+
+static void readDisk(context_snapshot *s) {
+  char  line[512];
+  unsigned int maj, min;
+  FILE *f;
+
+  if(device[0] == '\0' || (f = fopen("/proc/diskstats", "r")) == NULL)
+    return;
+  while(fgets(line, sizeof(line), f) != NULL) {
+    unsigned long long v[11];
+    if(sscanf(line, "%u %u %*s %llu %llu %llu %llu %llu %llu %llu %llu %llu %llu %llu",
+              &maj, &min, &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7], &v[8], &v[9], &v[10]) != 13 ||
+       maj != deviceMajor || min != deviceMinor)
+      continue;
+    // reads, merged, sectors, ms, writes, merged, sectors, ms, in flight, io ms, weighted ms
+    s->disk[CTX_READS]         = v[0];
+    s->disk[CTX_READ_SECTORS]  = v[2];
+    s->disk[CTX_READ_MS]       = v[3];
+    s->disk[CTX_WRITES]        = v[4];
+    s->disk[CTX_WRITE_SECTORS] = v[6];
+    s->disk[CTX_WRITE_MS]      = v[7];
+    s->disk[CTX_IO_MS]         = v[9];
+    s->hasDisk = 1;
+    break;
+  }
+  fclose(f);
+}
+
+
+/** the counters of a pair of lines of /proc/net/snmp, names and values */
+static void readNet(context_snapshot *s) {
+  char  names[2048], values[2048], *n, *v, *sn, *sv;
+  FILE *f = fopen("/proc/net/snmp", "r");
+
+  if(f == NULL)
+    return;
+  while(fgets(names, sizeof(names), f) != NULL && fgets(values, sizeof(values), f) != NULL) {
+    char *protocol = strtok_r(names, " \n", &sn);
+    strtok_r(values, " \n", &sv);
+    while(protocol != NULL && (n = strtok_r(NULL, " \n", &sn)) != NULL && (v = strtok_r(NULL, " \n", &sv)) != NULL)
+      for(int c = 0; c < CTX_NET_COUNTERS; c++)
+        if(strcmp(protocol, contextNetNames[c][0]) == 0 && strcmp(n, contextNetNames[c][1]) == 0)
+          s->net[c] = strtoull(v, NULL, 10);
+  }
+  s->hasNet = 1;
+  fclose(f);
+}
+
+
+static void takeSnapshot(context_snapshot *s) {
+  memset(s, 0, sizeof(context_snapshot));
+  s->at = timerRead();
+  readCpu(s);
+  readPsi(s);
+  readVm(s);
+  readDisk(s);
+  readNet(s);
+}
+
+
+/** percent of the time of the CPUs in a state between two snapshots */
+static double cpuShare(context_snapshot *from, context_snapshot *to, enum contextCpu state) {
+  uint64_t total = 0;
+
+  if(! from->hasCpu || ! to->hasCpu)
+    return 0;
+  for(int i = 0; i < CTX_CPU_STATES; i++)
+    total += to->cpu[i] - from->cpu[i];
+  return total > 0 ? 100. * (to->cpu[state] - from->cpu[state]) / total : 0;
+}
+
+
+/** percent of the time that some task stalled on a resource */
+static double psiShare(context_snapshot *from, context_snapshot *to, uint64_t *fromTotal, uint64_t *toTotal) {
+  double seconds = sbenchTimerElapsed(from->at, to->at);
+  return seconds > 0 ? (*toTotal - *fromTotal) / 1E6 / seconds * 100 : 0;
+}
+
+
+/** percent of the time that the device was busy */
+static double diskUtil(context_snapshot *from, context_snapshot *to) {
+  double seconds = sbenchTimerElapsed(from->at, to->at);
+  return from->hasDisk && to->hasDisk && seconds > 0 ? (to->disk[CTX_IO_MS] - from->disk[CTX_IO_MS]) / 1E3 / seconds * 100 : 0;
+}
+
+
+/** the worst second so far of the shares */
+static void updatePeaks(context_snapshot *now) {
+  double v;
+
+  if((v = cpuShare(&previous, now, CTX_STEAL)) > peakSteal)
+    peakSteal = v;
+  if((v = cpuShare(&previous, now, CTX_IOWAIT)) > peakIowait)
+    peakIowait = v;
+  for(int r = 0; r < CTX_PSI_RESOURCES; r++)
+    if(now->hasPsi[r] && (v = psiShare(&previous, now, &previous.psiSome[r], &now->psiSome[r])) > peakPsi[r])
+      peakPsi[r] = v;
+  if((v = diskUtil(&previous, now)) > peakUtil)
+    peakUtil = v;
+  previous = *now;
+}
+
+
+static void *contextRoutine(void *arg) {
+  struct timespec  deadline;
+  context_snapshot now;
+
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+  pthread_mutex_lock(&contextLock);
+  while(! stopping) {
+    deadline.tv_nsec += (CONTEXT_INTERVAL_MS % 1000) * 1000000L;
+    deadline.tv_sec  += CONTEXT_INTERVAL_MS / 1000 + deadline.tv_nsec / 1000000000L;
+    deadline.tv_nsec %= 1000000000L;
+    while(! stopping && pthread_cond_timedwait(&contextWake, &contextLock, &deadline) != ETIMEDOUT)
+      ;
+    if(! stopping) {
+      takeSnapshot(&now);
+      updatePeaks(&now);
+    }
+  }
+  pthread_mutex_unlock(&contextLock);
+  return NULL;
+}
+
+
+/**
+  * Finds the device of a file or of the folder where it will be,
+  * on /proc/diskstats.
+  */
+static void findDevice(const char *path) {
+  char  line[512], name[64];
+  unsigned int maj, min;
+  FILE *f;
+
+  device[0] = '\0';
+  if(! sbenchPathDevice(path, &deviceMajor, &deviceMinor) || (f = fopen("/proc/diskstats", "r")) == NULL)
+    return;
+  while(fgets(line, sizeof(line), f) != NULL)
+    if(sscanf(line, "%u %u %63s", &maj, &min, name) == 3 && maj == deviceMajor && min == deviceMinor) {
+      snprintf(device, sizeof(device), "%s", name);
+      break;
+    }
+  fclose(f);
+}
+
+
+/**
+  * Takes the counters of the host before a test and starts taking
+  * them every second while it runs.
+  * @param path file or folder of a disk test, NULL if it's not one
+  * @return SBENCH_OK or SBENCH_ERR_THREADS, then there's no context
+  */
+int sbenchContextBegin(const char *path, int verbose) {
+  pthread_condattr_t attr;
+
+  contextOn      = 1;
+  contextVerbose = verbose;
+  device[0]      = '\0';
+  if(path != NULL)
+    findDevice(path);
+  if(verbose)
+    printf("Context of the host%s%s\n", device[0] ? ", device " : "", device);
+  peakSteal = peakIowait = peakUtil = 0;
+  memset(peakPsi, 0, sizeof(peakPsi));
+  takeSnapshot(&before);
+  previous = before;
+
+  stopping = 0;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&contextWake, &attr);
+  pthread_condattr_destroy(&attr);
+  if(pthread_create(&watcher, NULL, contextRoutine, NULL) != 0) {
+    pthread_cond_destroy(&contextWake);
+    contextOn = 0;
+    return sbenchFailTest(SBENCH_ERR_THREADS, "Can't create the thread of the context of the host");
+  }
+  return SBENCH_OK;
+}
+
+
+/**
+  * Takes the counters after the test and adds what changed
+  * to its result.
+  */
+void sbenchContextEnd(test_result *res) {
+  context_snapshot after;
+  double user, system, iowait, steal, idle, psi;
+  int    stalls = 0;
+
+  if(! contextOn)
+    return;
+  contextOn = 0;
+  pthread_mutex_lock(&contextLock);
+  stopping = 1;
+  pthread_cond_signal(&contextWake);
+  pthread_mutex_unlock(&contextLock);
+  pthread_join(watcher, NULL);
+  pthread_cond_destroy(&contextWake);
+  takeSnapshot(&after);
+  updatePeaks(&after);
+
+  if(before.hasCpu && after.hasCpu) {
+    user   = cpuShare(&before, &after, CTX_USER) + cpuShare(&before, &after, CTX_NICE);
+    system = cpuShare(&before, &after, CTX_SYSTEM) + cpuShare(&before, &after, CTX_IRQ) +
+             cpuShare(&before, &after, CTX_SOFTIRQ);
+    iowait = cpuShare(&before, &after, CTX_IOWAIT);
+    steal  = cpuShare(&before, &after, CTX_STEAL);
+    idle   = cpuShare(&before, &after, CTX_IDLE);
+    sbenchAddMetric(res, "ctx_cpu_user_pct",        user,       "%");
+    sbenchAddMetric(res, "ctx_cpu_system_pct",      system,     "%");
+    sbenchAddMetric(res, "ctx_cpu_iowait_pct",      iowait,     "%");
+    sbenchAddMetric(res, "ctx_cpu_steal_pct",       steal,      "%");
+    sbenchAddMetric(res, "ctx_cpu_idle_pct",        idle,       "%");
+    sbenchAddMetric(res, "ctx_cpu_iowait_peak_pct", peakIowait, "%");
+    sbenchAddMetric(res, "ctx_cpu_steal_peak_pct",  peakSteal,  "%");
+    sbenchAppendText(res, "context: cpu user %.1f%%;system %.1f%%;iowait %.1f%% (peak %.1f%%);steal %.1f%% (peak %.1f%%);idle %.1f%%\n",
+                     user, system, iowait, peakIowait, steal, peakSteal, idle);
+    if(peakSteal >= CONTEXT_NOTICE_PCT)
+      sbenchAppendText(res, "context: the hypervisor gave up to %.1f%% of the CPUs to other guests (steal)\n", peakSteal);
+  }
+
+  for(int r = 0; r < CTX_PSI_RESOURCES; r++) {
+    char name[48];
+    if(! before.hasPsi[r] || ! after.hasPsi[r])
+      continue;
+    psi = psiShare(&before, &after, &before.psiSome[r], &after.psiSome[r]);
+    sprintf(name, "ctx_psi_%s_some_pct", contextPsiNames[r]);
+    sbenchAddMetric(res, name, psi, "%");
+    // all the tasks stalled at once, the whole cpu has no full
+    if(r != CTX_PSI_CPU) {
+      sprintf(name, "ctx_psi_%s_full_pct", contextPsiNames[r]);
+      sbenchAddMetric(res, name, psiShare(&before, &after, &before.psiFull[r], &after.psiFull[r]), "%");
+    }
+    sprintf(name, "ctx_psi_%s_some_peak_pct", contextPsiNames[r]);
+    sbenchAddMetric(res, name, peakPsi[r], "%");
+    sbenchAppendText(res, "%s%s stalled %.1f%% (peak %.1f%%)", stalls++ == 0 ? "context: pressure " : ";",
+                     contextPsiNames[r], psi, peakPsi[r]);
+  }
+  if(stalls > 0)
+    sbenchAppendText(res, "\n");
+  for(int r = 0; r < CTX_PSI_RESOURCES; r++)
+    if(peakPsi[r] >= CONTEXT_NOTICE_PCT)
+      sbenchAppendText(res, "context: tasks stalled on %s up to %.1f%% of a second\n", contextPsiNames[r], peakPsi[r]);
+
+  if(before.hasVm && after.hasVm) {
+    uint64_t d[CTX_VM_COUNTERS];
+    for(int c = 0; c < CTX_VM_COUNTERS; c++)
+      d[c] = after.vm[c] - before.vm[c];
+    sbenchAddMetric(res, "ctx_pgmajfault", d[CTX_PGMAJFAULT], "c");
+    sbenchAddMetric(res, "ctx_pswpin",     d[CTX_PSWPIN],     "c");
+    sbenchAddMetric(res, "ctx_pswpout",    d[CTX_PSWPOUT],    "c");
+    sbenchAddMetric(res, "ctx_pgscan",     d[CTX_PGSCAN],     "c");
+    sbenchAddMetric(res, "ctx_allocstall", d[CTX_ALLOCSTALL], "c");
+    sbenchAppendText(res, "context: memory %lu major faults;%lu/%lu pages swapped in/out;%lu pages scanned by reclaim;%lu direct reclaims\n",
+                     (unsigned long) d[CTX_PGMAJFAULT], (unsigned long) d[CTX_PSWPIN], (unsigned long) d[CTX_PSWPOUT],
+                     (unsigned long) d[CTX_PGSCAN], (unsigned long) d[CTX_ALLOCSTALL]);
+  }
+
+  if(before.hasDisk && after.hasDisk) {
+    uint64_t reads  = after.disk[CTX_READS]  - before.disk[CTX_READS];
+    uint64_t writes = after.disk[CTX_WRITES] - before.disk[CTX_WRITES];
+    double   await  = reads + writes > 0 ? (double) (after.disk[CTX_READ_MS] - before.disk[CTX_READ_MS] +
+                                           after.disk[CTX_WRITE_MS] - before.disk[CTX_WRITE_MS]) / (reads + writes) : 0;
+    double   util   = diskUtil(&before, &after);
+    sbenchAddLabeledMetric(res, "ctx_disk_reads",       reads, "c", "device", device);
+    sbenchAddLabeledMetric(res, "ctx_disk_writes",      writes, "c", "device", device);
+    sbenchAddLabeledMetric(res, "ctx_disk_read_bytes",  (after.disk[CTX_READ_SECTORS] - before.disk[CTX_READ_SECTORS]) * 512., "B", "device", device);
+    sbenchAddLabeledMetric(res, "ctx_disk_write_bytes", (after.disk[CTX_WRITE_SECTORS] - before.disk[CTX_WRITE_SECTORS]) * 512., "B", "device", device);
+    sbenchAddLabeledMetric(res, "ctx_disk_await_ms",    await, "ms", "device", device);
+    sbenchAddLabeledMetric(res, "ctx_disk_util_pct",    util, "%", "device", device);
+    sbenchAddLabeledMetric(res, "ctx_disk_util_peak_pct", peakUtil, "%", "device", device);
+    sbenchAppendText(res, "context: %s %lu reads, %lu writes;await %.3f ms;util %.1f%% (peak %.1f%%)\n", device,
+                     (unsigned long) reads, (unsigned long) writes, await, util, peakUtil);
+  }
+
+  if(before.hasNet && after.hasNet) {
+    for(int c = 0; c < CTX_NET_COUNTERS; c++)
+      sbenchAddMetric(res, contextNetMetrics[c], after.net[c] - before.net[c], "c");
+    sbenchAppendText(res, "context: tcp %lu segments out, %lu retransmitted, %lu errors in, %lu resets out;udp %lu to closed ports, %lu errors in, %lu receive buffer errors\n",
+                     (unsigned long) (after.net[CTX_TCP_OUT_SEGS] - before.net[CTX_TCP_OUT_SEGS]),
+                     (unsigned long) (after.net[CTX_TCP_RETRANS_SEGS] - before.net[CTX_TCP_RETRANS_SEGS]),
+                     (unsigned long) (after.net[CTX_TCP_IN_ERRS] - before.net[CTX_TCP_IN_ERRS]),
+                     (unsigned long) (after.net[CTX_TCP_OUT_RSTS] - before.net[CTX_TCP_OUT_RSTS]),
+                     (unsigned long) (after.net[CTX_UDP_NO_PORTS] - before.net[CTX_UDP_NO_PORTS]),
+                     (unsigned long) (after.net[CTX_UDP_IN_ERRORS] - before.net[CTX_UDP_IN_ERRORS]),
+                     (unsigned long) (after.net[CTX_UDP_RCVBUF_ERRORS] - before.net[CTX_UDP_RCVBUF_ERRORS]));
+  }
+}
@@ -0,0 +1,58 @@
+/*
+ * Simple Benchmarks: what else the host was doing while a test ran,
+ * to tell a degraded IaaS from a busy host.
+ *
+ * @since 20161027
+ * @author zoquero@gmail.com
+ */
+
+#ifndef SBENCHCONTEXT_H
+#define SBENCHCONTEXT_H
+
+#include <stdint.h>       // uint64_t
+
+#include "sbenchresult.h"  // test_result
+
+#define CONTEXT_INTERVAL_MS  1000 // between the samples taken during the test
+#define CONTEXT_NOTICE_PCT   5    // of steal or stall that is worth a note
+
+/** states of the CPUs on /proc/stat, in its order */
+enum contextCpu {CTX_USER, CTX_NICE, CTX_SYSTEM, CTX_IDLE, CTX_IOWAIT, CTX_IRQ, CTX_SOFTIRQ,
+                 CTX_STEAL, CTX_CPU_STATES};
+
+/** resources of /proc/pressure */
+enum contextPsi {CTX_PSI_CPU, CTX_PSI_MEMORY, CTX_PSI_IO, CTX_PSI_RESOURCES};
+
+/** counters taken from /proc/vmstat */
+enum contextVm {CTX_PGMAJFAULT, CTX_PSWPIN, CTX_PSWPOUT, CTX_PGSCAN, CTX_ALLOCSTALL, CTX_VM_COUNTERS};
+
+/** fields of the device on /proc/diskstats */
+enum contextDisk {CTX_READS, CTX_READ_SECTORS, CTX_READ_MS, CTX_WRITES, CTX_WRITE_SECTORS,
+                  CTX_WRITE_MS, CTX_IO_MS, CTX_DISK_FIELDS};
+
+/** counters taken from /proc/net/snmp */
+enum contextNet {CTX_TCP_OUT_SEGS, CTX_TCP_RETRANS_SEGS, CTX_TCP_IN_ERRS, CTX_TCP_OUT_RSTS,
+                 CTX_UDP_NO_PORTS, CTX_UDP_IN_ERRORS, CTX_UDP_RCVBUF_ERRORS, CTX_NET_COUNTERS};
+
+/** the counters of the host at an instant, the ones that can't be
+    read (an old kernel without PSI, a test without a device) are off */
+typedef struct {
+  uint64_t at;
+  uint64_t cpu[CTX_CPU_STATES];
+  int      hasCpu;
+  /** stall time in us of some and of all the tasks */
+  uint64_t psiSome[CTX_PSI_RESOURCES];
+  uint64_t psiFull[CTX_PSI_RESOURCES];
+  int      hasPsi[CTX_PSI_RESOURCES];
+  uint64_t vm[CTX_VM_COUNTERS];
+  int      hasVm;
+  uint64_t disk[CTX_DISK_FIELDS];
+  int      hasDisk;
+  uint64_t net[CTX_NET_COUNTERS];
+  int      hasNet;
+} context_snapshot;
+
+int  sbenchContextBegin(const char *path, int verbose);
+void sbenchContextEnd(test_result *res);
+
+#endif // SBENCHCONTEXT_H
@@ -0,0 +1,715 @@
+/*
+ * Simple Benchmarks: the same scenario run at once on many hosts,
+ * a coordinator and its agents.
+ *
+ * "sbench --agent (address:)port" waits for coordinators, on the
+ * loopback unless an address is given, forking a child for each one,
+ * so that a test that aborts doesn't end the agent, up to
+ * COORD_MAX_CHILDREN at once.
+ * "sbench --coordinate host:port,... -f scenario" sends the scenario
+ * to the agents and runs its steps on all of them at once:
+ *
+ *   * it estimates the offset of the clock of each agent from its own
+ *     like NTP does, with the fastest of some time exchanges, so that
+ *     the agents don't need synchronized clocks
+ *   * for each step it agrees a start instant a bit in the future, in
+ *     the clock of each agent; the agents sleep until just before it
+ *     and spin on the clock until it comes, and report how late they
+ *     really started
+ *   * it gathers the results of each agent and merges them: min, avg
+ *     and max of each metric over the hosts, the sum of the rates,
+ *     and the latency histograms of the open-loop tests merged into
+ *     the percentiles of the whole fleet
+ *
+ * The protocol is plain text over TCP, one line per message:
+ *
+ *   coordinator              agent
+ *   SBENCH 1 secret     ->
+ *                       <-   SBENCH 1 hostname
+ *   TIME                ->                          (some times)
+ *                       <-   TIME realtimeNs
+ *   SCENARIO bytes      ->                          (and the file)
+ *                       <-   READY nSteps
+ *   START step whenNs   ->                          (for each step)
+ *                       <-   RESULT ... END
+ *   BYE                 ->
+ *
+ * and a result is a RESULT line with its fields separated by tabs,
+ * then SUMMARY, THRESHOLDS, METRIC, HIST, BUCKETS and TEXT lines
+ * until END. The secret is the first line of the "--secret" file of
+ * each side, an agent closes the connection of a coordinator that
+ * doesn't know it. It goes in clear, as the rest of the protocol.
+ *
+ * @since 20161027
+ * @author zoquero@gmail.com
+ */
+
+#include <stdio.h>        // fdopen, fgets, fprintf
+#include <stdlib.h>       // malloc, free, strtod, mkstemp
+#include <limits.h>       // PATH_MAX
+#include <string.h>       // strsep, strdup
+#include <stdint.h>       // int64_t
+#include <errno.h>        // errno
+#include <time.h>         // clock_gettime
+#include <unistd.h>       // fork, close, dup, sleep
+#include <sys/wait.h>     // waitpid
+#include <sys/socket.h>   // socket, connect, accept
+#include <netinet/in.h>   // IPPROTO_TCP
+#include <netinet/tcp.h>  // TCP_NODELAY
+
+#include "sbenchfuncs.h"
+#include "sbenchnet.h"
+#include "sbenchcoord.h"
+
+/* an agent, as seen by the coordinator */
+typedef struct {
+  /* as given, host:port */
+  char    spec[300];
+  int     fd;
+  FILE   *in;
+  FILE   *out;
+  /* hostname of the agent */
+  char    name[256];
+  /* its clock minus ours */
+  int64_t offsetNs;
+  /* of the fastest time exchange, the offset is right within half of it */
+  int64_t rttNs;
+  /* how late it started the current step, in its clock */
+  int64_t lateNs;
+} agent_link;
+
+
+/**
+  * Reads the secret of the coordinator and its agents, the first line
+  * of the file, or aborts.
+  */
+static void readSecret(const char *fileName, char *secret) {
+  FILE *f;
+  char  msg[PATH_MAX + 100];
+
+  if((f = fopen(fileName, "r")) == NULL || fgets(secret, COORD_MAX_SECRET, f) == NULL) {
+    sprintf(msg, "Can't read the secret on %.*s", PATH_MAX, fileName);
+    sbenchMyAbort(msg);
+  }
+  fclose(f);
+  secret[strcspn(secret, "\r\n")] = '\0';
+  if(strlen(secret) < COORD_MIN_SECRET) {
+    sprintf(msg, "The secret on %.*s must have %d characters at least", PATH_MAX, fileName, COORD_MIN_SECRET);
+    sbenchMyAbort(msg);
+  }
+}
+
+
+/**
+  * Compares the secret given by a coordinator with ours in a time that
+  * doesn't tell how much of it was right.
+  */
+static int sameSecret(const char *given, const char *secret) {
+  size_t        n = strlen(secret);
+  unsigned char diff = strlen(given) != n;
+
+  for(size_t i = 0; i < n; i++)
+    diff |= (unsigned char) (given[i] ^ secret[i]) | (given[i] == '\0');
+  return diff == 0;
+}
+
+
+static int64_t realtimeNs() {
+  struct timespec t;
+
+  clock_gettime(CLOCK_REALTIME, &t);
+  return (int64_t) t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+
+/**
+  * Sleeps until COORD_SPIN_NS before the instant and then spins on
+  * the clock until it comes, as waking up from a sleep isn't precise.
+  */
+static void waitUntilRealtime(int64_t when) {
+  int64_t left;
+
+  while((left = when - realtimeNs()) > COORD_SPIN_NS) {
+    struct timespec ts = {(left - COORD_SPIN_NS) / 1000000000LL, (left - COORD_SPIN_NS) % 1000000000LL};
+    nanosleep(&ts, NULL);
+  }
+  while(realtimeNs() < when)
+    ;
+}
+
+
+/** a line without its end, NULL at the end of the connection */
+static char *readLine(FILE *in, char *line) {
+  size_t len;
+
+  if(fgets(line, COORD_MAX_LINE, in) == NULL)
+    return NULL;
+  len = strlen(line);
+  while(len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+    line[--len] = '\0';
+  return line;
+}
+
+
+/** splits a line on its tabs, in place */
+static size_t splitFields(char *line, char **fields, size_t max) {
+  size_t n = 0;
+
+  while(n < max && line != NULL)
+    fields[n++] = strsep(&line, "\t");
+  return n;
+}
+
+
+/** a field, without the tabs and ends of line that would split it */
+static void putField(FILE *out, const char *s) {
+  for(; s != NULL && *s != '\0'; s++)
+    fputc(*s == '\t' || *s == '\n' || *s == '\r' ? ' ' : *s, out);
+}
+
+
+static void sendResult(FILE *out, test_result *res, int nagios, int64_t lateNs) {
+  char *text, *line, *next;
+
+  fprintf(out, "RESULT\t");
+  putField(out, res->step);
+  fputc('\t', out);
+  putField(out, res->test);
+  fputc('\t', out);
+  putField(out, res->name);
+  fputc('\t', out);
+  putField(out, res->params);
+  fprintf(out, "\t%d\t%d\t%lld\t%ld\t", res->status, nagios, (long long) lateNs, (long) res->timestamp);
+  putField(out, res->host);
+  fprintf(out, "\nSUMMARY\t");
+  putField(out, res->summary);
+  fprintf(out, "\nTHRESHOLDS\t%d", res->nWarn);
+  for(int i = 0; i < res->nWarn; i++)
+    fprintf(out, "\t%.17g", res->warn[i]);
+  fprintf(out, "\t%d", res->nCrit);
+  for(int i = 0; i < res->nCrit; i++)
+    fprintf(out, "\t%.17g", res->crit[i]);
+  fputc('\n', out);
+
+  for(size_t i = 0; i < res->nMetrics; i++) {
+    metric *m = &res->metrics[i];
+    fprintf(out, "METRIC\t");
+    putField(out, m->name);
+    fprintf(out, "\t%.17g\t", m->value);
+    putField(out, m->unit);
+    fputc('\t', out);
+    putField(out, m->labelName);
+    fputc('\t', out);
+    putField(out, m->labelValue);
+    fputc('\n', out);
+  }
+  if(res->histogram != NULL) {
+    latencyHistogram *h = res->histogram;
+    // just the buckets with something, as bucket:count
+    int  nBuckets = 0;
+    fprintf(out, "HIST\t%llu\t%llu\t%llu\t%.17g\t%.17g", (unsigned long long) h->total,
+            (unsigned long long) h->min, (unsigned long long) h->max, h->sum, h->sum2);
+    // the buckets with something, as bucket:count, some on each line
+    for(int b = 0; b < HISTOGRAM_BUCKETS; b++)
+      if(h->count[b] > 0)
+        fprintf(out, "%s%d:%llu", nBuckets++ % COORD_BUCKETS_PER_LINE == 0 ? "\nBUCKETS\t" : "\t",
+                b, (unsigned long long) h->count[b]);
+    fputc('\n', out);
+  }
+  if(res->text != NULL && (text = strdup(res->text)) != NULL) {
+    for(next = text; (line = strsep(&next, "\n")) != NULL; ) {
+      if(*line == '\0')
+        continue;
+      fprintf(out, "TEXT\t");
+      putField(out, line);
+      fputc('\n', out);
+    }
+    free(text);
+  }
+  fprintf(out, "END\n");
+  fflush(out);
+}
+
+
+/**
+  * Reads a result sent by sendResult. Its strings are allocated,
+  * freeRemoteResult frees them.
+  * @return 0, -1 if the connection ended or the result is wrong
+  */
+static int readResult(FILE *in, test_result *res, int *nagios, int64_t *lateNs) {
+  char  line[COORD_MAX_LINE], *f[COORD_BUCKETS_PER_LINE + MAX_THRESHOLDS * 2 + 4];
+  size_t n;
+
+  if(readLine(in, line) == NULL || splitFields(line, f, 10) != 10 || strcmp(f[0], "RESULT") != 0)
+    return -1;
+  sbenchInitResult(res, strdup(f[2]), strdup(f[3]), strdup(f[4]));
+  res->step      = strdup(f[1]);
+  res->status    = atoi(f[5]);
+  *nagios        = atoi(f[6]);
+  *lateNs        = atoll(f[7]);
+  res->timestamp = atol(f[8]);
+  snprintf(res->host, sizeof(res->host), "%s", f[9]);
+  if(res->status < EXIT_CODE_OK || res->status > EXIT_CODE_UNKNOWN)
+    res->status = EXIT_CODE_UNKNOWN;
+
+  while(readLine(in, line) != NULL) {
+    if(strcmp(line, "END") == 0)
+      return 0;
+    n = splitFields(line, f, sizeof(f) / sizeof(f[0]));
+    if(strcmp(f[0], "SUMMARY") == 0 && n == 2)
+      snprintf(res->summary, sizeof(res->summary), "%s", f[1]);
+    else if(strcmp(f[0], "THRESHOLDS") == 0 && n >= 3) {
+      size_t c;
+      res->nWarn = atoi(f[1]);
+      if(res->nWarn < 0 || res->nWarn > MAX_THRESHOLDS || n < (size_t) res->nWarn + 3)
+        return -1;
+      for(int i = 0; i < res->nWarn; i++)
+        res->warn[i] = strtod(f[2 + i], NULL);
+      c = 2 + res->nWarn;
+      res->nCrit = atoi(f[c]);
+      if(res->nCrit < 0 || res->nCrit > MAX_THRESHOLDS || n < c + 1 + res->nCrit)
+        return -1;
+      for(int i = 0; i < res->nCrit; i++)
+        res->crit[i] = strtod(f[c + 1 + i], NULL);
+    }
+    else if(strcmp(f[0], "METRIC") == 0 && n == 6)
+      sbenchAddLabeledMetric(res, f[1], strtod(f[2], NULL), f[3], f[4], f[5]);
+    else if(strcmp(f[0], "HIST") == 0 && n == 6) {
+      free(res->histogram);
+      res->histogram = (latencyHistogram *) calloc(1, sizeof(latencyHistogram));
+      if(res->histogram == NULL)
+        sbenchMyAbort("Can't allocate the latency histogram of the result");
+      res->histogram->total = strtoull(f[1], NULL, 10);
+      res->histogram->min   = strtoull(f[2], NULL, 10);
+      res->histogram->max   = strtoull(f[3], NULL, 10);
+      res->histogram->sum   = strtod(f[4], NULL);
+      res->histogram->sum2  = strtod(f[5], NULL);
+    }
+    else if(strcmp(f[0], "BUCKETS") == 0 && res->histogram != NULL)
+      for(size_t i = 1; i < n; i++) {
+        int b;
+        unsigned long long count;
+        if(sscanf(f[i], "%d:%llu", &b, &count) == 2 && b >= 0 && b < HISTOGRAM_BUCKETS)
+          res->histogram->count[b] = count;
+      }
+    else if(strcmp(f[0], "TEXT") == 0 && n == 2)
+      sbenchAppendText(res, "%s\n", f[1]);
+  }
+  return -1;
+}
+
+
+static void freeRemoteResult(test_result *res) {
+  free((char *) res->test);
+  free((char *) res->name);
+  free((char *) res->params);
+  free((char *) res->step);
+  sbenchFreeResult(res);
+}
+
+
+static void setReceiveTimeout(int fd, int seconds) {
+  struct timeval t = {seconds, 0};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &t, sizeof(t));
+}
+
+
+/**
+  * Talks with a coordinator until it says BYE, runs the steps that
+  * it asks for when it says.
+  */
+static void serveCoordinator(int fd, const char *secret, scenario_ops *ops, void *arg, int verbose) {
+  char    line[COORD_MAX_LINE], host[256] = "unknown", path[64], buf[65536];
+  FILE   *in  = fdopen(fd, "r");
+  FILE   *out = fdopen(dup(fd), "w");
+  void   *scenario = NULL;
+  size_t  nSteps = 0, len, step;
+  long long when;
+
+  if(in == NULL || out == NULL)
+    sbenchMyAbort("Can't talk with the coordinator");
+  // one that connects and says nothing doesn't keep the child
+  setReceiveTimeout(fd, COORD_TIMEOUT_S);
+  if(readLine(in, line) == NULL || strncmp(line, COORD_HELLO " ", strlen(COORD_HELLO " ")) != 0 ||
+     !sameSecret(line + strlen(COORD_HELLO " "), secret)) {
+    fprintf(stderr, "Refused a coordinator without the secret\n");
+    fclose(in);
+    fclose(out);
+    return;
+  }
+  // then it waits for the steps and cooldowns of the scenario
+  setReceiveTimeout(fd, 0);
+  gethostname(host, sizeof(host) - 1);
+  fprintf(out, "%s %s\n", COORD_HELLO, host);
+  fflush(out);
+
+  while(readLine(in, line) != NULL) {
+    if(strcmp(line, "TIME") == 0)
+      fprintf(out, "TIME %lld\n", (long long) realtimeNs());
+    else if(sscanf(line, "SCENARIO %zu", &len) == 1 && scenario == NULL) {
+      char tmp[] = "/tmp/sbench-agent-XXXXXX";
+      int  tfd = mkstemp(tmp);
+      if(tfd < 0)
+        sbenchMyAbort("Can't create a file for the scenario of the coordinator");
+      // gone when it's closed, even if the scenario is wrong
+      unlink(tmp);
+      while(len > 0) {
+        size_t r = fread(buf, 1, len < sizeof(buf) ? len : sizeof(buf), in);
+        if(r == 0 || write(tfd, buf, r) != (ssize_t) r)
+          sbenchMyAbort("Can't receive the scenario of the coordinator");
+        len -= r;
+      }
+      snprintf(path, sizeof(path), "/proc/self/fd/%d", tfd);
+      scenario = ops->parse(path, arg, &nSteps);
+      close(tfd);
+      fprintf(out, "READY %zu\n", nSteps);
+    }
+    else if(sscanf(line, "START %zu %lld", &step, &when) == 2 && scenario != NULL && step < nSteps) {
+      test_result res;
+      int64_t late;
+      int     nagios = 0;
+
+      waitUntilRealtime(when);
+      late = realtimeNs() - when;
+      if(verbose)
+        printf("Running step %zu, %lld ns late\n", step, (long long) late);
+      ops->runStep(scenario, step, &res, &nagios);
+      sendResult(out, &res, nagios, late);
+      sbenchFreeResult(&res);
+    }
+    else if(strcmp(line, "BYE") == 0)
+      break;
+    else
+      fprintf(out, "ERROR unknown command\n");
+    fflush(out);
+  }
+  if(scenario != NULL)
+    ops->release(scenario);
+  fclose(in);
+  fclose(out);
+}
+
+
+/**
+  * Waits for coordinators forever, each one on a child process, and
+  * closes the connections beyond COORD_MAX_CHILDREN at once.
+  * @param listen "port" (on the loopback) or "address:port"
+  */
+int sbenchRunAgent(char *listen, const char *secretFile, scenario_ops *ops, void *arg, int verbose) {
+  char secret[COORD_MAX_SECRET];
+  int  fd, children = 0;
+
+  readSecret(secretFile, secret);
+  fd = sbenchListenTcp(listen);
+  if(verbose)
+    printf("Agent waiting for coordinators on %s\n", listen);
+  fflush(stdout);
+  while(1) {
+    int   c = accept(fd, NULL, NULL);
+    pid_t pid;
+    if(c < 0)
+      continue;
+    // the children that ended, no zombies for long
+    while(children > 0 && waitpid(-1, NULL, WNOHANG) > 0)
+      children--;
+    if(children >= COORD_MAX_CHILDREN) {
+      fprintf(stderr, "Refused a coordinator, already serving %d\n", children);
+      close(c);
+      continue;
+    }
+    if((pid = fork()) == 0) {
+      close(fd);
+      serveCoordinator(c, secret, ops, arg, verbose);
+      exit(EXIT_CODE_OK);
+    }
+    if(pid < 0)
+      perror("Can't fork for the coordinator");
+    else
+      children++;
+    close(c);
+  }
+  return EXIT_CODE_OK;
+}
+
+
+/** a line of an agent, or aborts if it's gone */
+static char *agentLine(agent_link *a, char *line) {
+  char msg[400];
+
+  if(readLine(a->in, line) == NULL) {
+    sprintf(msg, "The agent %.256s closed the connection, see its output", a->spec);
+    sbenchMyAbort(msg);
+  }
+  return line;
+}
+
+
+
+
+/**
+  * Connects to an agent and finds out the offset of its clock: the
+  * fastest exchange is the one least disturbed by queues and the
+  * scheduler, and in it the agent read its clock half way.
+  */
+static void connectAgent(agent_link *a, const char *secret) {
+  struct sockaddr_storage addr;
+  socklen_t addrLen;
+  char  host[300], *port, line[COORD_MAX_LINE], msg[600];
+  int   on = 1;
+
+  snprintf(host, sizeof(host), "%s", a->spec);
+  if((port = strrchr(host, ':')) == NULL) {
+    sprintf(msg, "The agent %.256s must be host:port", a->spec);
+    sbenchMyAbort(msg);
+  }
+  *port++ = '\0';
+  // [ipv6]:port
+  if(host[0] == '[' && host[strlen(host) - 1] == ']') {
+    host[strlen(host) - 1] = '\0';
+    memmove(host, host + 1, strlen(host));
+  }
+  if(sbenchResolveAddress(host, port, SOCK_STREAM, &addr, &addrLen) != 0 ||
+     (a->fd = socket(addr.ss_family, SOCK_STREAM, 0)) < 0 ||
+     connect(a->fd, (struct sockaddr *) &addr, addrLen) != 0) {
+    sprintf(msg, "Can't connect to the agent %.256s", a->spec);
+    sbenchMyAbort(msg);
+  }
+  setsockopt(a->fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+  setReceiveTimeout(a->fd, COORD_TIMEOUT_S);
+  a->in  = fdopen(a->fd, "r");
+  a->out = fdopen(dup(a->fd), "w");
+  if(a->in == NULL || a->out == NULL)
+    sbenchMyAbort("Can't talk with the agents");
+
+  fprintf(a->out, "%s %s\n", COORD_HELLO, secret);
+  fflush(a->out);
+  if(readLine(a->in, line) == NULL) {
+    sprintf(msg, "The agent %.256s refused the connection, has it the same secret?", a->spec);
+    sbenchMyAbort(msg);
+  }
+  if(sscanf(line, COORD_HELLO " %255s", a->name) != 1) {
+    sprintf(msg, "%.256s isn't an sbench agent", a->spec);
+    sbenchMyAbort(msg);
+  }
+
+  a->rttNs = INT64_MAX;
+  for(int i = 0; i < COORD_SYNC_ROUNDS; i++) {
+    int64_t t0, t1, t2;
+    long long theirs;
+    t0 = realtimeNs();
+    fprintf(a->out, "TIME\n");
+    fflush(a->out);
+    if(sscanf(agentLine(a, line), "TIME %lld", &theirs) != 1) {
+      sprintf(msg, "Wrong answer of the agent %.256s: %.256s", a->spec, line);
+      sbenchMyAbort(msg);
+    }
+    t2 = realtimeNs();
+    t1 = theirs;
+    if(t2 - t0 < a->rttNs) {
+      a->rttNs    = t2 - t0;
+      a->offsetNs = t1 - (t0 + t2) / 2;
+    }
+  }
+}
+
+
+/**
+  * The result of a step on all the hosts: min, avg and max of each
+  * metric, the sum of the rates, the latency of the whole fleet if
+  * they have histograms, and how far apart they started.
+  */
+static void mergeResults(test_result *hosts, agent_link *agents, size_t n, int64_t maxRttNs, const char *step, test_result *m) {
+  latencyHistogram h;
+  latencyStats     ls;
+  int64_t          earliest = INT64_MAX, latest = INT64_MIN;
+  int              histograms = 1;
+  char             name[64];
+
+  sbenchInitResult(m, strdup(hosts[0].test), strdup(hosts[0].name), strdup(hosts[0].params));
+  m->step = strdup(step);
+  strcpy(m->host, "all");
+  memcpy(m->warn, hosts[0].warn, sizeof(m->warn));
+  memcpy(m->crit, hosts[0].crit, sizeof(m->crit));
+  m->nWarn = hosts[0].nWarn;
+  m->nCrit = hosts[0].nCrit;
+
+  sbenchAddMetric(m, "hosts", n, "");
+  for(size_t k = 0; k < hosts[0].nMetrics; k++) {
+    metric *mk = &hosts[0].metrics[k];
+    double  min = 0, max = 0, sum = 0;
+    size_t  count = 0;
+    for(size_t j = 0; j < n; j++)
+      for(size_t i = 0; i < hosts[j].nMetrics; i++) {
+        metric *mi = &hosts[j].metrics[i];
+        if(strcmp(mi->name, mk->name) != 0 || strcmp(mi->labelValue, mk->labelValue) != 0)
+          continue;
+        if(count == 0 || mi->value < min) min = mi->value;
+        if(count == 0 || mi->value > max) max = mi->value;
+        sum += mi->value;
+        count++;
+        break;
+      }
+    snprintf(name, sizeof(name), "%s_min", mk->name);
+    sbenchAddLabeledMetric(m, name, min, mk->unit, mk->labelName, mk->labelValue);
+    snprintf(name, sizeof(name), "%s_avg", mk->name);
+    sbenchAddLabeledMetric(m, name, sum / count, mk->unit, mk->labelName, mk->labelValue);
+    snprintf(name, sizeof(name), "%s_max", mk->name);
+    sbenchAddLabeledMetric(m, name, max, mk->unit, mk->labelName, mk->labelValue);
+    // what the fleet did together
+    if(strcmp(mk->name, "gbps") == 0 || strcmp(mk->name, "iops") == 0 ||
+       (strlen(mk->name) > 8 && strcmp(mk->name + strlen(mk->name) - 8, "_per_sec") == 0)) {
+      snprintf(name, sizeof(name), "%s_sum", mk->name);
+      sbenchAddLabeledMetric(m, name, sum, mk->unit, mk->labelName, mk->labelValue);
+    }
+  }
+
+  memset(&h, 0, sizeof(h));
+  for(size_t j = 0; j < n; j++) {
+    if(hosts[j].status > m->status)
+      m->status = hosts[j].status;
+    if(hosts[j].histogram == NULL)
+      histograms = 0;
+    else
+      sbenchHistogramMerge(&h, hosts[j].histogram);
+    if(agents[j].lateNs < earliest) earliest = agents[j].lateNs;
+    if(agents[j].lateNs > latest)   latest   = agents[j].lateNs;
+  }
+  sbenchAddMetric(m, "start_skew_ms",        (latest - earliest) / 1E6, "ms");
+  sbenchAddMetric(m, "clock_uncertainty_ms", maxRttNs / 2 / 1E6,       "ms");
+  snprintf(m->summary, sizeof(m->summary), "%zu hosts, started within %.3f ms (+-%.3f)",
+           n, (latest - earliest) / 1E6, maxRttNs / 2 / 1E6);
+  sbenchAppendText(m, "%zu hosts;started within %.3f ms;clock uncertainty %.3f ms\n",
+                   n, (latest - earliest) / 1E6, maxRttNs / 2 / 1E6);
+
+  if(histograms && h.total > 0) {
+    size_t len = strlen(m->summary);
+    sbenchHistogramStats(&h, &ls);
+    sbenchAddMetric(m, "latency_ops",     ls.count, "c");
+    sbenchAddMetric(m, "latency_p50_ms",  ls.p50,   "ms");
+    sbenchAddMetric(m, "latency_p99_ms",  ls.p99,   "ms");
+    sbenchAddMetric(m, "latency_p999_ms", ls.p999,  "ms");
+    sbenchAddMetric(m, "latency_max_ms",  ls.max,   "ms");
+    snprintf(m->summary + len, sizeof(m->summary) - len, ", fleet p99 %.3f ms", ls.p99);
+    sbenchAppendText(m, "fleet latency min/avg/p50/p90/p99/p99.9/max = %.3f/%.3f/%.3f/%.3f/%.3f/%.3f/%.3f ms;%zu ops\n",
+                     ls.min, ls.avg, ls.p50, ls.p90, ls.p99, ls.p999, ls.max, ls.count);
+  }
+}
+
+
+/**
+  * Runs a scenario on the agents at once, step by step, and prints
+  * the result of each step on each host and merged.
+  * @param agents comma-separated list of host:port
+  * @return the worst status
+  */
+int sbenchCoordinate(char *agents, const char *secretFile, const char *scenarioFile, scenario_ops *ops, void *arg,
+                     enum outputFormat format, int verbose) {
+  agent_link  *a;
+  test_result *results;
+  void        *scenario;
+  char        *list, *spec, *next, *content, line[COORD_MAX_LINE], msg[PATH_MAX + 100];
+  char         secret[COORD_MAX_SECRET];
+  size_t       nAgents = 0, nSteps, size, agentSteps, nResults = 0;
+  int64_t      maxRttNs = 0;
+  int          nagios = 0, r;
+  FILE        *f;
+
+  readSecret(secretFile, secret);
+  // wrong scenarios are found here, not on the agents
+  scenario = ops->parse(scenarioFile, arg, &nSteps);
+
+  if((f = fopen(scenarioFile, "r")) == NULL || fseek(f, 0, SEEK_END) != 0 || (long) (size = ftell(f)) < 0) {
+    sprintf(msg, "Can't read the scenario %.*s", PATH_MAX, scenarioFile);
+    sbenchMyAbort(msg);
+  }
+  rewind(f);
+  if((content = (char *) malloc(size + 1)) == NULL || fread(content, 1, size, f) != size)
+    sbenchMyAbort("Can't read the scenario");
+  fclose(f);
+
+  a = (agent_link *) calloc(COORD_MAX_AGENTS, sizeof(agent_link));
+  if(a == NULL || (list = strdup(agents)) == NULL)
+    sbenchMyAbort("Can't allocate the agents");
+  for(next = list; (spec = strsep(&next, ",")) != NULL; ) {
+    if(*spec == '\0')
+      continue;
+    if(nAgents == COORD_MAX_AGENTS) {
+      sprintf(msg, "Up to %d agents", COORD_MAX_AGENTS);
+      sbenchMyAbort(msg);
+    }
+    snprintf(a[nAgents++].spec, sizeof(a[0].spec), "%s", spec);
+  }
+  free(list);
+  if(nAgents == 0)
+    sbenchMyAbort("No agents to coordinate");
+
+  for(size_t i = 0; i < nAgents; i++) {
+    connectAgent(&a[i], secret);
+    if(verbose)
+      printf("Agent %s (%s): clock offset %.3f ms, round trip %.3f ms\n", a[i].spec, a[i].name,
+             a[i].offsetNs / 1E6, a[i].rttNs / 1E6);
+    if(a[i].rttNs > maxRttNs)
+      maxRttNs = a[i].rttNs;
+    fprintf(a[i].out, "SCENARIO %zu\n", size);
+    fwrite(content, 1, size, a[i].out);
+    fflush(a[i].out);
+  }
+  free(content);
+  for(size_t i = 0; i < nAgents; i++) {
+    if(sscanf(agentLine(&a[i], line), "READY %zu", &agentSteps) != 1 || agentSteps != nSteps) {
+      sprintf(msg, "The agent %.256s didn't take the scenario: %.256s", a[i].spec, line);
+      sbenchMyAbort(msg);
+    }
+    // the steps take as long as they take
+    setReceiveTimeout(a[i].fd, 0);
+  }
+
+  results = (test_result *) malloc(nSteps * (nAgents + 1) * sizeof(test_result));
+  if(results == NULL)
+    sbenchMyAbort("Can't allocate the results of the agents");
+  for(size_t step = 0; step < nSteps; step++) {
+    int64_t      start = realtimeNs() + COORD_LEAD_NS + maxRttNs;
+    test_result *hosts = &results[nResults];
+    char        *stepName = NULL;
+
+    for(size_t i = 0; i < nAgents; i++) {
+      fprintf(a[i].out, "START %zu %lld\n", step, (long long) (start + a[i].offsetNs));
+      fflush(a[i].out);
+    }
+    for(size_t i = 0; i < nAgents; i++) {
+      int agentNagios;
+      if(readResult(a[i].in, &hosts[i], &agentNagios, &a[i].lateNs) != 0) {
+        sprintf(msg, "The agent %.256s didn't send the result of step %zu, see its output", a[i].spec, step + 1);
+        sbenchMyAbort(msg);
+      }
+      nagios |= agentNagios;
+      // step@agent, the hosts can have the same name
+      if(stepName == NULL)
+        stepName = strdup(hosts[i].step);
+      snprintf(line, sizeof(line), "%s@%s", hosts[i].step, a[i].spec);
+      free((char *) hosts[i].step);
+      hosts[i].step = strdup(line);
+    }
+    mergeResults(hosts, a, nAgents, maxRttNs, stepName, &results[nResults + nAgents]);
+    free(stepName);
+    nResults += nAgents + 1;
+    if(ops->cooldown(scenario, step) > 0 && step + 1 < nSteps) {
+      if(verbose)
+        printf("Cooling down for %lu s\n", ops->cooldown(scenario, step));
+      sleep(ops->cooldown(scenario, step));
+    }
+  }
+
+  for(size_t i = 0; i < nAgents; i++) {
+    fprintf(a[i].out, "BYE\n");
+    fclose(a[i].out);
+    fclose(a[i].in);
+  }
+  r = sbenchEmitResults(results, nResults, format, nagios);
+  for(size_t i = 0; i < nResults; i++)
+    freeRemoteResult(&results[i]);
+  free(results);
+  free(a);
+  ops->release(scenario);
+  return r;
+}
@@ -0,0 +1,45 @@
+/*
+ * Simple Benchmarks: the same scenario run at once on many hosts,
+ * a coordinator and its agents.
+ *
+ * @since 20161027
+ * @author zoquero@gmail.com
+ */
+
+#ifndef SBENCHCOORD_H
+#define SBENCHCOORD_H
+
+#include <stddef.h>       // size_t
+
+#include "sbenchresult.h"  // test_result, outputFormat
+
+#define COORD_HELLO        "SBENCH 1"
+#define COORD_MAX_SECRET   256
+#define COORD_MIN_SECRET   16
+#define COORD_MAX_AGENTS   64
+#define COORD_SYNC_ROUNDS  16        // time exchanges, the fastest one is kept
+#define COORD_LEAD_NS      500000000 // from the agreement to the start of a step
+#define COORD_SPIN_NS      2000000   // the agents spin the last 2 ms
+#define COORD_TIMEOUT_S    10        // for the answers that don't run a test
+#define COORD_MAX_CHILDREN 4         // coordinators served at once by an agent
+#define COORD_MAX_LINE     8192
+#define COORD_BUCKETS_PER_LINE 64 // of a latency histogram, so that they fit on a line
+
+/** how the coordinator and the agents parse and run a scenario,
+    given by sbench.c as the scenarios are its options */
+typedef struct {
+  /** parses a scenario file, aborting if it's wrong
+      @param arg the argument given to sbenchCoordinate or sbenchRunAgent */
+  void         *(*parse)(const char *fileName, void *arg, size_t *nSteps);
+  /** runs a step, without its cooldown, and fills its result */
+  void          (*runStep)(void *scenario, size_t step, test_result *res, int *nagios);
+  /** seconds to wait after a step */
+  unsigned long (*cooldown)(void *scenario, size_t step);
+  void          (*release)(void *scenario);
+} scenario_ops;
+
+int sbenchRunAgent(char *listen, const char *secretFile, scenario_ops *ops, void *arg, int verbose);
+int sbenchCoordinate(char *agents, const char *secretFile, const char *scenarioFile, scenario_ops *ops, void *arg,
+                     enum outputFormat format, int verbose);
+
+#endif // SBENCHCOORD_H
@@ -0,0 +1,426 @@
+/*
+ * Simple Benchmarks: how the cores talk to each other, the cost of
+ * moving a cache line between two CPUs and of synchronizing threads.
+ *
+ * cpu_c2c pins two threads on each pair of the CPUs that sbench can run
+ * on and ping-pongs a cache line between them: one writes an odd number
+ * on it and spins until the other, spinning on it too, writes the next
+ * even one. A round trip moves the line twice. The pairs run one after
+ * the other, on large machines a sample of them. CPUs of the same core
+ * (SMT) or of the same L3 are much faster than the ones of another
+ * socket, whatever the topology that the hypervisor tells the guest.
+ *
+ * cpu_sync runs 1, 2, 4... threads updating a shared counter through
+ * each primitive for a while and counts their ops/s: atomic increments,
+ * a CAS loop, a pthread mutex, a spinlock, a rwlock (mostly reads) and
+ * a token handed from each thread to the next one with futexes. The
+ * efficiency is how much of one thread alone each one keeps. A token
+ * handed to itself never waits nor wakes, so the handoff starts at 2
+ * threads, and as only one has the token at a time its efficiency is
+ * the handoffs/s of all of them against the ones of 2. Under
+ * virtualization a lock holder whose vCPU is preempted makes the
+ * others wait or spin (pause-loop exits), so they drop far more than
+ * on bare metal.
+ *
+ * @since 20161027
+ * @author zoquero@gmail.com
+ */
+
+#define _GNU_SOURCE       // CPU_SET, pthread_setaffinity_np
+#include <stdio.h>        // printf, snprintf
+#include <stdlib.h>       // calloc, free, rand_r
+#include <string.h>       // memset
+#include <math.h>         // NAN
+#include <pthread.h>      // pthread_setaffinity_np
+#include <sched.h>        // sched_getaffinity
+#include <unistd.h>       // syscall
+#include <sys/syscall.h>  // SYS_futex
+#include <linux/futex.h>  // FUTEX_WAIT_PRIVATE
+
+#include "sbenchfuncs.h"
+#include "sbenchtime.h"
+#include "sbenchpool.h"
+#include "sbenchcores.h"
+
+/** names of the primitives of cpu_sync, indexed by enum syncPrimitive */
+const char *sbenchSyncPrimitiveNames[SYNC_PRIMITIVES] = {"atomic", "cas", "mutex", "spinlock", "rwlock", "futex"};
+
+/** a futex word on a cache line of its own */
+typedef struct {
+  uint32_t word;
+  char     pad[CACHE_LINE_SIZE - sizeof(uint32_t)];
+} __attribute__((aligned(CACHE_LINE_SIZE))) sync_futex;
+
+/* what the threads of cpu_sync fight for, each thing on its own line */
+static c2c_line           syncCounter;
+static pthread_mutex_t    syncMutex __attribute__((aligned(CACHE_LINE_SIZE)));
+static pthread_spinlock_t syncSpin __attribute__((aligned(CACHE_LINE_SIZE)));
+static pthread_rwlock_t   syncRwlock __attribute__((aligned(CACHE_LINE_SIZE)));
+/** futex: the thread whose word is 1 has the token */
+static sync_futex        *syncTurns;
+static volatile int       syncStop __attribute__((aligned(CACHE_LINE_SIZE)));
+
+
+/**
+  * A field of the topology of a CPU as the guest sees it, like
+  * "physical_package_id" or "core_id".
+  * @return -1 if it can't be read
+  */
+int sbenchCpuTopology(int cpu, const char *what) {
+  char  name[128];
+  int   v = -1;
+  FILE *f;
+
+  snprintf(name, sizeof(name), "/sys/devices/system/cpu/cpu%d/topology/%s", cpu, what);
+  if((f = fopen(name, "r")) == NULL)
+    return -1;
+  if(fscanf(f, "%d", &v) != 1)
+    v = -1;
+  fclose(f);
+  return v;
+}
+
+
+/**
+  * Spins until the line has that sequence.
+  * @return 0 if the other thread gave up
+  */
+static inline int c2cWait(c2c_line *line, uint64_t seq) {
+  uint64_t v;
+
+  while((v = __atomic_load_n(&line->seq, __ATOMIC_ACQUIRE)) != seq)
+    if(v == C2C_STOP)
+      return 0;
+  return 1;
+}
+
+
+/**
+  * One of the two threads of a pair. The pool keeps the thread for
+  * other tests, so it's unpinned afterwards.
+  */
+static void *c2cStartupRoutine(void *arg) {
+  c2c_args    *a = (c2c_args *) arg;
+  sched_params p;
+  cpu_set_t    set, old;
+  uint64_t     total = C2C_WARMUP + a->roundTrips, beginning = 0, end;
+
+  pthread_getaffinity_np(pthread_self(), sizeof(old), &old);
+  CPU_ZERO(&set);
+  CPU_SET(a->cpu, &set);
+  if(pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+    sbenchFailTest(SBENCH_ERR_THREADS, "Can't pin a thread on the CPU %d", a->cpu);
+    // don't leave the other one spinning
+    if(a->initiator)
+      __atomic_store_n(&a->line->seq, C2C_STOP, __ATOMIC_RELEASE);
+    else
+      __atomic_store_n(a->ready, -1, __ATOMIC_RELEASE);
+    return NULL;
+  }
+  if(a->realtime == 1)
+    sbenchEnterRealTime(&p);
+
+  if(a->initiator) {
+    while(__atomic_load_n(a->ready, __ATOMIC_ACQUIRE) == 0)
+      ;
+    if(__atomic_load_n(a->ready, __ATOMIC_ACQUIRE) == 1) {
+      for(uint64_t k = 0; k < total; k++) {
+        if(k == C2C_WARMUP)
+          beginning = timerRead();
+        __atomic_store_n(&a->line->seq, 2 * k + 1, __ATOMIC_RELEASE);
+        c2cWait(a->line, 2 * k + 2);
+      }
+      end      = timerRead();
+      a->rttNs = sbenchTimerElapsed(beginning, end) * 1E9 / a->roundTrips;
+    }
+  }
+  else {
+    __atomic_store_n(a->ready, 1, __ATOMIC_RELEASE);
+    for(uint64_t k = 0; k < total; k++) {
+      if(! c2cWait(a->line, 2 * k + 1))
+        break;
+      __atomic_store_n(&a->line->seq, 2 * k + 2, __ATOMIC_RELEASE);
+    }
+  }
+
+  if(a->realtime == 1)
+    sbenchExitRealTime(p);
+  pthread_setaffinity_np(pthread_self(), sizeof(old), &old);
+  return NULL;
+}
+
+
+/**
+  * Round trips of a cache line between each pair of CPUs.
+  * @param roundTrips of each pair
+  * @param maxPairs pairs to measure, a sample of them, 0 == all
+  * @param cr return value, to free with sbenchFreeC2C
+  * @return SBENCH_OK or why it failed
+  */
+int sbenchDoC2CTest(unsigned long roundTrips, unsigned long maxPairs, int verbose, int realtime, c2cResponse *cr) {
+  cpu_set_t     set;
+  c2c_line     *line;
+  c2c_args      args[2];
+  volatile int  ready;
+  unsigned long *pairs, k;
+  unsigned int  n = 0, seed = C2C_SAMPLE_SEED;
+
+  sbenchClearTestFailure();
+  memset(cr, 0, sizeof(*cr));
+  if(roundTrips == 0)
+    return sbenchFailTest(SBENCH_ERR_PARAMS, "cpu_c2c needs the round trips of each pair");
+  if(sched_getaffinity(0, sizeof(set), &set) != 0)
+    return sbenchFailTest(SBENCH_ERR_THREADS, "Can't get the CPUs that sbench can run on");
+  if(CPU_COUNT(&set) < 2)
+    return sbenchFailTest(SBENCH_ERR_PARAMS, "cpu_c2c needs at least 2 CPUs, sbench can run on %d", CPU_COUNT(&set));
+
+  cr->cpus = (int *) calloc(CPU_COUNT(&set), sizeof(int));
+  cr->rtt  = (double *) calloc(CPU_COUNT(&set) * CPU_COUNT(&set), sizeof(double));
+  for(int cpu = 0; cr->cpus != NULL && n < CPU_COUNT(&set); cpu++)
+    if(CPU_ISSET(cpu, &set))
+      cr->cpus[n++] = cpu;
+  cr->nCpus  = n;
+  cr->nPairs = (unsigned long) n * (n - 1) / 2;
+  pairs      = (unsigned long *) malloc(cr->nPairs * sizeof(unsigned long));
+  line       = (c2c_line *) sbenchReusableBuffer(0, sizeof(c2c_line));
+  if(cr->cpus == NULL || cr->rtt == NULL || pairs == NULL || line == NULL) {
+    free(pairs);
+    sbenchFreeC2C(cr);
+    return sbenchFailTest(SBENCH_ERR_MEMORY, "Can't allocate the matrix of %u CPUs", n);
+  }
+
+  // pair k is (i, j), i < j, in order; a sample is a shuffle cut short
+  for(k = 0; k < cr->nPairs; k++)
+    pairs[k] = k;
+  cr->nMeasured = maxPairs > 0 && maxPairs < cr->nPairs ? maxPairs : cr->nPairs;
+  if(cr->nMeasured < cr->nPairs)
+    for(k = 0; k < cr->nMeasured; k++) {
+      unsigned long r = k + rand_r(&seed) % (cr->nPairs - k), t = pairs[k];
+      pairs[k] = pairs[r];
+      pairs[r] = t;
+    }
+  if(verbose)
+    printf("%lu of the %lu pairs of %u CPUs, %lu round trips each\n", cr->nMeasured, cr->nPairs, n, roundTrips);
+
+  for(k = 0; k < cr->nMeasured; k++) {
+    unsigned long rest = pairs[k];
+    unsigned int  i = 0, j;
+    // row i has n - 1 - i pairs
+    while(rest >= n - 1 - i)
+      rest -= n - 1 - i++;
+    j = i + 1 + rest;
+
+    line->seq = 0;
+    ready     = 0;
+    for(int t = 0; t < 2; t++) {
+      args[t].roundTrips = roundTrips;
+      args[t].cpu        = cr->cpus[t == 0 ? i : j];
+      args[t].initiator  = t == 0;
+      args[t].line       = line;
+      args[t].ready      = &ready;
+      args[t].realtime   = realtime;
+      args[t].rttNs      = 0;
+    }
+    if(sbenchRunOnThreads(c2cStartupRoutine, args, sizeof(c2c_args), 2) != SBENCH_OK || sbenchTestFailure() != SBENCH_OK) {
+      free(pairs);
+      sbenchFreeC2C(cr);
+      return sbenchTestFailure();
+    }
+    cr->rtt[i * n + j] = cr->rtt[j * n + i] = args[0].rttNs;
+    if(verbose)
+      printf("cpu %d - cpu %d: %.1f ns\n", cr->cpus[i], cr->cpus[j], args[0].rttNs);
+  }
+  free(pairs);
+  return SBENCH_OK;
+}
+
+
+void sbenchFreeC2C(c2cResponse *cr) {
+  free(cr->cpus);
+  free(cr->rtt);
+  cr->cpus = NULL;
+  cr->rtt  = NULL;
+}
+
+
+/**
+  * Hands the token of the futex handoff to a thread.
+  */
+static inline void syncPass(unsigned int to, unsigned int from) {
+  __atomic_store_n(&syncTurns[to].word, 1, __ATOMIC_RELEASE);
+  if(to != from)
+    syscall(SYS_futex, &syncTurns[to].word, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+
+/**
+  * The futex handoff: waits for the token, counts, and hands it to the
+  * next thread. The one that sees the time over stops, and each thread
+  * still hands the token on when stopping so that none is left waiting.
+  */
+static uint64_t syncHandoff(sync_args *a, uint64_t beginning) {
+  unsigned int me = a->threadNumber, next = (me + 1) % a->nThreads;
+  uint64_t     ops = 0;
+
+  for(;;) {
+    while(__atomic_load_n(&syncTurns[me].word, __ATOMIC_ACQUIRE) == 0)
+      syscall(SYS_futex, &syncTurns[me].word, FUTEX_WAIT_PRIVATE, 0, NULL, NULL, 0);
+    syncTurns[me].word = 0;
+    if(syncStop) {
+      syncPass(next, me);
+      return ops;
+    }
+    syncCounter.seq++;
+    ops++;
+    if(sbenchTimerElapsed(beginning, timerRead()) >= a->seconds)
+      syncStop = 1;
+    syncPass(next, me);
+  }
+}
+
+
+/**
+  * A thread of cpu_sync, updating the shared counter through its
+  * primitive until its time is over.
+  */
+static void *syncStartupRoutine(void *arg) {
+  sync_args   *a = (sync_args *) arg;
+  sched_params p;
+  uint64_t     beginning, ops = 0, v;
+  int          b;
+
+  if(a->realtime == 1)
+    sbenchEnterRealTime(&p);
+  beginning = timerRead();
+  if(a->primitive == SYNC_FUTEX)
+    ops = syncHandoff(a, beginning);
+  else do {
+    // the time is checked once on each batch, it'd cost like an op
+    for(b = 0; b < SYNC_BATCH; b++)
+      switch(a->primitive) {
+        case SYNC_ATOMIC:
+          __atomic_fetch_add(&syncCounter.seq, 1, __ATOMIC_SEQ_CST);
+          break;
+        case SYNC_CAS:
+          v = __atomic_load_n(&syncCounter.seq, __ATOMIC_RELAXED);
+          while(! __atomic_compare_exchange_n(&syncCounter.seq, &v, v + 1, 1, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+            ;
+          break;
+        case SYNC_MUTEX:
+          pthread_mutex_lock(&syncMutex);
+          syncCounter.seq++;
+          pthread_mutex_unlock(&syncMutex);
+          break;
+        case SYNC_SPINLOCK:
+          pthread_spin_lock(&syncSpin);
+          syncCounter.seq++;
+          pthread_spin_unlock(&syncSpin);
+          break;
+        default: // SYNC_RWLOCK
+          if((b & (SYNC_RWLOCK_WRITES - 1)) == 0) {
+            pthread_rwlock_wrlock(&syncRwlock);
+            syncCounter.seq++;
+          }
+          else {
+            pthread_rwlock_rdlock(&syncRwlock);
+            v = *(volatile uint64_t *) &syncCounter.seq;
+          }
+          pthread_rwlock_unlock(&syncRwlock);
+      }
+    ops += SYNC_BATCH;
+  } while(sbenchTimerElapsed(beginning, timerRead()) < a->seconds);
+  a->delta = sbenchTimerElapsed(beginning, timerRead());
+  a->ops   = ops;
+
+  if(a->realtime == 1)
+    sbenchExitRealTime(p);
+  return NULL;
+}
+
+
+/**
+  * Ops/s of each synchronization primitive as the threads that use it
+  * at once grow: 1, 2, 4... up to maxThreads.
+  * @param maxThreads 0 == the CPUs that sbench can run on
+  * @param sr return value
+  * @return SBENCH_OK or why it failed
+  */
+int sbenchDoSyncTest(unsigned long msPerStep, unsigned int maxThreads, int verbose, int realtime, syncResponse *sr) {
+  cpu_set_t  set;
+  sync_args *args;
+  int        cpus;
+
+  sbenchClearTestFailure();
+  memset(sr, 0, sizeof(*sr));
+  if(msPerStep == 0)
+    return sbenchFailTest(SBENCH_ERR_PARAMS, "cpu_sync needs the ms of each step");
+  cpus = sched_getaffinity(0, sizeof(set), &set) == 0 ? CPU_COUNT(&set) : 1;
+  if(maxThreads == 0)
+    maxThreads = cpus;
+  // a spinning SCHED_FIFO thread never lets a preempted holder on its CPU run
+  if(realtime && maxThreads > cpus)
+    return sbenchFailTest(SBENCH_ERR_PARAMS, "With -r cpu_sync can't have more threads (%u) than CPUs (%d)", maxThreads, cpus);
+  for(unsigned int n = 1; n < maxThreads && sr->nSteps < SYNC_MAX_STEPS - 1; n *= 2)
+    sr->threads[sr->nSteps++] = n;
+  sr->threads[sr->nSteps++] = maxThreads;
+
+  args      = (sync_args *) calloc(maxThreads, sizeof(sync_args));
+  syncTurns = (sync_futex *) sbenchReusableBuffer(0, maxThreads * sizeof(sync_futex));
+  if(args == NULL || syncTurns == NULL) {
+    free(args);
+    return sbenchFailTest(SBENCH_ERR_MEMORY, "Can't allocate the arguments of %u threads", maxThreads);
+  }
+  pthread_mutex_init(&syncMutex, NULL);
+  pthread_spin_init(&syncSpin, PTHREAD_PROCESS_PRIVATE);
+  pthread_rwlock_init(&syncRwlock, NULL);
+  if(verbose)
+    printf("%d primitives with %u to %u threads, %lu ms each\n", SYNC_PRIMITIVES, sr->threads[0], maxThreads, msPerStep);
+
+  for(int s = 0; s < sr->nSteps; s++) {
+    unsigned int n = sr->threads[s];
+    for(int prim = 0; prim < SYNC_PRIMITIVES; prim++) {
+      uint64_t total = 0;
+      double   longest = 0;
+      if(prim == SYNC_FUTEX && n == 1) {
+        sr->opsPerSec[prim][s] = sr->efficiency[prim][s] = NAN;
+        continue;
+      }
+      syncCounter.seq = 0;
+      syncStop        = 0;
+      memset(syncTurns, 0, n * sizeof(sync_futex));
+      syncTurns[0].word = 1;
+      for(unsigned int i = 0; i < n; i++) {
+        args[i].primitive    = prim;
+        args[i].threadNumber = i;
+        args[i].nThreads     = n;
+        args[i].seconds      = msPerStep / 1000.;
+        args[i].realtime     = realtime;
+        args[i].ops          = 0;
+        args[i].delta        = 0;
+      }
+      if(sbenchRunOnThreads(syncStartupRoutine, args, sizeof(sync_args), n) != SBENCH_OK) {
+        free(args);
+        return sbenchTestFailure();
+      }
+      for(unsigned int i = 0; i < n; i++) {
+        total += args[i].ops;
+        if(args[i].delta > longest)
+          longest = args[i].delta;
+      }
+      sr->opsPerSec[prim][s]  = longest > 0 ? total / longest : 0;
+      if(prim == SYNC_FUTEX)
+        sr->efficiency[prim][s] = sr->opsPerSec[prim][1] > 0 ? sr->opsPerSec[prim][s] / sr->opsPerSec[prim][1] * 100 : 0;
+      else
+        sr->efficiency[prim][s] = sr->opsPerSec[prim][0] > 0 ?
+                                  sr->opsPerSec[prim][s] / (n * sr->opsPerSec[prim][0]) * 100 : 0;
+      if(verbose)
+        printf("%s with %u threads: %.0f ops/s, %.1f%%\n", sbenchSyncPrimitiveNames[prim], n,
+               sr->opsPerSec[prim][s], sr->efficiency[prim][s]);
+    }
+  }
+  pthread_mutex_destroy(&syncMutex);
+  pthread_spin_destroy(&syncSpin);
+  pthread_rwlock_destroy(&syncRwlock);
+  free(args);
+  return SBENCH_OK;
+}
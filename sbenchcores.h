@@ -0,0 +1,89 @@
+/*
+ * Simple Benchmarks: how the cores talk to each other, the cost of
+ * moving a cache line between two CPUs and of synchronizing threads.
+ *
+ * @since 20161027
+ * @author zoquero@gmail.com
+ */
+
+#ifndef SBENCHCORES_H
+#define SBENCHCORES_H
+
+#include <stdint.h>       // uint64_t
+
+#define CACHE_LINE_SIZE    64
+#define C2C_WARMUP         1000 // round trips before timing each pair
+#define C2C_STOP           UINT64_MAX // on the line, the other thread gave up
+#define C2C_MAX_NOTES      8    // of pairs that don't match the topology of the guest
+#define C2C_SAMPLE_SEED    20161027 // the pairs sampled are the same on each run
+
+#define SYNC_BATCH         256  // ops of cpu_sync between the checks of the time
+#define SYNC_RWLOCK_WRITES 16   // rwlock: one write each, the rest reads
+#define SYNC_MAX_STEPS     32   // thread counts of cpu_sync
+
+/** primitives of cpu_sync */
+enum syncPrimitive {SYNC_ATOMIC, SYNC_CAS, SYNC_MUTEX, SYNC_SPINLOCK, SYNC_RWLOCK, SYNC_FUTEX, SYNC_PRIMITIVES};
+
+extern const char *sbenchSyncPrimitiveNames[SYNC_PRIMITIVES];
+
+/** a cache line on its own, with the sequence of the ping-pong */
+typedef struct {
+  uint64_t seq;
+  char     pad[CACHE_LINE_SIZE - sizeof(uint64_t)];
+} __attribute__((aligned(CACHE_LINE_SIZE))) c2c_line;
+
+/* arguments and results of each of the two threads of a pair */
+typedef struct {
+  unsigned long roundTrips;
+  int           cpu;
+  /** 1 on the one that starts each round trip and times them */
+  int           initiator;
+  c2c_line     *line;
+  /** 1 when the responder is pinned and waiting, -1 if it can't be */
+  volatile int *ready;
+  int           realtime;
+  /** return value, average round trip in ns, on the initiator */
+  double        rttNs;
+} c2c_args;
+
+/** cpu_c2c response */
+typedef struct {
+  /** CPUs that sbench can run on */
+  unsigned int  nCpus;
+  int          *cpus;
+  /** nCpus x nCpus round trips in ns, symmetric, 0 == not measured */
+  double       *rtt;
+  unsigned long nPairs;
+  unsigned long nMeasured;
+} c2cResponse;
+
+/* arguments and results of each thread of cpu_sync */
+typedef struct {
+  enum syncPrimitive primitive;
+  unsigned int  threadNumber;
+  unsigned int  nThreads;
+  double        seconds;
+  int           realtime;
+  /** return values */
+  uint64_t      ops;
+  double        delta;
+} sync_args;
+
+/** cpu_sync response */
+typedef struct {
+  unsigned int nSteps;
+  /** threads of each step: 1, 2, 4... and the maximum */
+  unsigned int threads[SYNC_MAX_STEPS];
+  /** NAN on the futex handoff with 1 thread, that hands nothing */
+  double       opsPerSec[SYNC_PRIMITIVES][SYNC_MAX_STEPS];
+  /** ops/s of each thread against the ones of one thread alone, in percent;
+      of the futex handoff its handoffs/s against the ones of 2 threads */
+  double       efficiency[SYNC_PRIMITIVES][SYNC_MAX_STEPS];
+} syncResponse;
+
+int sbenchDoC2CTest(unsigned long roundTrips, unsigned long maxPairs, int verbose, int realtime, c2cResponse *cr);
+void sbenchFreeC2C(c2cResponse *cr);
+int sbenchCpuTopology(int cpu, const char *what);
+int sbenchDoSyncTest(unsigned long msPerStep, unsigned int maxThreads, int verbose, int realtime, syncResponse *sr);
+
+#endif // SBENCHCORES_H
@@ -0,0 +1,566 @@
+/*
+ * Simple Benchmarks: daemon that runs light probes on intervals and
+ * serves the aggregates of their recent results.
+ *
+ * A one-shot check every five minutes misses the degradations that
+ * last less than that, and forking a test for each sample costs more
+ * than the sample. The daemon runs each probe (a small test, like a
+ * cpu quantum, a fsync'ed write or a ping) on its own interval, keeps
+ * the last results of all of them in a fixed-size ring and serves,
+ * while the next probes run:
+ *
+ *   * a unix socket: "metrics" (or an empty line) for OpenMetrics,
+ *     "samples" for the samples of the ring, one per line
+ *   * an HTTP endpoint: GET /metrics for OpenMetrics, to be scraped
+ *
+ * The OpenMetrics are the last, min, avg and max of each metric of a
+ * probe over its samples in the ring, the runs of each probe by status,
+ * its last status and when and how long it last ran.
+ *
+ * The probes run one at a time on the main thread, so that they don't
+ * disturb each other, and a thread serves the endpoints.
+ *
+ * @since 20161027
+ * @author zoquero@gmail.com
+ */
+
+#include <stdio.h>        // fprintf, open_memstream
+#include <stdlib.h>       // malloc, calloc, free
+#include <string.h>       // strcmp, strncpy
+#include <math.h>         // NAN, isnan
+#include <errno.h>        // errno
+#include <signal.h>       // sigaction
+#include <pthread.h>      // pthread_create, pthread_mutex_t
+#include <poll.h>         // poll
+#include <unistd.h>       // close, unlink, gethostname
+#include <sys/socket.h>   // socket, bind, listen, accept
+#include <sys/un.h>       // sockaddr_un
+
+#include "sbenchfuncs.h"
+#include "sbenchnet.h"
+#include "sbenchtime.h"
+#include "sbenchdaemon.h"
+
+/* a run of a probe */
+typedef struct {
+  size_t probe;
+  time_t timestamp;
+  int    status;
+  /* seconds that the run took */
+  double duration;
+  /* indexed like the metrics of the probe, NAN if the run hadn't it */
+  double value[DAEMON_MAX_METRICS];
+} daemon_sample;
+
+/* what is known about a probe since the daemon started */
+typedef struct {
+  const char   *test;
+  char          host[256];
+  /* the metrics that its runs had, their values aren't used */
+  metric        metrics[DAEMON_MAX_METRICS];
+  size_t        nMetrics;
+  /* runs by status */
+  unsigned long runs[4];
+  int           lastStatus;
+  time_t        lastRun;
+  double        lastDuration;
+  double        nextDue;
+} probe_state;
+
+static daemon_probe   *probes;
+static probe_state    *states;
+static size_t          nProbes;
+static daemon_sample  *ring;
+static size_t          ringSize;
+/* next slot to write and samples in the ring */
+static size_t          ringNext, ringCount;
+static pthread_mutex_t ringLock = PTHREAD_MUTEX_INITIALIZER;
+static volatile sig_atomic_t stopping;
+
+
+static void stopDaemon(int signum) {
+  stopping = 1;
+}
+
+
+/**
+  * Keeps a run of a probe on the ring, overwriting the oldest one
+  * if it's full.
+  */
+static void recordSample(size_t p, test_result *res, double duration) {
+  probe_state   *s;
+  daemon_sample *d;
+
+  pthread_mutex_lock(&ringLock);
+  s = &states[p];
+  d = &ring[ringNext];
+  d->probe     = p;
+  d->timestamp = res->timestamp;
+  d->status    = res->status;
+  d->duration  = duration;
+  for(size_t k = 0; k < DAEMON_MAX_METRICS; k++)
+    d->value[k] = NAN;
+  for(size_t i = 0; i < res->nMetrics; i++) {
+    metric *m = &res->metrics[i];
+    size_t  k;
+    for(k = 0; k < s->nMetrics; k++)
+      if(strcmp(s->metrics[k].name, m->name) == 0 && strcmp(s->metrics[k].labelValue, m->labelValue) == 0)
+        break;
+    if(k == s->nMetrics) {
+      if(k == DAEMON_MAX_METRICS)
+        continue;
+      memcpy(&s->metrics[k], m, sizeof(metric));
+      s->nMetrics++;
+    }
+    d->value[k] = m->value;
+  }
+  ringNext = (ringNext + 1) % ringSize;
+  if(ringCount < ringSize)
+    ringCount++;
+
+  s->test = res->test;
+  snprintf(s->host, sizeof(s->host), "%s", res->host);
+  s->runs[res->status]++;
+  s->lastStatus   = res->status;
+  s->lastRun      = res->timestamp;
+  s->lastDuration = duration;
+  pthread_mutex_unlock(&ringLock);
+}
+
+
+static void writeLabelValue(FILE *out, const char *s) {
+  fputc('"', out);
+  for(; s != NULL && *s != '\0'; s++) {
+    if(*s == '"' || *s == '\\')
+      fprintf(out, "\\%c", *s);
+    else if(*s == '\n')
+      fprintf(out, "\\n");
+    else
+      fputc(*s, out);
+  }
+  fputc('"', out);
+}
+
+
+/* like the metrics of a one-shot test, sbench_<test>_<name> */
+static void writeMetricName(FILE *out, const char *test, const char *name) {
+  fprintf(out, "sbench_%s_", test);
+  for(; *name != '\0'; name++) {
+    if((*name >= 'a' && *name <= 'z') || (*name >= 'A' && *name <= 'Z') ||
+       (*name >= '0' && *name <= '9') || *name == '_')
+      fputc(*name, out);
+    else
+      fputc('_', out);
+  }
+}
+
+
+/* with one more label if extraName isn't NULL */
+static void writeProbeLabels(FILE *out, size_t p, metric *m, const char *extraName, const char *extraValue) {
+  fprintf(out, "{host=");
+  writeLabelValue(out, states[p].host);
+  fprintf(out, ",probe=");
+  writeLabelValue(out, probes[p].name);
+  if(m != NULL && m->labelName[0] != '\0') {
+    fprintf(out, ",%s=", m->labelName);
+    writeLabelValue(out, m->labelValue);
+  }
+  if(extraName != NULL)
+    fprintf(out, ",%s=\"%s\"", extraName, extraValue);
+  fputc('}', out);
+}
+
+
+/**
+  * OpenMetrics of the probes: their runs and, for each metric, its
+  * last, min, avg and max over the samples of the probe in the ring.
+  * The probes of the same test are in the same metric families.
+  */
+static void writeOpenMetrics(FILE *out) {
+  static const char *statNames[] = {"last", "min", "avg", "max"};
+  double *last, *min, *sum, *max;
+  size_t *n, *samples;
+
+  pthread_mutex_lock(&ringLock);
+  last    = (double *) malloc(nProbes * DAEMON_MAX_METRICS * sizeof(double));
+  min     = (double *) malloc(nProbes * DAEMON_MAX_METRICS * sizeof(double));
+  sum     = (double *) calloc(nProbes * DAEMON_MAX_METRICS, sizeof(double));
+  max     = (double *) malloc(nProbes * DAEMON_MAX_METRICS * sizeof(double));
+  n       = (size_t *) calloc(nProbes * DAEMON_MAX_METRICS, sizeof(size_t));
+  samples = (size_t *) calloc(nProbes, sizeof(size_t));
+  if(last == NULL || min == NULL || sum == NULL || max == NULL || n == NULL || samples == NULL)
+    sbenchMyAbort("Can't allocate the aggregates of the daemon");
+
+  // from the oldest to the newest
+  for(size_t i = 0; i < ringCount; i++) {
+    daemon_sample *d = &ring[(ringNext + ringSize - ringCount + i) % ringSize];
+    samples[d->probe]++;
+    for(size_t k = 0; k < states[d->probe].nMetrics; k++) {
+      size_t a = d->probe * DAEMON_MAX_METRICS + k;
+      double v = d->value[k];
+      if(isnan(v))
+        continue;
+      if(n[a] == 0 || v < min[a]) min[a] = v;
+      if(n[a] == 0 || v > max[a]) max[a] = v;
+      last[a] = v;
+      sum[a] += v;
+      n[a]++;
+    }
+  }
+
+  fprintf(out, "# TYPE sbench_probe_runs counter\n");
+  for(size_t p = 0; p < nProbes; p++)
+    for(int status = EXIT_CODE_OK; status <= EXIT_CODE_UNKNOWN; status++) {
+      fprintf(out, "sbench_probe_runs_total");
+      writeProbeLabels(out, p, NULL, "status", sbenchStatusNames[status]);
+      fprintf(out, " %lu\n", states[p].runs[status]);
+    }
+  fprintf(out, "# TYPE sbench_probe_samples gauge\n");
+  for(size_t p = 0; p < nProbes; p++) {
+    fprintf(out, "sbench_probe_samples");
+    writeProbeLabels(out, p, NULL, NULL, NULL);
+    fprintf(out, " %zu\n", samples[p]);
+  }
+  fprintf(out, "# TYPE sbench_probe_status gauge\n");
+  for(size_t p = 0; p < nProbes; p++) {
+    if(states[p].lastRun == 0)
+      continue;
+    fprintf(out, "sbench_probe_status");
+    writeProbeLabels(out, p, NULL, NULL, NULL);
+    fprintf(out, " %d\n", states[p].lastStatus);
+  }
+  fprintf(out, "# TYPE sbench_probe_last_run_timestamp_seconds gauge\n");
+  for(size_t p = 0; p < nProbes; p++) {
+    if(states[p].lastRun == 0)
+      continue;
+    fprintf(out, "sbench_probe_last_run_timestamp_seconds");
+    writeProbeLabels(out, p, NULL, NULL, NULL);
+    fprintf(out, " %ld\n", (long) states[p].lastRun);
+  }
+  fprintf(out, "# TYPE sbench_probe_duration_seconds gauge\n");
+  for(size_t p = 0; p < nProbes; p++) {
+    if(states[p].lastRun == 0)
+      continue;
+    fprintf(out, "sbench_probe_duration_seconds");
+    writeProbeLabels(out, p, NULL, NULL, NULL);
+    fprintf(out, " %.9g\n", states[p].lastDuration);
+  }
+
+  for(size_t p = 0; p < nProbes; p++) {
+    for(size_t k = 0; k < states[p].nMetrics; k++) {
+      const char *name = states[p].metrics[k].name;
+      int seen = 0;
+      for(size_t q = 0; q <= p && ! seen; q++) {
+        if(states[q].test == NULL || strcmp(states[q].test, states[p].test) != 0)
+          continue;
+        for(size_t j = 0; j < (q == p ? k : states[q].nMetrics) && ! seen; j++)
+          seen = strcmp(states[q].metrics[j].name, name) == 0;
+      }
+      if(seen)
+        continue;
+
+      fprintf(out, "# TYPE ");
+      writeMetricName(out, states[p].test, name);
+      fprintf(out, " gauge\n");
+      for(size_t q = p; q < nProbes; q++) {
+        if(states[q].lastRun == 0 || strcmp(states[q].test, states[p].test) != 0)
+          continue;
+        for(size_t j = q == p ? k : 0; j < states[q].nMetrics; j++) {
+          size_t a = q * DAEMON_MAX_METRICS + j;
+          double v[4];
+          if(strcmp(states[q].metrics[j].name, name) != 0 || n[a] == 0)
+            continue;
+          v[0] = last[a]; v[1] = min[a]; v[2] = sum[a] / n[a]; v[3] = max[a];
+          for(int stat = 0; stat < 4; stat++) {
+            writeMetricName(out, states[q].test, name);
+            writeProbeLabels(out, q, &states[q].metrics[j], "stat", statNames[stat]);
+            fprintf(out, " %.9g\n", v[stat]);
+          }
+        }
+      }
+    }
+  }
+  fprintf(out, "# EOF\n");
+  pthread_mutex_unlock(&ringLock);
+
+  free(last); free(min); free(sum); free(max); free(n); free(samples);
+}
+
+
+/**
+  * The samples of the ring, from the oldest to the newest, one per line:
+  * timestamp probe status duration metric=value...
+  */
+static void writeSamples(FILE *out) {
+  pthread_mutex_lock(&ringLock);
+  for(size_t i = 0; i < ringCount; i++) {
+    daemon_sample *d = &ring[(ringNext + ringSize - ringCount + i) % ringSize];
+    probe_state   *s = &states[d->probe];
+    fprintf(out, "%ld %s %s %.6f", (long) d->timestamp, probes[d->probe].name,
+            sbenchStatusNames[d->status], d->duration);
+    for(size_t k = 0; k < s->nMetrics; k++) {
+      if(isnan(d->value[k]))
+        continue;
+      if(s->metrics[k].labelValue[0] != '\0')
+        fprintf(out, " %s_%s=%.9g", s->metrics[k].labelValue, s->metrics[k].name, d->value[k]);
+      else
+        fprintf(out, " %s=%.9g", s->metrics[k].name, d->value[k]);
+    }
+    fputc('\n', out);
+  }
+  pthread_mutex_unlock(&ringLock);
+}
+
+
+static int sendAll(int fd, const char *buf, size_t len) {
+  while(len > 0) {
+    ssize_t w = send(fd, buf, len, MSG_NOSIGNAL);
+    if(w < 0 && errno == EINTR)
+      continue;
+    if(w <= 0)
+      return -1;
+    buf += w;
+    len -= w;
+  }
+  return 0;
+}
+
+
+/**
+  * Reads a request until its end mark or until it's DAEMON_MAX_REQUEST
+  * long, a slow or silent client gives up after 2 seconds.
+  */
+static void readRequest(int fd, char *buf, const char *endMark) {
+  struct timeval timeout = {2, 0};
+  size_t len = 0;
+
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  buf[0] = '\0';
+  while(len < DAEMON_MAX_REQUEST - 1 && strstr(buf, endMark) == NULL) {
+    ssize_t r = recv(fd, buf + len, DAEMON_MAX_REQUEST - 1 - len, 0);
+    if(r < 0 && errno == EINTR)
+      continue;
+    if(r <= 0)
+      break;
+    len += r;
+    buf[len] = '\0';
+  }
+}
+
+
+/**
+  * A unix socket client: a command line and its answer.
+  */
+static void serveUnixClient(int fd) {
+  char   request[DAEMON_MAX_REQUEST];
+  char  *body = NULL;
+  size_t bodyLen = 0;
+  FILE  *out;
+
+  readRequest(fd, request, "\n");
+  if((out = open_memstream(&body, &bodyLen)) == NULL)
+    return;
+  if(strncmp(request, "samples", 7) == 0)
+    writeSamples(out);
+  else if(request[0] == '\0' || request[0] == '\n' || strncmp(request, "metrics", 7) == 0)
+    writeOpenMetrics(out);
+  else
+    fprintf(out, "Unknown command, use \"metrics\" or \"samples\"\n");
+  fclose(out);
+  sendAll(fd, body, bodyLen);
+  free(body);
+}
+
+
+/**
+  * An HTTP client: GET /metrics, HTTP/1.0 style, closing after it.
+  */
+static void serveHttpClient(int fd) {
+  char   request[DAEMON_MAX_REQUEST], header[256];
+  char   method[16] = "", path[256] = "";
+  char  *body = NULL;
+  size_t bodyLen = 0;
+  FILE  *out;
+  const char *status = "200 OK", *type = "application/openmetrics-text; version=1.0.0; charset=utf-8";
+
+  readRequest(fd, request, "\r\n\r\n");
+  sscanf(request, "%15s %255s", method, path);
+  if((out = open_memstream(&body, &bodyLen)) == NULL)
+    return;
+  if(strcmp(method, "GET") != 0 && strcmp(method, "HEAD") != 0) {
+    status = "405 Method Not Allowed";
+    type   = "text/plain";
+    fprintf(out, "Only GET\n");
+  }
+  else if(strcmp(path, "/metrics") == 0)
+    writeOpenMetrics(out);
+  else if(strcmp(path, "/") == 0) {
+    type = "text/html";
+    fprintf(out, "<html><body><a href=\"/metrics\">sbench metrics</a></body></html>\n");
+  }
+  else {
+    status = "404 Not Found";
+    type   = "text/plain";
+    fprintf(out, "Not found, the metrics are on /metrics\n");
+  }
+  fclose(out);
+
+  snprintf(header, sizeof(header), "HTTP/1.0 %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\n"
+           "Connection: close\r\n\r\n", status, type, bodyLen);
+  if(sendAll(fd, header, strlen(header)) == 0 && strcmp(method, "HEAD") != 0)
+    sendAll(fd, body, bodyLen);
+  free(body);
+}
+
+
+static int listenUnix(const char *path) {
+  struct sockaddr_un addr;
+  char msg[PATH_MAX + 100];
+  int fd;
+
+  if(strlen(path) >= sizeof(addr.sun_path)) {
+    sprintf(msg, "The socket path %.*s is too long", PATH_MAX, path);
+    sbenchMyAbort(msg);
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+  unlink(path); // left by a previous run
+  if((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 ||
+     bind(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 || listen(fd, 16) != 0) {
+    sprintf(msg, "Can't listen on the socket %.*s: %s", PATH_MAX, path, strerror(errno));
+    sbenchMyAbort(msg);
+  }
+  return fd;
+}
+
+
+/* the listening sockets, -1 == none */
+typedef struct {
+  int unixFd;
+  int httpFd;
+} daemon_listeners;
+
+static void *serverLoop(void *arg) {
+  daemon_listeners *l = (daemon_listeners *) arg;
+  struct pollfd fds[2] = {{l->unixFd, POLLIN, 0}, {l->httpFd, POLLIN, 0}};
+
+  while(! stopping) {
+    // now and then, to see if the daemon stops
+    if(poll(fds, 2, 500) <= 0)
+      continue;
+    for(int i = 0; i < 2; i++) {
+      int fd;
+      if(! (fds[i].revents & POLLIN) || (fd = accept(fds[i].fd, NULL, NULL)) < 0)
+        continue;
+      if(fds[i].fd == l->unixFd)
+        serveUnixClient(fd);
+      else
+        serveHttpClient(fd);
+      close(fd);
+    }
+  }
+  return NULL;
+}
+
+
+/**
+  * Runs the probes on their intervals until SIGINT or SIGTERM, serving
+  * their aggregates meanwhile. Each probe starts at a different time
+  * of its interval, so that they don't all run at the same second.
+  * @param run runs a probe, given its test
+  * @return the exit code
+  */
+int sbenchRunDaemon(daemon_probe *theProbes, size_t n, probe_runner run, daemon_options *o) {
+  daemon_listeners l = {-1, -1};
+  struct sigaction sa;
+  sigset_t signals, previous;
+  pthread_t server;
+
+  if(o->socketPath[0] == '\0' && o->listen[0] == '\0')
+    sbenchMyAbort("The daemon needs a socket or listen to serve its metrics");
+  probes   = theProbes;
+  nProbes  = n;
+  ringSize = o->ringSize > 0 ? o->ringSize : DAEMON_DEFAULT_RING;
+  states   = (probe_state *) calloc(nProbes, sizeof(probe_state));
+  ring     = (daemon_sample *) malloc(ringSize * sizeof(daemon_sample));
+  if(states == NULL || ring == NULL)
+    sbenchMyAbort("Can't allocate the ring of the daemon");
+  for(size_t p = 0; p < nProbes; p++)
+    if(gethostname(states[p].host, sizeof(states[p].host) - 1) != 0)
+      strcpy(states[p].host, "unknown");
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = stopDaemon;
+  sigaction(SIGINT,  &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  signal(SIGPIPE, SIG_IGN);
+
+  if(o->socketPath[0] != '\0')
+    l.unixFd = listenUnix(o->socketPath);
+  if(o->listen[0] != '\0')
+    l.httpFd = sbenchListenTcp(o->listen);
+  // the signals interrupt the sleeps of the probes, not the server
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &signals, &previous);
+  if(pthread_create(&server, NULL, serverLoop, &l) != 0)
+    sbenchMyAbort("Can't create the thread of the daemon endpoints");
+  pthread_sigmask(SIG_SETMASK, &previous, NULL);
+  if(o->verbose)
+    printf("Daemon running %zu probes, keeping %zu samples%s%s%s%s\n", nProbes, ringSize,
+           l.unixFd >= 0 ? ", socket " : "", o->socketPath,
+           l.httpFd >= 0 ? ", listening on " : "", o->listen);
+
+  double start = sbenchMonotonicSeconds();
+  for(size_t p = 0; p < nProbes; p++)
+    states[p].nextDue = start + (double) probes[p].interval * p / nProbes;
+
+  while(! stopping) {
+    size_t      p = 0;
+    double      now, t0;
+    test_result res;
+
+    for(size_t q = 1; q < nProbes; q++)
+      if(states[q].nextDue < states[p].nextDue)
+        p = q;
+    now = sbenchMonotonicSeconds();
+    if(states[p].nextDue > now) {
+      // by seconds at most, a signal may go to another thread
+      double wait = states[p].nextDue - now < 1 ? states[p].nextDue - now : 1;
+      struct timespec ts = {(time_t) wait, (long) ((wait - (time_t) wait) * 1e9)};
+      nanosleep(&ts, NULL);
+      continue;
+    }
+
+    t0 = sbenchMonotonicSeconds();
+    run(probes[p].test, &res);
+    now = sbenchMonotonicSeconds();
+    recordSample(p, &res, now - t0);
+    if(o->verbose)
+      printf("[%s] %s %s = %s (%.3f s)\n", probes[p].name, res.name, sbenchStatusNames[res.status],
+             res.summary, now - t0);
+    else if(res.error != SBENCH_OK)
+      fprintf(stderr, "[%s] %s\n", probes[p].name, res.summary);
+    fflush(stdout);
+    sbenchFreeResult(&res);
+    // a probe that took longer than its interval skips the runs missed
+    do
+      states[p].nextDue += probes[p].interval;
+    while(states[p].nextDue <= now);
+  }
+
+  if(o->verbose)
+    printf("Daemon stopping\n");
+  pthread_join(server, NULL);
+  if(l.unixFd >= 0) {
+    close(l.unixFd);
+    unlink(o->socketPath);
+  }
+  if(l.httpFd >= 0)
+    close(l.httpFd);
+  free(states);
+  free(ring);
+  return EXIT_CODE_OK;
+}
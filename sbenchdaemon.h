@@ -0,0 +1,49 @@
+/*
+ * Simple Benchmarks: daemon that runs light probes on intervals and
+ * serves the aggregates of their recent results.
+ *
+ * @since 20161027
+ * @author zoquero@gmail.com
+ */
+
+#ifndef SBENCHDAEMON_H
+#define SBENCHDAEMON_H
+
+#include <stddef.h>       // size_t
+#include <limits.h>       // PATH_MAX
+
+#include "sbenchresult.h"  // test_result
+
+#define DAEMON_DEFAULT_RING     1024 // samples kept, of all the probes
+#define DAEMON_DEFAULT_INTERVAL 60   // seconds between runs of a probe
+#define DAEMON_MAX_METRICS      64   // per probe, the next ones are dropped
+#define DAEMON_MAX_REQUEST      4096 // bytes of a request to the endpoints
+
+/** a test that the daemon runs again and again */
+typedef struct {
+  /** name of its section */
+  const char   *name;
+  /** seconds between its runs */
+  unsigned long interval;
+  /** what sbenchRunDaemon passes to the runner, the options of the test */
+  void         *test;
+} daemon_probe;
+
+/** where the daemon serves and how much it keeps */
+typedef struct {
+  /** unix socket, "" == none */
+  char   socketPath[PATH_MAX];
+  /** HTTP endpoint, "port" or "address:port" ("" == none),
+      on the loopback if there's no address */
+  char   listen[300];
+  /** samples kept, of all the probes */
+  size_t ringSize;
+  int    verbose;
+} daemon_options;
+
+/** runs the test of a probe once and fills its result */
+typedef void (*probe_runner)(void *test, test_result *res);
+
+int sbenchRunDaemon(daemon_probe *probes, size_t nProbes, probe_runner run, daemon_options *o);
+
+#endif // SBENCHDAEMON_H
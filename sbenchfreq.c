@@ -0,0 +1,403 @@
+/*
+ * Simple Benchmarks: the effective clock frequency of the threads of
+ * the cpu test while it runs, to tell a slower clock (turbo lost,
+ * thermal or power capping, a host that lowers the frequency) from
+ * threads that contend for the cores.
+ *
+ * Like the sampler it's enabled for a test and then each thread of it
+ * probes on its own every FREQ_INTERVAL from its loop (freqTick): a
+ * probe times a chain of dependent integer adds, written in asm so
+ * that the compiler keeps them on registers. Each add needs the
+ * result of the previous one and takes one cycle on any core since
+ * long ago (a multiply of 3 cycles gives the same clock), so adds per
+ * second are cycles per second: the clock that
+ * the thread really got on the CPU where it ran, whatever the
+ * hypervisor or the governor say. The fastest of some runs is taken,
+ * as an interrupt or a preemption only make it slower. Every some
+ * probes the scaling_cur_freq of cpufreq of that CPU is read too, and
+ * when /dev/cpu/N/msr is readable (root and the msr module) APERF and
+ * MPERF of each CPU are read at the start and at the end of each run:
+ * the cycles at the actual clock against the ones at the base clock.
+ *
+ * At the end the frequency is added to the result, of each thread, of
+ * each CPU and over time; the probes of the runs of a repeated test
+ * follow one another.
+ *
+ * @since 20161027
+ * @author zoquero@gmail.com
+ */
+
+#define _GNU_SOURCE       // sched_getcpu, CPU_ISSET
+#include <stdio.h>        // printf, snprintf
+#include <stdlib.h>       // posix_memalign, realloc, free
+#include <string.h>       // memset, memcpy
+#include <fcntl.h>        // open
+#include <unistd.h>       // pread, close
+#include <sched.h>        // sched_getcpu, sched_getaffinity
+
+#include "sbenchfuncs.h"
+#include "sbenchtime.h"
+#include "sbenchfreq.h"
+
+/* registers of the actual and of the base cycles */
+#define MSR_MPERF 0xE7
+#define MSR_APERF 0xE8
+
+/** 0 == not tracking the frequency */
+static int           freqOn;
+static int           freqVerbose;
+static freq_probe   *probes;
+static unsigned int  nProbes;
+/** start of the run and ticks between the probes of a thread */
+static uint64_t      runStart, intervalTicks;
+/** seconds probed on the previous runs */
+static double        offset;
+/** probes of all the threads of all the runs */
+static freq_sample  *samples;
+static size_t        nSamples, samplesSize;
+/** APERF and MPERF of each CPU at the start of the run and added up */
+static int           msrRead[FREQ_MAX_CPUS];
+static uint64_t      aperfStart[FREQ_MAX_CPUS], mperfStart[FREQ_MAX_CPUS];
+static uint64_t      aperfSum[FREQ_MAX_CPUS], mperfSum[FREQ_MAX_CPUS];
+/** GHz of the probes on each CPU and what cpufreq said, for sbenchAddFrequency */
+static double        cpuSum[FREQ_MAX_CPUS], cpuFreqSum[FREQ_MAX_CPUS];
+static size_t        cpuN[FREQ_MAX_CPUS], cpuFreqN[FREQ_MAX_CPUS];
+
+
+/**
+  * Tracks the frequency of the tests from now on, until sbenchAddFrequency.
+  * Without calling it sbenchFreqStart does nothing.
+  */
+void sbenchFreqEnable(int verbose) {
+#ifdef FREQ_ADD_BLOCK
+  freqOn      = 1;
+  freqVerbose = verbose;
+  offset      = 0;
+  nSamples    = 0;
+  memset(msrRead,  0, sizeof(msrRead));
+  memset(aperfSum, 0, sizeof(aperfSum));
+  memset(mperfSum, 0, sizeof(mperfSum));
+#else
+  if(verbose)
+    printf("The frequency can't be probed on this architecture\n");
+#endif
+}
+
+
+/**
+  * Seconds of the fastest run of the chain of dependent adds.
+  */
+static double freqChain() {
+  double   best = 0, s;
+  uint64_t x = 0, y = 1, start, end;
+
+#ifdef FREQ_ADD_BLOCK
+  for(int r = 0; r < FREQ_PROBE_RUNS; r++) {
+    start = timerRead();
+    for(int i = 0; i < FREQ_PROBE_ADDS / FREQ_BLOCK_ADDS; i++)
+      FREQ_ADD_BLOCK(x, y);
+    end = timerRead();
+    s   = sbenchTimerElapsed(start, end);
+    if(s > 0 && (best == 0 || s < best))
+      best = s;
+  }
+#endif
+  return best;
+}
+
+
+/**
+  * A frequency of cpufreq of a CPU in GHz.
+  * @param what "scaling_cur_freq", "base_frequency"...
+  * @return 0 if it can't be read
+  */
+static double cpufreqGhz(int cpu, const char *what) {
+  char          name[128];
+  unsigned long khz = 0;
+  FILE         *f;
+
+  snprintf(name, sizeof(name), "/sys/devices/system/cpu/cpu%d/cpufreq/%s", cpu, what);
+  if((f = fopen(name, "r")) == NULL)
+    return 0;
+  if(fscanf(f, "%lu", &khz) != 1)
+    khz = 0;
+  fclose(f);
+  return khz / 1E6;
+}
+
+
+/**
+  * Probes the frequency of the thread now, and when the next probe
+  * is due.
+  */
+void sbenchFreqProbe(freq_probe *fp) {
+  double       seconds = freqChain();
+  uint64_t     now     = timerRead();
+  freq_sample *s;
+
+  fp->next = now + intervalTicks;
+  if(seconds <= 0)
+    return;
+  if(fp->nSamples == fp->size) {
+    fp->size    = fp->size == 0 ? 256 : fp->size * 2;
+    fp->samples = (freq_sample *) realloc(fp->samples, fp->size * sizeof(freq_sample));
+    if(fp->samples == NULL) {
+      // better without the frequency than ending the test
+      fp->nSamples = fp->size = 0;
+      fp->next     = UINT64_MAX;
+      return;
+    }
+  }
+  s = &fp->samples[fp->nSamples++];
+  s->t          = offset + sbenchTimerElapsed(runStart, now);
+  s->thread     = fp->thread;
+  s->cpu        = sched_getcpu();
+  s->ghz        = FREQ_PROBE_ADDS / seconds / 1E9;
+  s->cpufreqGhz = s->cpu >= 0 && fp->probes % FREQ_CPUFREQ_EVERY == 0 ? cpufreqGhz(s->cpu, "scaling_cur_freq") : 0;
+  fp->probes++;
+}
+
+
+/**
+  * Reads a model specific register of a CPU.
+  * @return 0 if it can't be read
+  */
+static int readMsr(int cpu, unsigned int reg, uint64_t *value) {
+  char name[64];
+  int  fd, ok;
+
+  snprintf(name, sizeof(name), "/dev/cpu/%d/msr", cpu);
+  if((fd = open(name, O_RDONLY)) < 0)
+    return 0;
+  ok = pread(fd, value, sizeof(*value), reg) == sizeof(*value);
+  close(fd);
+  return ok;
+}
+
+
+/**
+  * Reads APERF and MPERF of the CPUs that sbench can run on.
+  * @param end if it's the end of the run, then what they counted
+  *        meanwhile is added up
+  */
+static void readAperfMperf(int end) {
+  cpu_set_t set;
+  uint64_t  a, m;
+
+  if(sched_getaffinity(0, sizeof(set), &set) != 0)
+    return;
+  for(int cpu = 0; cpu < FREQ_MAX_CPUS; cpu++) {
+    if(! CPU_ISSET(cpu, &set))
+      continue;
+    if(! readMsr(cpu, MSR_APERF, &a) || ! readMsr(cpu, MSR_MPERF, &m)) {
+      if(! end)
+        msrRead[cpu] = 0;
+      continue;
+    }
+    if(! end) {
+      aperfStart[cpu] = a;
+      mperfStart[cpu] = m;
+      msrRead[cpu]    = 1;
+    }
+    else if(msrRead[cpu] && a >= aperfStart[cpu] && m > mperfStart[cpu]) {
+      aperfSum[cpu] += a - aperfStart[cpu];
+      mperfSum[cpu] += m - mperfStart[cpu];
+    }
+  }
+}
+
+
+/**
+  * Starts tracking the frequency of a run of a test, if it's enabled.
+  * @return the probes of each thread, to give to them, NULL if it's
+  *         not tracking it or if it can't (see sbenchFailTest)
+  */
+freq_probe *sbenchFreqStart(unsigned int nThreads) {
+  void *mem;
+
+  if(! freqOn)
+    return NULL;
+  if(posix_memalign(&mem, sizeof(freq_probe), nThreads * sizeof(freq_probe)) != 0) {
+    sbenchFailTest(SBENCH_ERR_MEMORY, "Can't allocate the probes of the frequency");
+    return NULL;
+  }
+  probes  = (freq_probe *) mem;
+  nProbes = nThreads;
+  memset(probes, 0, nThreads * sizeof(freq_probe));
+  readAperfMperf(0);
+  intervalTicks = (uint64_t) (FREQ_INTERVAL / sbenchTimer.secondsPerTick);
+  runStart      = timerRead();
+  // the first probe is as soon as each thread starts
+  for(unsigned int i = 0; i < nThreads; i++) {
+    probes[i].thread = i;
+    probes[i].next   = runStart;
+  }
+  return probes;
+}
+
+
+/**
+  * Stops tracking the frequency of the run, after its threads finish.
+  * The samples that can't be kept are lost, see sbenchFailTest.
+  */
+void sbenchFreqStop() {
+  uint64_t     end;
+  freq_sample *grown;
+
+  if(probes == NULL)
+    return;
+  end = timerRead();
+  readAperfMperf(1);
+  for(unsigned int i = 0; i < nProbes; i++) {
+    freq_probe *fp = &probes[i];
+    if(nSamples + fp->nSamples > samplesSize) {
+      grown = (freq_sample *) realloc(samples, (nSamples + fp->nSamples + 256) * sizeof(freq_sample));
+      if(grown == NULL)
+        sbenchFailTest(SBENCH_ERR_MEMORY, "Can't allocate the probes of the frequency");
+      else {
+        samples     = grown;
+        samplesSize = nSamples + fp->nSamples + 256;
+      }
+    }
+    if(nSamples + fp->nSamples <= samplesSize) {
+      memcpy(&samples[nSamples], fp->samples, fp->nSamples * sizeof(freq_sample));
+      nSamples += fp->nSamples;
+    }
+    free(fp->samples);
+  }
+  offset += sbenchTimerElapsed(runStart, end);
+  free(probes);
+  probes  = NULL;
+  nProbes = 0;
+}
+
+
+/**
+  * Adds the frequency to the result: of all the probes, of each thread,
+  * of each CPU and over time, and stops tracking the next tests.
+  */
+void sbenchAddFrequency(test_result *res) {
+  double   sum = 0, min = 0, max = 0, base, low = 0, high = 0;
+  size_t   nThreads = 0, nSteps, step;
+  char     label[32];
+  int      msr = 0;
+
+  if(! freqOn)
+    return;
+  freqOn = 0;
+  if(nSamples == 0) {
+    sbenchAppendText(res, "frequency: not probed, the test is too short\n");
+    return;
+  }
+
+  for(size_t i = 0; i < nSamples; i++) {
+    sum += samples[i].ghz;
+    if(i == 0 || samples[i].ghz < min)
+      min = samples[i].ghz;
+    if(samples[i].ghz > max)
+      max = samples[i].ghz;
+    if(samples[i].thread + 1 > nThreads)
+      nThreads = samples[i].thread + 1;
+  }
+  sbenchAddMetric(res, "ghz_avg", sum / nSamples, "");
+  sbenchAddMetric(res, "ghz_min", min, "");
+  sbenchAddMetric(res, "ghz_max", max, "");
+  sbenchAppendText(res, "frequency: avg %.2f GHz;min %.2f GHz;max %.2f GHz on %lu probes of %lu threads\n",
+                   sum / nSamples, min, max, (unsigned long) nSamples, (unsigned long) nThreads);
+
+  // of each thread
+  for(size_t t = 0; t < nThreads; t++) {
+    size_t n = 0;
+    sum = 0;
+    for(size_t i = 0; i < nSamples; i++)
+      if(samples[i].thread == t) {
+        sum += samples[i].ghz;
+        n++;
+      }
+    if(n == 0)
+      continue;
+    snprintf(label, sizeof(label), "%lu", (unsigned long) t);
+    sbenchAddDetailMetric(res, "thread_ghz", sum / n, "", "thread", label);
+    if(freqVerbose)
+      sbenchAppendText(res, "frequency: thread %lu %.2f GHz\n", (unsigned long) t, sum / n);
+  }
+
+  // of each CPU, with what cpufreq and APERF/MPERF say
+  memset(cpuSum,     0, sizeof(cpuSum));
+  memset(cpuFreqSum, 0, sizeof(cpuFreqSum));
+  memset(cpuN,       0, sizeof(cpuN));
+  memset(cpuFreqN,   0, sizeof(cpuFreqN));
+  for(size_t i = 0; i < nSamples; i++) {
+    int cpu = samples[i].cpu;
+    if(cpu < 0 || cpu >= FREQ_MAX_CPUS)
+      continue;
+    cpuSum[cpu] += samples[i].ghz;
+    cpuN[cpu]++;
+    if(samples[i].cpufreqGhz > 0) {
+      cpuFreqSum[cpu] += samples[i].cpufreqGhz;
+      cpuFreqN[cpu]++;
+    }
+  }
+  for(int cpu = 0; cpu < FREQ_MAX_CPUS; cpu++) {
+    char more[128] = "";
+    if(cpuN[cpu] == 0 && mperfSum[cpu] == 0)
+      continue;
+    snprintf(label, sizeof(label), "%d", cpu);
+    if(cpuN[cpu] > 0)
+      sbenchAddDetailMetric(res, "cpu_ghz", cpuSum[cpu] / cpuN[cpu], "", "cpu", label);
+    if(cpuFreqN[cpu] > 0) {
+      sbenchAddDetailMetric(res, "cpufreq_ghz", cpuFreqSum[cpu] / cpuFreqN[cpu], "", "cpu", label);
+      snprintf(more, sizeof(more), ";cpufreq %.2f GHz", cpuFreqSum[cpu] / cpuFreqN[cpu]);
+    }
+    if(mperfSum[cpu] > 0) {
+      // MPERF ticks at the base clock, the one of the invariant TSC
+      base = cpufreqGhz(cpu, "base_frequency");
+      if(base == 0 && sbenchTimer.source == TIMER_TSC)
+        base = 1E-9 / sbenchTimer.secondsPerTick;
+      sbenchAddDetailMetric(res, "aperf_mperf_pct", 100. * aperfSum[cpu] / mperfSum[cpu], "%", "cpu", label);
+      snprintf(more + strlen(more), sizeof(more) - strlen(more), ";aperf/mperf %.1f%%",
+               100. * aperfSum[cpu] / mperfSum[cpu]);
+      if(base > 0) {
+        sbenchAddDetailMetric(res, "aperf_ghz", base * aperfSum[cpu] / mperfSum[cpu], "", "cpu", label);
+        snprintf(more + strlen(more), sizeof(more) - strlen(more), " of %.2f GHz = %.2f GHz",
+                 base, base * aperfSum[cpu] / mperfSum[cpu]);
+      }
+      msr = 1;
+    }
+    if(cpuN[cpu] > 0)
+      sbenchAppendText(res, "frequency: cpu %d %.2f GHz%s\n", cpu, cpuSum[cpu] / cpuN[cpu], more);
+    else
+      sbenchAppendText(res, "frequency: cpu %d not probed%s\n", cpu, more);
+  }
+
+  // over time, the average of all the threads on each step
+  nSteps = 0;
+  for(size_t i = 0; i < nSamples; i++)
+    if((size_t) (samples[i].t / FREQ_SERIES_STEP) + 1 > nSteps)
+      nSteps = (size_t) (samples[i].t / FREQ_SERIES_STEP) + 1;
+  sbenchAppendText(res, "frequency over time (GHz each %.0f s):", FREQ_SERIES_STEP);
+  for(step = 0; step < nSteps; step++) {
+    size_t n = 0;
+    sum = 0;
+    for(size_t i = 0; i < nSamples; i++)
+      if((size_t) (samples[i].t / FREQ_SERIES_STEP) == step) {
+        sum += samples[i].ghz;
+        n++;
+      }
+    if(n == 0)
+      continue;
+    snprintf(label, sizeof(label), "%.0f", (step + 1) * FREQ_SERIES_STEP);
+    sbenchAddDetailMetric(res, "ghz_over_time", sum / n, "", "t", label);
+    sbenchAppendText(res, " %.2f", sum / n);
+    if(low == 0 || sum / n < low)
+      low = sum / n;
+    if(sum / n > high)
+      high = sum / n;
+  }
+  sbenchAppendText(res, "\n");
+  if(low < high * 0.9)
+    sbenchAppendText(res, "frequency: the clock fell %.0f%% during the test, the calcs/s fall with it\n",
+                     100. * (high - low) / high);
+  if(! msr && freqVerbose)
+    sbenchAppendText(res, "frequency: APERF/MPERF not read, /dev/cpu/N/msr needs root and the msr module\n");
+}
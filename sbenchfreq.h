@@ -0,0 +1,74 @@
+/*
+ * Simple Benchmarks: the effective clock frequency of the threads of
+ * the cpu test while it runs, to tell a slower clock (turbo lost,
+ * thermal or power capping, a host that lowers the frequency) from
+ * threads that contend for the cores.
+ *
+ * @since 20161027
+ * @author zoquero@gmail.com
+ */
+
+#ifndef SBENCHFREQ_H
+#define SBENCHFREQ_H
+
+#include <stdint.h>       // uint64_t
+#include <stddef.h>       // size_t
+
+#include "sbenchresult.h"  // test_result
+#include "sbenchtime.h"    // timerRead
+
+#define FREQ_BLOCK_ADDS    64     // dependent adds of each asm block
+#define FREQ_PROBE_ADDS    16384  // dependent adds of a probe, a multiple of FREQ_BLOCK_ADDS
+#define FREQ_PROBE_RUNS    3      // of a probe, the fastest one is taken
+#define FREQ_INTERVAL      0.01   // seconds between the probes of a thread
+#define FREQ_CPUFREQ_EVERY 10     // probes between reads of scaling_cur_freq
+#define FREQ_SERIES_STEP   1.0    // seconds of each point of the series over time
+#define FREQ_MAX_CPUS      1024   // CPUs that are reported, as CPU_SETSIZE
+
+/* x += y, FREQ_BLOCK_ADDS times: y on a register, as recent cores fold
+   chains of adds of an immediate and run several of them on a cycle */
+#if defined(__x86_64__) || defined(__i386__)
+#define FREQ_ADD_BLOCK(x, y) __asm__ __volatile__(".rept 64\n\tadd %1, %0\n\t.endr" : "+r" (x) : "r" (y))
+#elif defined(__aarch64__)
+#define FREQ_ADD_BLOCK(x, y) __asm__ __volatile__(".rept 64\n\tadd %0, %0, %1\n\t.endr" : "+r" (x) : "r" (y))
+#endif
+
+/** a probe of a thread */
+typedef struct {
+  /** seconds since sbenchFreqEnable */
+  double       t;
+  unsigned int thread;
+  /** where it ran, -1 if unknown */
+  int          cpu;
+  double       ghz;
+  /** scaling_cur_freq of the CPU, 0 == not read */
+  double       cpufreqGhz;
+} freq_sample;
+
+/** probes of a thread: written only by it, read after it finishes */
+typedef struct freq_probe {
+  unsigned int  thread;
+  /** timer ticks when the next probe is due */
+  uint64_t      next;
+  unsigned long probes;
+  freq_sample  *samples;
+  size_t        nSamples, size;
+} __attribute__((aligned(64))) freq_probe;
+
+void sbenchFreqEnable(int verbose);
+freq_probe *sbenchFreqStart(unsigned int nThreads);
+void sbenchFreqProbe(freq_probe *fp);
+void sbenchFreqStop();
+void sbenchAddFrequency(test_result *res);
+
+/**
+  * Probes the frequency if it's due, to call often from the loop of
+  * a thread: it just reads the timer.
+  * @param fp probes of the thread, NULL if the frequency isn't tracked
+  */
+static inline void freqTick(freq_probe *fp) {
+  if(fp != NULL && timerRead() >= fp->next)
+    sbenchFreqProbe(fp);
+}
+
+#endif // SBENCHFREQ_H
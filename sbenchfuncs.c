@@ -8,8 +8,11 @@
 #include <unistd.h>       // read, write, fsync, lseek, access
 #include <stdlib.h>       // exit, malloc, free
 #include <string.h>       // memcpy, strlen
+#include <stdarg.h>       // va_list
+#include <errno.h>        // errno
 #include <math.h>         // pow
 #include <sys/stat.h>     // stat
+#include <sys/sysmacros.h> // major, minor
 #include <fcntl.h>        // open
 #include <curl/curl.h>    // libcurl
 #include <pthread.h>      // pthread_create ...
@@ -18,139 +21,613 @@
 
 #ifdef OPING_ENABLED
 #include <oping.h>        // octo's ping library
-#else // OPING_ENABLED
-#define BUFSIZE 1024
-#include <regex.h>
 #endif // OPING_ENABLED
 
 #include "sbenchfuncs.h"
+#include "sbenchtime.h"
+#include "sbenchperf.h"
+#include "sbenchpool.h"
+#include "sbenchsample.h"
+#include "sbenchfreq.h"
 
 
-void myAbort(char* msg) {
+void sbenchMyAbort(char* msg) {
   fprintf(stderr, "Error: %s\n", msg);
   exit(EXIT_CODE_CRITICAL);
 }
 
+
 /**
-  * Difference between two instants.
-  * @arg start
-  * @arg end
-  * @return difference in seconds
+  * The device of a file, or of the folder where it will be
+  * (disk_w creates its folder).
+  * @return 0 if it can't be found
   */
-double timeval_diff(struct timeval *a, struct timeval *b) {
-  return (double)(a->tv_sec + (double)a->tv_usec/1000000) - (double)(b->tv_sec + (double)b->tv_usec/1000000);
+int sbenchPathDevice(const char *path, unsigned int *maj, unsigned int *min) {
+  struct stat st;
+  char  parent[PATH_MAX], *slash;
+
+  snprintf(parent, sizeof(parent), "%s", path);
+  while(stat(parent, &st) != 0) {
+    if((slash = strrchr(parent, '/')) == NULL || slash == parent) {
+      strcpy(parent, slash == parent ? "/" : ".");
+      if(stat(parent, &st) != 0)
+        return 0;
+      break;
+    }
+    *slash = '\0';
+  }
+  *maj = major(st.st_dev);
+  *min = minor(st.st_dev);
+  // no device, like tmpfs and overlayfs
+  return *maj != 0;
 }
 
 
 /**
-  * Gets the schedulling policy and priority of the current thread
+  * The whole disk of a partition (8:1 -> 8:0), where the limits of
+  * the block I/O of the cgroups are set: the partition is a folder
+  * inside the one of its disk on sysfs. Leaves a disk as it is.
   */
-sched_params getRTSched() {
-  sched_params p;
+void sbenchPartitionDisk(unsigned int *maj, unsigned int *min) {
+  char  name[128];
+  unsigned int ma, mi;
+  FILE *f;
+
+  snprintf(name, sizeof(name), "/sys/dev/block/%u:%u/partition", *maj, *min);
+  if(access(name, F_OK) != 0)
+    return;
+  snprintf(name, sizeof(name), "/sys/dev/block/%u:%u/../dev", *maj, *min);
+  if((f = fopen(name, "r")) == NULL)
+    return;
+  if(fscanf(f, "%u:%u", &ma, &mi) == 2) {
+    *maj = ma;
+    *min = mi;
+  }
+  fclose(f);
+}
 
-  struct sched_param sp;
-  /* reads priority and increments by 2 */
-  if(sched_getparam(0, &sp) != 0) {
-    fputs("Error getting sched params with sched_getparam", stderr);
-    exit(-1);
+
+/** names of the HTTP phases, indexed by enum httpPhase */
+const char *sbenchHttpPhaseNames[HTTP_PHASES] = {"dns", "connect", "tls", "ttfb", "transfer", "total"};
+
+
+/* why the running test failed, the first error of its threads */
+static int             failureCode;
+static char            failure[PATH_MAX + 200];
+static pthread_mutex_t failureLock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+  * Records why the running test failed, instead of ending the program,
+  * so that its threads can return and the test can return the error.
+  * The first failure is kept, the ones of the other threads follow from it.
+  * @return code
+  */
+int sbenchFailTest(int code, const char *fmt, ...) {
+  va_list ap;
+
+  pthread_mutex_lock(&failureLock);
+  if(failureCode == SBENCH_OK) {
+    failureCode = code;
+    va_start(ap, fmt);
+    vsnprintf(failure, sizeof(failure), fmt, ap);
+    va_end(ap);
+  }
+  pthread_mutex_unlock(&failureLock);
+  return code;
+}
+
+
+/**
+  * The failure of the running test, SBENCH_OK if it didn't fail.
+  */
+int sbenchTestFailure() {
+  int code;
+
+  pthread_mutex_lock(&failureLock);
+  code = failureCode;
+  pthread_mutex_unlock(&failureLock);
+  return code;
+}
+
+
+const char *sbenchTestFailureMessage() {
+  return failureCode == SBENCH_OK ? "" : failure;
+}
+
+
+/**
+  * Forgets the failure of the previous test, before running the next one.
+  */
+void sbenchClearTestFailure() {
+  pthread_mutex_lock(&failureLock);
+  failureCode = SBENCH_OK;
+  failure[0]  = '\0';
+  pthread_mutex_unlock(&failureLock);
+}
+
+static int compareDoubles(const void *a, const void *b) {
+  double x = *(const double *) a, y = *(const double *) b;
+  return x < y ? -1 : x > y;
+}
+
+
+/**
+  * Percentile of an already sorted array, interpolating between
+  * the two nearest samples.
+  * @arg sorted samples in ascending order
+  * @arg p percentile, from 0 to 100
+  */
+static double percentile(double *sorted, size_t n, double p) {
+  double rank, frac;
+  size_t i;
+
+  if(n == 0)
+    return 0.;
+  rank = p / 100. * (n - 1);
+  i    = (size_t) rank;
+  frac = rank - i;
+  if(i + 1 >= n)
+    return sorted[n - 1];
+  return sorted[i] + frac * (sorted[i + 1] - sorted[i]);
+}
+
+
+/**
+  * Summarizes latency samples: min, avg, percentiles, max and mdev.
+  * It sorts the samples in place.
+  */
+void sbenchComputeLatencyStats(double *samples, size_t n, latencyStats *ls) {
+  double sum = 0, sum2 = 0;
+
+  memset(ls, 0, sizeof(latencyStats));
+  ls->count = n;
+  if(n == 0)
+    return;
+  qsort(samples, n, sizeof(double), compareDoubles);
+  for(size_t i = 0; i < n; i++) {
+    sum  += samples[i];
+    sum2 += samples[i] * samples[i];
+  }
+  ls->min  = samples[0];
+  ls->max  = samples[n - 1];
+  ls->avg  = sum / n;
+  ls->mdev = sqrt(fabs(sum2 / n - ls->avg * ls->avg));
+  ls->p50  = percentile(samples, n, 50);
+  ls->p90  = percentile(samples, n, 90);
+  ls->p99  = percentile(samples, n, 99);
+  ls->p999 = percentile(samples, n, 99.9);
+}
+
+
+/**
+  * Bucket of a latency in a histogram.
+  */
+static int histogramBucket(uint64_t ns) {
+  int e;
+
+  if(ns < 2 * HISTOGRAM_SUB_BUCKETS)
+    return ns;
+  e = 63 - __builtin_clzll(ns); // 2^e <= ns < 2^(e+1), e >= 5
+  return (e - 3) * HISTOGRAM_SUB_BUCKETS + ((ns >> (e - 4)) & (HISTOGRAM_SUB_BUCKETS - 1));
+}
+
+
+/**
+  * Middle of the values of a bucket of a histogram, in nanoseconds.
+  */
+static double histogramBucketValue(int b) {
+  int e, sub;
+
+  if(b < 2 * HISTOGRAM_SUB_BUCKETS)
+    return b;
+  e   = b / HISTOGRAM_SUB_BUCKETS + 3;
+  sub = b % HISTOGRAM_SUB_BUCKETS;
+  return ((HISTOGRAM_SUB_BUCKETS + sub) + 0.5) * (double) (1ULL << (e - 4));
+}
+
+
+void sbenchHistogramAdd(latencyHistogram *h, uint64_t ns) {
+  h->count[histogramBucket(ns)]++;
+  if(h->total == 0 || ns < h->min)
+    h->min = ns;
+  if(ns > h->max)
+    h->max = ns;
+  h->total++;
+  h->sum  += ns;
+  h->sum2 += (double) ns * ns;
+}
+
+
+void sbenchHistogramMerge(latencyHistogram *to, latencyHistogram *from) {
+  if(from->total == 0)
+    return;
+  for(int i = 0; i < HISTOGRAM_BUCKETS; i++)
+    to->count[i] += from->count[i];
+  if(to->total == 0 || from->min < to->min)
+    to->min = from->min;
+  if(from->max > to->max)
+    to->max = from->max;
+  to->total += from->total;
+  to->sum   += from->sum;
+  to->sum2  += from->sum2;
+}
+
+
+static double histogramPercentile(latencyHistogram *h, double p) {
+  uint64_t rank = (uint64_t) ceil(p / 100. * h->total), seen = 0;
+
+  if(rank == 0)
+    rank = 1;
+  for(int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+    seen += h->count[i];
+    if(seen >= rank)
+      return fmin(fmax(histogramBucketValue(i), h->min), h->max);
+  }
+  return h->max;
+}
+
+
+/**
+  * Summarizes a histogram like sbenchComputeLatencyStats does with the
+  * samples, in miliseconds. The percentiles are the middle of their
+  * bucket.
+  */
+void sbenchHistogramStats(latencyHistogram *h, latencyStats *ls) {
+  memset(ls, 0, sizeof(latencyStats));
+  ls->count = h->total;
+  if(h->total == 0)
+    return;
+  ls->min  = h->min / 1E6;
+  ls->max  = h->max / 1E6;
+  ls->avg  = h->sum / h->total / 1E6;
+  ls->mdev = sqrt(fabs(h->sum2 / h->total - (h->sum / h->total) * (h->sum / h->total))) / 1E6;
+  ls->p50  = histogramPercentile(h, 50) / 1E6;
+  ls->p90  = histogramPercentile(h, 90) / 1E6;
+  ls->p99  = histogramPercentile(h, 99) / 1E6;
+  ls->p999 = histogramPercentile(h, 99.9) / 1E6;
+}
+
+
+/**
+  * Two-sided 95% quantile of the Student's t distribution,
+  * to build confidence intervals from few samples.
+  * @arg df degrees of freedom
+  */
+static double tQuantile95(size_t df) {
+  static const double t[] = {0, 12.706, 4.303, 3.182, 2.776, 2.571, 2.447,
+    2.365, 2.306, 2.262, 2.228, 2.201, 2.179, 2.160, 2.145, 2.131, 2.120,
+    2.110, 2.101, 2.093, 2.086, 2.080, 2.074, 2.069, 2.064, 2.060, 2.056,
+    2.052, 2.048, 2.045, 2.042};
+
+  if(df < sizeof(t) / sizeof(t[0]))
+    return t[df];
+  if(df <= 60)
+    return 2.042 - (2.042 - 2.000) * (df - 30) / 30.;
+  if(df <= 120)
+    return 2.000 - (2.000 - 1.980) * (df - 60) / 60.;
+  return 1.960;
+}
+
+
+/**
+  * Summarizes the results of a repeated test: mean, median, standard
+  * deviation and 95% confidence interval of the mean. From 4 samples
+  * on, the ones out of Tukey's fences (1.5 times the interquartile
+  * range beyond the quartiles) are rejected as outliers first.
+  * The samples aren't modified.
+  * @return SBENCH_OK or why it failed, then ss is empty
+  */
+static int computeSampleStats(double *samples, size_t n, sampleStats *ss) {
+  double *sorted, *kept, q1, q3, iqr, sum = 0, sum2 = 0, half;
+  size_t  k = 0;
+
+  memset(ss, 0, sizeof(sampleStats));
+  if(n == 0)
+    return SBENCH_OK;
+  sorted = (double *) malloc(n * sizeof(double));
+  if(sorted == NULL)
+    return sbenchFailTest(SBENCH_ERR_MEMORY, "Can't allocate the array of samples");
+  memcpy(sorted, samples, n * sizeof(double));
+  qsort(sorted, n, sizeof(double), compareDoubles);
+
+  kept = sorted;
+  k    = n;
+  if(n >= 4) {
+    q1  = percentile(sorted, n, 25);
+    q3  = percentile(sorted, n, 75);
+    iqr = q3 - q1;
+    // sorted, so the outliers are at both ends
+    while(k > 0 && kept[0] < q1 - 1.5 * iqr) {
+      kept++;
+      k--;
+    }
+    while(k > 0 && kept[k - 1] > q3 + 1.5 * iqr)
+      k--;
+  }
+
+  for(size_t i = 0; i < k; i++) {
+    sum  += kept[i];
+    sum2 += kept[i] * kept[i];
   }
+  ss->count    = k;
+  ss->outliers = n - k;
+  ss->min      = kept[0];
+  ss->max      = kept[k - 1];
+  ss->mean     = sum / k;
+  ss->median   = percentile(kept, k, 50);
+  ss->stddev   = k > 1 ? sqrt(fabs(sum2 - k * ss->mean * ss->mean) / (k - 1)) : 0;
+  half         = k > 1 ? tQuantile95(k - 1) * ss->stddev / sqrt(k) : 0;
+  ss->ciLow    = ss->mean - half;
+  ss->ciHigh   = ss->mean + half;
+  free(sorted);
+  return SBENCH_OK;
+}
+
 
-  p.priority = sp.sched_priority;
-  p.sched_policy = sched_getscheduler(0);
-  if(p.sched_policy == -1) {
-    fputs("Error getting thread's priority with sched_getscheduler", stderr);
-    exit(-1);
+/**
+  * Compares the samples of a test with the ones of its baseline,
+  * both without outliers. Welch's t-test if there are 2 samples at
+  * least; with just one, if it's out of the 95% prediction interval
+  * of the baseline (where a new run of the baseline would fall).
+  * The baseline needs 2 samples at least to be compared.
+  */
+void sbenchCompareSamples(double *baseline, size_t nBaseline, double *samples, size_t n, baselineComparison *bc) {
+  double se;
+
+  memset(bc, 0, sizeof(baselineComparison));
+  computeSampleStats(baseline, nBaseline, &bc->baseline);
+  computeSampleStats(samples, n, &bc->current);
+  if(bc->baseline.count < 2 || bc->current.count == 0)
+    return;
+  if(bc->baseline.mean != 0)
+    bc->deviationPerCent = (bc->current.mean - bc->baseline.mean) / fabs(bc->baseline.mean) * 100;
+
+  if(bc->current.count == 1) {
+    se     = bc->baseline.stddev * sqrt(1 + 1. / bc->baseline.count);
+    bc->df = bc->baseline.count - 1;
+  }
+  else {
+    double vb = bc->baseline.stddev * bc->baseline.stddev / bc->baseline.count;
+    double vc = bc->current.stddev  * bc->current.stddev  / bc->current.count;
+    se = sqrt(vb + vc);
+    // Welch-Satterthwaite
+    bc->df = se > 0 ? (size_t) ((vb + vc) * (vb + vc) / (vb * vb / (bc->baseline.count - 1) +
+                                                         vc * vc / (bc->current.count - 1))) : 1;
+    if(bc->df < 1)
+      bc->df = 1;
   }
+  if(se > 0) {
+    bc->t = (bc->current.mean - bc->baseline.mean) / se;
+    bc->significant = fabs(bc->t) > tQuantile95(bc->df);
+  }
+  else // no noise at all, any difference is real
+    bc->significant = bc->current.mean != bc->baseline.mean;
+}
+
 
-  return p;
+/**
+  * Splits values[a..b) where the means of both sides differ the most
+  * for their lengths (the maximum of the standardized CUSUM), if the
+  * difference is significant and big enough, and then both sides.
+  */
+static void splitSegment(double *values, size_t a, size_t b, size_t minLength, double minPerCent,
+                  size_t *changes, size_t *nChanges, size_t maxChanges) {
+  double sum = 0, left = 0, best = 0, score;
+  size_t split = 0;
+  baselineComparison bc;
+
+  if(b - a < 2 * minLength || *nChanges == maxChanges)
+    return;
+  for(size_t i = a; i < b; i++)
+    sum += values[i];
+  for(size_t k = a + 1; k < b; k++) {
+    left += values[k - 1];
+    if(k - a < minLength || b - k < minLength)
+      continue;
+    score = fabs(left / (k - a) - (sum - left) / (b - k)) * sqrt((double) (k - a) * (b - k) / (b - a));
+    if(score > best) {
+      best  = score;
+      split = k;
+    }
+  }
+  if(split == 0)
+    return;
+  sbenchCompareSamples(values + a, split - a, values + split, b - split, &bc);
+  if(! bc.significant || fabs(bc.deviationPerCent) < minPerCent)
+    return;
+  // in order: the ones before it, it and the ones after it
+  splitSegment(values, a, split, minLength, minPerCent, changes, nChanges, maxChanges);
+  if(*nChanges < maxChanges)
+    changes[(*nChanges)++] = split;
+  splitSegment(values, split, b, minLength, minPerCent, changes, nChanges, maxChanges);
+}
+
+
+/**
+  * Finds where a series steps to another level and stays there, like
+  * the throughput of a disk when its burst credits run out: binary
+  * segmentation, with minLength values on each side of a change at
+  * least, a change of minPerCent of the mean before it at least and
+  * significant on Welch's t-test.
+  * @param changes return value, index of the first value after each
+  *        change, sorted
+  * @return number of changes
+  */
+size_t sbenchDetectStepChanges(double *values, size_t n, size_t minLength, double minPerCent, size_t *changes, size_t maxChanges) {
+  size_t nChanges = 0;
+
+  if(minLength < 2)
+    minLength = 2;
+  splitSegment(values, 0, n, minLength, minPerCent, changes, &nChanges, maxChanges);
+  return nChanges;
 }
 
 
-void printRTRecommendations() {
-  printf("\n== Regarding RealTime checks: ==\n");
-
-  printf("You will need to run it as root or use setuid.\n"
-         "If the kernel enables it, you can also use capabilities like this:\n"
-         "# sudo setcap cap_sys_nice+ep ./sbench\n"
-         "# sudo setcap cap_ipc_lock+ep ./sbench\n"
-         "Then you may also want to set permisions like this:\n"
-         "# chown root:nagios ./sbench\n"
-         "# chmod 0750 ./sbench\n"
-         "or use \"setfacl\":\n"
-         "# setfacl -m user:nagios:r-x ./sbench\n\n");
-
-  printf("You may want to read about 'System wide settings'"
-         " described in chapter 2.1 of 'Real-Time group scheduling' doc"
-         " from the Linux kernel"
-         " https://www.kernel.org/doc/Documentation/scheduler/sched-rt-group.txt "
-         " You may want to do as root something like:\n"
-         "echo \"-1\" > /proc/sys/kernel/sched_rt_runtime_us\n"
-         "it's risky but it will ensure that any non-realtime processes"
-         " won't steal CPU cycles to your RT tests.\n\n");
+/**
+  * Runs a test some times to get error bars: first the warmup runs,
+  * that are discarded, and then the measured ones. On adaptive mode
+  * it keeps repeating until the 95% confidence interval of the mean is
+  * narrow enough or the time budget runs out. With a rate the runs
+  * start on a schedule and each result includes how late it started,
+  * so it only makes sense for results that are times.
+  * A run that fails stops it, with the samples taken until then.
+  * @param measure runs the test once and gives its result, it returns
+  *        SBENCH_OK or why it failed
+  * @param samples return value, to be freed by the caller, NULL if
+  *        they can't be allocated
+  * @param n return value, number of samples
+  * @param ss return value, summary of the samples
+  * @return SBENCH_OK or why it failed, see sbenchFailTest
+  */
+int sbenchRepeatTest(repetition_params *rp, int (*measure)(void *, double *), void *arg,
+                     double **samples, size_t *n, sampleStats *ss, int verbose) {
+  double  *grown, start, width, value, late = 0;
+  uint64_t intended;
+  pacer    pc;
+  size_t   size;
+  int      err = SBENCH_OK;
+  unsigned long minReps = rp->repetitions;
+
+  *samples = NULL;
+  *n       = 0;
+  memset(ss, 0, sizeof(sampleStats));
+  if(rp->ciTargetPerCent > 0 && minReps == 0)
+    minReps = DEFAULT_MIN_REPETITIONS;
+  if(minReps == 0)
+    minReps = 1;
+  if(minReps > MAX_REPETITIONS)
+    minReps = MAX_REPETITIONS;
+
+  for(unsigned long i = 0; i < rp->warmup; i++) {
+    if((err = measure(arg, &value)) != SBENCH_OK)
+      return err;
+    if(verbose) printf("warmup #%lu: %f\n", i + 1, value);
+  }
+
+  size     = minReps;
+  *samples = (double *) malloc(size * sizeof(double));
+  if(*samples == NULL)
+    return sbenchFailTest(SBENCH_ERR_MEMORY, "Can't allocate the array of samples");
+
+  start = sbenchMonotonicSeconds();
+  if(rp->rate > 0)
+    sbenchPacerInit(&pc, rp->rate, 0);
+  while(*n < MAX_REPETITIONS) {
+    if(*n == size) {
+      if((grown = (double *) realloc(*samples, size * 2 * sizeof(double))) == NULL) {
+        err = sbenchFailTest(SBENCH_ERR_MEMORY, "Can't allocate the array of samples");
+        break;
+      }
+      *samples = grown;
+      size    *= 2;
+    }
+    if(rp->rate > 0) {
+      // a slow run delays the next ones, that count from when they were due
+      intended = sbenchPacerWait(&pc);
+      late     = sbenchTimerElapsed(intended, timerRead());
+    }
+    if((err = measure(arg, &value)) != SBENCH_OK)
+      break;
+    (*samples)[(*n)++] = value + late;
+    if(verbose) printf("repetition #%zu: %f\n", *n, (*samples)[*n - 1]);
+    if(*n < minReps)
+      continue;
+    if(rp->ciTargetPerCent <= 0)
+      break;
+
+    computeSampleStats(*samples, *n, ss);
+    width = ss->mean != 0 ? 100. * (ss->ciHigh - ss->mean) / fabs(ss->mean) : 0;
+    if(verbose) printf("  CI95 +-%.2f%% of the mean\n", width);
+    if(*n > 1 && width <= rp->ciTargetPerCent)
+      break;
+    if(rp->maxSeconds > 0 && sbenchMonotonicSeconds() - start >= rp->maxSeconds) {
+      if(verbose) printf("  time budget exhausted\n");
+      break;
+    }
+  }
+  computeSampleStats(*samples, *n, ss);
+  return err;
+}
+
+
+/**
+  * Gets the schedulling policy and priority of the current thread
+  * @return SBENCH_OK or SBENCH_ERR_REALTIME
+  */
+static int getRTSched(sched_params *p) {
+  struct sched_param sp;
+
+  if(sched_getparam(0, &sp) != 0)
+    return sbenchFailTest(SBENCH_ERR_REALTIME, "Error getting sched params with sched_getparam: %s",
+                          strerror(errno));
+  p->priority     = sp.sched_priority;
+  p->sched_policy = sched_getscheduler(0);
+  if(p->sched_policy == -1)
+    return sbenchFailTest(SBENCH_ERR_REALTIME, "Error getting thread's priority with sched_getscheduler: %s",
+                          strerror(errno));
+  return SBENCH_OK;
 }
 
 
 /**
   * Sets the schedulling policy and priority of the current thread
   * and unlocks it's memory space
+  * @return SBENCH_OK or SBENCH_ERR_REALTIME
   */
-void exitRealTime(sched_params p) {
-  sched_params r = getRTSched();
-
+int sbenchExitRealTime(sched_params p) {
   struct sched_param param;
   param.sched_priority = p.priority;
 
   // schedulling policy and priority
-  if(sched_setscheduler(0, p.sched_policy, &param) != 0) {
-    fputs("Error setting scheduling policy&priority with sched_setscheduler\n",
-          stderr);
-    printRTRecommendations();
-    exit(1);
-  }
-  
+  if(sched_setscheduler(0, p.sched_policy, &param) != 0)
+    return sbenchFailTest(SBENCH_ERR_REALTIME, "Error setting scheduling policy&priority with sched_setscheduler: %s",
+                          strerror(errno));
+
   // lock memory, both current and future
-  if(munlockall() != 0) {
-    fputs("Error unlocking memory with munlockall", stderr);
-    printRTRecommendations();
-    exit(-1);
-  }
+  if(munlockall() != 0)
+    return sbenchFailTest(SBENCH_ERR_REALTIME, "Error unlocking memory with munlockall: %s", strerror(errno));
+  return SBENCH_OK;
 }
  
 
 /**
   * Sets the schedulling policy and priority of the current thread
-  * and locks it's memory space
+  * and locks it's memory space. If it can't, the thread goes on as
+  * it was and the test fails, see "RealTime checks" on the README.
+  * @param saved return value, the policy and priority to go back to
+  *        with sbenchExitRealTime, even if it fails
+  * @return SBENCH_OK or SBENCH_ERR_REALTIME
   */
-sched_params enterRealTimeWithParams(sched_params p) {
-  sched_params r = getRTSched();
-
+static int enterRealTimeWithParams(sched_params p, sched_params *saved) {
   struct sched_param param;
-  param.sched_priority = p.priority;
+
+  saved->sched_policy = SCHED_OTHER;
+  saved->priority     = 0;
+  if(getRTSched(saved) != SBENCH_OK)
+    return SBENCH_ERR_REALTIME;
 
   // schedulling policy and priority
-  if(sched_setscheduler(0, p.sched_policy, &param) == -1) {
-    fputs("Error setting scheduling policy&priority with sched_setscheduler\n",
-          stderr);
-    printRTRecommendations();
-    exit(1);
-  }
-  
+  param.sched_priority = p.priority;
+  if(sched_setscheduler(0, p.sched_policy, &param) == -1)
+    return sbenchFailTest(SBENCH_ERR_REALTIME, "Error setting scheduling policy&priority with sched_setscheduler: %s"
+                          " (it needs root or cap_sys_nice)", strerror(errno));
+
   // lock memory, both current and future
-  if(mlockall(MCL_CURRENT|MCL_FUTURE) == -1) {
-    fputs("Error locking memory with mlockall", stderr);
-    exit(-1);
-  }
-  return r;
+  if(mlockall(MCL_CURRENT|MCL_FUTURE) == -1)
+    return sbenchFailTest(SBENCH_ERR_REALTIME, "Error locking memory with mlockall: %s (it needs root or cap_ipc_lock)",
+                          strerror(errno));
+  return SBENCH_OK;
 }
  
 
 /**
   * Sets the schedulling policy to RealTime of the current thread,
   * sets to a non-low priority and locks it's memory space
+  * @see enterRealTimeWithParams
   */
-sched_params enterRealTime() {
+int sbenchEnterRealTime(sched_params *saved) {
   sched_params p = {SCHED_FIFO, 49};
-  return enterRealTimeWithParams(p);
+  return enterRealTimeWithParams(p, saved);
 }
 
 
@@ -163,9 +640,10 @@ sched_params enterRealTime() {
   * then you may be looking for specs like these: https://www.spec.org/cpu/
   * 
   */
-void *cpuTestStartupRoutine(void *arg) {
+static void *cpuTestStartupRoutine(void *arg) {
   sched_params p;
-  struct timeval beginning, end;
+  uint64_t beginning, end;
+  perf_group pg;
   cpu_args_struct *args = (cpu_args_struct *) arg;
 
   // output is not serialized, so verbose mode will have an ugly look
@@ -176,21 +654,28 @@ void *cpuTestStartupRoutine(void *arg) {
 
   // Enter realtime if needed
   if(args->realtime == 1)
-    p = enterRealTime();
+    sbenchEnterRealTime(&p);
 
   // Let's work:
-  gettimeofday(&beginning, NULL);
+  sbenchPerfBegin(&pg);
+  beginning = timerRead();
   double x=2;
   for(long int i = 0; i < args->times; i++) {
     x=pow(x, x);
     x=pow(x, 1/(x-1));
+    if((i & (SAMPLE_CPU_BATCH - 1)) == SAMPLE_CPU_BATCH - 1) {
+      sampleCount(args->counters, SAMPLE_CPU_BATCH, 0, 0);
+      freqTick(args->probe);
+    }
   }
-  gettimeofday(&end, NULL);
-  args->delta=timeval_diff(&end, &beginning);
+  end = timerRead();
+  sampleCount(args->counters, args->times % SAMPLE_CPU_BATCH, 0, 0);
+  sbenchPerfEnd(&pg, args->times, "calc");
+  args->delta=sbenchTimerElapsed(beginning, end);
 
   // Exit realtime if entered previously
   if(args->realtime == 1)
-    exitRealTime(p);
+    sbenchExitRealTime(p);
 
   return NULL;
 }
@@ -202,15 +687,20 @@ void *cpuTestStartupRoutine(void *arg) {
   * @param nThreads Number of threads
   * @param verbose if verbose
   * @param realtime if realtime
-  * @return double Average time that took each thread to do it
+  * @param delta return value, average time that took each thread to do it
+  * @return SBENCH_OK or why it failed
   */
-double doCpuTest(unsigned long times, int nThreads, int verbose, int realtime) {
-  char msg[100];
-  double delta = 0;
+int sbenchDoCpuTest(unsigned long times, int nThreads, int verbose, int realtime, double *delta) {
+  sample_counters *counters;
+  freq_probe      *probes;
+  int err;
 
+  sbenchClearTestFailure();
+  *delta = 0;
   // Thread creation
-  pthread_t       *threads = (pthread_t *)       malloc(nThreads * sizeof(pthread_t));
   cpu_args_struct *args    = (cpu_args_struct *) malloc(nThreads * sizeof(cpu_args_struct));
+  if(args == NULL)
+    return sbenchFailTest(SBENCH_ERR_MEMORY, "Can't allocate the arguments of %d threads", nThreads);
 
   if(verbose) printf("Let's create %d threads:\n", nThreads);
 
@@ -221,87 +711,100 @@ double doCpuTest(unsigned long times, int nThreads, int verbose, int realtime) {
     args[i].realtime     = realtime,
     args[i].threadNumber = i;
     args[i].delta        = 0.;
-
-    if(pthread_create(&(threads[i]), NULL, cpuTestStartupRoutine, (void *) &args[i]) ) {
-      sprintf(msg, "Can't create the %d-th thread", i);
-      myAbort(msg);
-    }
   }
 
   if(verbose) printf("Threads created, waiting for completion...:\n");
+  counters = sbenchSamplerStart(nThreads);
+  probes   = sbenchFreqStart(nThreads);
+  for (int i = 0; i < nThreads; i++) {
+    args[i].counters = counters != NULL ? &counters[i] : NULL;
+    args[i].probe    = probes != NULL ? &probes[i] : NULL;
+  }
+  err = sbenchRunOnThreads(cpuTestStartupRoutine, args, sizeof(args[0]), nThreads);
+  sbenchFreqStop();
+  sbenchSamplerStop();
   for (int i = 0; i < nThreads; i++) {
-    if(pthread_join(threads[i], NULL)) {
-      sprintf(msg, "Can't join to %d-th thread", i);
-      myAbort(msg);
-    }
     if(verbose) printf("The thread #%d has finished with delta = %f\n", i, args[i].delta);
-    delta+=args[i].delta;
+    *delta+=args[i].delta;
   }
-  delta/=nThreads; // Average!!
-  free(threads);
+  *delta/=nThreads; // Average!!
   free(args);
 
-  return delta;
+  return err;
 }
 
 
-double doMemTest(unsigned long sizeInBytes, unsigned long times, int verbose, int realtime) {
+/**
+  * Allocates, sets and frees memory times.
+  * @param delta return value, seconds that it took
+  * @return SBENCH_OK or why it failed
+  */
+int sbenchDoMemTest(unsigned long sizeInBytes, unsigned long times, int verbose, int realtime, double *delta) {
   sched_params p;
-  char msg[100];
   char *cptr;
-  struct timeval beginning, end, before, after;
-  double delta;
+  uint64_t beginning, end, before, after, last;
+  perf_group pg;
+  sample_counters *counters;
 
+  sbenchClearTestFailure();
   // Enter realtime if needed
   if(realtime == 1)
-    p = enterRealTime();
+    sbenchEnterRealTime(&p);
 
-  gettimeofday(&beginning, NULL);
+  sbenchPerfBegin(&pg);
+  counters  = sbenchSamplerStart(1);
+  beginning = last = timerRead();
   for(int i = 0; i < times; i++) {
     /* Just VmSize, isn't VmRSS */
     /* It takes longer on first time. */
-    gettimeofday(&before, NULL);
+    before = timerRead();
     cptr = (char *) malloc(sizeInBytes);
     if(cptr == NULL) {
-      sprintf(msg, "Can't allocate %lu bytes on memory", sizeInBytes);
-      myAbort(msg);
+      sbenchFailTest(SBENCH_ERR_MEMORY, "Can't allocate %lu bytes on memory", sizeInBytes);
+      break;
     }
-    gettimeofday(&after, NULL);
-    delta=timeval_diff(&after, &before);
-    if(verbose) printf("* malloc : %f\n", delta);
+    after = timerRead();
+    *delta=sbenchTimerElapsed(before, after);
+    if(verbose) printf("* malloc : %f\n", *delta);
    
     /* VmRSS ! */
-    gettimeofday(&before, NULL);
+    before = timerRead();
     if(memset(cptr, 0xA5, sizeInBytes) == NULL) {
-      sprintf(msg, "Can't memset on those %lu bytes on memory", sizeInBytes);
-      myAbort(msg);
+      sbenchFailTest(SBENCH_ERR_MEMORY, "Can't memset on those %lu bytes on memory", sizeInBytes);
+      free(cptr);
+      break;
     }
-    gettimeofday(&after, NULL);
-    delta=timeval_diff(&after, &before);
-    if(verbose) printf("  memset : %f\n", delta);
+    after = timerRead();
+    *delta=sbenchTimerElapsed(before, after);
+    if(verbose) printf("  memset : %f\n", *delta);
   
-    gettimeofday(&before, NULL);
+    before = timerRead();
     free(cptr);
-    gettimeofday(&after, NULL);
-    delta=timeval_diff(&after, &before);
-    if(verbose) printf("  free   : %f\n", delta);
+    after = timerRead();
+    *delta=sbenchTimerElapsed(before, after);
+    if(verbose) printf("  free   : %f\n", *delta);
     //getchar();
+    sampleCount(counters, 1, sizeInBytes, (uint64_t) (sbenchTimerElapsed(last, after) * 1E9));
+    last = after;
   }
-  gettimeofday(&end, NULL);
-  delta=timeval_diff(&end, &beginning);
+  end = timerRead();
+  sbenchSamplerStop();
+  sbenchPerfEnd(&pg, (double) times * sizeInBytes / 4096, "4KiB page");
+  *delta=sbenchTimerElapsed(beginning, end);
 
   // Exit realtime if entered previously
   if(realtime == 1)
-    exitRealTime(p);
+    sbenchExitRealTime(p);
 
-  return delta;
+  return sbenchTestFailure();
 }
 
 
-void *diskWriteStartupRoutine(void *arg) {
+static void *diskWriteStartupRoutine(void *arg) {
   sched_params p;
-  char msg[100];
-  struct timeval beginning, end;
+  uint64_t beginning, end, intended = 0, last, now, ns;
+  perf_group pg;
+  pacer pc;
   int  fd;
   char fileName[PATH_MAX];
   char *buffer;
@@ -326,98 +829,115 @@ void *diskWriteStartupRoutine(void *arg) {
   if(access(fileName, F_OK) != -1 ) {
     sprintf(msg, "Ensure that the target file %s doesn't exist previously",
       fileName);
-    myAbort(msg);
+    sbenchMyAbort(msg);
   }
 */
 
-  // Allocate RAM for the block of sizeInBytes bytes
-  buffer=malloc(args->sizeInBytes);
+  // RAM for the block of sizeInBytes bytes, kept for the next tests
+  buffer=sbenchReusableBuffer(args->threadNumber, args->sizeInBytes);
   if(buffer == NULL) {
-    sprintf(msg, "Can't allocate %lu bytes for the buffer", args->sizeInBytes);
-    myAbort(msg);
+    sbenchFailTest(SBENCH_ERR_MEMORY, "Can't allocate %lu bytes for the buffer", args->sizeInBytes);
+    return NULL;
   }
   if(memset(buffer, 0xA5, args->sizeInBytes) == NULL) {
-    sprintf(msg, "Can't memset on the %lu bytes of the buffer", args->sizeInBytes);
-    myAbort(msg);
+    sbenchFailTest(SBENCH_ERR_MEMORY, "Can't memset on the %lu bytes of the buffer", args->sizeInBytes);
+    return NULL;
   }
 
   // open creating or truncating
   fd = open(fileName, O_CREAT | O_TRUNC | O_RDWR, S_IRUSR | S_IWUSR);
   if(fd == -1) {
-    sprintf(msg, "Can't open the target file %s for writing", fileName);
-    myAbort(msg);
+    sbenchFailTest(SBENCH_ERR_FILE, "Can't open the target file %s for writing", fileName);
+    return NULL;
   }
 
   // Enter realtime if needed
   if(args->realtime == 1)
-    p = enterRealTime();
+    sbenchEnterRealTime(&p);
 
   // loop for writing and storing (fflush+msync)
   if(args->verbose) printf("Let's write %lu bytes %lu types on %s\n",
                 args->sizeInBytes, args->times, fileName);
-  gettimeofday(&beginning, NULL);
+  sbenchPerfBegin(&pg);
+  beginning = timerRead();
+  if(args->rate > 0)
+    sbenchPacerInit(&pc, args->rate, args->rateOffset);
+  last = beginning;
   for(unsigned long i = 0; i < args->times; i++) {
+    if(args->rate > 0)
+      intended = sbenchPacerWait(&pc);
     // write
     if(write(fd, buffer, args->sizeInBytes) != args->sizeInBytes) {
-      sprintf(msg, "Can't write %lu bytes to %s", args->sizeInBytes, fileName);
-      myAbort(msg);
+      sbenchFailTest(SBENCH_ERR_IO, "Can't write %lu bytes to %s", args->sizeInBytes, fileName);
+      break;
     }
     /*
      * fsync for flushing all modified in-core data to the disk device.
      * This way we'll be able to send burst of BIOs if needed.
      */
     if(fsync(fd) != 0) {
-      sprintf(msg, "Can't flush after writing %lu-th block on %s", i, fileName);
-      myAbort(msg);
+      sbenchFailTest(SBENCH_ERR_IO, "Can't flush after writing %lu-th block on %s", i, fileName);
+      break;
+    }
+    if(args->rate > 0 || args->counters != NULL) {
+      now = timerRead();
+      // closed loop: since the previous one ended
+      ns  = (uint64_t) (sbenchTimerElapsed(args->rate > 0 ? intended : last, now) * 1E9);
+      if(args->rate > 0)
+        sbenchHistogramAdd(&args->latency, ns);
+      sampleCount(args->counters, 1, args->sizeInBytes, ns);
+      last = now;
     }
   }
-  gettimeofday(&end, NULL);
-  args->delta=timeval_diff(&end, &beginning);
+  end = timerRead();
+  sbenchPerfEnd(&pg, args->times, "block");
+  args->delta=sbenchTimerElapsed(beginning, end);
 
   // Exit realtime if entered previously
   if(args->realtime == 1)
-    enterRealTime(p);
+    sbenchExitRealTime(p);
 
   // close
-  if(close(fd) == -1) {
-    sprintf(msg, "Can't close the target file %s", fileName);
-    myAbort(msg);
-  }
+  if(close(fd) == -1)
+    sbenchFailTest(SBENCH_ERR_IO, "Can't close the target file %s", fileName);
 
   // delete the file
-  if(remove(fileName) != 0) {
-    sprintf(msg, "Can't delete the target file %s after the test", fileName);
-    myAbort(msg);
-  }
-
-  // free the buffer
-  free(buffer);
+  if(remove(fileName) != 0)
+    sbenchFailTest(SBENCH_ERR_FILE, "Can't delete the target file %s after the test", fileName);
 
   return NULL;
 }
 
 
-double doDiskWriteTest(unsigned long sizeInBytes, unsigned long times, unsigned int nThreads, char *folderName, int verbose, int realtime) {
-  char msg[100];
-  double delta = 0;
+/**
+  * Writes and flushes blocks on a file per thread.
+  * @param rate total blocks per second of all the threads,
+  *        0 == as fast as possible
+  * @param latency return value if rate > 0, latency of each block
+  *        from its intended start
+  * @param delta return value, average time that took each thread
+  * @return SBENCH_OK or why it failed
+  */
+int sbenchDoDiskWriteTest(unsigned long sizeInBytes, unsigned long times, unsigned int nThreads, char *folderName, double rate, latencyHistogram *latency, int verbose, int realtime, double *delta) {
+  sample_counters *counters;
+  int err;
 
+  sbenchClearTestFailure();
+  *delta = 0;
   struct stat s = {0};
   if(stat(folderName, &s) == 0)  {
-    if(! S_ISDIR(s.st_mode))  {
-      sprintf(msg, "%s must be a folder", folderName);
-      myAbort(msg);
-    }
+    if(! S_ISDIR(s.st_mode))
+      return sbenchFailTest(SBENCH_ERR_PARAMS, "%s must be a folder", folderName);
   }
   else {
-    if(mkdir(folderName, 0700) != 0) {
-      sprintf(msg, "Can't create the folder %s", folderName);
-      myAbort(msg);
-    }
+    if(mkdir(folderName, 0700) != 0)
+      return sbenchFailTest(SBENCH_ERR_FILE, "Can't create the folder %s", folderName);
   }
 
   // Thread creation
-  pthread_t      *threads = (pthread_t *)      malloc(nThreads * sizeof(pthread_t));
   dw_args_struct *args    = (dw_args_struct *) malloc(nThreads * sizeof(dw_args_struct));
+  if(args == NULL)
+    return sbenchFailTest(SBENCH_ERR_MEMORY, "Can't allocate the arguments of %u threads", nThreads);
 
   if(verbose) printf("Let's create %d threads:\n", nThreads);
 
@@ -429,32 +949,35 @@ double doDiskWriteTest(unsigned long sizeInBytes, unsigned long times, unsigned
     args[i].verbose      = verbose,
     args[i].realtime     = realtime,
     args[i].threadNumber = i,
+    args[i].rate         = rate / nThreads,
+    args[i].rateOffset   = rate > 0 ? i / rate : 0,
     args[i].delta        = 0.;
-
-    if(pthread_create(&(threads[i]), NULL, diskWriteStartupRoutine, (void *) &args[i]) ) {
-      sprintf(msg, "Can't create the %d-th thread", i);
-      myAbort(msg);
-    }
+    memset(&args[i].latency, 0, sizeof(latencyHistogram));
   }
 
   if(verbose) printf("Threads created, waiting for completion...:\n");
+  counters = sbenchSamplerStart(nThreads);
+  for (int i = 0; i < nThreads; i++)
+    args[i].counters = counters != NULL ? &counters[i] : NULL;
+  err = sbenchRunOnThreads(diskWriteStartupRoutine, args, sizeof(args[0]), nThreads);
+  sbenchSamplerStop();
   for (int i = 0; i < nThreads; i++) {
-    if(pthread_join(threads[i], NULL)) {
-      sprintf(msg, "Can't join to %d-th thread", i);
-      myAbort(msg);
-    }
     if(verbose) printf("The thread #%d has finished with delta = %f\n", i, args[i].delta);
-    delta+=args[i].delta;
+    *delta+=args[i].delta;
+  }
+  *delta/=nThreads; // Average!!
+  if(rate > 0 && latency != NULL) {
+    for (int i = 1; i < nThreads; i++)
+      sbenchHistogramMerge(&args[0].latency, &args[i].latency);
+    memcpy(latency, &args[0].latency, sizeof(latencyHistogram));
   }
-  delta/=nThreads; // Average!!
-  free(threads);
   free(args);
 
-  return delta;
+  return err != SBENCH_OK ? err : sbenchTestFailure();
 }
 
 
-void shuffle(unsigned long *array, size_t n) {
+static void shuffle(unsigned long *array, size_t n) {
   if (n > 1) {
     size_t i;
     for (i = 0; i < n - 1; i++) {
@@ -466,17 +989,18 @@ void shuffle(unsigned long *array, size_t n) {
   }
 }
 
-void *diskReadStartupRoutine(void *arg) {
+static void *diskReadStartupRoutine(void *arg) {
   sched_params p;
-  char msg[100];
-  struct timeval beginning, end;
+  uint64_t beginning, end, intended = 0, last, now, ns;
+  perf_group pg;
+  pacer pc;
   double delta;
   int  fd;      // Each thread must have its own file descriptor for the file
   char *buffer;
   dr_args_struct *args = (dr_args_struct *) arg;
   unsigned long position;
   unsigned long position2;
-  unsigned long *positions;
+  unsigned long *positions = NULL;
 
   if(args->verbose) printf("Thread #%d started:\n", args->threadNumber);
   if(args->verbose) printf("Thread #%d started, with first byte of first bloc: %lu\n", args->threadNumber, args->blocks[args->threadNumber * args->times] * args->sizeInBytes );
@@ -485,6 +1009,10 @@ void *diskReadStartupRoutine(void *arg) {
   // create the array with positions to read, case DISK_R_RAN
   if(args->type == DISK_R_RAN) {
     positions = (unsigned long *) malloc(sizeof(unsigned long) * args->times);
+    if(positions == NULL) {
+      sbenchFailTest(SBENCH_ERR_MEMORY, "Can't allocate the positions of %lu blocks", args->times);
+      return NULL;
+    }
     for(unsigned long i = 0; i < args->times; i++) {
       position  = args->threadNumber * args->times + i;
       position2 = args->blocks[position] * args->sizeInBytes;
@@ -495,22 +1023,25 @@ void *diskReadStartupRoutine(void *arg) {
 
   // The file must exist previously
   if(access(args->targetFileName, F_OK) == -1 ) {
-    sprintf(msg, "Can't find the target file %s", args->targetFileName);
-    myAbort(msg);
+    sbenchFailTest(SBENCH_ERR_FILE, "Can't find the target file %s", args->targetFileName);
+    free(positions);
+    return NULL;
   }
 
-  // Allocate RAM for the block of sizeInBytes bytes
-  buffer=malloc(args->sizeInBytes);
+  // RAM for the block of sizeInBytes bytes, kept for the next tests
+  buffer=sbenchReusableBuffer(args->threadNumber, args->sizeInBytes);
   if(buffer == NULL) {
-    sprintf(msg, "Can't allocate %lu bytes for the buffer", args->sizeInBytes);
-    myAbort(msg);
+    sbenchFailTest(SBENCH_ERR_MEMORY, "Can't allocate %lu bytes for the buffer", args->sizeInBytes);
+    free(positions);
+    return NULL;
   }
 
   // open file
   fd = open(args->targetFileName, O_RDONLY);
   if(fd == -1) {
-    sprintf(msg, "Can't open the target file %s for reading", args->targetFileName);
-    myAbort(msg);
+    sbenchFailTest(SBENCH_ERR_FILE, "Can't open the target file %s for reading", args->targetFileName);
+    free(positions);
+    return NULL;
   }
 
   if(args->verbose)
@@ -519,17 +1050,23 @@ void *diskReadStartupRoutine(void *arg) {
 
   // Enter realtime if needed
   if(args->realtime == 1)
-    p = enterRealTime();
+    sbenchEnterRealTime(&p);
 
   // loop for reading
-  gettimeofday(&beginning, NULL);
+  sbenchPerfBegin(&pg);
+  beginning = timerRead();
+  if(args->rate > 0)
+    sbenchPacerInit(&pc, args->rate, args->rateOffset);
+  last = beginning;
   for(unsigned long i = 0; i < args->times; i++) {
+    if(args->rate > 0)
+      intended = sbenchPacerWait(&pc);
     // lseek for random read if DISK_R_RAN is choosen
     if(args->type == DISK_R_RAN) {
       // printf("Thread %d, iteration %lu: lseek to byte #%lu\n", args->threadNumber, i, positions[i]);
       if(lseek(fd, positions[i], SEEK_SET) == -1) {
-        sprintf(msg, "Can't lseek to reposition to %lu byte before reading on random-access to %s on %lu-th iteration", position2, args->targetFileName, i);
-        myAbort(msg);
+        sbenchFailTest(SBENCH_ERR_IO, "Can't lseek to reposition to %lu byte before reading on random-access to %s on %lu-th iteration", positions[i], args->targetFileName, i);
+        break;
       }
     }
 
@@ -538,28 +1075,33 @@ void *diskReadStartupRoutine(void *arg) {
     // format: %zd for ssize_t
     if(args->verbose) printf("Thread #%d read %zd bytes on %lu-th iteration\n", args->threadNumber, ret_in, i);
     if(ret_in != args->sizeInBytes) {
-      sprintf(msg, "Read just %zd bytes from %s on %lu-th iteration", ret_in, args->targetFileName, i);
-      myAbort(msg);
+      sbenchFailTest(SBENCH_ERR_IO, "Read just %zd bytes from %s on %lu-th iteration", ret_in, args->targetFileName, i);
+      break;
+    }
+    if(args->rate > 0 || args->counters != NULL) {
+      now = timerRead();
+      // closed loop: since the previous one ended
+      ns  = (uint64_t) (sbenchTimerElapsed(args->rate > 0 ? intended : last, now) * 1E9);
+      if(args->rate > 0)
+        sbenchHistogramAdd(&args->latency, ns);
+      sampleCount(args->counters, 1, args->sizeInBytes, ns);
+      last = now;
     }
   }
-  gettimeofday(&end, NULL);
-  delta=timeval_diff(&end, &beginning);
+  end = timerRead();
+  sbenchPerfEnd(&pg, args->times, "block");
+  delta=sbenchTimerElapsed(beginning, end);
 
   // Exit realtime if entered previously
   if(args->realtime == 1)
-    exitRealTime(p);
+    sbenchExitRealTime(p);
 
   // close file
-  if(close(fd) == -1) {
-    sprintf(msg, "Can't close the target file %s", args->targetFileName);
-    myAbort(msg);
-  }
+  if(close(fd) == -1)
+    sbenchFailTest(SBENCH_ERR_IO, "Can't close the target file %s", args->targetFileName);
 
-  // let's free the buffer and the array with positions
-  free(buffer);
-  if(args->type == DISK_R_RAN) {
-    free(positions);
-  }
+  // let's free the array with positions
+  free(positions);
 
   // return value
   args->delta=delta;
@@ -576,35 +1118,43 @@ void *diskReadStartupRoutine(void *arg) {
   * * creates "nThreads" threads
   * * asks each thread to read "times" of those positions
   * The result is a random concurrent access to that single file.
+  * @param delta return value, average time that took each thread
+  * @return SBENCH_OK or why it failed
   */
-double doDiskReadTest(enum btype thisType, unsigned long sizeInBytes, unsigned long times, int nThreads, char *targetFileName, int verbose, int realtime) {
-  sched_params p;
-  char msg[100];
-  double delta;
+int sbenchDoDiskReadTest(enum btype thisType, unsigned long sizeInBytes, unsigned long times, int nThreads, char *targetFileName, double rate, latencyHistogram *latency, int verbose, int realtime, double *delta) {
   unsigned long *blocks;
+  sample_counters *counters;
+  int err;
+
+  sbenchClearTestFailure();
+  *delta = 0;
+  // check file size
+  struct stat s;
+  if(stat(targetFileName, &s) != 0)
+    return sbenchFailTest(SBENCH_ERR_FILE, "Can't find the target file %s", targetFileName);
+  if(s.st_size < times*nThreads*sizeInBytes) {
+    // format: %jd (intmax_t) for off_t
+    return sbenchFailTest(SBENCH_ERR_PARAMS, "The size of the file %s is %jd bytes" \
+                          " and must be greater or equal to %lu*%d*%lu bytes",
+                          targetFileName, (intmax_t) s.st_size, times,
+                          nThreads, sizeInBytes);
+  }
 
   // allocate the array that will contain the block positions of the file
   blocks = (unsigned long *) malloc(sizeof(unsigned long) * times * nThreads);
+  if(blocks == NULL)
+    return sbenchFailTest(SBENCH_ERR_MEMORY, "Can't allocate the positions of %lu blocks", times * nThreads);
   for(unsigned long i = 0; i < times * nThreads; i++) {
     blocks[i] = i;
   }
   shuffle(blocks, times * nThreads);
 
-  // check file size
-  struct stat s;
-  stat(targetFileName, &s);
-  if(s.st_size < times*nThreads*sizeInBytes) {
-    // format: %jd (intmax_t) for off_t
-    sprintf(msg, "The size of the file %s is %jd bytes" \
-                 " and must be greater or equal to %lu*%d*%lu bytes",
-                 targetFileName, (intmax_t) s.st_size, times,
-                 nThreads, sizeInBytes);
-    myAbort(msg);
-  }
-
   // Thread creation
-  pthread_t      *threads = (pthread_t *)      malloc(nThreads * sizeof(pthread_t));
   dr_args_struct *args    = (dr_args_struct *) malloc(nThreads * sizeof(dr_args_struct));
+  if(args == NULL) {
+    free(blocks);
+    return sbenchFailTest(SBENCH_ERR_MEMORY, "Can't allocate the arguments of %d threads", nThreads);
+  }
 
   if(verbose) printf("Let's create %d threads:\n", nThreads);
 
@@ -618,62 +1168,276 @@ double doDiskReadTest(enum btype thisType, unsigned long sizeInBytes, unsigned l
     args[i].realtime       = realtime,
     args[i].threadNumber   = i,
     args[i].blocks         = blocks,
+    args[i].rate           = rate / nThreads,
+    args[i].rateOffset     = rate > 0 ? i / rate : 0,
     args[i].delta          = 0.;
-
-    if(pthread_create(&(threads[i]), NULL, diskReadStartupRoutine, (void *) &args[i]) ) {
-      sprintf(msg, "Can't create the %d-th thread", i);
-      myAbort(msg);
-    }
+    memset(&args[i].latency, 0, sizeof(latencyHistogram));
   }
 
   // sit back and enjoy
   if(verbose) printf("All threads created, waiting for its completion...:\n");
+  counters = sbenchSamplerStart(nThreads);
+  for (int i = 0; i < nThreads; i++)
+    args[i].counters = counters != NULL ? &counters[i] : NULL;
+  err = sbenchRunOnThreads(diskReadStartupRoutine, args, sizeof(args[0]), nThreads);
+  sbenchSamplerStop();
   for (int i = 0; i < nThreads; i++) {
-    if(pthread_join(threads[i], NULL)) {
-      sprintf(msg, "Can't join to %d-th thread", i);
-      myAbort(msg);
-    }
     if(verbose) printf("Thread #%d finished with delta = %f\n", i, args[i].delta);
-    delta+=args[i].delta;
+    *delta+=args[i].delta;
+  }
+  *delta/=nThreads; // Average!!
+  if(rate > 0 && latency != NULL) {
+    for (int i = 1; i < nThreads; i++)
+      sbenchHistogramMerge(&args[0].latency, &args[i].latency);
+    memcpy(latency, &args[0].latency, sizeof(latencyHistogram));
   }
-  delta/=nThreads; // Average!!
-  free(threads);
   free(args);
-  return delta;
+  free(blocks);
+  return err != SBENCH_OK ? err : sbenchTestFailure();
+}
+
+
+/** SHA-256 round constants */
+static const uint32_t sha256K[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define SHA256_ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256Block(sha256_ctx *c, const unsigned char *b) {
+  uint32_t w[64], s[8], t1, t2;
+
+  for(int i = 0; i < 16; i++)
+    w[i] = (uint32_t) b[i*4] << 24 | (uint32_t) b[i*4+1] << 16 |
+           (uint32_t) b[i*4+2] << 8 | (uint32_t) b[i*4+3];
+  for(int i = 16; i < 64; i++)
+    w[i] = w[i-16] + w[i-7] +
+           (SHA256_ROTR(w[i-15], 7) ^ SHA256_ROTR(w[i-15], 18) ^ (w[i-15] >> 3)) +
+           (SHA256_ROTR(w[i-2], 17) ^ SHA256_ROTR(w[i-2], 19) ^ (w[i-2] >> 10));
+  memcpy(s, c->state, sizeof(s));
+  for(int i = 0; i < 64; i++) {
+    t1 = s[7] + (SHA256_ROTR(s[4], 6) ^ SHA256_ROTR(s[4], 11) ^ SHA256_ROTR(s[4], 25)) +
+         ((s[4] & s[5]) ^ (~s[4] & s[6])) + sha256K[i] + w[i];
+    t2 = (SHA256_ROTR(s[0], 2) ^ SHA256_ROTR(s[0], 13) ^ SHA256_ROTR(s[0], 22)) +
+         ((s[0] & s[1]) ^ (s[0] & s[2]) ^ (s[1] & s[2]));
+    memmove(s + 1, s, 7 * sizeof(uint32_t));
+    s[4] += t1;
+    s[0]  = t1 + t2;
+  }
+  for(int i = 0; i < 8; i++)
+    c->state[i] += s[i];
 }
 
+static void sha256Init(sha256_ctx *c) {
+  static const uint32_t h0[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                                 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+  memcpy(c->state, h0, sizeof(h0));
+  c->length = 0;
+  c->used   = 0;
+}
+
+static void sha256Update(sha256_ctx *c, const unsigned char *data, size_t len) {
+  c->length += len;
+  while(len > 0) {
+    size_t n = 64 - c->used < len ? 64 - c->used : len;
+    memcpy(c->buffer + c->used, data, n);
+    c->used += n;
+    data    += n;
+    len     -= n;
+    if(c->used == 64) {
+      sha256Block(c, c->buffer);
+      c->used = 0;
+    }
+  }
+}
 
-size_t writeToFile(void *ptr, size_t size, size_t nmemb, FILE *stream) {
-    size_t written = fwrite(ptr, size, nmemb, stream);
-    return written;
+static void sha256Final(sha256_ctx *c, unsigned char digest[32]) {
+  uint64_t bits = c->length * 8;
+  unsigned char pad = 0x80, zero = 0, len[8];
+
+  sha256Update(c, &pad, 1);
+  while(c->used != 56)
+    sha256Update(c, &zero, 1);
+  for(int i = 0; i < 8; i++)
+    len[i] = bits >> (56 - 8 * i);
+  sha256Update(c, len, 8);
+  for(int i = 0; i < 32; i++)
+    digest[i] = c->state[i / 4] >> (24 - 8 * (i % 4));
 }
 
 
 /**
-  * Compare two files
-  * 
-  * @arg FILE* stream open to first file
-  * @arg FILE* stream open to second file
-  * @return int 0 if are equal, 1 if are different
+  * libcurl write callback: verifies each chunk of the body as it arrives,
+  * so that nothing is written to disk. It compares it with the mmap'ed
+  * reference or feeds the SHA-256 of the stream when the reference is
+  * a digest.
   */
-int compare(FILE *fp1, FILE *fp2) {
-  char c1, c2;
-  int areDifferent = 0; // 0 ok, 1 differences found
-
-  while (((c1 = fgetc(fp1)) != EOF) &&((c2 = fgetc(fp2)) != EOF)) {
-    /* character by character comparision until end of file */
-    // printf("Comparing %c == %c\n", c1, c2);
-    if (c1 == c2)
-      continue;
-    /*
-      * If not equal then returns the byte position
-      */
-    else {
-      areDifferent = 1;
-      break;
+static size_t verifyChunk(void *ptr, size_t size, size_t nmemb, void *userdata) {
+  httpVerifier *v = (httpVerifier *) userdata;
+  size_t n = size * nmemb;
+
+  if(v->ref != NULL || v->refSize == 0) {
+    if(! v->different &&
+         (v->received + n > v->refSize ||
+          memcmp(v->ref + v->received, ptr, n) != 0))
+      v->different = 1;
+  }
+  else {
+    sha256Update(&v->sha, ptr, n);
+  }
+  v->received += n;
+  return n;
+}
+
+
+/**
+  * Prepares the verification of an HTTP body against its reference
+  * at CURL_REFS_FOLDER. The reference can be the expected file itself,
+  * that will be mmap'ed, or its SHA-256 digest in "<name>.sha256"
+  * as written by "sha256sum".
+  * @return SBENCH_OK or why it failed
+  */
+static int openHttpVerifier(httpVerifier *v, char *httpRefFileBasename, int verbose) {
+  char refFilePath[PATH_MAX];
+  char hex[65];
+  FILE *digestStream;
+  struct stat s;
+  int fd;
+
+  memset(v, 0, sizeof(httpVerifier));
+
+  sprintf(refFilePath, "%s/%s", CURL_REFS_FOLDER, httpRefFileBasename);
+  if(access(refFilePath, F_OK) == -1) {
+    // no plain reference, let's look for its digest
+    sprintf(refFilePath, "%s/%s.sha256", CURL_REFS_FOLDER, httpRefFileBasename);
+    if(verbose) printf("Using digest refFilePath = %s\n", refFilePath);
+    digestStream = fopen(refFilePath, "r");
+    if(digestStream == NULL)
+      return sbenchFailTest(SBENCH_ERR_FILE, "Can't open the reference file %s/%s nor its digest %s",
+                            CURL_REFS_FOLDER, httpRefFileBasename, refFilePath);
+    if(fscanf(digestStream, "%64s", hex) != 1 || strlen(hex) != 64) {
+      fclose(digestStream);
+      return sbenchFailTest(SBENCH_ERR_FILE, "Can't read a SHA-256 digest from %s", refFilePath);
+    }
+    fclose(digestStream);
+    for(int i = 0; i < 32; i++) {
+      if(sscanf(hex + 2 * i, "%2hhx", &v->digest[i]) != 1)
+        return sbenchFailTest(SBENCH_ERR_FILE, "Can't parse the SHA-256 digest from %s", refFilePath);
     }
+    v->refSize = (size_t) -1; // unknown, the digest covers it
+    sha256Init(&v->sha);
+    return SBENCH_OK;
+  }
+
+  if(verbose) printf("Using refFilePath = %s\n", refFilePath);
+  fd = open(refFilePath, O_RDONLY);
+  if(fd == -1 || fstat(fd, &s) != 0) {
+    if(fd != -1)
+      close(fd);
+    return sbenchFailTest(SBENCH_ERR_FILE, "Can't open the reference file %s", refFilePath);
   }
-  return areDifferent;
+  v->refSize = s.st_size;
+  if(v->refSize > 0) {
+    v->ref = mmap(NULL, v->refSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(v->ref == MAP_FAILED) {
+      v->ref = NULL;
+      close(fd);
+      return sbenchFailTest(SBENCH_ERR_FILE, "Can't mmap the reference file %s", refFilePath);
+    }
+    // it will be read just once and sequentially
+    madvise((void *) v->ref, v->refSize, MADV_SEQUENTIAL);
+  }
+  close(fd);
+  return SBENCH_OK;
+}
+
+
+/**
+  * Finishes the verification of an HTTP body and releases the reference
+  * @return int 0 if body and reference are equal, 1 if are different
+  */
+static int closeHttpVerifier(httpVerifier *v) {
+  unsigned char digest[32];
+
+  if(v->ref != NULL || v->refSize == 0) {
+    if(v->received != v->refSize)
+      v->different = 1;
+    if(v->ref != NULL)
+      munmap((void *) v->ref, v->refSize);
+  }
+  else {
+    sha256Final(&v->sha, digest);
+    v->different = memcmp(digest, v->digest, sizeof(digest)) != 0;
+  }
+  return v->different;
+}
+
+
+/**
+  * Reads one of the cumulative timers of a finished libcurl transfer.
+  * Uses the microsecond-precision *_TIME_T infos when libcurl has them
+  * (>= 7.61.0) and the older double ones otherwise.
+  * @return seconds since the start of the transfer
+  */
+static double curlTimer(CURL *curl, CURLINFO info) {
+#if LIBCURL_VERSION_NUM >= 0x073d00
+  curl_off_t us = 0;
+  if(curl_easy_getinfo(curl, info, &us) != CURLE_OK)
+    return 0.;
+  return us / 1000000.;
+#else
+  double s = 0.;
+  if(curl_easy_getinfo(curl, info, &s) != CURLE_OK)
+    return 0.;
+  return s;
+#endif
+}
+
+
+/**
+  * Splits the cumulative libcurl timers of a finished transfer
+  * into the duration of each phase: DNS, TCP connect, TLS handshake,
+  * time to first byte (server think time) and body transfer.
+  */
+static void getHttpPhases(CURL *curl, httpResponse *hr) {
+  double nameLookup, connect, appConnect, startTransfer, total;
+
+#if LIBCURL_VERSION_NUM >= 0x073d00
+  nameLookup    = curlTimer(curl, CURLINFO_NAMELOOKUP_TIME_T);
+  connect       = curlTimer(curl, CURLINFO_CONNECT_TIME_T);
+  appConnect    = curlTimer(curl, CURLINFO_APPCONNECT_TIME_T);
+  startTransfer = curlTimer(curl, CURLINFO_STARTTRANSFER_TIME_T);
+  total         = curlTimer(curl, CURLINFO_TOTAL_TIME_T);
+  curl_off_t speed = 0;
+  curl_easy_getinfo(curl, CURLINFO_SPEED_DOWNLOAD_T, &speed);
+  hr->speedDownload = speed;
+#else
+  nameLookup    = curlTimer(curl, CURLINFO_NAMELOOKUP_TIME);
+  connect       = curlTimer(curl, CURLINFO_CONNECT_TIME);
+  appConnect    = curlTimer(curl, CURLINFO_APPCONNECT_TIME);
+  startTransfer = curlTimer(curl, CURLINFO_STARTTRANSFER_TIME);
+  total         = curlTimer(curl, CURLINFO_TOTAL_TIME);
+  hr->speedDownload = 0.;
+  curl_easy_getinfo(curl, CURLINFO_SPEED_DOWNLOAD, &hr->speedDownload);
+#endif
+
+  // appConnect stays at 0 on plain HTTP, there's no TLS handshake then
+  if(appConnect < connect)
+    appConnect = connect;
+
+  hr->phase[HTTP_DNS]      = nameLookup;
+  hr->phase[HTTP_CONNECT]  = connect - nameLookup;
+  hr->phase[HTTP_TLS]      = appConnect - connect;
+  hr->phase[HTTP_TTFB]     = startTransfer - appConnect;
+  hr->phase[HTTP_TRANSFER] = total - startTransfer;
+  hr->phase[HTTP_TOTAL]    = total;
 }
 
 
@@ -682,51 +1446,23 @@ int compare(FILE *fp1, FILE *fp2) {
   * because it would add latency unnecessarily and the results would get biased
   * 
   * Done using libcurl: https://curl.haxx.se/libcurl/c/
+  *
+  * @param hr return value, the duration of each phase of the transfer,
+  *        the "total" phase is measured around curl_easy_perform
+  * @return SBENCH_OK or why it failed
   */
-double httpGet(char *url, char *httpRefFileBasename, int *different, int verbose, int realtime) {
+int sbenchHttpGet(char *url, char *httpRefFileBasename, int *different, int verbose, int realtime, httpResponse *hr) {
   sched_params p;
   CURL *curl;
   CURLcode res;
-  char msg[100];
-  int  fd;
-  FILE *fds;
-  FILE *refFileStream;
-  char fileNameTemplate[PATH_MAX];
-  char refFilePath[PATH_MAX];
-  struct timeval beginning, end;
-  double delta;
+  httpVerifier verifier;
+  uint64_t beginning, end;
 
-  // get TMPDIR , TMP , TEMP , TEMPDIR ... /tmp/
-  char const *tmpfolder = getenv("TMPDIR");
-  if (tmpfolder == 0) {
-    tmpfolder = getenv("TMP");
-    if (tmpfolder == 0) {
-      tmpfolder = getenv("TEMP");
-      if (tmpfolder == 0) {
-        tmpfolder = getenv("TEMPDIR");
-        if (tmpfolder == 0) {
-          // last chance, /tmp hardcoded
-          tmpfolder = "/tmp";
-        }
-      }
-    }
-  }
-
-  // get temporary file
-  sprintf(fileNameTemplate, "%s/_sbench.libcurl.XXXXXX", tmpfolder);
-  fd = mkstemp(fileNameTemplate);
-  if(verbose) printf("Using temporary file %s\n", fileNameTemplate);
-
-  // get a stream from the file descriptor
-  fds = fdopen(fd, "w");
-  if(fds == NULL) {
-    sprintf(msg, "Can't re-open (r) the stream of the output of libcurl %s", fileNameTemplate);
-    myAbort(msg);
-  }
-
-  // get the reference file
-  sprintf(refFilePath, "%s/%s", CURL_REFS_FOLDER, httpRefFileBasename);
-  if(verbose) printf("Using refFilePath = %s\n", refFilePath);
+  sbenchClearTestFailure();
+  memset(hr, 0, sizeof(httpResponse));
+  // get the reference, the body will be verified against it while arriving
+  if(openHttpVerifier(&verifier, httpRefFileBasename, verbose) != SBENCH_OK)
+    return sbenchTestFailure();
 
   // http://stackoverflow.com/questions/1636333/download-file-using-libcurl-in-c-c
  
@@ -757,82 +1493,51 @@ double httpGet(char *url, char *httpRefFileBasename, int *different, int verbose
      * CURLOPT_FOLLOWLOCATION will be disabled (by default):
      */
     curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, writeToFile);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, fds);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, verifyChunk);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &verifier);
 
     // Enter realtime if needed
     if(realtime == 1)
-      p = enterRealTime();
+      sbenchEnterRealTime(&p);
  
     // Perform the request, res will get the return code
-    gettimeofday(&beginning, NULL);
+    beginning = timerRead();
     res = curl_easy_perform(curl);
-    gettimeofday(&end, NULL);
-    delta=timeval_diff(&end, &beginning);
+    end = timerRead();
 
     // Exit realtime if entered previously
     if(realtime == 1)
-      exitRealTime(p);
+      sbenchExitRealTime(p);
 
     // Check for errors
     if(res != CURLE_OK) {
-      sprintf(msg, "curl_easy_perform() failed: %s\n", curl_easy_strerror(res));
-      myAbort(msg);
+      curl_easy_cleanup(curl);
+      closeHttpVerifier(&verifier);
+      return sbenchFailTest(SBENCH_ERR_HTTP, "curl_easy_perform() failed: %s", curl_easy_strerror(res));
     }
 
+    getHttpPhases(curl, hr);
+    hr->phase[HTTP_TOTAL] = sbenchTimerElapsed(beginning, end);
+    if(verbose) printf("HTTP phases: dns=%.6f connect=%.6f tls=%.6f "
+                       "ttfb=%.6f transfer=%.6f total=%.6f s, %.0f B/s\n",
+                       hr->phase[HTTP_DNS], hr->phase[HTTP_CONNECT],
+                       hr->phase[HTTP_TLS], hr->phase[HTTP_TTFB],
+                       hr->phase[HTTP_TRANSFER], hr->phase[HTTP_TOTAL],
+                       hr->speedDownload);
+
     /* cleanup libcurl stuff */ 
     curl_easy_cleanup(curl);
 
     // Compare with the reference
-    refFileStream = fopen(refFilePath, "r");
-    if(refFileStream == NULL) {
-      fclose(fds); // let's try to close blindly
-      sprintf(msg, "Can't open the reference file %s", refFilePath);
-      myAbort(msg);
-    }
-
-    /*
-     * Let's reopen libcurl's output just to compare with the reference:
-     * Don't know why rewinding the stream doesn't work.
-     */
-
-    // close the file stream fed by libcurl
-    if(fclose(fds) != 0) {
-      sprintf(msg, "Can't close (w) the stream of the output of libcurl %s", fileNameTemplate);
-      myAbort(msg);
-    }
-
-    // reopen the file stream previously fed by libcurl
-    fds = fopen(fileNameTemplate, "r");
-    if(fds == NULL) {
-      sprintf(msg, "Can't re-open (r) the stream of the output of libcurl %s", fileNameTemplate);
-      myAbort(msg);
-    }
-
-    // compare both files
-    *different = compare(refFileStream, fds);
-
-    // Close the file streams
-    if(fclose(fds) != 0) {
-      sprintf(msg, "Can't close (r) the stream of the output of libcurl %s", fileNameTemplate);
-      myAbort(msg);
-    }
-    if(fclose(refFileStream) != 0) {
-      sprintf(msg, "Can't close the stream of the reference file %s", refFilePath);
-      myAbort(msg);
-    }
-
-    // remove the temporary file
-    if(remove(fileNameTemplate) != 0) {
-      sprintf(msg, "Can't delete the target file %s after the test", fileNameTemplate);
-      myAbort(msg);
-    }
+    *different = closeHttpVerifier(&verifier);
+    if(verbose) printf("Received %zu bytes, %s the reference\n",
+                       verifier.received, *different ? "different from" : "equal to");
   }
   else {
-    sprintf(msg, "Can't get a libcurl handler for %s", url);
-    myAbort(msg);
+    closeHttpVerifier(&verifier);
+    return sbenchFailTest(SBENCH_ERR_HTTP, "Can't get a libcurl handler for %s", url);
   }
-  return delta;
+  return sbenchTestFailure();
 }
 
 #ifdef OPING_ENABLED
@@ -848,9 +1553,11 @@ double httpGet(char *url, char *httpRefFileBasename, int *different, int verbose
   * To avoid having to run it as root (sudo or setuid)
   *   you can simply "setcap cap_net_raw=ep /opt/sbench/sbench"
   *
+  * The native engine (sbenchnet.c) is used when it's not enabled.
+  *
   * @seeAlso https://github.com/octo/liboping/
   */
-pingResponse doPing(unsigned long sizeInBytes, unsigned long times, char *dest,
+pingResponse sbenchDoPing(unsigned long sizeInBytes, unsigned long times, unsigned long intervalMs, char *dest,
              int verbose, int realtime) {
   sched_params p;
   pingobj_t *ping;
@@ -859,36 +1566,40 @@ pingResponse doPing(unsigned long sizeInBytes, unsigned long times, char *dest,
   int i = 1;
   double accumulatedLatency = 0;
   size_t successfullResponses = 0;
-  double averageLatency = 0;
-  pingResponse pr = {1, -1};
+  double *samples;
+  pingResponse pr = {-1, 100};
 
   if(verbose) printf("Sending %lu ICMP echo request paquets "
                      "%lu bytes-long to %s\n",times, sizeInBytes, dest);
   
   if((ping = ping_construct()) == NULL) {
-    sprintf(msg, "ping_construct: failed\n");
-    myAbort(msg);
+    sbenchFailTest(SBENCH_ERR_NETWORK, "ping_construct: failed");
+    return pr;
   }
   if(verbose) printf("ping_construct(): success\n");
   
   if(ping_host_add(ping, dest) < 0) {
-    const char *errMsg = ping_get_error(ping);
-    sprintf(msg, "ping_host_add(%s): failed: %s. "
-                 "If 'the operation is not permitted' you could use "
-                 "something like \"sudo setcap cap_net_raw=ep\" "
-                 "on your executable\n", dest, errMsg);
-    myAbort(msg);
+    sbenchFailTest(SBENCH_ERR_NETWORK, "ping_host_add(%s): failed: %s. "
+                   "If 'the operation is not permitted' you could use "
+                   "something like \"sudo setcap cap_net_raw=ep\" "
+                   "on your executable", dest, ping_get_error(ping));
+    ping_destroy(ping);
+    return pr;
   }
   if(verbose) printf("ping_host_add(): success\n");
+
+  samples = (double *) malloc(times * sizeof(double));
+  if(samples == NULL)
+    sbenchMyAbort("Can't allocate the array of latencies");
   
   // Enter realtime if needed
   if(realtime == 1)
-    p = enterRealTime();
+    sbenchEnterRealTime(&p);
 
   while(1) {
     if(ping_send(ping) < 0) {
       sprintf(msg, "ping_send #%d: failed\n", i);
-      myAbort(msg);
+      sbenchMyAbort(msg);
     }
     // if(verbose) printf("ping_send() #%d: success\n", i);
     
@@ -903,9 +1614,9 @@ pingResponse doPing(unsigned long sizeInBytes, unsigned long times, char *dest,
       ping_iterator_get_info(iter, PING_INFO_HOSTNAME, hostname, &len);
       len = sizeof(double);
       ping_iterator_get_info(iter, PING_INFO_LATENCY, &latencyMs, &len);
-      if(latencyMs != -1) {
-        successfullResponses++;
-        accumulatedLatency  += latencyMs;
+      if(latencyMs >= 0 && successfullResponses < times) {
+        samples[successfullResponses++] = latencyMs;
+        accumulatedLatency += latencyMs;
       }
       
       if(verbose) printf("ping #%d: hostname = %s, latency = %f\n", i, hostname, latencyMs);
@@ -913,191 +1624,29 @@ pingResponse doPing(unsigned long sizeInBytes, unsigned long times, char *dest,
     // if(verbose) printf("ping iteration # %d\n", i);
     if(i++ == times)
       break;
-    sleep(1);
+    // ping_send already waited for the replies, up to its timeout
+    usleep(intervalMs * 1000);
   }
 
   // Exit realtime if entered previously
-  if(args->realtime == 1)
-    exitRealTime(p);
+  if(realtime == 1)
+    sbenchExitRealTime(p);
+  ping_destroy(ping);
 
+  // like the native one, -1 ms and 100% loss
   if(successfullResponses == 0) {
-    sprintf(msg, "Zero responses received when sending %lu echo requests to %s", times, dest);
-    myAbort(msg);
+    if(verbose) printf("Zero responses received when sending %lu echo requests to %s\n", times, dest);
+    free(samples);
+    return pr;
   }
-  averageLatency = accumulatedLatency/successfullResponses;
+  sbenchComputeLatencyStats(samples, successfullResponses, &pr.rtt);
+  free(samples);
 
-  pr.latencyMs     = averageLatency;
+  pr.latencyMs   = accumulatedLatency/successfullResponses;
   pr.lossPerCent = 100.*(times - successfullResponses)/times;
   if(verbose) printf("Returning latency=%.1f, packet loss=%.1f\n", pr.latencyMs, pr.lossPerCent);
   return pr;
 }
 
-#else  // OPING_ENABLED
-
-/**
-  * Ping running external ping program,
-  * it returns an structure with average latency and packet loss.
-  * It just requires ping on PATH, parses it's output with regular expressions.
-  *
-  * Lacking of an API is terrible because you have to parse standard output,
-  * and it can lead to problems with different versions of the command
-  * and locale dependencies. Luckily the ping command looks like consistent
-  * in different Linux distros with different locales:
-  *
-  * Ping output on SLES 11 SP4:
-  * # ping -c 10 192.168.0.1
-  * PING 192.168.0.1 (192.168.0.1) 56(84) bytes of data.
-  * 64 bytes from 192.168.0.1: icmp_seq=1 ttl=63 time=7.23 ms
-  * 64 bytes from 192.168.0.1: icmp_seq=2 ttl=63 time=5.41 ms
-  * ...
-  * --- 192.168.0.1 ping statistics ---
-  * 10 packets transmitted, 10 received, 0% packet loss, time 9003ms
-  * rtt min/avg/max/mdev = 4.124/5.438/7.666/1.584 ms
-  *
-  * Ping output on Ubuntu 16.04.1:
-  * $ ping -c 10 192.168.0.1
-  * PING 192.168.0.1 (192.168.0.1) 56(84) bytes of data.
-  * 64 bytes from 192.168.0.1: icmp_seq=1 ttl=64 time=1.89 ms
-  * 64 bytes from 192.168.0.1: icmp_seq=2 ttl=64 time=1.78 ms
-  * ...
-  * --- 192.168.0.1 ping statistics ---
-  * 10 packets transmitted, 10 received, 0% packet loss, time 9005ms
-  * rtt min/avg/max/mdev = 1.677/2.123/2.718/0.429 ms
-  *
-  */
-pingResponse doPing(unsigned long sizeInBytes, unsigned long times, char *dest,
-             int verbose, int realtime) {
-  sched_params p;
-  char msg[100];
-  int  i = 1;
-  char command[BUFSIZ];
-  char buf[BUFSIZE];
-  FILE *fp;
-
-  float q = 0;
-  float f;
-  char *end;
-  char *regex1String = "(.+) packets transmitted, (.+) received, .+% packet loss";
-  char *regex2String = ".* = [^/]+/([^/]+)/[^/]+/[^/]+ ms";
-  regex_t regex1Compiled;
-  regex_t regex2Compiled;
-  pingResponse pr = {1, -1};
-
-  if(verbose) printf("Sending %lu ICMP echo request paquets "
-                     "%lu bytes-long to %s\n",times, sizeInBytes, dest);
-
-//sprintf(command, "ping -s %lu -c %lu %s | cut -d \":\" -f 2 | cut -d \"=\" -f 4 | grep \" ms$\" | cut -d \" \" -f 1", sizeInBytes, times, dest);
-  sprintf(command, "ping -s %lu -c %lu %s", sizeInBytes, times, dest);
-  if(verbose) printf("ping command that will be used: [%s]\n", command);
-
-  // Enter realtime if needed
-  if(realtime == 1)
-    p = enterRealTime();
-
-  if ((fp = popen(command, "r")) == NULL) {
-    sprintf(msg, "Can't open a pipe for running the command [%s]", command);
-    myAbort(msg);
-  }
-
-  if(verbose) printf("regex1: %s\n", regex1String);
-  if(verbose) printf("regex2: %s\n", regex2String);
-
-  if (regcomp(&regex1Compiled, regex1String, REG_EXTENDED)) {
-    printf("Could not compile regular expression [%s]\n", regex1String);
-    exit(1);
-  }
-  if (regcomp(&regex2Compiled, regex2String, REG_EXTENDED)) {
-    printf("Could not compile regular expression [%s]\n", regex2String);
-    exit(1);
-  }
-
-  while (fgets(buf, BUFSIZE, fp) != NULL) {
-    // f = atof(buf);
-    // http://en.cppreference.com/w/c/string/byte/strtof
-    // f = strtod(buf, &end);
-    if(verbose) printf("* %s", buf);
-    parsePingOutput(buf, &pr, &regex1Compiled, &regex2Compiled);
-  }
-
-  if(verbose) printf("Ping response: latency=%.1fms, loss=%.1f%%\n", pr.latencyMs, pr.lossPerCent);
-  regfree(&regex1Compiled);
-  regfree(&regex2Compiled);
-
-  // Exit realtime if entered previously
-  if(realtime == 1)
-    exitRealTime(p);
-
-  return pr;
-}
-
-void parsePingOutput (char *source, pingResponse *pr, regex_t *regex1Compiled, regex_t *regex2Compiled) {
-  size_t maxGroups = 3;
-  char   numStr[strlen(source) + 1];
-  char  *end;
-  float  num;
-  unsigned int g = 0;
-  char sourceCopy[strlen(source) + 1];
-  regmatch_t groupArray[maxGroups];
-  int tx=-1, rx=-1;
-
-  // example about C regexp: http://stackoverflow.com/a/11864144/939015
-  if (regexec(regex1Compiled, source, maxGroups, groupArray, 0) == 0) {
-    for (g = 0; g < maxGroups; g++) {
-      if (groupArray[g].rm_so == (size_t)-1)
-        break;  // No more groups
-
-      strcpy(sourceCopy, source);
-      sourceCopy[groupArray[g].rm_eo] = 0;
-
-      if(g == 1 || g == 2) {
-        strcpy(numStr, sourceCopy + groupArray[g].rm_so);
-  
-        num = strtod(numStr, &end);
-        if (end == numStr) {
-          // parse error
-          continue;
-        }
-        if(g == 1) {
-          tx = num;
-        }
-        else if(g == 2) {
-          rx = num;
-        }
-      }
-
-    }
-    if(tx == 0)
-      pr->lossPerCent=100;
-    else {
-      pr->lossPerCent=100.*(tx-rx)/tx;
-    }
-//  printf("packets transmitted=%d , received=%d, calculated loss = %f per cent\n", tx, rx, pr->lossPerCent);
-  }
-
-  maxGroups = 2;
-  if (regexec(regex2Compiled, source, maxGroups, groupArray, 0) == 0) {
-    for (g = 0; g < maxGroups; g++) {
-      if (groupArray[g].rm_so == (size_t)-1)
-        break;  // No more groups
-
-      strcpy(sourceCopy, source);
-      sourceCopy[groupArray[g].rm_eo] = 0;
-
-      if(g == 1) {
-//      printf("Group %u: [%2u-%2u]: %s\n",
-//        g, groupArray[g].rm_so, groupArray[g].rm_eo,
-//          sourceCopy + groupArray[g].rm_so);
-        strcpy(numStr, sourceCopy + groupArray[g].rm_so);
-  
-        num = strtod(numStr, &end);
-        if (end == numStr) {
-          // parse error
-          continue;
-        }
-        pr->latencyMs=num;
-      }
-    }
-  }
-}
-#endif // else OPING_ENABLED
+#endif // OPING_ENABLED
 
@@ -8,6 +8,9 @@
 #ifndef SBENCHFUNCS_H
 #define SBENCHFUNCS_H
 
+#include <stdint.h>       // uint32_t, uint64_t
+#include <stddef.h>       // size_t
+
 #define CURL_REFS_FOLDER "/var/lib/sbench/http_refs"
 #define CURL_TIMEOUT_MS  30000 // 30s for HTTP is ~infinite
 
@@ -16,30 +19,154 @@
 #define EXIT_CODE_CRITICAL 2
 #define EXIT_CODE_UNKNOWN  3
 
+/** why a test failed, returned by the tests instead of ending the program */
+enum sbenchError {SBENCH_OK, SBENCH_ERR_PARAMS, SBENCH_ERR_MEMORY, SBENCH_ERR_THREADS, SBENCH_ERR_FILE,
+                  SBENCH_ERR_IO, SBENCH_ERR_HTTP, SBENCH_ERR_CONTENT, SBENCH_ERR_UNSUPPORTED, SBENCH_ERR_REALTIME,
+                  SBENCH_ERR_NO_REPLY, SBENCH_ERR_NETWORK, SBENCH_ERRORS};
+
+#define MAX_THRESHOLDS     8 // values in "-w a_b_c" / "-c a_b_c"
+#define MAX_REPETITIONS    10000 // adaptive mode stops here anyway
+#define DEFAULT_MIN_REPETITIONS 5 // adaptive mode without "-n"
+
 // ifdef OPING_ENABLED
-enum btype {CPU, MEM, DISK_W, DISK_R_SEQ, DISK_R_RAN, HTTP_GET, PING};
+enum btype {CPU, MEM, DISK_W, DISK_R_SEQ, DISK_R_RAN, HTTP_GET, PING, TCP_SERVER, TCP_CLIENT, UDP_REFLECTOR, UDP_RR, SURVEY, TCP_LISTENER, TCP_CONNECT, MIXED, SCHED_LAT, CPU_C2C, CPU_SYNC};
 // else  // OPING_ENABLED
 // enum btype {CPU, MEM, DISK_W, DISK_R_SEQ, DISK_R_RAN, HTTP_GET};
 // endif // OPING_ENABLED
 
-/** ping response */
+/** scheduling params */
 typedef struct {
   int sched_policy;
   int priority;
 } sched_params;
 
+/** summary of a set of latency samples, all in miliseconds */
+typedef struct {
+  size_t count;
+  double min;
+  double avg;
+  double p50;
+  double p90;
+  double p99;
+  double p999;
+  double max;
+  /** mean deviation, like ping's mdev */
+  double mdev;
+} latencyStats;
+
+/* sub-buckets per power of two of a histogram, ~6% resolution */
+#define HISTOGRAM_SUB_BUCKETS 16
+#define HISTOGRAM_BUCKETS     (61 * HISTOGRAM_SUB_BUCKETS)
+
+/** latencies in nanoseconds in log-linear buckets, for tests with too
+    many samples to keep: exact up to 31 ns, then 16 buckets for each
+    power of two */
+typedef struct {
+  uint64_t count[HISTOGRAM_BUCKETS];
+  uint64_t total;
+  uint64_t min;
+  uint64_t max;
+  double   sum;
+  double   sum2;
+} latencyHistogram;
+
+/** how many times a test is run, set with "-n" and "-a" */
+typedef struct {
+  /** runs discarded before measuring */
+  unsigned long warmup;
+  /** runs measured, the minimum on adaptive mode */
+  unsigned long repetitions;
+  /** adaptive mode: repeat until the CI95 is narrower than this
+      percent of the mean, 0 == not adaptive */
+  double        ciTargetPerCent;
+  /** adaptive mode: stop anyway after these seconds */
+  double        maxSeconds;
+  /** start the measured runs at this many per second on an open loop,
+      the lateness of each start is added to its result, 0 == one
+      after the other */
+  double        rate;
+} repetition_params;
+
+/** summary of the results of a repeated test */
+typedef struct {
+  /** samples kept */
+  size_t count;
+  /** samples rejected as outliers */
+  size_t outliers;
+  double mean;
+  double median;
+  double stddev;
+  double min;
+  double max;
+  /** 95% confidence interval of the mean */
+  double ciLow;
+  double ciHigh;
+} sampleStats;
+
+/** samples of a test compared with the ones of its baseline */
+typedef struct {
+  sampleStats baseline;
+  sampleStats current;
+  /** of the current mean from the baseline mean */
+  double      deviationPerCent;
+  /** Welch's t, or a prediction t if there's one current sample */
+  double      t;
+  size_t      df;
+  /** if the difference is beyond chance, at 95% */
+  int         significant;
+} baselineComparison;
+
 /** ping response */
 typedef struct {
   /** latency in miliseconds */
   float latencyMs;
   /** Percent of package loss */
   float lossPerCent;
+  /** round-trip times of the echo replies received */
+  latencyStats rtt;
 } pingResponse;
 
-#ifndef OPING_ENABLED
-#include <regex.h>
-void parsePingOutput (char *source, pingResponse *pr, regex_t *regex1Compiled, regex_t *regex2Compiled);
-#endif // OPING_ENABLED
+/** phases of an HTTP GET, each one measured on its own */
+enum httpPhase {HTTP_DNS, HTTP_CONNECT, HTTP_TLS, HTTP_TTFB, HTTP_TRANSFER, HTTP_TOTAL, HTTP_PHASES};
+
+/** names of the phases, indexed by enum httpPhase */
+extern const char *sbenchHttpPhaseNames[HTTP_PHASES];
+
+/** http_get response */
+typedef struct {
+  /** duration of each phase in seconds, indexed by enum httpPhase */
+  double phase[HTTP_PHASES];
+  /** average download speed in bytes per second */
+  double speedDownload;
+} httpResponse;
+
+/** incremental SHA-256 */
+typedef struct {
+  uint32_t      state[8];
+  uint64_t      length;
+  unsigned char buffer[64];
+  size_t        used;
+} sha256_ctx;
+
+/** streaming verification of an HTTP body against its reference */
+typedef struct {
+  /** mmap'ed reference file, NULL when verifying against a digest */
+  const unsigned char *ref;
+  /** size of the reference file */
+  size_t         refSize;
+  /** expected SHA-256 when there's no reference file */
+  unsigned char  digest[32];
+  sha256_ctx     sha;
+  /** bytes of the body received so far */
+  size_t         received;
+  /** 1 as soon as the body differs from the reference */
+  int            different;
+} httpVerifier;
+
+/* counters of a thread for the sampler, on sbenchsample.h */
+struct sample_counters;
+/* probes of the frequency of a thread, on sbenchfreq.h */
+struct freq_probe;
 
 /* arguments for cpu tests */
 typedef struct cpu_args {
@@ -47,6 +174,8 @@ typedef struct cpu_args {
   int            verbose;
   int            realtime;
   unsigned int   threadNumber;
+  struct sample_counters *counters; // NULL if not sampled
+  struct freq_probe *probe; // NULL if the frequency isn't tracked
   double         delta; // return value
 } cpu_args_struct;
 
@@ -59,6 +188,10 @@ typedef struct dw_args {
   int           verbose;
   int            realtime;
   unsigned int  threadNumber;
+  double        rate;       // ops/s of this thread, 0 == as fast as possible
+  double        rateOffset; // seconds to wait for the first op
+  struct sample_counters *counters; // NULL if not sampled
+  latencyHistogram latency; // return value, from the intended start, with rate
   double        delta; // return value
 } dw_args_struct;
 
@@ -72,32 +205,58 @@ typedef struct dr_args {
   int            realtime;
   unsigned int   threadNumber;
   unsigned long *blocks;
+  double         rate;       // ops/s of this thread, 0 == as fast as possible
+  double         rateOffset; // seconds to wait for the first op
+  struct sample_counters *counters; // NULL if not sampled
+  latencyHistogram latency; // return value, from the intended start, with rate
   double         delta; // return value
 } dr_args_struct;
 
-sched_params enterRealTime();
+int sbenchEnterRealTime(sched_params *saved);
 
-sched_params enterRealTimeWithParams(sched_params p);
+int sbenchExitRealTime(sched_params p);
 
-void exitRealTime(sched_params p);
+void sbenchMyAbort(char* msg);
 
-void myAbort(char* msg);
+int sbenchPathDevice(const char *path, unsigned int *maj, unsigned int *min);
+void sbenchPartitionDisk(unsigned int *maj, unsigned int *min);
 
-double doCpuTest(unsigned long times, int nThreads, int verbose, int realtime);
+int sbenchFailTest(int code, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
 
-double doMemTest(unsigned long sizeInBytes, unsigned long times, int verbose, int realtime);
+int sbenchTestFailure();
 
-double doDiskWriteTest(unsigned long sizeInBytes, unsigned long times, unsigned int nThreads, char *folderName, int verbose, int realtime);
+const char *sbenchTestFailureMessage();
 
-// void shuffle(unsigned long *array, size_t n);
+void sbenchClearTestFailure();
+
+void sbenchComputeLatencyStats(double *samples, size_t n, latencyStats *ls);
+
+void sbenchCompareSamples(double *baseline, size_t nBaseline, double *samples, size_t n, baselineComparison *bc);
+
+size_t sbenchDetectStepChanges(double *values, size_t n, size_t minLength, double minPerCent, size_t *changes, size_t maxChanges);
 
-double doDiskReadTest(enum btype thisType, unsigned long sizeInBytes, unsigned long times, int nThreads, char *targetFileName, int verbose, int realtime);
+void sbenchHistogramAdd(latencyHistogram *h, uint64_t ns);
+
+void sbenchHistogramMerge(latencyHistogram *to, latencyHistogram *from);
+
+void sbenchHistogramStats(latencyHistogram *h, latencyStats *ls);
+
+int sbenchRepeatTest(repetition_params *rp, int (*measure)(void *, double *), void *arg,
+                     double **samples, size_t *n, sampleStats *ss, int verbose);
+
+int sbenchDoCpuTest(unsigned long times, int nThreads, int verbose, int realtime, double *delta);
+
+int sbenchDoMemTest(unsigned long sizeInBytes, unsigned long times, int verbose, int realtime, double *delta);
+
+int sbenchDoDiskWriteTest(unsigned long sizeInBytes, unsigned long times, unsigned int nThreads, char *folderName, double rate, latencyHistogram *latency, int verbose, int realtime, double *delta);
+
+// void shuffle(unsigned long *array, size_t n);
 
-// size_t writeToFile(void *ptr, size_t size, size_t nmemb, FILE *stream);
+int sbenchDoDiskReadTest(enum btype thisType, unsigned long sizeInBytes, unsigned long times, int nThreads, char *targetFileName, double rate, latencyHistogram *latency, int verbose, int realtime, double *delta);
 
-double httpGet(char *url, char *httpRefFileBasename, int *different, int verbose, int realtime);
+int sbenchHttpGet(char *url, char *httpRefFileBasename, int *different, int verbose, int realtime, httpResponse *hr);
 
-pingResponse doPing(unsigned long sizeInBytes, unsigned long times, char *dest,
+pingResponse sbenchDoPing(unsigned long sizeInBytes, unsigned long times, unsigned long intervalMs, char *dest,
              int verbose, int realtime);
 
 #endif
@@ -0,0 +1,427 @@
+/*
+ * Simple Benchmarks: cpu, memory, disk and network loaded at once
+ * by the same process, to see how they interfere.
+ *
+ * Each component of the test runs its own threads doing the same work
+ * as the single test of its kind, but for some seconds instead of some
+ * times. Every second the main thread takes what each component did
+ * in that second while the others were running, so that a rise of the
+ * disk latency when the memory bandwidth is saturated shows up.
+ *
+ * @since 20161027
+ * @author zoquero@gmail.com
+ */
+
+#include <stdio.h>        // printf, sprintf
+#include <stdlib.h>       // malloc, calloc, free, rand_r
+#include <string.h>       // strtok_r, strchr, memcpy
+#include <unistd.h>       // pwrite, pread, fsync, close
+#include <fcntl.h>        // open
+#include <errno.h>        // errno
+#include <stdarg.h>       // va_list
+#include <math.h>         // pow
+#include <time.h>         // clock_nanosleep
+#include <pthread.h>      // pthread_barrier_t
+#include <sys/stat.h>     // fstat
+
+#include "sbenchmixed.h"
+#include "sbenchtime.h"
+#include "sbenchpool.h"
+
+/** names of the components on "-p", indexed by enum mixedKind */
+const char *sbenchMixedKindNames[MIXED_KINDS] = {"cpu", "mem", "disk_w", "disk_r_seq", "disk_r_ran", "tcp_client"};
+
+/** format of each kind on "-p", indexed by enum mixedKind */
+static const char *mixedKindFormats[MIXED_KINDS] = {"cpu:threads", "mem:threads:bufferSize",
+  "disk_w:threads:blockSize:folder", "disk_r_seq:threads:blockSize:file",
+  "disk_r_ran:threads:blockSize:file", "tcp_client:streams:msgSize:port:host"};
+
+/** fields of each kind on "-p", indexed by enum mixedKind */
+static const int mixedKindFields[MIXED_KINDS] = {2, 3, 4, 4, 4, 5};
+
+/* arguments of each thread of the mixed test */
+typedef struct {
+  mixed_component   *component;
+  /** number of the thread in its component */
+  unsigned int       threadNumber;
+  /** unique in the test, for its buffer */
+  unsigned int       slot;
+  /** taken before the threads start, NULL for cpu */
+  char              *buffer;
+  net_options       *options;
+  int                verbose;
+  int                realtime;
+  int               *stop;
+  pthread_barrier_t *start;
+  latencyHistogram   latency;
+} mixed_worker;
+
+/* keeps the calcs of the cpu component from being optimized out */
+static volatile double mixedSink;
+
+
+/**
+  * Parses the components of the mixed test, a comma-separated
+  * list of kind:threads:... like "cpu:2,disk_r_ran:4:4096:/tmp/f".
+  * @return the components, to be freed
+  */
+mixed_component *sbenchParseMixedComponents(char *list, unsigned int *n) {
+  mixed_component *components;
+  char *spec, *saveptr, *field[5], msg[PATH_MAX + 200];
+  char  copy[PATH_MAX];
+
+  components = (mixed_component *) calloc(MAX_MIXED_COMPONENTS, sizeof(mixed_component));
+  if(components == NULL)
+    sbenchMyAbort("Can't allocate the components of the mixed test");
+  snprintf(copy, sizeof(copy), "%s", list);
+
+  *n = 0;
+  for(spec = strtok_r(copy, ",", &saveptr); spec != NULL; spec = strtok_r(NULL, ",", &saveptr)) {
+    mixed_component *c = &components[*n];
+    int k, nFields = 1;
+
+    if(*n == MAX_MIXED_COMPONENTS) {
+      sprintf(msg, "The mixed test can have up to %d components", MAX_MIXED_COMPONENTS);
+      sbenchMyAbort(msg);
+    }
+    // the last field (a path or a host) can have colons
+    field[0] = spec;
+    for(k = 0; k < MIXED_KINDS; k++)
+      if(strncmp(spec, sbenchMixedKindNames[k], strlen(sbenchMixedKindNames[k])) == 0 &&
+         spec[strlen(sbenchMixedKindNames[k])] == ':')
+        break;
+    if(k == MIXED_KINDS) {
+      sprintf(msg, "Unknown component \"%.100s\" of the mixed test, they can be"
+                   " cpu, mem, disk_w, disk_r_seq, disk_r_ran or tcp_client", spec);
+      sbenchMyAbort(msg);
+    }
+    while(nFields < mixedKindFields[k] && (field[nFields] = strchr(field[nFields - 1], ':')) != NULL)
+      *field[nFields++]++ = '\0';
+    c->kind     = k;
+    c->nThreads = nFields > 1 ? strtoul(field[1], NULL, 10) : 0;
+    if(nFields != mixedKindFields[k] || c->nThreads == 0) {
+      sprintf(msg, "The component %s of the mixed test must be in \"%s\" format",
+              sbenchMixedKindNames[k], mixedKindFormats[k]);
+      sbenchMyAbort(msg);
+    }
+    if(nFields > 2 && (c->sizeInBytes = strtoul(field[2], NULL, 10)) == 0) {
+      sprintf(msg, "The size of the component %s of the mixed test can't be 0", sbenchMixedKindNames[k]);
+      sbenchMyAbort(msg);
+    }
+    if(k == MIXED_TCP_CLIENT) {
+      snprintf(c->port, sizeof(c->port), "%s", field[3]);
+      snprintf(c->host, sizeof(c->host), "%s", field[4]);
+    }
+    else if(nFields > 3)
+      snprintf(c->path, sizeof(c->path), "%s", field[3]);
+    (*n)++;
+  }
+  if(*n == 0)
+    sbenchMyAbort("The mixed test needs some component");
+  return components;
+}
+
+
+/**
+  * Adds operations to the counters of a component, that the main
+  * thread reads while the test runs.
+  * @param ns latency of the operation, 0 == not measured
+  */
+static void mixedCount(mixed_component *c, uint64_t ops, uint64_t bytes, uint64_t ns) {
+  uint64_t max = __atomic_load_n(&c->latencyMax, __ATOMIC_RELAXED);
+
+  __atomic_fetch_add(&c->ops, ops, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&c->bytes, bytes, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&c->latencySum, ns, __ATOMIC_RELAXED);
+  while(ns > max && ! __atomic_compare_exchange_n(&c->latencyMax, &max, ns, 1,
+                                                  __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+}
+
+
+/**
+  * Bytes of the buffer of a thread of a component, 0 for cpu.
+  */
+static size_t mixedBufferSize(mixed_component *c) {
+  if(c->kind == MIXED_CPU)
+    return 0;
+  // mem copies one half of its buffer to the other one
+  return c->kind == MIXED_MEM ? 2 * c->sizeInBytes : c->sizeInBytes;
+}
+
+
+/**
+  * Opens what a thread of a component needs before the test starts.
+  * What it can't open fails the test, see sbenchFailTest.
+  * @param buffer return value, the buffer of the thread
+  * @param fileSize return value, size of the file to read
+  * @return file descriptor or socket, -1 for cpu and mem or if it failed
+  */
+static int mixedSetup(mixed_worker *w, char **buffer, off_t *fileSize) {
+  mixed_component *c = w->component;
+  char fileName[PATH_MAX];
+  struct sockaddr_storage addr;
+  socklen_t addrLen;
+  struct stat st;
+  int fd = -1, failed = 0;
+
+  if(c->kind == MIXED_CPU)
+    return -1;
+
+  *buffer = w->buffer;
+  // committed before starting, by the thread that uses it
+  memset(*buffer, 0xA5, mixedBufferSize(c));
+
+  if(c->kind == MIXED_DISK_W) {
+    snprintf(fileName, sizeof(fileName), "%.*s/mixed_w.out.%u", PATH_MAX - 32, c->path, w->slot);
+    if((fd = open(fileName, O_CREAT | O_TRUNC | O_RDWR, S_IRUSR | S_IWUSR)) == -1)
+      failed = sbenchFailTest(SBENCH_ERR_FILE, "Can't open the target file %.*s for writing", PATH_MAX, fileName);
+  }
+  else if(c->kind == MIXED_DISK_R_SEQ || c->kind == MIXED_DISK_R_RAN) {
+    if((fd = open(c->path, O_RDONLY)) == -1 || fstat(fd, &st) != 0)
+      failed = sbenchFailTest(SBENCH_ERR_FILE, "Can't open the target file %.*s for reading", PATH_MAX, c->path);
+    else if((*fileSize = st.st_size) < c->sizeInBytes)
+      failed = sbenchFailTest(SBENCH_ERR_FILE, "The target file %.*s is smaller than a block", PATH_MAX, c->path);
+  }
+  else if(c->kind == MIXED_TCP_CLIENT) {
+    if(sbenchResolveAddress(c->host, c->port, SOCK_STREAM, &addr, &addrLen) != 0) {
+      sbenchFailTest(SBENCH_ERR_NETWORK, "Can't resolve %s port %s", c->host, c->port);
+      return -1;
+    }
+    if((fd = socket(addr.ss_family, SOCK_STREAM, 0)) == -1)
+      sbenchMyAbort("Can't create the socket");
+    sbenchSetSocketOptions(fd, w->options);
+    if(connect(fd, (struct sockaddr *) &addr, addrLen) != 0)
+      failed = sbenchFailTest(SBENCH_ERR_NETWORK, "Can't connect to %s port %s: %s", c->host, c->port, strerror(errno));
+  }
+  if(failed && fd != -1) {
+    close(fd);
+    fd = -1;
+  }
+  return fd;
+}
+
+
+/**
+  * Fails the test on an operation and stops all the threads.
+  * @return 0, the bytes moved
+  */
+static uint64_t mixedFail(mixed_worker *w, int code, const char *fmt, ...) {
+  char    msg[PATH_MAX + 200];
+  va_list ap;
+
+  va_start(ap, fmt);
+  vsnprintf(msg, sizeof(msg), fmt, ap);
+  va_end(ap);
+  sbenchFailTest(code, "%s", msg);
+  __atomic_store_n(w->stop, 1, __ATOMIC_RELAXED);
+  return 0;
+}
+
+
+/**
+  * Does one operation of a component.
+  * @param offset of the file, where to read or write, updated
+  * @return bytes moved
+  */
+static uint64_t mixedOperation(mixed_worker *w, int fd, char *buffer, off_t fileSize, off_t *offset, unsigned int *seed) {
+  mixed_component *c = w->component;
+  double x = 2;
+
+  switch(c->kind) {
+    case MIXED_CPU:
+      // the same calcs as the cpu test
+      for(int i = 0; i < MIXED_CPU_BATCH; i++) {
+        x = pow(x, x);
+        x = pow(x, 1/(x-1));
+      }
+      mixedSink = x;
+      return 0;
+    case MIXED_MEM:
+      memcpy(buffer + c->sizeInBytes, buffer, c->sizeInBytes);
+      return c->sizeInBytes;
+    case MIXED_DISK_W:
+      if(pwrite(fd, buffer, c->sizeInBytes, *offset) != c->sizeInBytes || fsync(fd) != 0)
+        return mixedFail(w, SBENCH_ERR_IO, "Can't write and flush %lu bytes on %s", c->sizeInBytes, sbenchMixedKindNames[c->kind]);
+      *offset += c->sizeInBytes;
+      if(*offset + c->sizeInBytes > MIXED_DISK_W_FILE_SIZE)
+        *offset = 0;
+      return c->sizeInBytes;
+    case MIXED_DISK_R_RAN:
+      *offset = (((uint64_t) rand_r(seed) << 31 | rand_r(seed)) % (fileSize / c->sizeInBytes)) * c->sizeInBytes;
+      // fall through
+    case MIXED_DISK_R_SEQ:
+      if(pread(fd, buffer, c->sizeInBytes, *offset) != c->sizeInBytes)
+        return mixedFail(w, SBENCH_ERR_IO, "Can't read %lu bytes on %s", c->sizeInBytes, sbenchMixedKindNames[c->kind]);
+      *offset += c->sizeInBytes;
+      if(*offset + c->sizeInBytes > fileSize)
+        *offset = 0;
+      return c->sizeInBytes;
+    case MIXED_TCP_CLIENT:
+      for(ssize_t sent = 0, n; sent < c->sizeInBytes; sent += n) {
+        if((n = write(fd, buffer + sent, c->sizeInBytes - sent)) <= 0)
+          return mixedFail(w, SBENCH_ERR_NETWORK, "Can't send to %s port %s: %s", c->host, c->port, strerror(errno));
+      }
+      return c->sizeInBytes;
+    default:
+      sbenchMyAbort(/* bug */ "Unknown component of the mixed test");
+  }
+  return 0;
+}
+
+
+static void *mixedWorkerRoutine(void *arg) {
+  mixed_worker *w = (mixed_worker *) arg;
+  mixed_component *c = w->component;
+  sched_params p;
+  char *buffer = NULL, fileName[PATH_MAX];
+  unsigned char reply[8];
+  off_t fileSize = 0, offset = 0;
+  unsigned int seed = w->slot + 1;
+  uint64_t before, after, bytes, ns;
+  int fd;
+
+  // one that can't start stops them all, once they are
+  if((fd = mixedSetup(w, &buffer, &fileSize)) == -1 && sbenchTestFailure() != SBENCH_OK)
+    __atomic_store_n(w->stop, 1, __ATOMIC_RELAXED);
+  // each sequential reader on its own part of the file
+  if(c->kind == MIXED_DISK_R_SEQ)
+    offset = (fileSize / c->nThreads * w->threadNumber) / c->sizeInBytes * c->sizeInBytes;
+
+  // all the components start at once
+  pthread_barrier_wait(w->start);
+
+  // Enter realtime if needed
+  if(w->realtime == 1)
+    sbenchEnterRealTime(&p);
+
+  while(! __atomic_load_n(w->stop, __ATOMIC_RELAXED)) {
+    before = timerRead();
+    bytes  = mixedOperation(w, fd, buffer, fileSize, &offset, &seed);
+    after  = timerRead();
+    if(c->kind == MIXED_CPU) {
+      mixedCount(c, MIXED_CPU_BATCH, 0, 0);
+      continue;
+    }
+    ns = (uint64_t) (sbenchTimerElapsed(before, after) * 1E9);
+    sbenchHistogramAdd(&w->latency, ns);
+    mixedCount(c, 1, bytes, ns);
+  }
+
+  // Exit realtime if entered previously
+  if(w->realtime == 1)
+    sbenchExitRealTime(p);
+
+  // cpu, mem or one that couldn't start
+  if(fd == -1)
+    return NULL;
+  if(c->kind == MIXED_TCP_CLIENT) {
+    // like tcp_client, so that tcp_server is happy
+    shutdown(fd, SHUT_WR);
+    for(ssize_t got = 0, n; got < sizeof(reply); got += n)
+      if((n = read(fd, reply + got, sizeof(reply) - got)) <= 0)
+        break;
+  }
+  close(fd);
+  if(c->kind == MIXED_DISK_W) {
+    snprintf(fileName, sizeof(fileName), "%.*s/mixed_w.out.%u", PATH_MAX - 32, c->path, w->slot);
+    if(remove(fileName) != 0)
+      fprintf(stderr, "Can't delete the target file %s after the test\n", fileName);
+  }
+  return NULL;
+}
+
+
+/**
+  * Runs all the components at once during some seconds, taking what
+  * each one did every second.
+  * @param components return value, their counters and latencies
+  * @return the intervals
+  */
+mixedResponse sbenchDoMixedTest(unsigned long seconds, mixed_component *components, unsigned int nComponents, net_options *options, int verbose, int realtime) {
+  mixedResponse mr;
+  mixed_worker *workers;
+  pthread_barrier_t start;
+  struct timespec deadline;
+  uint64_t prevOps[MAX_MIXED_COMPONENTS] = {0}, prevBytes[MAX_MIXED_COMPONENTS] = {0};
+  uint64_t prevLatency[MAX_MIXED_COMPONENTS] = {0};
+  uint64_t beginning, end;
+  char msg[200];
+  unsigned int nWorkers = 0;
+  int stop = 0;
+
+  for(unsigned int i = 0; i < nComponents; i++)
+    nWorkers += components[i].nThreads;
+  workers = (mixed_worker *) calloc(nWorkers, sizeof(mixed_worker));
+  mr.intervals  = (mixed_interval *) calloc(seconds, sizeof(mixed_interval));
+  mr.nIntervals = 0;
+  if(workers == NULL || (seconds > 0 && mr.intervals == NULL))
+    sbenchMyAbort("Can't allocate the threads of the mixed test");
+  pthread_barrier_init(&start, NULL, nWorkers + 1);
+
+  for(unsigned int i = 0, slot = 0; i < nComponents; i++) {
+    for(unsigned int t = 0; t < components[i].nThreads; t++, slot++) {
+      workers[slot].component    = &components[i];
+      workers[slot].threadNumber = t;
+      workers[slot].slot         = slot;
+      workers[slot].options      = options;
+      workers[slot].verbose      = verbose;
+      workers[slot].realtime     = realtime;
+      workers[slot].stop         = &stop;
+      workers[slot].start        = &start;
+      // the slots are taken here, not by the threads at once
+      if(mixedBufferSize(&components[i]) > 0 &&
+         (workers[slot].buffer = sbenchReusableBuffer(slot, mixedBufferSize(&components[i]))) == NULL) {
+        snprintf(msg, sizeof(msg), "Can't allocate %lu bytes for the buffer of %s",
+                 (unsigned long) mixedBufferSize(&components[i]), sbenchMixedKindNames[components[i].kind]);
+        sbenchMyAbort(msg);
+      }
+    }
+    if(verbose) printf("Component #%u: %s with %u threads\n", i, sbenchMixedKindNames[components[i].kind], components[i].nThreads);
+  }
+
+  sbenchClearTestFailure();
+  if(sbenchStartOnThreads(mixedWorkerRoutine, workers, sizeof(mixed_worker), nWorkers) != SBENCH_OK)
+    sbenchMyAbort((char *) sbenchTestFailureMessage());
+  pthread_barrier_wait(&start);
+  beginning = timerRead();
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+
+  // until a thread fails
+  for(unsigned long s = 0; s < seconds && ! __atomic_load_n(&stop, __ATOMIC_RELAXED); s++) {
+    mixed_interval *in = &mr.intervals[s];
+    deadline.tv_sec++;
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR)
+      ;
+    for(unsigned int i = 0; i < nComponents; i++) {
+      mixed_component *c = &components[i];
+      uint64_t ops     = __atomic_load_n(&c->ops, __ATOMIC_RELAXED);
+      uint64_t bytes   = __atomic_load_n(&c->bytes, __ATOMIC_RELAXED);
+      uint64_t latency = __atomic_load_n(&c->latencySum, __ATOMIC_RELAXED);
+      uint64_t max     = __atomic_exchange_n(&c->latencyMax, 0, __ATOMIC_RELAXED);
+
+      in->opsPerSec[i]    = ops - prevOps[i];
+      in->bytesPerSec[i]  = bytes - prevBytes[i];
+      in->avgLatencyMs[i] = ops > prevOps[i] ? (latency - prevLatency[i]) / 1E6 / (ops - prevOps[i]) : 0;
+      in->maxLatencyMs[i] = max / 1E6;
+      prevOps[i]     = ops;
+      prevBytes[i]   = bytes;
+      prevLatency[i] = latency;
+      if(verbose) printf("%lus %s: %.0f ops/s, %.0f B/s, avg %.3f ms, max %.3f ms\n", s + 1,
+                         sbenchMixedKindNames[c->kind], in->opsPerSec[i], in->bytesPerSec[i],
+                         in->avgLatencyMs[i], in->maxLatencyMs[i]);
+    }
+    mr.nIntervals++;
+  }
+
+  __atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+  end = timerRead();
+  sbenchWaitForThreads();
+  mr.seconds = sbenchTimerElapsed(beginning, end);
+
+  for(unsigned int i = 0; i < nWorkers; i++)
+    sbenchHistogramMerge(&workers[i].component->latency, &workers[i].latency);
+  pthread_barrier_destroy(&start);
+  free(workers);
+  return mr;
+}
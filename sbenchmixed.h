@@ -0,0 +1,68 @@
+/*
+ * Simple Benchmarks: cpu, memory, disk and network loaded at once
+ * by the same process, to see how they interfere.
+ *
+ * @since 20161027
+ * @author zoquero@gmail.com
+ */
+
+#ifndef SBENCHMIXED_H
+#define SBENCHMIXED_H
+
+#include <stdint.h>       // uint64_t
+#include <limits.h>       // PATH_MAX, HOST_NAME_MAX
+
+#include "sbenchfuncs.h"   // latencyHistogram
+#include "sbenchnet.h"     // net_options
+
+#define MAX_MIXED_COMPONENTS   16
+#define MIXED_CPU_BATCH        1000 // calcs counted at once
+#define MIXED_DISK_W_FILE_SIZE (256UL << 20) // disk_w writes wrap here
+
+/** kinds of load of the mixed test */
+enum mixedKind {MIXED_CPU, MIXED_MEM, MIXED_DISK_W, MIXED_DISK_R_SEQ, MIXED_DISK_R_RAN, MIXED_TCP_CLIENT, MIXED_KINDS};
+
+extern const char *sbenchMixedKindNames[MIXED_KINDS];
+
+/** one of the loads of the mixed test and its results */
+typedef struct {
+  enum mixedKind kind;
+  unsigned int   nThreads;
+  /** block, buffer or message size */
+  unsigned long  sizeInBytes;
+  /** folder for disk_w, file for disk_r_* */
+  char           path[PATH_MAX];
+  char           host[HOST_NAME_MAX];
+  char           port[32];
+  /** counters of all its threads, updated while running */
+  uint64_t       ops;
+  uint64_t       bytes;
+  /** sum and max of the latency of the operations, in ns */
+  uint64_t       latencySum;
+  uint64_t       latencyMax;
+  /** latency of each operation, all threads, at the end (not for cpu) */
+  latencyHistogram latency;
+} mixed_component;
+
+/** what each component did on an interval, while the others ran */
+typedef struct {
+  double opsPerSec[MAX_MIXED_COMPONENTS];
+  double bytesPerSec[MAX_MIXED_COMPONENTS];
+  double avgLatencyMs[MAX_MIXED_COMPONENTS];
+  double maxLatencyMs[MAX_MIXED_COMPONENTS];
+} mixed_interval;
+
+/** mixed test response */
+typedef struct {
+  /** seconds that the components ran */
+  double          seconds;
+  /** one per second, to be freed */
+  mixed_interval *intervals;
+  unsigned int    nIntervals;
+} mixedResponse;
+
+mixed_component *sbenchParseMixedComponents(char *list, unsigned int *n);
+
+mixedResponse sbenchDoMixedTest(unsigned long seconds, mixed_component *components, unsigned int nComponents, net_options *options, int verbose, int realtime);
+
+#endif // SBENCHMIXED_H
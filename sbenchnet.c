@@ -0,0 +1,1618 @@
+/*
+ * Simple Benchmarks: network tests that don't need external tools,
+ * both sides of the test are sbench.
+ *
+ * @since 20161027
+ * @author zoquero@gmail.com
+ */
+
+#define _GNU_SOURCE       // splice, vmsplice, memfd_create
+
+#include <unistd.h>       // read, write, close, pipe
+#include <stdlib.h>       // exit, malloc, free
+#include <stdio.h>        // printf, sprintf
+#include <string.h>       // memset, strerror
+#include <errno.h>        // errno
+#include <limits.h>       // PATH_MAX
+#include <time.h>         // clock_gettime
+#include <fcntl.h>        // splice, vmsplice, F_SETPIPE_SZ
+#include <netdb.h>        // getaddrinfo, getaddrinfo_a
+#include <pthread.h>      // pthread_create ...
+#include <sys/socket.h>   // socket, setsockopt
+#include <sys/sendfile.h> // sendfile
+#include <sys/mman.h>     // memfd_create
+#include <sys/uio.h>      // vmsplice
+#include <netinet/in.h>   // sockaddr_in6
+#include <netinet/tcp.h>  // TCP_NODELAY, TCP_INFO
+#include <poll.h>         // poll
+#include <sys/epoll.h>    // epoll
+#include <math.h>         // fabs
+#include <arpa/inet.h>    // htonl, ntohl
+#include <netinet/ip_icmp.h> // icmphdr
+#include <netinet/icmp6.h> // ICMP6_ECHO_REQUEST
+#include <linux/errqueue.h> // sock_extended_err, scm_timestamping
+#include <linux/net_tstamp.h> // SOF_TIMESTAMPING_*
+
+#include "sbenchfuncs.h"
+#include "sbenchnet.h"
+#include "sbenchtime.h"
+#include "sbenchperf.h"
+#include "sbenchpool.h"
+#include "sbenchsample.h"
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+
+/**
+  * Difference between two monotonic instants.
+  * @arg start
+  * @arg end
+  * @return difference in seconds
+  */
+static double timespec_diff(struct timespec *a, struct timespec *b) {
+  return (double)(a->tv_sec - b->tv_sec) + (double)(a->tv_nsec - b->tv_nsec)/1000000000;
+}
+
+
+/**
+  * Resolves host and port (name or number) for the socket type.
+  * @return 0 if resolved, -1 if not
+  */
+int sbenchResolveAddress(char *host, char *port, int sockType, struct sockaddr_storage *addr, socklen_t *addrLen) {
+  struct addrinfo hints, *res;
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family   = AF_UNSPEC;
+  hints.ai_socktype = sockType;
+  if(getaddrinfo(host, port, &hints, &res) != 0)
+    return -1;
+  memcpy(addr, res->ai_addr, res->ai_addrlen);
+  *addrLen = res->ai_addrlen;
+  freeaddrinfo(res);
+  return 0;
+}
+
+
+/**
+  * Applies the buffer sizes and TCP_NODELAY chosen with "-o"
+  */
+void sbenchSetSocketOptions(int fd, net_options *options) {
+  char msg[100];
+
+  if(options->sndBuf > 0 &&
+     setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &options->sndBuf, sizeof(int)) != 0) {
+    sprintf(msg, "Can't set SO_SNDBUF to %d", options->sndBuf);
+    sbenchMyAbort(msg);
+  }
+  if(options->rcvBuf > 0 &&
+     setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &options->rcvBuf, sizeof(int)) != 0) {
+    sprintf(msg, "Can't set SO_RCVBUF to %d", options->rcvBuf);
+    sbenchMyAbort(msg);
+  }
+  if(options->noDelay &&
+     setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &options->noDelay, sizeof(int)) != 0) {
+    sbenchMyAbort("Can't set TCP_NODELAY");
+  }
+}
+
+
+/**
+  * Binds a socket to the port on every local address,
+  * IPv6 and IPv4 (dual stack) if it can, just IPv4 if not.
+  * It listens if it's a SOCK_STREAM.
+  * @return the socket
+  */
+static int listenOn(char *port, int sockType, net_options *options) {
+  char msg[100];
+  int  fd, off = 0, on = 1;
+  struct addrinfo hints, *res;
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family   = AF_INET6;
+  hints.ai_socktype = sockType;
+  hints.ai_flags    = AI_PASSIVE;
+  if(getaddrinfo(NULL, port, &hints, &res) != 0 ||
+     (fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol)) == -1) {
+    hints.ai_family = AF_INET;
+    if(getaddrinfo(NULL, port, &hints, &res) != 0) {
+      sprintf(msg, "Can't resolve the local port %s", port);
+      sbenchMyAbort(msg);
+    }
+    if((fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol)) == -1)
+      sbenchMyAbort("Can't create the listening socket");
+  }
+  if(res->ai_family == AF_INET6)
+    setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+  // accepted sockets inherit the buffer sizes, must be set before listen
+  if(options != NULL && sockType == SOCK_STREAM)
+    sbenchSetSocketOptions(fd, options);
+
+  if(bind(fd, res->ai_addr, res->ai_addrlen) != 0) {
+    sprintf(msg, "Can't bind to the port %s: %s", port, strerror(errno));
+    sbenchMyAbort(msg);
+  }
+  freeaddrinfo(res);
+  if(sockType == SOCK_STREAM && listen(fd, SOMAXCONN) != 0) {
+    sprintf(msg, "Can't listen on the port %s", port);
+    sbenchMyAbort(msg);
+  }
+  return fd;
+}
+
+
+/**
+  * Listens on "port" (on the loopback) or on "address:port".
+  */
+int sbenchListenTcp(const char *spec) {
+  struct addrinfo hints, *ai;
+  char   address[300], msg[400];
+  const char *port = spec;
+  char  *colon;
+  int    fd, on = 1, rc;
+
+  snprintf(address, sizeof(address), "%s", spec);
+  if((colon = strrchr(address, ':')) != NULL) {
+    *colon = '\0';
+    port   = colon + 1;
+  }
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family   = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  if((rc = getaddrinfo(colon != NULL ? address : "127.0.0.1", port, &hints, &ai)) != 0) {
+    sprintf(msg, "Can't resolve the listen address %.256s: %s", spec, gai_strerror(rc));
+    sbenchMyAbort(msg);
+  }
+  if((fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol)) < 0 ||
+     setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) != 0 ||
+     bind(fd, ai->ai_addr, ai->ai_addrlen) != 0 || listen(fd, 16) != 0) {
+    sprintf(msg, "Can't listen on %.256s: %s", spec, strerror(errno));
+    sbenchMyAbort(msg);
+  }
+  freeaddrinfo(ai);
+  return fd;
+}
+
+
+/* arguments and results of each connection accepted by the tcp server */
+typedef struct tcps_args {
+  int            fd;
+  int            verbose;
+  int            detached;      // frees itself when done
+  unsigned long  connectionNumber;
+  unsigned long  bytesReceived; // return value
+  double         delta;         // return value
+} tcps_args_struct;
+
+
+/**
+  * Sinks everything the client sends and, when the client shuts down
+  * its side, replies with the number of bytes received (8 bytes, network
+  * byte order) so that the client measures data that really arrived.
+  */
+static void *tcpServerStartupRoutine(void *arg) {
+  tcps_args_struct *args = (tcps_args_struct *) arg;
+  uint64_t  beginning, end;
+  char     *buffer;
+  ssize_t   n;
+  uint64_t  count;
+  unsigned char reply[8];
+
+  buffer = malloc(TCP_DEFAULT_MSG_SIZE);
+  if(buffer == NULL)
+    sbenchMyAbort("Can't allocate the receive buffer");
+
+  beginning = timerRead();
+  while((n = read(args->fd, buffer, TCP_DEFAULT_MSG_SIZE)) > 0)
+    args->bytesReceived += n;
+  end = timerRead();
+  args->delta = sbenchTimerElapsed(beginning, end);
+
+  count = args->bytesReceived;
+  for(int i = 0; i < 8; i++)
+    reply[i] = count >> (56 - 8 * i);
+  if(n == 0 && write(args->fd, reply, sizeof(reply)) != sizeof(reply))
+    fprintf(stderr, "Can't reply the byte count to the connection #%lu\n",
+            args->connectionNumber);
+  close(args->fd);
+
+  if(args->verbose)
+    printf("Connection #%lu: %lu bytes in %.3f s, %.3f Gb/s\n",
+           args->connectionNumber, args->bytesReceived, args->delta,
+           args->delta > 0 ? args->bytesReceived * 8 / args->delta / 1E9 : 0.);
+  free(buffer);
+  if(args->detached)
+    free(args);
+  return NULL;
+}
+
+
+/**
+  * Receiving side of the tcp throughput test.
+  * @param maxConnections connections to serve before returning, 0 == forever
+  * @return average throughput of each connection in Gb/s
+  */
+double sbenchDoTcpServer(unsigned long maxConnections, char *port, net_options *options, int verbose, int realtime) {
+  sched_params p;
+  char msg[100];
+  int  lfd, fd;
+  unsigned long accepted = 0;
+  double gbps = 0;
+  pthread_t        *threads = NULL;
+  tcps_args_struct *args    = NULL;
+
+  lfd = listenOn(port, SOCK_STREAM, options);
+  if(verbose) printf("Listening on TCP port %s for %lu connections\n", port, maxConnections);
+
+  if(maxConnections > 0) {
+    threads = (pthread_t *)        malloc(maxConnections * sizeof(pthread_t));
+    args    = (tcps_args_struct *) calloc(maxConnections, sizeof(tcps_args_struct));
+  }
+
+  // Enter realtime if needed
+  if(realtime == 1)
+    sbenchEnterRealTime(&p);
+
+  while(maxConnections == 0 || accepted < maxConnections) {
+    if((fd = accept(lfd, NULL, NULL)) == -1) {
+      if(errno == EINTR)
+        continue;
+      sbenchMyAbort("Can't accept a connection");
+    }
+
+    if(maxConnections == 0) {
+      // serving forever: detached threads that free their own args
+      pthread_t t;
+      tcps_args_struct *a = (tcps_args_struct *) calloc(1, sizeof(tcps_args_struct));
+      a->fd               = fd;
+      a->verbose          = 1;
+      a->detached         = 1;
+      a->connectionNumber = accepted;
+      if(pthread_create(&t, NULL, tcpServerStartupRoutine, (void *) a) ||
+         pthread_detach(t)) {
+        sprintf(msg, "Can't create the thread for the %lu-th connection", accepted);
+        sbenchMyAbort(msg);
+      }
+    }
+    else {
+      args[accepted].fd               = fd;
+      args[accepted].verbose          = verbose;
+      args[accepted].connectionNumber = accepted;
+      if(pthread_create(&(threads[accepted]), NULL, tcpServerStartupRoutine, (void *) &args[accepted])) {
+        sprintf(msg, "Can't create the thread for the %lu-th connection", accepted);
+        sbenchMyAbort(msg);
+      }
+    }
+    accepted++;
+  }
+
+  for(unsigned long i = 0; i < maxConnections; i++) {
+    if(pthread_join(threads[i], NULL)) {
+      sprintf(msg, "Can't join to %lu-th thread", i);
+      sbenchMyAbort(msg);
+    }
+    if(args[i].delta > 0)
+      gbps += args[i].bytesReceived * 8 / args[i].delta / 1E9;
+  }
+  gbps /= maxConnections; // Average!!
+
+  // Exit realtime if entered previously
+  if(realtime == 1)
+    sbenchExitRealTime(p);
+
+  close(lfd);
+  free(args);
+  return gbps;
+}
+
+
+/**
+  * Drains the MSG_ZEROCOPY completion notifications of the socket,
+  * the buffer is never modified so they just have to be consumed.
+  */
+static void drainZeroCopyCompletions(int fd) {
+  char control[128];
+  struct msghdr msg;
+
+  do {
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_control    = control;
+    msg.msg_controllen = sizeof(control);
+  } while(recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) != -1);
+}
+
+
+/**
+  * Sends one message of msgSize bytes using the chosen send path.
+  * @param fileFd  memfd holding the message, for SEND_SENDFILE
+  * @param pipeFds pipe for SEND_SPLICE
+  * @return 0 if ok, -1 on error
+  */
+static int sendMessage(int fd, char *buffer, unsigned long msgSize, enum sendMode mode, int fileFd, int pipeFds[2]) {
+  unsigned long sent = 0;
+  ssize_t n;
+
+  while(sent < msgSize) {
+    switch(mode) {
+      case SEND_WRITE:
+        n = send(fd, buffer + sent, msgSize - sent, 0);
+        break;
+      case SEND_SENDFILE: {
+        off_t offset = sent;
+        n = sendfile(fd, fileFd, &offset, msgSize - sent);
+        break;
+      }
+      case SEND_SPLICE: {
+        // user pages into the pipe, and from the pipe to the socket
+        struct iovec iov = {buffer + sent, msgSize - sent};
+        n = vmsplice(pipeFds[1], &iov, 1, 0);
+        for(ssize_t left = n; left > 0; ) {
+          ssize_t m = splice(pipeFds[0], NULL, fd, NULL, left, SPLICE_F_MOVE | SPLICE_F_MORE);
+          if(m <= 0)
+            return -1;
+          left -= m;
+        }
+        break;
+      }
+      case SEND_ZEROCOPY:
+        n = send(fd, buffer + sent, msgSize - sent, MSG_ZEROCOPY);
+        if(n == -1 && errno == ENOBUFS) {
+          // too many pending completions, consume them and retry
+          drainZeroCopyCompletions(fd);
+          continue;
+        }
+        break;
+      default:
+        return -1;
+    }
+    if(n == -1 && errno == EINTR)
+      continue;
+    if(n <= 0)
+      return -1;
+    sent += n;
+  }
+  if(mode == SEND_ZEROCOPY)
+    drainZeroCopyCompletions(fd);
+  return 0;
+}
+
+
+/**
+  * Closes the socket of a tcp stream and what it sends from.
+  */
+static void closeStream(int fd, int fileFd, int pipeFds[2]) {
+  if(fd != -1)
+    close(fd);
+  if(fileFd != -1)
+    close(fileFd);
+  if(pipeFds[0] != -1) {
+    close(pipeFds[0]);
+    close(pipeFds[1]);
+  }
+}
+
+
+/**
+  * Sending side of a tcp stream: pushes data for args->seconds,
+  * shuts down its side and waits for the byte count of the server.
+  */
+static void *tcpClientStartupRoutine(void *arg) {
+  sched_params p;
+  char msg[200];
+  int  fd, fileFd = -1, pipeFds[2] = {-1, -1}, on = 1;
+  char *buffer;
+  struct sockaddr_storage addr;
+  socklen_t addrLen;
+  uint64_t beginning, now, last, intended = 0, ns;
+  pacer pc;
+  perf_group pg;
+  struct tcp_info info;
+  socklen_t infoLen = sizeof(info);
+  unsigned char reply[8];
+  tcp_args_struct *args = (tcp_args_struct *) arg;
+
+  // what the network doesn't allow fails the test, not the program
+  if(sbenchResolveAddress(args->host, args->port, SOCK_STREAM, &addr, &addrLen) != 0)
+    sbenchFailTest(SBENCH_ERR_NETWORK, "Can't resolve %s port %s", args->host, args->port);
+
+  // kept for the next tests
+  buffer = sbenchReusableBuffer(args->threadNumber, args->msgSize);
+  if(buffer == NULL) {
+    sprintf(msg, "Can't allocate %lu bytes for the buffer", args->msgSize);
+    sbenchMyAbort(msg);
+  }
+  memset(buffer, 0xA5, args->msgSize);
+
+  if(args->options->sendMode == SEND_SENDFILE) {
+    fileFd = memfd_create("sbench", 0);
+    if(fileFd == -1 || write(fileFd, buffer, args->msgSize) != args->msgSize)
+      sbenchMyAbort("Can't create the in-memory file for sendfile");
+  }
+  else if(args->options->sendMode == SEND_SPLICE) {
+    if(pipe(pipeFds) != 0)
+      sbenchMyAbort("Can't create the pipe for splice");
+    // it's fine if it can't grow, vmsplice just moves less per call
+    fcntl(pipeFds[1], F_SETPIPE_SZ, args->msgSize);
+  }
+
+  fd = -1;
+  if(sbenchTestFailure() == SBENCH_OK) {
+    if((fd = socket(addr.ss_family, SOCK_STREAM, 0)) == -1)
+      sbenchMyAbort("Can't create the socket");
+    sbenchSetSocketOptions(fd, args->options);
+    if(args->options->sendMode == SEND_ZEROCOPY &&
+       setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)) != 0)
+      sbenchMyAbort("Can't enable SO_ZEROCOPY, it needs Linux >= 4.14");
+    if(connect(fd, (struct sockaddr *) &addr, addrLen) != 0)
+      sbenchFailTest(SBENCH_ERR_NETWORK, "Can't connect to %s port %s: %s", args->host, args->port, strerror(errno));
+  }
+
+  // all the streams start at once, none if one of them can't connect
+  pthread_barrier_wait(args->start);
+  if(sbenchTestFailure() != SBENCH_OK) {
+    closeStream(fd, fileFd, pipeFds);
+    return NULL;
+  }
+
+  // Enter realtime if needed
+  if(args->realtime == 1)
+    sbenchEnterRealTime(&p);
+
+  sbenchPerfBegin(&pg);
+  beginning = last = timerRead();
+  if(args->rate > 0)
+    sbenchPacerInit(&pc, args->rate, args->rateOffset);
+  do {
+    if(args->rate > 0)
+      intended = sbenchPacerWait(&pc);
+    if(sendMessage(fd, buffer, args->msgSize, args->options->sendMode, fileFd, pipeFds) != 0) {
+      sbenchFailTest(SBENCH_ERR_NETWORK, "Can't send to %s port %s on stream #%d: %s",
+                     args->host, args->port, args->threadNumber, strerror(errno));
+      break;
+    }
+    args->bytesSent += args->msgSize;
+    now = timerRead();
+    // closed loop: since the previous one was sent
+    ns  = (uint64_t) (sbenchTimerElapsed(args->rate > 0 ? intended : last, now) * 1E9);
+    if(args->rate > 0)
+      sbenchHistogramAdd(&args->latency, ns);
+    sampleCount(args->counters, 1, args->msgSize, ns);
+    last = now;
+  } while(sbenchTimerElapsed(beginning, now) < args->seconds);
+
+  // no more data, wait for the server to tell what really arrived
+  shutdown(fd, SHUT_WR);
+  for(ssize_t got = 0, n; got < sizeof(reply); got += n) {
+    if((n = read(fd, reply + got, sizeof(reply) - got)) <= 0) {
+      sbenchFailTest(SBENCH_ERR_NETWORK, "The server didn't report the bytes received on stream #%d", args->threadNumber);
+      break;
+    }
+  }
+  now = timerRead();
+  sbenchPerfEnd(&pg, args->bytesSent / args->msgSize, "message");
+  args->delta = sbenchTimerElapsed(beginning, now);
+
+  // Exit realtime if entered previously
+  if(args->realtime == 1)
+    sbenchExitRealTime(p);
+
+  for(int i = 0; i < 8; i++)
+    args->bytesReceived = args->bytesReceived << 8 | reply[i];
+  if(getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &infoLen) == 0)
+    args->retransmits = info.tcpi_total_retrans;
+
+  closeStream(fd, fileFd, pipeFds);
+  return NULL;
+}
+
+
+/**
+  * Sends data to a "tcp_server" over nStreams parallel connections
+  * during some seconds.
+  * @param rate total messages per second of all the streams,
+  *        0 == as fast as possible
+  * @return aggregate throughput, retransmits and per-stream results
+  */
+tcpResponse sbenchDoTcpClientTest(unsigned long seconds, unsigned int nStreams, unsigned long msgSize, double rate, char *port, char *host, net_options *options, int verbose, int realtime) {
+  double longest = 0;
+  unsigned long bytes = 0;
+  pthread_barrier_t start;
+  tcpResponse tr;
+  sample_counters *counters;
+
+  memset(&tr, 0, sizeof(tr));
+  tr.nStreams = nStreams;
+
+  // Thread creation
+  tcp_args_struct *args    = (tcp_args_struct *) calloc(nStreams, sizeof(tcp_args_struct));
+  pthread_barrier_init(&start, NULL, nStreams);
+
+  if(verbose) printf("Let's create %d streams:\n", nStreams);
+
+  // let's fill the args for the n-th thread.
+  for (int i = 0; i < nStreams; i++) {
+    args[i].host         = host,
+    args[i].port         = port,
+    args[i].seconds      = seconds,
+    args[i].msgSize      = msgSize,
+    args[i].options      = options,
+    args[i].verbose      = verbose,
+    args[i].realtime     = realtime,
+    args[i].threadNumber = i,
+    args[i].rate         = rate / nStreams,
+    args[i].rateOffset   = rate > 0 ? i / rate : 0,
+    args[i].start        = &start;
+  }
+
+  if(verbose) printf("Streams created, waiting for completion...:\n");
+  counters = sbenchSamplerStart(nStreams);
+  for (int i = 0; i < nStreams; i++)
+    args[i].counters = counters != NULL ? &counters[i] : NULL;
+  sbenchClearTestFailure();
+  // a stream that can't connect or send fails the test, that the caller sees
+  if(sbenchRunOnThreads(tcpClientStartupRoutine, args, sizeof(args[0]), nStreams) != SBENCH_OK &&
+     sbenchTestFailure() != SBENCH_ERR_NETWORK)
+    sbenchMyAbort((char *) sbenchTestFailureMessage());
+  sbenchSamplerStop();
+  for (int i = 0; i < nStreams; i++) {
+    if(verbose) printf("The stream #%d has finished with delta = %f, %lu bytes sent, %lu received\n", i, args[i].delta, args[i].bytesSent, args[i].bytesReceived);
+    if(args[i].delta > longest)
+      longest = args[i].delta;
+    bytes          += args[i].bytesReceived;
+    tr.retransmits += args[i].retransmits;
+    sbenchHistogramMerge(&tr.histogram, &args[i].latency);
+  }
+  pthread_barrier_destroy(&start);
+  if(rate > 0)
+    sbenchHistogramStats(&tr.histogram, &tr.latency);
+
+  tr.gbps    = longest > 0 ? bytes * 8 / longest / 1E9 : 0;
+  tr.streams = args;
+  return tr;
+}
+
+
+/**
+  * Sends back every datagram it gets, as is.
+  * @param seconds time to keep reflecting, 0 == forever
+  * @return number of datagrams reflected
+  */
+double sbenchDoUdpReflector(unsigned long seconds, char *port, int verbose, int realtime) {
+  sched_params p;
+  int  fd;
+  char buffer[65536];
+  ssize_t n;
+  unsigned long reflected = 0;
+  struct sockaddr_storage peer;
+  socklen_t peerLen;
+  double start;
+  struct pollfd pfd;
+
+  fd = listenOn(port, SOCK_DGRAM, NULL);
+  if(verbose) printf("Reflecting UDP datagrams on port %s for %lu s\n", port, seconds);
+  pfd.fd     = fd;
+  pfd.events = POLLIN;
+
+  // Enter realtime if needed
+  if(realtime == 1)
+    sbenchEnterRealTime(&p);
+
+  start = sbenchMonotonicSeconds();
+  while(1) {
+    if(seconds > 0 && sbenchMonotonicSeconds() - start >= seconds)
+      break;
+    if(poll(&pfd, 1, 100) <= 0)
+      continue;
+    peerLen = sizeof(peer);
+    n = recvfrom(fd, buffer, sizeof(buffer), 0, (struct sockaddr *) &peer, &peerLen);
+    if(n < 0)
+      continue;
+    if(sendto(fd, buffer, n, 0, (struct sockaddr *) &peer, peerLen) == n)
+      reflected++;
+  }
+
+  // Exit realtime if entered previously
+  if(realtime == 1)
+    sbenchExitRealTime(p);
+
+  close(fd);
+  return reflected;
+}
+
+
+/* arguments for the sending thread of udp_rr */
+typedef struct udp_rr_args {
+  int            fd;
+  unsigned long  count;
+  unsigned long  rate;
+  unsigned long  sizeInBytes;
+  int            realtimeClock; // stamps with CLOCK_REALTIME, like the kernel
+  int            realtime;
+  double        *txUser;        // return value, send instant of each seq
+  int            done;          // return value, set with __atomic_store_n
+} udp_rr_args_struct;
+
+
+/**
+  * Time in seconds of the clock used to stamp the datagrams:
+  * CLOCK_REALTIME to be comparable with the kernel timestamps,
+  * CLOCK_MONOTONIC_RAW if there are no kernel timestamps.
+  */
+static double udpRRNow(int realtimeClock) {
+  struct timespec t;
+  clock_gettime(realtimeClock ? CLOCK_REALTIME : CLOCK_MONOTONIC_RAW, &t);
+  return t.tv_sec + t.tv_nsec / 1E9;
+}
+
+
+/**
+  * Sends the datagrams of udp_rr following an absolute schedule,
+  * so that the rate doesn't drift with the time it takes to send.
+  */
+static void *udpRRSenderStartupRoutine(void *arg) {
+  sched_params p;
+  udp_rr_args_struct *args = (udp_rr_args_struct *) arg;
+  char *buffer;
+  udp_rr_header *h;
+  struct timespec next;
+  long period = 1000000000L / args->rate;
+
+  buffer = calloc(1, args->sizeInBytes);
+  if(buffer == NULL)
+    sbenchMyAbort("Can't allocate the datagram buffer");
+  h = (udp_rr_header *) buffer;
+  h->magic = htonl(UDP_RR_MAGIC);
+
+  // Enter realtime if needed
+  if(args->realtime == 1)
+    sbenchEnterRealTime(&p);
+
+  clock_gettime(CLOCK_MONOTONIC, &next);
+  for(unsigned long i = 0; i < args->count; i++) {
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+    h->seq  = htonl(i);
+    args->txUser[i] = udpRRNow(args->realtimeClock);
+    h->txNs = (uint64_t) (args->txUser[i] * 1E9);
+    if(send(args->fd, buffer, args->sizeInBytes, 0) != args->sizeInBytes)
+      args->txUser[i] = -1; // not sent, it will count as lost
+    next.tv_nsec += period;
+    while(next.tv_nsec >= 1000000000L) {
+      next.tv_nsec -= 1000000000L;
+      next.tv_sec++;
+    }
+  }
+
+  // Exit realtime if entered previously
+  if(args->realtime == 1)
+    sbenchExitRealTime(p);
+
+  free(buffer);
+  // releases the send instants on txUser to the receiving thread
+  __atomic_store_n(&args->done, 1, __ATOMIC_RELEASE);
+  return NULL;
+}
+
+
+/**
+  * Gets the software timestamp that the kernel attached to a message
+  * with SO_TIMESTAMPING.
+  * @return the timestamp in seconds, -1 if there's none
+  */
+static double kernelTimestamp(struct msghdr *msg) {
+  struct cmsghdr *cmsg;
+
+  for(cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+    if(cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPING) {
+      struct scm_timestamping *ts = (struct scm_timestamping *) CMSG_DATA(cmsg);
+      if(ts->ts[0].tv_sec != 0 || ts->ts[0].tv_nsec != 0)
+        return ts->ts[0].tv_sec + ts->ts[0].tv_nsec / 1E9;
+    }
+  }
+  return -1;
+}
+
+
+/**
+  * Request/response latency over UDP against a "udp_reflector":
+  * sends "count" timestamped datagrams at "rate" per second and measures
+  * the round-trip time of each one, the jitter, the reordering and the loss.
+  *
+  * When the kernel supports SO_TIMESTAMPING the times are the software
+  * timestamps of the kernel when sending and receiving, so the scheduling
+  * delays of sbench itself are left out.
+  */
+udpRRResponse sbenchDoUdpRRTest(unsigned long count, unsigned long rate, unsigned long sizeInBytes, char *port, char *host, int verbose, int realtime) {
+  int  fd, flags;
+  struct sockaddr_storage addr;
+  socklen_t addrLen;
+  pthread_t sender;
+  udp_rr_args_struct args;
+  double *txKernel, *rtt, *samples;
+  double lastRtt = -1, jitterSum = 0, deadline = 0;
+  unsigned long jitterCount = 0, maxSeq = 0, nSamples = 0;
+  char buffer[65536], control[512];
+  struct pollfd pfd;
+  udpRRResponse ur;
+
+  memset(&ur, 0, sizeof(ur));
+  if(sizeInBytes < UDP_RR_MIN_SIZE)
+    sizeInBytes = UDP_RR_MIN_SIZE;
+  if(sbenchResolveAddress(host, port, SOCK_DGRAM, &addr, &addrLen) != 0) {
+    sbenchFailTest(SBENCH_ERR_NETWORK, "Can't resolve %s port %s", host, port);
+    return ur;
+  }
+  if((fd = socket(addr.ss_family, SOCK_DGRAM, 0)) == -1)
+    sbenchMyAbort("Can't create the socket");
+  if(connect(fd, (struct sockaddr *) &addr, addrLen) != 0) {
+    sbenchFailTest(SBENCH_ERR_NETWORK, "Can't connect to %s port %s: %s", host, port, strerror(errno));
+    close(fd);
+    return ur;
+  }
+
+  // kernel timestamps on send (through the error queue) and receive
+  flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_TX_SOFTWARE |
+          SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_OPT_ID |
+          SOF_TIMESTAMPING_OPT_TSONLY;
+  ur.kernelTimestamps = setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) == 0;
+  if(verbose) printf("Using %s timestamps\n", ur.kernelTimestamps ? "kernel" : "user space");
+
+  args.txUser = (double *) malloc(count * sizeof(double));
+  txKernel    = (double *) malloc(count * sizeof(double));
+  rtt         = (double *) malloc(count * sizeof(double));
+  samples     = (double *) malloc(count * sizeof(double));
+  if(args.txUser == NULL || txKernel == NULL || rtt == NULL || samples == NULL)
+    sbenchMyAbort("Can't allocate the arrays of timestamps");
+  for(unsigned long i = 0; i < count; i++) {
+    args.txUser[i] = 0;
+    txKernel[i]    = -1;
+    rtt[i]         = -1;
+  }
+
+  args.fd            = fd;
+  args.count         = count;
+  args.rate          = rate;
+  args.sizeInBytes   = sizeInBytes;
+  args.realtimeClock = ur.kernelTimestamps;
+  args.realtime      = realtime;
+  args.done          = 0;
+  if(pthread_create(&sender, NULL, udpRRSenderStartupRoutine, (void *) &args))
+    sbenchMyAbort("Can't create the sending thread");
+
+  pfd.fd     = fd;
+  pfd.events = POLLIN;
+  while(1) {
+    if(__atomic_load_n(&args.done, __ATOMIC_ACQUIRE)) {
+      // everything sent, wait a bit for the late replies
+      if(deadline == 0)
+        deadline = udpRRNow(0) + UDP_RR_TIMEOUT_MS / 1000.;
+      else if(udpRRNow(0) > deadline || ur.received == count)
+        break;
+    }
+    if(poll(&pfd, 1, 10) <= 0)
+      continue;
+
+    struct iovec iov = {buffer, sizeof(buffer)};
+    struct msghdr m;
+    memset(&m, 0, sizeof(m));
+    m.msg_iov        = &iov;
+    m.msg_iovlen     = 1;
+    m.msg_control    = control;
+    m.msg_controllen = sizeof(control);
+
+    if(pfd.revents & POLLERR) {
+      // a send timestamp: its id is the number of datagrams sent before
+      if(recvmsg(fd, &m, MSG_ERRQUEUE) >= 0) {
+        struct cmsghdr *cmsg;
+        double t = kernelTimestamp(&m);
+        for(cmsg = CMSG_FIRSTHDR(&m); cmsg != NULL; cmsg = CMSG_NXTHDR(&m, cmsg)) {
+          struct sock_extended_err *err = (struct sock_extended_err *) CMSG_DATA(cmsg);
+          if((cmsg->cmsg_level == SOL_IP   && cmsg->cmsg_type == IP_RECVERR) ||
+             (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR)) {
+            if(err->ee_origin == SO_EE_ORIGIN_TIMESTAMPING && err->ee_data < count)
+              txKernel[err->ee_data] = t;
+          }
+        }
+      }
+      continue;
+    }
+
+    ssize_t n = recvmsg(fd, &m, 0);
+    double  rx, tx;
+    udp_rr_header *h = (udp_rr_header *) buffer;
+    if(n < (ssize_t) UDP_RR_MIN_SIZE || ntohl(h->magic) != UDP_RR_MAGIC)
+      continue;
+    uint32_t seq = ntohl(h->seq);
+    if(seq >= count || rtt[seq] >= 0)
+      continue; // unknown or duplicated
+
+    rx = ur.kernelTimestamps ? kernelTimestamp(&m) : -1;
+    if(rx < 0)
+      rx = udpRRNow(ur.kernelTimestamps);
+    tx = txKernel[seq] >= 0 ? txKernel[seq] : args.txUser[seq];
+    rtt[seq] = (rx - tx) * 1000;
+    if(rtt[seq] < 0)
+      rtt[seq] = 0;
+
+    if(seq < maxSeq)
+      ur.reordered++;
+    else
+      maxSeq = seq;
+    if(lastRtt >= 0) {
+      jitterSum += fabs(rtt[seq] - lastRtt);
+      jitterCount++;
+    }
+    lastRtt = rtt[seq];
+    ur.received++;
+    if(verbose) printf("seq=%u rtt=%.3f ms\n", seq, rtt[seq]);
+  }
+
+  if(pthread_join(sender, NULL))
+    sbenchMyAbort("Can't join to the sending thread");
+  close(fd);
+
+  for(unsigned long i = 0; i < count; i++) {
+    if(args.txUser[i] >= 0)
+      ur.sent++;
+    if(rtt[i] >= 0)
+      samples[nSamples++] = rtt[i];
+  }
+  sbenchComputeLatencyStats(samples, nSamples, &ur.rtt);
+  ur.jitterMs    = jitterCount > 0 ? jitterSum / jitterCount : 0;
+  ur.lossPerCent = count > 0 ? 100. * (count - ur.received) / count : 0;
+
+  free(args.txUser);
+  free(txKernel);
+  free(rtt);
+  free(samples);
+  return ur;
+}
+
+
+/**
+  * Internet checksum (RFC 1071), needed on raw ICMP sockets
+  */
+static uint16_t inetChecksum(const void *data, size_t len) {
+  const uint16_t *w = data;
+  uint32_t sum = 0;
+
+  for(; len > 1; len -= 2)
+    sum += *w++;
+  if(len == 1)
+    sum += *(const uint8_t *) w;
+  sum  = (sum >> 16) + (sum & 0xffff);
+  sum += sum >> 16;
+  return ~sum;
+}
+
+
+/**
+  * Opens a socket to send ICMP echo requests without forking "ping".
+  * It tries first an unprivileged ICMP datagram socket, allowed to the
+  * groups in /proc/sys/net/ipv4/ping_group_range, and then a raw one,
+  * that needs root or "setcap cap_net_raw=ep".
+  * @return 0 if ok, -1 if neither can be opened
+  */
+static int openIcmpSocket(int family, icmp_socket *s) {
+  int protocol = family == AF_INET6 ? IPPROTO_ICMPV6 : IPPROTO_ICMP;
+
+  s->family = family;
+  s->id     = getpid() & 0xffff;
+  s->raw    = 0;
+  if((s->fd = socket(family, SOCK_DGRAM, protocol)) != -1)
+    return 0;
+  s->raw = 1;
+  if((s->fd = socket(family, SOCK_RAW, protocol)) != -1)
+    return 0;
+  return -1;
+}
+
+
+/**
+  * Sends an echo request with sizeInBytes bytes of payload, like "ping -s"
+  * @return 0 if sent, -1 if not
+  */
+static int sendEchoRequest(icmp_socket *s, struct sockaddr_storage *addr, socklen_t addrLen, uint16_t seq, unsigned long sizeInBytes) {
+  unsigned char packet[sizeof(struct icmphdr) + ICMP_MAX_PAYLOAD];
+  struct icmphdr *h = (struct icmphdr *) packet;
+  size_t len = sizeof(struct icmphdr) + sizeInBytes;
+
+  memset(packet, 0, sizeof(struct icmphdr));
+  memset(packet + sizeof(struct icmphdr), 0xA5, sizeInBytes);
+  // ICMPv6 echo has the same layout, just other type numbers
+  h->type             = s->family == AF_INET6 ? ICMP6_ECHO_REQUEST : ICMP_ECHO;
+  h->un.echo.id       = htons(s->id);
+  h->un.echo.sequence = htons(seq);
+  // the kernel does it on datagram sockets and for ICMPv6
+  if(s->raw && s->family == AF_INET)
+    h->checksum = inetChecksum(packet, len);
+
+  return sendto(s->fd, packet, len, 0, (struct sockaddr *) addr, addrLen) == len ? 0 : -1;
+}
+
+
+/**
+  * Reads one packet from the ICMP socket.
+  * @return 1 if it's an echo reply to us, with its sequence number in seq,
+  *         0 if it's another packet, -1 on error
+  */
+static int receiveEchoReply(icmp_socket *s, struct sockaddr_storage *from, uint16_t *seq) {
+  unsigned char packet[sizeof(struct icmphdr) + ICMP_MAX_PAYLOAD + 60];
+  unsigned char *p = packet;
+  socklen_t fromLen = sizeof(struct sockaddr_storage);
+  ssize_t n;
+  struct icmphdr *h;
+
+  if((n = recvfrom(s->fd, packet, sizeof(packet), 0, (struct sockaddr *) from, &fromLen)) < 0)
+    return -1;
+  if(s->raw && s->family == AF_INET) {
+    // raw IPv4 sockets get the IP header too
+    size_t ipHeaderLen = (packet[0] & 0x0f) * 4;
+    p += ipHeaderLen;
+    n -= ipHeaderLen;
+  }
+  if(n < (ssize_t) sizeof(struct icmphdr))
+    return 0;
+  h = (struct icmphdr *) p;
+  if(h->type != (s->family == AF_INET6 ? ICMP6_ECHO_REPLY : ICMP_ECHOREPLY))
+    return 0;
+  // raw sockets see the replies to everybody, datagram ones just ours
+  if(s->raw && ntohs(h->un.echo.id) != s->id)
+    return 0;
+  *seq = ntohs(h->un.echo.sequence);
+  return 1;
+}
+
+
+#ifndef OPING_ENABLED
+/**
+  * Ping without external programs nor libraries: sends "times" ICMP echo
+  * requests every intervalMs miliseconds (it can be less than a second)
+  * and keeps the round-trip time of each one.
+  *
+  * It uses an unprivileged ICMP datagram socket if the kernel allows it
+  * to our group (sysctl net.ipv4.ping_group_range) and a raw socket if not,
+  * then you'll need to run it as root or "setcap cap_net_raw=ep" it.
+  *
+  * @return latency (average and percentiles) and packet loss
+  */
+pingResponse sbenchDoPing(unsigned long sizeInBytes, unsigned long times, unsigned long intervalMs, char *dest,
+             int verbose, int realtime) {
+  sched_params p;
+  char msg[300];
+  icmp_socket s;
+  struct sockaddr_storage addr, from;
+  socklen_t addrLen;
+  struct timespec now, next, deadline;
+  uint64_t *tx;
+  double *rtt, *samples;
+  unsigned long sent = 0, received = 0, nSamples = 0;
+  uint16_t seq;
+  struct pollfd pfd;
+  pingResponse pr = {-1, 100};
+
+  if(verbose) printf("Sending %lu ICMP echo request paquets "
+                     "%lu bytes-long to %s every %lu ms\n", times, sizeInBytes, dest, intervalMs);
+
+  if(sizeInBytes > ICMP_MAX_PAYLOAD) {
+    sprintf(msg, "The ICMP payload can't be bigger than %d bytes", ICMP_MAX_PAYLOAD);
+    sbenchMyAbort(msg);
+  }
+  // what the host or its network don't allow fails the test, not the program
+  if(sbenchResolveAddress(dest, NULL, SOCK_DGRAM, &addr, &addrLen) != 0) {
+    sbenchFailTest(SBENCH_ERR_NETWORK, "Can't resolve %s", dest);
+    return pr;
+  }
+  if(openIcmpSocket(addr.ss_family, &s) != 0) {
+    sbenchFailTest(SBENCH_ERR_NETWORK, "Can't open an ICMP socket: add your group to "
+                   "net.ipv4.ping_group_range or use something like "
+                   "\"sudo setcap cap_net_raw=ep\" on your executable");
+    return pr;
+  }
+  if(verbose) printf("Using a %s ICMP socket\n", s.raw ? "raw" : "datagram");
+
+  tx      = (uint64_t *) malloc(times * sizeof(uint64_t));
+  rtt     = (double *) malloc(times * sizeof(double));
+  samples = (double *) malloc(times * sizeof(double));
+  if(tx == NULL || rtt == NULL || samples == NULL)
+    sbenchMyAbort("Can't allocate the arrays of timestamps");
+  for(unsigned long i = 0; i < times; i++)
+    rtt[i] = -1;
+
+  pfd.fd     = s.fd;
+  pfd.events = POLLIN;
+
+  // Enter realtime if needed
+  if(realtime == 1)
+    sbenchEnterRealTime(&p);
+
+  clock_gettime(CLOCK_MONOTONIC, &next);
+  while(1) {
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if(sent < times && timespec_diff(&now, &next) >= 0) {
+      tx[sent] = timerRead();
+      if(sendEchoRequest(&s, &addr, addrLen, sent & 0xffff, sizeInBytes) != 0 && verbose)
+        printf("Can't send the echo request #%lu: %s\n", sent, strerror(errno));
+      sent++;
+      next.tv_sec  += intervalMs / 1000;
+      next.tv_nsec += (intervalMs % 1000) * 1000000;
+      if(next.tv_nsec >= 1000000000L) {
+        next.tv_nsec -= 1000000000L;
+        next.tv_sec++;
+      }
+      if(sent == times) {
+        deadline         = now;
+        deadline.tv_sec += ICMP_TIMEOUT_MS / 1000;
+      }
+      continue;
+    }
+    if(sent == times && (received == times || timespec_diff(&now, &deadline) >= 0))
+      break;
+
+    // wait for replies until the next request is due
+    double wait = sent < times ? timespec_diff(&next, &now) : timespec_diff(&deadline, &now);
+    if(poll(&pfd, 1, wait > 0 ? (int) (wait * 1000) + 1 : 0) <= 0)
+      continue;
+    if(receiveEchoReply(&s, &from, &seq) != 1)
+      continue;
+    uint64_t rx = timerRead();
+
+    // the latest request sent with that sequence number
+    unsigned long i = (sent - 1) - ((((sent - 1) & 0xffff) - seq) & 0xffff);
+    if(i >= sent || rtt[i] >= 0)
+      continue; // unknown or duplicated
+    rtt[i] = sbenchTimerElapsed(tx[i], rx) * 1000;
+    samples[nSamples++] = rtt[i];
+    received++;
+    if(verbose) printf("reply from %s: icmp_seq=%lu time=%.3f ms\n", dest, i + 1, rtt[i]);
+  }
+
+  // Exit realtime if entered previously
+  if(realtime == 1)
+    sbenchExitRealTime(p);
+
+  close(s.fd);
+  sbenchComputeLatencyStats(samples, nSamples, &pr.rtt);
+  if(received > 0)
+    pr.latencyMs = pr.rtt.avg;
+  pr.lossPerCent = 100. * (times - received) / times;
+  if(verbose) printf("Ping response: latency=%.3fms, loss=%.1f%%\n", pr.latencyMs, pr.lossPerCent);
+
+  free(tx);
+  free(rtt);
+  free(samples);
+  return pr;
+}
+#endif // OPING_ENABLED
+
+
+/**
+  * Adds a target like "host" (ICMP echo) or "host/port" (TCP connect)
+  * to the survey
+  */
+static void addSurveyTarget(survey_target **targets, unsigned int *n, char *spec, unsigned long times) {
+  char msg[300];
+  char *slash;
+  survey_target *t;
+
+  if(*n >= SURVEY_MAX_TARGETS) {
+    sprintf(msg, "Too many targets, the maximum is %d", SURVEY_MAX_TARGETS);
+    sbenchMyAbort(msg);
+  }
+  // grows in powers of two
+  if((*n & (*n - 1)) == 0) {
+    *targets = (survey_target *) realloc(*targets, (*n == 0 ? 1 : *n * 2) * sizeof(survey_target));
+    if(*targets == NULL)
+      sbenchMyAbort("Can't allocate the array of targets");
+  }
+  t = &(*targets)[(*n)++];
+  memset(t, 0, sizeof(survey_target));
+  snprintf(t->name, sizeof(t->name), "%s", spec);
+  if((slash = strrchr(t->name, '/')) != NULL) {
+    snprintf(t->port, sizeof(t->port), "%s", slash + 1);
+    *slash = '\0';
+  }
+  t->tcpFd = -1;
+  t->tx    = (double *) malloc(times * sizeof(double));
+  t->rtt   = (double *) malloc(times * sizeof(double));
+  if(t->tx == NULL || t->rtt == NULL)
+    sbenchMyAbort("Can't allocate the arrays of timestamps");
+  for(unsigned long i = 0; i < times; i++)
+    t->rtt[i] = -1;
+}
+
+
+/**
+  * Parses the targets of the survey: a comma-separated list
+  * or "@fileName" with one target per line ('#' starts a comment)
+  * @return array of targets, nTargets gets its size
+  */
+static survey_target *parseSurveyTargets(char *targetList, unsigned long times, unsigned int *nTargets) {
+  char msg[PATH_MAX + 100];
+  char line[512], *saveptr, *tok;
+  FILE *f;
+  survey_target *targets = NULL;
+
+  *nTargets = 0;
+
+  if(targetList[0] == '@') {
+    if((f = fopen(targetList + 1, "r")) == NULL) {
+      sprintf(msg, "Can't open the file of targets %s", targetList + 1);
+      sbenchMyAbort(msg);
+    }
+    while(fgets(line, sizeof(line), f) != NULL) {
+      line[strcspn(line, "#\r\n")] = '\0';
+      if((tok = strtok_r(line, " \t", &saveptr)) != NULL)
+        addSurveyTarget(&targets, nTargets, tok, times);
+    }
+    fclose(f);
+  }
+  else {
+    for(tok = strtok_r(targetList, ",", &saveptr); tok != NULL; tok = strtok_r(NULL, ",", &saveptr))
+      addSurveyTarget(&targets, nTargets, tok, times);
+  }
+  if(*nTargets == 0)
+    sbenchMyAbort("There are no targets to survey");
+  return targets;
+}
+
+
+/**
+  * Resolves all the targets at once with getaddrinfo_a, whose pool of
+  * threads asks for several names at a time, so that a slow DNS costs
+  * about the slowest name instead of the sum of all of them. If the
+  * requests can't be queued they are resolved one after the other.
+  */
+static void resolveSurveyTargets(survey_target *targets, unsigned int n, int verbose) {
+  struct gaicb    *reqs  = (struct gaicb *)    calloc(n, sizeof(struct gaicb));
+  struct gaicb   **list  = (struct gaicb **)   malloc(n * sizeof(struct gaicb *));
+  struct addrinfo *hints = (struct addrinfo *) calloc(n, sizeof(struct addrinfo));
+  int queued;
+
+  if(reqs == NULL || list == NULL || hints == NULL)
+    sbenchMyAbort("Can't allocate the name lookups of the targets");
+  for(unsigned int i = 0; i < n; i++) {
+    hints[i].ai_family    = AF_UNSPEC;
+    hints[i].ai_socktype  = targets[i].port[0] ? SOCK_STREAM : SOCK_DGRAM;
+    reqs[i].ar_name       = targets[i].name;
+    reqs[i].ar_service    = targets[i].port[0] ? targets[i].port : NULL;
+    reqs[i].ar_request    = &hints[i];
+    list[i]               = &reqs[i];
+  }
+  queued = getaddrinfo_a(GAI_WAIT, list, n, NULL) != EAI_AGAIN;
+
+  for(unsigned int i = 0; i < n; i++) {
+    survey_target *t = &targets[i];
+    if(! queued)
+      t->resolved = sbenchResolveAddress(t->name, t->port[0] ? t->port : NULL, hints[i].ai_socktype,
+                                         &t->addr, &t->addrLen) == 0;
+    else if(gai_error(&reqs[i]) == 0 && reqs[i].ar_result != NULL) {
+      memcpy(&t->addr, reqs[i].ar_result->ai_addr, reqs[i].ar_result->ai_addrlen);
+      t->addrLen  = reqs[i].ar_result->ai_addrlen;
+      t->resolved = 1;
+    }
+    if(reqs[i].ar_result != NULL)
+      freeaddrinfo(reqs[i].ar_result);
+    if(! t->resolved && verbose)
+      printf("Can't resolve %s, it will count as lost\n", t->name);
+  }
+  free(reqs);
+  free(list);
+  free(hints);
+}
+
+
+/**
+  * Starts a non-blocking TCP connect to the target and watches it
+  * @return 0 if in progress or already connected, -1 if it failed
+  */
+static int startTcpProbe(int epfd, survey_target *t, unsigned int index, unsigned long probe) {
+  struct epoll_event ev;
+
+  t->tcpFd = socket(t->addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  if(t->tcpFd == -1)
+    return -1;
+  if(connect(t->tcpFd, (struct sockaddr *) &t->addr, t->addrLen) != 0 && errno != EINPROGRESS) {
+    close(t->tcpFd);
+    t->tcpFd = -1;
+    return -1;
+  }
+  t->tcpProbe   = probe;
+  ev.events     = EPOLLOUT;
+  ev.data.u64   = (uint64_t) 2 << 32 | index;
+  epoll_ctl(epfd, EPOLL_CTL_ADD, t->tcpFd, &ev);
+  return 0;
+}
+
+
+static void closeTcpProbe(int epfd, survey_target *t) {
+  epoll_ctl(epfd, EPOLL_CTL_DEL, t->tcpFd, NULL);
+  close(t->tcpFd);
+  t->tcpFd = -1;
+}
+
+
+/**
+  * Do two socket addresses point to the same host?
+  */
+static int sameHost(struct sockaddr_storage *a, struct sockaddr_storage *b) {
+  if(a->ss_family != b->ss_family)
+    return 0;
+  if(a->ss_family == AF_INET)
+    return ((struct sockaddr_in *) a)->sin_addr.s_addr == ((struct sockaddr_in *) b)->sin_addr.s_addr;
+  return memcmp(&((struct sockaddr_in6 *) a)->sin6_addr, &((struct sockaddr_in6 *) b)->sin6_addr, sizeof(struct in6_addr)) == 0;
+}
+
+
+/**
+  * Latency survey of many targets at once from a single epoll loop:
+  * each target gets "times" probes every intervalMs, ICMP echo requests
+  * or TCP connects, and the targets are spread along the interval
+  * so that the probes don't go out in bursts.
+  *
+  * @param targetList comma-separated list of "host" or "host/port"
+  *                   or "@fileName" with one per line
+  * @return array of nTargets results, to be freed by the caller
+  */
+survey_target *sbenchDoSurvey(char *targetList, unsigned long times, unsigned long intervalMs, unsigned int *nTargets, int verbose, int realtime) {
+  sched_params p;
+  int  epfd, n;
+  icmp_socket icmp[2] = {{-1}, {-1}}; // IPv4 and IPv6
+  struct epoll_event ev, events[64];
+  survey_target *targets;
+  double start, now, nextDue, interval = intervalMs / 1000.;
+  unsigned long pending = 0;
+
+  targets = parseSurveyTargets(targetList, times, nTargets);
+  if((epfd = epoll_create1(0)) == -1)
+    sbenchMyAbort("Can't create the epoll instance");
+
+  resolveSurveyTargets(targets, *nTargets, verbose);
+  for(unsigned int i = 0; i < *nTargets; i++) {
+    survey_target *t = &targets[i];
+    if(t->resolved && t->port[0] == '\0') {
+      icmp_socket *s = &icmp[t->addr.ss_family == AF_INET6];
+      if(s->fd == -1) {
+        if(openIcmpSocket(t->addr.ss_family, s) != 0)
+          sbenchMyAbort("Can't open an ICMP socket: add your group to "
+                        "net.ipv4.ping_group_range or use something like "
+                        "\"sudo setcap cap_net_raw=ep\" on your executable");
+        ev.events   = EPOLLIN;
+        ev.data.u64 = (uint64_t) (t->addr.ss_family == AF_INET6);
+        epoll_ctl(epfd, EPOLL_CTL_ADD, s->fd, &ev);
+      }
+    }
+  }
+  if(verbose) printf("Surveying %u targets, %lu probes each every %lu ms\n", *nTargets, times, intervalMs);
+
+  // Enter realtime if needed
+  if(realtime == 1)
+    sbenchEnterRealTime(&p);
+
+  start = sbenchMonotonicSeconds();
+  while(1) {
+    now     = sbenchMonotonicSeconds();
+    nextDue = -1;
+
+    // send the probes that are due, and expire the ones that timed out
+    for(unsigned int i = 0; i < *nTargets; i++) {
+      survey_target *t = &targets[i];
+      double offset = interval * i / *nTargets;
+
+      if(t->tcpFd != -1 && now - t->tx[t->tcpProbe] >= ICMP_TIMEOUT_MS / 1000.) {
+        closeTcpProbe(epfd, t);
+        pending--;
+      }
+      if(t->sent == times)
+        continue;
+      double due = start + offset + interval * t->sent;
+      if(due > now) {
+        if(nextDue < 0 || due < nextDue)
+          nextDue = due;
+        continue;
+      }
+      t->tx[t->sent] = now;
+      if(t->resolved && t->port[0] == '\0') {
+        sendEchoRequest(&icmp[t->addr.ss_family == AF_INET6], &t->addr, t->addrLen, t->sent & 0xffff, 56);
+      }
+      else if(t->resolved) {
+        if(t->tcpFd != -1) {
+          // the previous connect is still pending, give up on it
+          closeTcpProbe(epfd, t);
+          pending--;
+        }
+        if(startTcpProbe(epfd, t, i, t->sent) == 0)
+          pending++;
+      }
+      t->sent++;
+      if(t->sent < times && (nextDue < 0 || due + interval < nextDue))
+        nextDue = due + interval;
+    }
+
+    // all sent: wait for the last replies, at most the timeout
+    if(nextDue < 0) {
+      double lastSent = start + interval * times;
+      unsigned long outstanding = pending;
+      for(unsigned int i = 0; i < *nTargets; i++)
+        if(targets[i].resolved && targets[i].port[0] == '\0')
+          outstanding += targets[i].sent - targets[i].received;
+      if(outstanding == 0 || now - lastSent >= ICMP_TIMEOUT_MS / 1000.)
+        break;
+      nextDue = now + 0.01;
+    }
+
+    n = epoll_wait(epfd, events, 64, nextDue > now ? (int) ((nextDue - now) * 1000) + 1 : 0);
+    now = sbenchMonotonicSeconds();
+    for(int e = 0; e < n; e++) {
+      uint64_t kind = events[e].data.u64 >> 32;
+      if(kind == 2) {
+        // a TCP connect finished
+        survey_target *t = &targets[events[e].data.u64 & 0xffffffff];
+        int err = 0;
+        socklen_t len = sizeof(err);
+        if(t->tcpFd == -1)
+          continue;
+        getsockopt(t->tcpFd, SOL_SOCKET, SO_ERROR, &err, &len);
+        if(err == 0) {
+          t->rtt[t->tcpProbe] = (now - t->tx[t->tcpProbe]) * 1000;
+          t->received++;
+        }
+        closeTcpProbe(epfd, t);
+        pending--;
+      }
+      else {
+        // ICMP echo replies, matched by source address and sequence
+        icmp_socket *s = &icmp[events[e].data.u64 & 1];
+        struct sockaddr_storage from;
+        uint16_t seq;
+        while(poll(&(struct pollfd) {s->fd, POLLIN, 0}, 1, 0) > 0) {
+          if(receiveEchoReply(s, &from, &seq) != 1)
+            continue;
+          for(unsigned int i = 0; i < *nTargets; i++) {
+            survey_target *t = &targets[i];
+            if(t->port[0] != '\0' || t->sent == 0 || ! sameHost(&t->addr, &from))
+              continue;
+            unsigned long probe = (t->sent - 1) - ((((t->sent - 1) & 0xffff) - seq) & 0xffff);
+            if(probe < t->sent && t->rtt[probe] < 0 && now - t->tx[probe] < ICMP_TIMEOUT_MS / 1000.) {
+              t->rtt[probe] = (now - t->tx[probe]) * 1000;
+              t->received++;
+              break;
+            }
+          }
+        }
+      }
+    }
+  }
+
+  // Exit realtime if entered previously
+  if(realtime == 1)
+    sbenchExitRealTime(p);
+
+  for(int f = 0; f < 2; f++)
+    if(icmp[f].fd != -1)
+      close(icmp[f].fd);
+  close(epfd);
+
+  for(unsigned int i = 0; i < *nTargets; i++) {
+    survey_target *t = &targets[i];
+    size_t nSamples = 0;
+    if(t->tcpFd != -1)
+      close(t->tcpFd);
+    // compact the received ones at the beginning of tx to get the stats
+    for(unsigned long j = 0; j < times; j++)
+      if(t->rtt[j] >= 0)
+        t->tx[nSamples++] = t->rtt[j];
+    sbenchComputeLatencyStats(t->tx, nSamples, &t->stats);
+    t->lossPerCent = 100. * (times - t->received) / times;
+    free(t->tx);
+    free(t->rtt);
+    t->tx = t->rtt = NULL;
+  }
+  if(verbose) printf("Survey finished after %.3f s\n", sbenchMonotonicSeconds() - start);
+  return targets;
+}
+
+
+/**
+  * Closes a socket, with an RST instead of a FIN if "-o reset"
+  */
+static void closeSocket(int fd, net_options *options) {
+  if(options->reset) {
+    struct linger l = {1, 0};
+    setsockopt(fd, SOL_SOCKET, SO_LINGER, &l, sizeof(l));
+  }
+  close(fd);
+}
+
+
+/**
+  * Accepts connections and closes them at once, the server side
+  * of the tcp_connect test.
+  * @param seconds time to keep accepting, 0 == forever
+  * @return number of connections accepted
+  */
+double sbenchDoTcpListener(unsigned long seconds, char *port, net_options *options, int verbose, int realtime) {
+  sched_params p;
+  int  lfd, fd;
+  unsigned long accepted = 0;
+  double start;
+  struct pollfd pfd;
+
+  lfd = listenOn(port, SOCK_STREAM, options);
+  // non-blocking, so draining the accept queue never blocks
+  fcntl(lfd, F_SETFL, fcntl(lfd, F_GETFL) | O_NONBLOCK);
+  if(verbose) printf("Accepting TCP connections on port %s for %lu s\n", port, seconds);
+  pfd.fd     = lfd;
+  pfd.events = POLLIN;
+
+  // Enter realtime if needed
+  if(realtime == 1)
+    sbenchEnterRealTime(&p);
+
+  start = sbenchMonotonicSeconds();
+  while(seconds == 0 || sbenchMonotonicSeconds() - start < seconds) {
+    if(poll(&pfd, 1, 100) <= 0)
+      continue;
+    // drain the accept queue
+    while((fd = accept4(lfd, NULL, NULL, SOCK_NONBLOCK)) != -1) {
+      closeSocket(fd, options);
+      accepted++;
+    }
+  }
+
+  // Exit realtime if entered previously
+  if(realtime == 1)
+    sbenchExitRealTime(p);
+
+  close(lfd);
+  return accepted;
+}
+
+
+/* a connection attempt in flight */
+typedef struct {
+  int    fd;
+  double start;
+} connect_attempt;
+
+
+/**
+  * Connection establishment benchmark: opens and closes connections
+  * to host:port during some seconds, with up to "concurrency" attempts
+  * in flight over non-blocking sockets and epoll.
+  * @param rate attempts per second, 0 == as fast as possible
+  * @return connects per second, handshake latencies and failures
+  */
+tcpConnectResponse sbenchDoTcpConnectTest(unsigned long seconds, unsigned int concurrency, unsigned long rate, char *port, char *host, net_options *options, int verbose, int realtime) {
+  sched_params p;
+  int  epfd, n;
+  struct sockaddr_storage addr;
+  socklen_t addrLen;
+  struct epoll_event ev, events[256];
+  connect_attempt *slots;
+  perf_group pg;
+  unsigned int inFlight = 0;
+  double start, now, end, *samples;
+  size_t nSamples = 0, maxSamples = 65536;
+  tcpConnectResponse cr;
+
+  memset(&cr, 0, sizeof(cr));
+  if(sbenchResolveAddress(host, port, SOCK_STREAM, &addr, &addrLen) != 0) {
+    sbenchFailTest(SBENCH_ERR_NETWORK, "Can't resolve %s port %s", host, port);
+    return cr;
+  }
+  if((epfd = epoll_create1(0)) == -1)
+    sbenchMyAbort("Can't create the epoll instance");
+  slots   = (connect_attempt *) malloc(concurrency * sizeof(connect_attempt));
+  samples = (double *) malloc(maxSamples * sizeof(double));
+  if(slots == NULL || samples == NULL)
+    sbenchMyAbort("Can't allocate the arrays of attempts");
+  for(unsigned int i = 0; i < concurrency; i++)
+    slots[i].fd = -1;
+
+  if(verbose) printf("Connecting to %s port %s during %lu s, %u in flight, %lu/s\n", host, port, seconds, concurrency, rate);
+
+  // Enter realtime if needed
+  if(realtime == 1)
+    sbenchEnterRealTime(&p);
+
+  sbenchPerfBegin(&pg);
+  start = sbenchMonotonicSeconds();
+  end   = start + seconds;
+  while(1) {
+    now = sbenchMonotonicSeconds();
+
+    // launch attempts: while there are free slots, and if rate-limited
+    // just the ones due by now
+    for(unsigned int i = 0; now < end && i < concurrency; i++) {
+      if(slots[i].fd != -1)
+        continue;
+      if(rate > 0 && cr.attempts >= (now - start) * rate)
+        break;
+      cr.attempts++;
+      slots[i].start = now;
+      slots[i].fd    = socket(addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+      if(slots[i].fd == -1 ||
+         (connect(slots[i].fd, (struct sockaddr *) &addr, addrLen) != 0 && errno != EINPROGRESS)) {
+        if(verbose) printf("Attempt #%lu failed: %s\n", cr.attempts, strerror(errno));
+        if(slots[i].fd != -1)
+          close(slots[i].fd);
+        slots[i].fd = -1;
+        cr.failed++;
+        continue;
+      }
+      ev.events   = EPOLLOUT;
+      ev.data.u32 = i;
+      epoll_ctl(epfd, EPOLL_CTL_ADD, slots[i].fd, &ev);
+      inFlight++;
+    }
+    if(now >= end && inFlight == 0)
+      break;
+
+    // the next attempt due or 10ms, whatever comes first
+    int timeout = 10;
+    if(rate > 0 && now < end) {
+      double due = start + (double) cr.attempts / rate;
+      timeout = due > now ? (int) ((due - now) * 1000) : 0;
+      if(timeout > 10)
+        timeout = 10;
+    }
+    else if(rate == 0 && inFlight < concurrency && now < end)
+      timeout = 0;
+
+    n = epoll_wait(epfd, events, 256, timeout);
+    now = sbenchMonotonicSeconds();
+    for(int e = 0; e < n; e++) {
+      unsigned int i = events[e].data.u32;
+      int err = 0;
+      socklen_t len = sizeof(err);
+      getsockopt(slots[i].fd, SOL_SOCKET, SO_ERROR, &err, &len);
+      if(err == 0) {
+        if(nSamples == maxSamples) {
+          maxSamples *= 2;
+          samples = (double *) realloc(samples, maxSamples * sizeof(double));
+          if(samples == NULL)
+            sbenchMyAbort("Can't grow the array of latencies");
+        }
+        samples[nSamples++] = (now - slots[i].start) * 1000;
+        cr.connected++;
+      }
+      else {
+        if(verbose) printf("Connect failed: %s\n", strerror(err));
+        cr.failed++;
+      }
+      epoll_ctl(epfd, EPOLL_CTL_DEL, slots[i].fd, NULL);
+      closeSocket(slots[i].fd, options);
+      slots[i].fd = -1;
+      inFlight--;
+    }
+
+    // attempts taking too long are failures
+    for(unsigned int i = 0; i < concurrency; i++) {
+      if(slots[i].fd != -1 && now - slots[i].start >= TCP_CONNECT_TIMEOUT_MS / 1000.) {
+        epoll_ctl(epfd, EPOLL_CTL_DEL, slots[i].fd, NULL);
+        close(slots[i].fd);
+        slots[i].fd = -1;
+        inFlight--;
+        cr.failed++;
+      }
+    }
+  }
+  now = sbenchMonotonicSeconds();
+  sbenchPerfEnd(&pg, cr.attempts, "connect");
+
+  // Exit realtime if entered previously
+  if(realtime == 1)
+    sbenchExitRealTime(p);
+
+  close(epfd);
+  cr.connectsPerSec = cr.connected / (now - start);
+  sbenchComputeLatencyStats(samples, nSamples, &cr.handshake);
+  free(slots);
+  free(samples);
+  return cr;
+}
@@ -0,0 +1,170 @@
+/*
+ * Simple Benchmarks: network tests that don't need external tools,
+ * both sides of the test are sbench.
+ *
+ * @since 20161027
+ * @author zoquero@gmail.com
+ */
+
+#ifndef SBENCHNET_H
+#define SBENCHNET_H
+
+#include <netinet/in.h>   // in_port_t
+#include <sys/socket.h>   // sockaddr_storage
+
+#include "sbenchfuncs.h"   // latencyStats
+#include <pthread.h>      // pthread_barrier_t
+#include <stdint.h>       // uint32_t, uint64_t
+
+#define TCP_DEFAULT_MSG_SIZE 131072 // 128 KiB per send call
+
+/** how the tcp client pushes data into the socket */
+enum sendMode {SEND_WRITE, SEND_SENDFILE, SEND_SPLICE, SEND_ZEROCOPY};
+
+/** tunables of the network tests, set with "-o" */
+typedef struct {
+  /** SO_SNDBUF, 0 keeps the kernel default (autotuning) */
+  int           sndBuf;
+  /** SO_RCVBUF, 0 keeps the kernel default (autotuning) */
+  int           rcvBuf;
+  /** TCP_NODELAY */
+  int           noDelay;
+  enum sendMode sendMode;
+  /** close with an RST (SO_LINGER 0) instead of a FIN, no TIME_WAIT */
+  int           reset;
+} net_options;
+
+/* arguments and results of each tcp client stream */
+typedef struct tcp_args {
+  char          *host;
+  char          *port;
+  unsigned long  seconds;
+  unsigned long  msgSize;
+  net_options   *options;
+  int            verbose;
+  int            realtime;
+  unsigned int   threadNumber;
+  pthread_barrier_t *start;
+  double         rate;          // messages/s of this stream, 0 == as fast as possible
+  double         rateOffset;    // seconds to wait for the first message
+  struct sample_counters *counters; // NULL if not sampled
+  latencyHistogram latency;     // return value, from the intended start, with rate
+  unsigned long  bytesSent;     // return value
+  unsigned long  bytesReceived; // return value, as reported by the server
+  unsigned long  retransmits;   // return value, from TCP_INFO
+  double         delta;         // return value
+} tcp_args_struct;
+
+/** tcp client response */
+typedef struct {
+  /** aggregate throughput of all the streams in Gb/s */
+  double          gbps;
+  /** sum of the retransmitted segments of all the streams */
+  unsigned long   retransmits;
+  unsigned int    nStreams;
+  /** per-stream results, to be freed by the caller */
+  tcp_args_struct *streams;
+  /** with a rate, latency of each message from its intended start in ms */
+  latencyStats    latency;
+  /** and all of them, to merge them with other hosts */
+  latencyHistogram histogram;
+} tcpResponse;
+
+#define UDP_RR_MIN_SIZE   16   // header of each datagram
+#define UDP_RR_MAGIC      0x53425252 // "SBRR"
+#define UDP_RR_TIMEOUT_MS 1000 // wait for late replies after the last send
+
+/** header of the datagrams of the udp_rr test, in network byte order */
+typedef struct {
+  uint32_t magic;
+  uint32_t seq;
+  uint64_t txNs;
+} udp_rr_header;
+
+/** udp_rr response */
+typedef struct {
+  unsigned long sent;
+  unsigned long received;
+  /** replies arriving after one with a greater sequence number */
+  unsigned long reordered;
+  float         lossPerCent;
+  /** round-trip times in miliseconds */
+  latencyStats  rtt;
+  /** mean difference between consecutive round-trip times, in ms */
+  double        jitterMs;
+  /** 1 if the times were taken by the kernel with SO_TIMESTAMPING */
+  int           kernelTimestamps;
+} udpRRResponse;
+
+#define ICMP_TIMEOUT_MS   1000 // wait for late echo replies after the last request
+#define ICMP_MAX_PAYLOAD  65507
+
+/** a socket able to send ICMP echo requests */
+typedef struct {
+  int      fd;
+  /** AF_INET or AF_INET6 */
+  int      family;
+  /** 1 if SOCK_RAW, 0 if unprivileged SOCK_DGRAM (the kernel sets the id) */
+  int      raw;
+  /** identifier of our echo requests, just checked on raw sockets */
+  uint16_t id;
+} icmp_socket;
+
+#define SURVEY_MAX_TARGETS 65536
+
+/** one destination of the latency survey */
+typedef struct {
+  /** host name or address */
+  char          name[256];
+  /** TCP port to connect to, empty for ICMP echo */
+  char          port[32];
+  struct sockaddr_storage addr;
+  socklen_t     addrLen;
+  int           resolved;
+  /** send instant of each probe, in seconds */
+  double       *tx;
+  /** round-trip time of each probe in ms, -1 if lost or pending */
+  double       *rtt;
+  /** socket of the pending TCP connect, -1 if none */
+  int           tcpFd;
+  unsigned long tcpProbe;
+  unsigned long sent;
+  unsigned long received;
+  latencyStats  stats;
+  float         lossPerCent;
+} survey_target;
+
+#define TCP_CONNECT_TIMEOUT_MS 3000 // a connect taking longer is a failure
+
+/** tcp_connect response */
+typedef struct {
+  unsigned long attempts;
+  unsigned long connected;
+  unsigned long failed;
+  /** successful connections per second */
+  double        connectsPerSec;
+  /** handshake latency in miliseconds */
+  latencyStats  handshake;
+} tcpConnectResponse;
+
+int sbenchResolveAddress(char *host, char *port, int sockType, struct sockaddr_storage *addr, socklen_t *addrLen);
+
+int sbenchListenTcp(const char *spec);
+
+void sbenchSetSocketOptions(int fd, net_options *options);
+
+double sbenchDoTcpServer(unsigned long maxConnections, char *port, net_options *options, int verbose, int realtime);
+
+tcpResponse sbenchDoTcpClientTest(unsigned long seconds, unsigned int nStreams, unsigned long msgSize, double rate, char *port, char *host, net_options *options, int verbose, int realtime);
+
+double sbenchDoUdpReflector(unsigned long seconds, char *port, int verbose, int realtime);
+
+udpRRResponse sbenchDoUdpRRTest(unsigned long count, unsigned long rate, unsigned long sizeInBytes, char *port, char *host, int verbose, int realtime);
+
+survey_target *sbenchDoSurvey(char *targetList, unsigned long times, unsigned long intervalMs, unsigned int *nTargets, int verbose, int realtime);
+
+double sbenchDoTcpListener(unsigned long seconds, char *port, net_options *options, int verbose, int realtime);
+
+tcpConnectResponse sbenchDoTcpConnectTest(unsigned long seconds, unsigned int concurrency, unsigned long rate, char *port, char *host, net_options *options, int verbose, int realtime);
+
+#endif
@@ -0,0 +1,206 @@
+/*
+ * Simple Benchmarks: hardware and software performance counters
+ * of the threads that run the tests, with perf_event_open.
+ *
+ * Each thread counts just its measured region: sbenchPerfBegin() before it
+ * and sbenchPerfEnd() after it. The counts of all the threads are added up
+ * and printed at the end. Counters that can't be opened (VMs without
+ * a virtualized PMU, perf_event_paranoid) are reported as n/a.
+ *
+ * @since 20161027
+ * @author zoquero@gmail.com
+ */
+
+#include <unistd.h>       // syscall, read, close
+#include <stdio.h>        // printf
+#include <string.h>       // memset
+#include <errno.h>        // errno
+#include <pthread.h>      // pthread_mutex_t
+#include <sys/ioctl.h>    // ioctl
+#include <sys/syscall.h>  // SYS_perf_event_open
+#include <linux/perf_event.h> // perf_event_attr
+
+#include "sbenchperf.h"
+
+/** names of the counters, indexed by enum perfCounter */
+static const char *perfCounterNames[PERF_COUNTERS] = {"cycles", "instructions", "LLC-misses",
+  "branch-misses", "dTLB-misses", "context-switches", "cpu-migrations", "page-faults"};
+
+/** type and config of each counter, indexed by enum perfCounter */
+static const struct {
+  uint32_t type;
+  uint64_t config;
+} perfCounterEvents[PERF_COUNTERS] = {
+  {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+  {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+  {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+  {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+  {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                       (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+  {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES},
+  {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS},
+  {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS},
+};
+
+static int perfOn;
+static int perfVerbose;
+/** count only user space if the kernel doesn't let us count the kernel */
+static int perfExcludeKernel;
+static perfCounts perfTotals;
+static pthread_mutex_t perfLock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/**
+  * Counts the tests from now on. Without calling it sbenchPerfBegin
+  * and sbenchPerfEnd do nothing.
+  */
+void sbenchPerfEnable(int verbose) {
+  perfOn      = 1;
+  perfVerbose = verbose;
+  memset(&perfTotals, 0, sizeof(perfTotals));
+}
+
+
+static int perfEventOpen(enum perfCounter c, int groupFd) {
+  struct perf_event_attr attr;
+  int fd;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.size        = sizeof(attr);
+  attr.type        = perfCounterEvents[c].type;
+  attr.config      = perfCounterEvents[c].config;
+  // the members follow their leader
+  attr.disabled    = groupFd == -1;
+  attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+  attr.exclude_kernel = perfExcludeKernel;
+  attr.exclude_hv     = perfExcludeKernel;
+
+  // this thread, any CPU
+  fd = syscall(SYS_perf_event_open, &attr, 0, -1, groupFd, 0);
+  if(fd == -1 && (errno == EACCES || errno == EPERM) && ! perfExcludeKernel) {
+    perfExcludeKernel = 1;
+    if(perfVerbose) printf("perf: not allowed to count the kernel, counting user space only\n");
+    return perfEventOpen(c, groupFd);
+  }
+  return fd;
+}
+
+
+/**
+  * Opens and starts the counters of the calling thread, the hardware
+  * ones in a group so that they are scheduled together.
+  */
+void sbenchPerfBegin(perf_group *g) {
+  for(int i = 0; i < PERF_COUNTERS; i++)
+    g->fd[i] = -1;
+  if(! perfOn)
+    return;
+
+  for(int i = 0; i < PERF_COUNTERS; i++) {
+    int leader = i < PERF_FIRST_SW ? PERF_CYCLES : PERF_FIRST_SW;
+    if(i != leader && g->fd[leader] == -1)
+      continue; // no group without its leader
+    g->fd[i] = perfEventOpen(i, i == leader ? -1 : g->fd[leader]);
+  }
+  for(int leader = 0; leader < PERF_COUNTERS; leader += PERF_FIRST_SW) {
+    if(g->fd[leader] == -1)
+      continue;
+    ioctl(g->fd[leader], PERF_EVENT_IOC_RESET,  PERF_IOC_FLAG_GROUP);
+    ioctl(g->fd[leader], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+  }
+}
+
+
+/**
+  * Stops the counters of the calling thread and adds them to the totals.
+  * @param ops operations done by the thread in the measured region
+  * @param opName name of an operation, for the per-op rates
+  */
+void sbenchPerfEnd(perf_group *g, double ops, const char *opName) {
+  uint64_t v[3]; // value, time enabled, time running
+
+  if(! perfOn)
+    return;
+  for(int leader = 0; leader < PERF_COUNTERS; leader += PERF_FIRST_SW)
+    if(g->fd[leader] != -1)
+      ioctl(g->fd[leader], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+  pthread_mutex_lock(&perfLock);
+  for(int i = 0; i < PERF_COUNTERS; i++) {
+    if(g->fd[i] == -1)
+      continue;
+    // never scheduled: no PMU for it, like on many VMs
+    if(read(g->fd[i], v, sizeof(v)) == sizeof(v) && v[2] > 0) {
+      // scaled if multiplexed with other events
+      perfTotals.value[i]    += v[2] < v[1] ? (uint64_t) ((double) v[0] * v[1] / v[2]) : v[0];
+      perfTotals.available[i] = 1;
+    }
+    close(g->fd[i]);
+  }
+  perfTotals.ops   += ops;
+  perfTotals.opName = opName;
+  pthread_mutex_unlock(&perfLock);
+}
+
+
+/**
+  * Prints the counters of all the threads, IPC and the rates per
+  * operation. Nothing if the counters weren't enabled.
+  */
+void sbenchPrintPerfCounts() {
+  perfCounts *t = &perfTotals;
+  int any = 0;
+
+  if(! perfOn)
+    return;
+  for(int i = 0; i < PERF_COUNTERS; i++)
+    any |= t->available[i];
+  if(! any) {
+    printf("perf: counters not available (kernel.perf_event_paranoid or no PMU on this VM)\n");
+    return;
+  }
+
+  printf("perf:");
+  for(int i = 0; i < PERF_COUNTERS; i++) {
+    if(t->available[i])
+      printf(" %s=%llu", perfCounterNames[i], (unsigned long long) t->value[i]);
+    else
+      printf(" %s=n/a", perfCounterNames[i]);
+  }
+  if(t->available[PERF_CYCLES] && t->available[PERF_INSTRUCTIONS] && t->value[PERF_CYCLES] > 0)
+    printf(" IPC=%.2f", (double) t->value[PERF_INSTRUCTIONS] / t->value[PERF_CYCLES]);
+  printf("%s\n", perfExcludeKernel ? " (user space)" : "");
+
+  if(t->ops <= 0 || t->opName == NULL)
+    return;
+  printf("perf per %s:", t->opName);
+  for(int i = 0; i < PERF_COUNTERS; i++)
+    if(t->available[i])
+      printf(" %s=%.4g", perfCounterNames[i], t->value[i] / t->ops);
+  printf("\n");
+}
+
+
+/**
+  * Adds the counters to the result of the test: the totals, IPC
+  * and the rates per operation. The ones not available are left out.
+  */
+void sbenchAddPerfMetrics(test_result *res) {
+  perfCounts *t = &perfTotals;
+  char name[48];
+
+  if(! perfOn)
+    return;
+  for(int i = 0; i < PERF_COUNTERS; i++) {
+    if(! t->available[i])
+      continue;
+    sprintf(name, "perf_%s", perfCounterNames[i]);
+    sbenchAddMetric(res, name, t->value[i], "c");
+    if(t->ops > 0) {
+      sprintf(name, "perf_%s_per_op", perfCounterNames[i]);
+      sbenchAddMetric(res, name, t->value[i] / t->ops, "");
+    }
+  }
+  if(t->available[PERF_CYCLES] && t->available[PERF_INSTRUCTIONS] && t->value[PERF_CYCLES] > 0)
+    sbenchAddMetric(res, "perf_ipc", (double) t->value[PERF_INSTRUCTIONS] / t->value[PERF_CYCLES], "");
+}
@@ -0,0 +1,47 @@
+/*
+ * Simple Benchmarks: hardware and software performance counters
+ * of the threads that run the tests, with perf_event_open.
+ *
+ * @since 20161027
+ * @author zoquero@gmail.com
+ */
+
+#ifndef SBENCHPERF_H
+#define SBENCHPERF_H
+
+#include <stdint.h>       // uint64_t
+
+#include "sbenchresult.h"  // test_result
+
+/** counters read, in the order they are opened */
+enum perfCounter {PERF_CYCLES, PERF_INSTRUCTIONS, PERF_LLC_MISSES, PERF_BRANCH_MISSES,
+                  PERF_DTLB_MISSES, PERF_CONTEXT_SWITCHES, PERF_MIGRATIONS, PERF_PAGE_FAULTS,
+                  PERF_COUNTERS};
+
+/* the hardware ones are a group and the software ones another one */
+#define PERF_FIRST_SW PERF_CONTEXT_SWITCHES
+
+/** counters of the measured region of a thread */
+typedef struct {
+  /** file descriptor of each counter, -1 if it can't be counted */
+  int fd[PERF_COUNTERS];
+} perf_group;
+
+/** sum of the counters of all the threads of a test */
+typedef struct {
+  uint64_t     value[PERF_COUNTERS];
+  /** 1 for the counters that could be read */
+  int          available[PERF_COUNTERS];
+  /** operations done, for the per-op rates */
+  double       ops;
+  const char  *opName;
+} perfCounts;
+
+void sbenchPerfEnable(int verbose);
+void sbenchPerfBegin(perf_group *g);
+void sbenchPerfEnd(perf_group *g, double ops, const char *opName);
+void sbenchPrintPerfCounts();
+
+void sbenchAddPerfMetrics(test_result *res);
+
+#endif // SBENCHPERF_H
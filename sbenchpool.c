@@ -0,0 +1,209 @@
+/*
+ * Simple Benchmarks: threads and buffers kept between tests, so that
+ * running many tests in one process doesn't create them again.
+ *
+ * The pool grows to the biggest number of threads asked for and its
+ * threads wait for the next test. The buffers are page aligned and
+ * grow to the biggest size asked for each slot (usually the number of
+ * the thread that uses it).
+ *
+ * @since 20161027
+ * @author zoquero@gmail.com
+ */
+
+#include <stdlib.h>       // malloc, realloc, free, posix_memalign
+#include <string.h>       // memset
+#include <pthread.h>      // pthread_create ...
+
+#include "sbenchfuncs.h"
+#include "sbenchpool.h"
+
+/* a thread of the pool and its current task */
+typedef struct {
+  pthread_t        thread;
+  pthread_mutex_t  lock;
+  pthread_cond_t   wake;
+  void          *(*routine)(void *);
+  void            *arg;
+} pool_worker;
+
+static pool_worker   **workers;
+static unsigned int    nWorkers;
+/* tasks of the current run still working */
+static unsigned int    pending;
+static pthread_mutex_t pendingLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  pendingDone = PTHREAD_COND_INITIALIZER;
+
+static void          **buffers;
+static size_t         *bufferSizes;
+static unsigned int    nBuffers;
+/* of the table of buffers, the threads of a test take theirs at once */
+static pthread_mutex_t bufferLock = PTHREAD_MUTEX_INITIALIZER;
+
+
+static void *poolWorkerLoop(void *arg) {
+  pool_worker *w = (pool_worker *) arg;
+  void *(*routine)(void *);
+
+  while(1) {
+    pthread_mutex_lock(&w->lock);
+    while(w->routine == NULL)
+      pthread_cond_wait(&w->wake, &w->lock);
+    routine = w->routine;
+    pthread_mutex_unlock(&w->lock);
+
+    if(routine == poolWorkerLoop) // asked to finish
+      return NULL;
+    routine(w->arg);
+
+    pthread_mutex_lock(&w->lock);
+    w->routine = NULL;
+    pthread_mutex_unlock(&w->lock);
+    pthread_mutex_lock(&pendingLock);
+    if(--pending == 0)
+      pthread_cond_signal(&pendingDone);
+    pthread_mutex_unlock(&pendingLock);
+  }
+}
+
+
+/**
+  * Starts routine on nThreads threads at once, each one with its
+  * element of the args array, without waiting for them.
+  * The threads are created the first time and then reused.
+  * @param argSize size of each element of args
+  * @return SBENCH_OK, or SBENCH_ERR_THREADS and none was started
+  */
+int sbenchStartOnThreads(void *(*routine)(void *), void *args, size_t argSize, unsigned int nThreads) {
+  pool_worker **grown;
+
+  if(nThreads > nWorkers) {
+    grown = (pool_worker **) realloc(workers, nThreads * sizeof(pool_worker *));
+    if(grown == NULL)
+      return sbenchFailTest(SBENCH_ERR_THREADS, "Can't allocate the thread pool");
+    workers = grown;
+    for(unsigned int i = nWorkers; i < nThreads; i++) {
+      // each one on its own, the pointers can't move while they run
+      workers[i] = (pool_worker *) calloc(1, sizeof(pool_worker));
+      if(workers[i] == NULL)
+        return sbenchFailTest(SBENCH_ERR_THREADS, "Can't allocate the thread pool");
+      pthread_mutex_init(&workers[i]->lock, NULL);
+      pthread_cond_init(&workers[i]->wake, NULL);
+      if(pthread_create(&workers[i]->thread, NULL, poolWorkerLoop, workers[i])) {
+        free(workers[i]);
+        return sbenchFailTest(SBENCH_ERR_THREADS, "Can't create the %d-th thread", i);
+      }
+      nWorkers++;
+    }
+  }
+
+  pending = nThreads;
+  for(unsigned int i = 0; i < nThreads; i++) {
+    pool_worker *w = workers[i];
+    pthread_mutex_lock(&w->lock);
+    w->arg     = (char *) args + i * argSize;
+    w->routine = routine;
+    pthread_cond_signal(&w->wake);
+    pthread_mutex_unlock(&w->lock);
+  }
+  return SBENCH_OK;
+}
+
+
+/**
+  * Waits for the threads started by sbenchStartOnThreads.
+  */
+void sbenchWaitForThreads() {
+  pthread_mutex_lock(&pendingLock);
+  while(pending > 0)
+    pthread_cond_wait(&pendingDone, &pendingLock);
+  pthread_mutex_unlock(&pendingLock);
+}
+
+
+/**
+  * Runs routine on nThreads threads at once and waits for all of them.
+  * @return SBENCH_OK, or SBENCH_ERR_THREADS and none was run
+  */
+int sbenchRunOnThreads(void *(*routine)(void *), void *args, size_t argSize, unsigned int nThreads) {
+  if(sbenchStartOnThreads(routine, args, argSize, nThreads) != SBENCH_OK)
+    return SBENCH_ERR_THREADS;
+  sbenchWaitForThreads();
+  // the threads record their failures, see sbenchFailTest
+  return sbenchTestFailure();
+}
+
+
+/**
+  * The buffer of a slot, grown to size if it's smaller, holding bufferLock.
+  */
+static void *growBuffer(unsigned int slot, size_t size) {
+  if(slot >= nBuffers) {
+    void  **grownBuffers = (void **) realloc(buffers, (slot + 1) * sizeof(void *));
+    if(grownBuffers == NULL)
+      return NULL;
+    buffers = grownBuffers;
+    size_t *grownSizes   = (size_t *) realloc(bufferSizes, (slot + 1) * sizeof(size_t));
+    if(grownSizes == NULL)
+      return NULL;
+    bufferSizes = grownSizes;
+    for(unsigned int i = nBuffers; i <= slot; i++) {
+      buffers[i]     = NULL;
+      bufferSizes[i] = 0;
+    }
+    nBuffers = slot + 1;
+  }
+  if(bufferSizes[slot] < size) {
+    free(buffers[slot]);
+    if(posix_memalign(&buffers[slot], BUFFER_ALIGNMENT, size) != 0) {
+      buffers[slot]     = NULL;
+      bufferSizes[slot] = 0;
+      return NULL;
+    }
+    bufferSizes[slot] = size;
+  }
+  return buffers[slot];
+}
+
+
+/**
+  * A page-aligned buffer of at least size bytes that is kept for the
+  * next tests. The same slot returns the same buffer if it's big enough,
+  * so two threads running at once must use different slots. The threads
+  * of a test may ask for their buffers at the same time, so the table of
+  * slots is grown under a lock. Its content isn't initialized.
+  * @return NULL if it can't be allocated
+  */
+void *sbenchReusableBuffer(unsigned int slot, size_t size) {
+  void *buffer;
+
+  pthread_mutex_lock(&bufferLock);
+  buffer = growBuffer(slot, size);
+  pthread_mutex_unlock(&bufferLock);
+  return buffer;
+}
+
+
+/**
+  * Finishes the threads and frees the buffers of the pool.
+  */
+void sbenchFreePool() {
+  for(unsigned int i = 0; i < nWorkers; i++) {
+    pthread_mutex_lock(&workers[i]->lock);
+    workers[i]->routine = poolWorkerLoop;
+    pthread_cond_signal(&workers[i]->wake);
+    pthread_mutex_unlock(&workers[i]->lock);
+    pthread_join(workers[i]->thread, NULL);
+    free(workers[i]);
+  }
+  free(workers);
+  workers  = NULL;
+  nWorkers = 0;
+
+  for(unsigned int i = 0; i < nBuffers; i++)
+    free(buffers[i]);
+  free(buffers);
+  free(bufferSizes);
+  buffers  = NULL;
+  nBuffers = 0;
+}
@@ -0,0 +1,22 @@
+/*
+ * Simple Benchmarks: threads and buffers kept between tests, so that
+ * running many tests in one process doesn't create them again.
+ *
+ * @since 20161027
+ * @author zoquero@gmail.com
+ */
+
+#ifndef SBENCHPOOL_H
+#define SBENCHPOOL_H
+
+#include <stddef.h>       // size_t
+
+#define BUFFER_ALIGNMENT 4096 // page aligned, valid for O_DIRECT too
+
+int sbenchStartOnThreads(void *(*routine)(void *), void *args, size_t argSize, unsigned int nThreads);
+void sbenchWaitForThreads();
+int sbenchRunOnThreads(void *(*routine)(void *), void *args, size_t argSize, unsigned int nThreads);
+void *sbenchReusableBuffer(unsigned int slot, size_t size);
+void sbenchFreePool();
+
+#endif // SBENCHPOOL_H
@@ -0,0 +1,577 @@
+/*
+ * Simple Benchmarks: the result of a test and its output formats.
+ *
+ * Every test fills a test_result with its metrics, its status and
+ * a human summary, and it's printed as plain text or Nagios plugin
+ * output (the default), JSON, CSV or OpenMetrics. The steps of
+ * a scenario are printed together in one report.
+ *
+ * @since 20161027
+ * @author zoquero@gmail.com
+ */
+
+#include <stdio.h>        // printf
+#include <stdlib.h>       // malloc, realloc, free
+#include <string.h>       // strncpy, strcmp
+#include <stdarg.h>       // va_list
+#include <math.h>         // NAN, isfinite
+#include <unistd.h>       // gethostname, sysconf
+#include <sys/utsname.h>  // uname
+
+#include "sbenchfuncs.h"
+#include "sbenchresult.h"
+
+#define PERF_VALUE_SIZE 352 // fixed point, up to 1E308
+
+const char *sbenchStatusNames[] = {"OK", "Warning", "Critical", "Unknown"};
+
+
+/**
+  * Starts an empty result of a test run on this host, now.
+  * @param test type of test, like "cpu"
+  * @param name name on the nagios status line, like "CPU"
+  */
+void sbenchInitResult(test_result *res, const char *test, const char *name, const char *params) {
+  struct utsname u;
+
+  memset(res, 0, sizeof(test_result));
+  res->test      = test;
+  res->name      = name;
+  res->params    = params;
+  res->timestamp = time(NULL);
+  res->nCpus     = sysconf(_SC_NPROCESSORS_ONLN);
+  if(gethostname(res->host, sizeof(res->host) - 1) != 0)
+    strcpy(res->host, "unknown");
+  if(uname(&u) == 0)
+    snprintf(res->kernel, sizeof(res->kernel), "%s", u.release);
+}
+
+
+/**
+  * Adds a value with a label, like the one of each stream.
+  * If it can't be allocated the value is lost, see sbenchFailTest.
+  * @return SBENCH_OK or SBENCH_ERR_MEMORY
+  */
+int sbenchAddLabeledMetric(test_result *res, const char *name, double value, const char *unit,
+                           const char *labelName, const char *labelValue) {
+  metric *m;
+
+  if(res->nMetrics == res->size) {
+    size_t size = res->size == 0 ? 16 : res->size * 2;
+    if((m = (metric *) realloc(res->metrics, size * sizeof(metric))) == NULL)
+      return sbenchFailTest(SBENCH_ERR_MEMORY, "Can't allocate the metrics of the result");
+    res->metrics = m;
+    res->size    = size;
+  }
+  m = &res->metrics[res->nMetrics++];
+  memset(m, 0, sizeof(metric));
+  snprintf(m->name, sizeof(m->name), "%s", name);
+  snprintf(m->unit, sizeof(m->unit), "%s", unit);
+  m->value = value;
+  if(labelName != NULL) {
+    snprintf(m->labelName,  sizeof(m->labelName),  "%s", labelName);
+    snprintf(m->labelValue, sizeof(m->labelValue), "%s", labelValue);
+  }
+  return SBENCH_OK;
+}
+
+
+/**
+  * Adds a labeled value that is too detailed for the nagios perfdata
+  * (one per CPU, per second...), it's on the other outputs.
+  */
+void sbenchAddDetailMetric(test_result *res, const char *name, double value, const char *unit,
+                           const char *labelName, const char *labelValue) {
+  if(sbenchAddLabeledMetric(res, name, value, unit, labelName, labelValue) == SBENCH_OK)
+    res->metrics[res->nMetrics - 1].detail = 1;
+}
+
+
+/**
+  * Adds a value measured by the test.
+  * @param unit nagios unit of measure: "s", "ms", "%", "B", "c" or ""
+  */
+void sbenchAddMetric(test_result *res, const char *name, double value, const char *unit) {
+  sbenchAddLabeledMetric(res, name, value, unit, NULL, NULL);
+}
+
+
+/**
+  * Appends to the plain output of the result, printf-like.
+  * If it can't be allocated the text is lost, see sbenchFailTest.
+  */
+void sbenchAppendText(test_result *res, const char *fmt, ...) {
+  va_list ap;
+  int     len;
+  char   *text;
+
+  va_start(ap, fmt);
+  len = vsnprintf(NULL, 0, fmt, ap);
+  va_end(ap);
+  if((text = (char *) realloc(res->text, res->textLen + len + 1)) == NULL) {
+    sbenchFailTest(SBENCH_ERR_MEMORY, "Can't allocate the output of the result");
+    return;
+  }
+  res->text = text;
+  va_start(ap, fmt);
+  vsnprintf(res->text + res->textLen, len + 1, fmt, ap);
+  va_end(ap);
+  res->textLen += len;
+}
+
+
+/**
+  * Adds the latency of the operations of an open-loop test ("--rate"),
+  * measured from when they should have started, and its summary.
+  * The result keeps the histogram, to merge it with other hosts.
+  * @param ls return value, the stats of the histogram
+  */
+void sbenchAddOpenLoopLatency(test_result *res, double rate, latencyHistogram *h, latencyStats *ls) {
+  sbenchHistogramStats(h, ls);
+  // without it the result can't be merged, but the stats are there
+  if((res->histogram = (latencyHistogram *) malloc(sizeof(latencyHistogram))) == NULL)
+    sbenchFailTest(SBENCH_ERR_MEMORY, "Can't allocate the latency histogram of the result");
+  else
+    memcpy(res->histogram, h, sizeof(latencyHistogram));
+  sbenchAddMetric(res, "rate",    rate,     "");
+  sbenchAddMetric(res, "p50_ms",  ls->p50,  "ms");
+  sbenchAddMetric(res, "p99_ms",  ls->p99,  "ms");
+  sbenchAddMetric(res, "p999_ms", ls->p999, "ms");
+  sbenchAddMetric(res, "max_ms",  ls->max,  "ms");
+  sprintf(res->summary, "p99 %.3f ms at %g ops/s", ls->p99, rate);
+  sbenchAppendText(res, "at %g ops/s: latency min/avg/p50/p90/p99/p99.9/max = %.3f/%.3f/%.3f/%.3f/%.3f/%.3f/%.3f ms"
+                   " from the intended start;%zu ops\n", rate, ls->min, ls->avg, ls->p50, ls->p90, ls->p99,
+                   ls->p999, ls->max, ls->count);
+}
+
+
+/**
+  * The value of the metric with that name and without a label,
+  * NAN if the result hasn't it.
+  */
+double sbenchMetricValue(test_result *res, const char *name) {
+  for(size_t i = 0; i < res->nMetrics; i++)
+    if(res->metrics[i].labelName[0] == '\0' && strcmp(res->metrics[i].name, name) == 0)
+      return res->metrics[i].value;
+  return NAN;
+}
+
+
+void sbenchFreeResult(test_result *res) {
+  free(res->metrics);
+  free(res->text);
+  free(res->samples);
+  free(res->histogram);
+  free(res->series);
+  free(res->changes);
+  res->metrics   = NULL;
+  res->text      = NULL;
+  res->samples   = NULL;
+  res->histogram = NULL;
+  res->series    = NULL;
+  res->changes   = NULL;
+}
+
+
+/**
+  * Prints a string as a JSON string, quoted and escaped.
+  */
+static void printJsonString(const char *s) {
+  putchar('"');
+  for(; s != NULL && *s != '\0'; s++) {
+    if(*s == '"' || *s == '\\')
+      printf("\\%c", *s);
+    else if((unsigned char) *s < 0x20)
+      printf("\\u%04x", *s);
+    else
+      putchar(*s);
+  }
+  putchar('"');
+}
+
+
+/**
+  * Prints a string as a CSV field, quoted if needed.
+  */
+static void printCsvField(const char *s) {
+  if(s == NULL || strpbrk(s, ",\"\n") == NULL) {
+    printf("%s", s == NULL ? "" : s);
+    return;
+  }
+  putchar('"');
+  for(; *s != '\0'; s++) {
+    if(*s == '"')
+      putchar('"');
+    putchar(*s);
+  }
+  putchar('"');
+}
+
+
+/**
+  * Prints a string as an OpenMetrics label value, escaped.
+  */
+static void printLabelValue(const char *s) {
+  putchar('"');
+  for(; s != NULL && *s != '\0'; s++) {
+    if(*s == '"' || *s == '\\')
+      printf("\\%c", *s);
+    else if(*s == '\n')
+      printf("\\n");
+    else
+      putchar(*s);
+  }
+  putchar('"');
+}
+
+
+/**
+  * Prints a metric name with the characters that OpenMetrics
+  * doesn't allow replaced by underscores.
+  */
+static void printMetricName(const char *test, const char *name) {
+  printf("sbench_%s_", test);
+  for(; *name != '\0'; name++) {
+    if((*name >= 'a' && *name <= 'z') || (*name >= 'A' && *name <= 'Z') ||
+       (*name >= '0' && *name <= '9') || *name == '_')
+      putchar(*name);
+    else
+      putchar('_');
+  }
+}
+
+
+/**
+  * Prints a number for JSON, that has no NaN nor infinity: null then.
+  */
+static void printJsonNumber(double value) {
+  if(isfinite(value))
+    printf("%.9g", value);
+  else
+    printf("null");
+}
+
+
+static void printThresholds(const char *key, double *values, int n) {
+  printf(",\"%s\":[", key);
+  for(int i = 0; i < n; i++) {
+    printf("%s", i > 0 ? "," : "");
+    printJsonNumber(values[i]);
+  }
+  printf("]");
+}
+
+
+static void printJsonResult(test_result *res) {
+  char when[32];
+
+  strftime(when, sizeof(when), "%Y-%m-%dT%H:%M:%SZ", gmtime(&res->timestamp));
+  printf("{");
+  if(res->step != NULL) {
+    printf("\"step\":");
+    printJsonString(res->step);
+    putchar(',');
+  }
+  printf("\"timestamp\":\"%s\",\"host\":{\"name\":", when);
+  printJsonString(res->host);
+  printf(",\"kernel\":");
+  printJsonString(res->kernel);
+  printf(",\"cpus\":%ld},\"test\":\"%s\",\"params\":", res->nCpus, res->test);
+  printJsonString(res->params);
+  if(res->nWarn > 0) {
+    printThresholds("warn", res->warn, res->nWarn);
+    printThresholds("crit", res->crit, res->nCrit);
+  }
+  printf(",\"status\":\"%s\",\"exit_code\":%d,\"summary\":", sbenchStatusNames[res->status], res->status);
+  printJsonString(res->summary);
+  printf(",\"metrics\":[");
+  for(size_t i = 0; i < res->nMetrics; i++) {
+    metric *m = &res->metrics[i];
+    printf("%s{\"name\":", i > 0 ? "," : "");
+    printJsonString(m->name);
+    printf(",\"value\":");
+    printJsonNumber(m->value);
+    printf(",\"unit\":");
+    printJsonString(m->unit);
+    if(m->labelName[0] != '\0') {
+      printf(",\"labels\":{");
+      printJsonString(m->labelName);
+      putchar(':');
+      printJsonString(m->labelValue);
+      putchar('}');
+    }
+    putchar('}');
+  }
+  printf("]");
+  if(res->nSeries > 0) {
+    printf(",\"series\":[");
+    for(size_t i = 0; i < res->nSeries; i++) {
+      sample_interval *in = &res->series[i];
+      printf("%s{\"t\":%.6g,\"ops_per_sec\":", i > 0 ? "," : "", in->t);
+      printJsonNumber(in->opsPerSec);
+      printf(",\"bytes_per_sec\":");
+      printJsonNumber(in->bytesPerSec);
+      printf(",\"avg_ms\":");
+      printJsonNumber(in->avgLatencyMs);
+      printf(",\"max_ms\":");
+      printJsonNumber(in->maxLatencyMs);
+      putchar('}');
+    }
+    printf("],\"changes\":[");
+    for(size_t i = 0; i < res->nChanges; i++)
+      // where the interval before it ends
+      printf("%s%.6g", i > 0 ? "," : "", res->series[res->changes[i] - 1].t);
+    printf("]");
+  }
+  printf("}");
+}
+
+
+static void printCsvRow(test_result *res, const char *name, const char *label, double value, const char *unit) {
+  if(res->step != NULL) {
+    printCsvField(res->step);
+    putchar(',');
+  }
+  printf("%ld,", (long) res->timestamp);
+  printCsvField(res->host);
+  printf(",%s,", res->test);
+  printCsvField(res->params);
+  printf(",%s,", sbenchStatusNames[res->status]);
+  printCsvField(name);
+  putchar(',');
+  printCsvField(label);
+  printf(",%.9g,", value);
+  printCsvField(unit);
+  putchar('\n');
+}
+
+
+/**
+  * One row per metric, without header:
+  * timestamp,host,test,params,status,metric,label,value,unit
+  * The steps of a scenario have their name as first field. The time
+  * series of a sampled test follows, with the end of each interval
+  * in seconds as label.
+  */
+static void emitCsv(test_result *res) {
+  char t[32];
+
+  for(size_t i = 0; i < res->nMetrics; i++) {
+    metric *m = &res->metrics[i];
+    printCsvRow(res, m->name, m->labelValue, m->value, m->unit);
+  }
+  for(size_t i = 0; i < res->nSeries; i++) {
+    sample_interval *in = &res->series[i];
+    snprintf(t, sizeof(t), "%.6g", in->t);
+    printCsvRow(res, "series_ops_per_sec",   t, in->opsPerSec,    "");
+    printCsvRow(res, "series_bytes_per_sec", t, in->bytesPerSec,  "");
+    printCsvRow(res, "series_avg_ms",        t, in->avgLatencyMs, "ms");
+    printCsvRow(res, "series_max_ms",        t, in->maxLatencyMs, "ms");
+  }
+}
+
+
+static void printOpenMetricsLabels(test_result *res, metric *m) {
+  printf("{host=");
+  printLabelValue(res->host);
+  printf(",params=");
+  printLabelValue(res->params);
+  if(res->step != NULL) {
+    printf(",step=");
+    printLabelValue(res->step);
+  }
+  if(m != NULL && m->labelName[0] != '\0') {
+    printf(",%s=", m->labelName);
+    printLabelValue(m->labelValue);
+  }
+  putchar('}');
+}
+
+
+/**
+  * OpenMetrics text format, all the samples of a metric together
+  * after its TYPE line, and the status as one more gauge.
+  * The results of the same test are in the same metric families.
+  */
+static void emitOpenMetrics(test_result *res, size_t n) {
+  for(size_t r = 0; r < n; r++) {
+    for(size_t i = 0; i < res[r].nMetrics; i++) {
+      const char *name = res[r].metrics[i].name;
+      int seen = 0;
+      for(size_t q = 0; q <= r && ! seen; q++) {
+        if(strcmp(res[q].test, res[r].test) != 0)
+          continue;
+        for(size_t j = 0; j < (q == r ? i : res[q].nMetrics) && ! seen; j++)
+          seen = strcmp(res[q].metrics[j].name, name) == 0;
+      }
+      if(seen)
+        continue;
+
+      printf("# TYPE ");
+      printMetricName(res[r].test, name);
+      printf(" gauge\n");
+      for(size_t q = r; q < n; q++) {
+        if(strcmp(res[q].test, res[r].test) != 0)
+          continue;
+        for(size_t j = q == r ? i : 0; j < res[q].nMetrics; j++) {
+          metric *m = &res[q].metrics[j];
+          if(strcmp(m->name, name) != 0)
+            continue;
+          printMetricName(res[q].test, m->name);
+          printOpenMetricsLabels(&res[q], m);
+          printf(" %.9g\n", m->value);
+        }
+      }
+    }
+  }
+  for(size_t r = 0; r < n; r++) {
+    int seen = 0;
+    for(size_t q = 0; q < r && ! seen; q++)
+      seen = strcmp(res[q].test, res[r].test) == 0;
+    if(seen)
+      continue;
+    printf("# TYPE ");
+    printMetricName(res[r].test, "status");
+    printf(" gauge\n");
+    for(size_t q = r; q < n; q++) {
+      if(strcmp(res[q].test, res[r].test) != 0)
+        continue;
+      printMetricName(res[q].test, "status");
+      printOpenMetricsLabels(&res[q], NULL);
+      printf(" %d\n", res[q].status);
+    }
+  }
+  printf("# EOF\n");
+}
+
+
+/**
+  * A value of the nagios perfdata, that must be [-0-9.]: fixed point
+  * with 9 significant digits, without the zeros at the end, and "U"
+  * (undetermined) if it isn't finite.
+  * @param buf PERF_VALUE_SIZE bytes at least
+  */
+static char *perfValue(double value, char *buf) {
+  int   decimals = 0;
+  char *end;
+
+  if(! isfinite(value))
+    return strcpy(buf, "U");
+  if(value != 0)
+    decimals = 8 - (int) floor(log10(fabs(value)));
+  decimals = decimals < 0 ? 0 : decimals > 15 ? 15 : decimals;
+  snprintf(buf, PERF_VALUE_SIZE, "%.*f", decimals, value);
+  if(strchr(buf, '.') != NULL) {
+    for(end = buf + strlen(buf) - 1; *end == '0'; end--)
+      *end = '\0';
+    if(*end == '.')
+      *end = '\0';
+  }
+  if(strcmp(buf, "-0") == 0)
+    strcpy(buf, "0");
+  return buf;
+}
+
+
+/**
+  * Nagios plugin output: status line with the metrics as perfdata,
+  * but the details.
+  */
+static void emitNagios(test_result *res) {
+  char value[PERF_VALUE_SIZE];
+
+  printf("%s %s = %s|", res->name, sbenchStatusNames[res->status], res->summary);
+  for(size_t i = 0; i < res->nMetrics; i++) {
+    metric *m = &res->metrics[i];
+    if(m->detail)
+      continue;
+    if(m->labelValue[0] != '\0')
+      printf(" '%s_%s'=%s%s", m->labelValue, m->name, perfValue(m->value, value), m->unit);
+    else
+      printf(" %s=%s%s", m->name, perfValue(m->value, value), m->unit);
+  }
+  printf("\n");
+}
+
+
+/**
+  * Prints the result.
+  * @param nagios on OUTPUT_TEXT, Nagios plugin output instead of the plain one
+  */
+void sbenchEmitResult(test_result *res, enum outputFormat format, int nagios) {
+  if(format == OUTPUT_JSON) {
+    printJsonResult(res);
+    printf("\n");
+  }
+  else if(format == OUTPUT_CSV)
+    emitCsv(res);
+  else if(format == OUTPUT_OPENMETRICS)
+    emitOpenMetrics(res, 1);
+  else if(nagios)
+    emitNagios(res);
+  else if(res->text != NULL)
+    printf("%s", res->text);
+}
+
+
+/**
+  * Prints the results of the steps of a scenario as one report.
+  * The Nagios status line is the worst status of the steps, with the
+  * status of each step after it and the perfdata of all of them,
+  * labelled with the name of the step.
+  * @return the worst status, the highest EXIT_CODE_*
+  */
+int sbenchEmitResults(test_result *res, size_t n, enum outputFormat format, int nagios) {
+  int  worst = EXIT_CODE_OK;
+  int  count[4] = {0, 0, 0, 0};
+  char value[PERF_VALUE_SIZE];
+
+  for(size_t r = 0; r < n; r++) {
+    count[res[r].status]++;
+    if(res[r].status > worst)
+      worst = res[r].status;
+  }
+
+  if(format == OUTPUT_JSON) {
+    printf("{\"status\":\"%s\",\"exit_code\":%d,\"steps\":[", sbenchStatusNames[worst], worst);
+    for(size_t r = 0; r < n; r++) {
+      if(r > 0)
+        putchar(',');
+      printJsonResult(&res[r]);
+    }
+    printf("]}\n");
+  }
+  else if(format == OUTPUT_CSV) {
+    for(size_t r = 0; r < n; r++)
+      emitCsv(&res[r]);
+  }
+  else if(format == OUTPUT_OPENMETRICS)
+    emitOpenMetrics(res, n);
+  else if(nagios) {
+    printf("Scenario %s = %zu steps, %d warning, %d critical, %d unknown|",
+      sbenchStatusNames[worst], n, count[EXIT_CODE_WARNING], count[EXIT_CODE_CRITICAL],
+      count[EXIT_CODE_UNKNOWN]);
+    for(size_t r = 0; r < n; r++) {
+      for(size_t i = 0; i < res[r].nMetrics; i++) {
+        metric *m = &res[r].metrics[i];
+        if(m->detail)
+          continue;
+        if(m->labelValue[0] != '\0')
+          printf(" '%s_%s_%s'=%s%s", res[r].step, m->labelValue, m->name, perfValue(m->value, value), m->unit);
+        else
+          printf(" '%s_%s'=%s%s", res[r].step, m->name, perfValue(m->value, value), m->unit);
+      }
+    }
+    printf("\n");
+    for(size_t r = 0; r < n; r++)
+      printf("%s: %s %s = %s\n", res[r].step, res[r].name, sbenchStatusNames[res[r].status], res[r].summary);
+  }
+  else {
+    for(size_t r = 0; r < n; r++) {
+      printf("[%s] %s\n", res[r].step, res[r].test);
+      if(res[r].text != NULL)
+        printf("%s", res[r].text);
+    }
+  }
+  return worst;
+}
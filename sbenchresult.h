@@ -0,0 +1,103 @@
+/*
+ * Simple Benchmarks: the result of a test and its output formats.
+ *
+ * @since 20161027
+ * @author zoquero@gmail.com
+ */
+
+#ifndef SBENCHRESULT_H
+#define SBENCHRESULT_H
+
+#include <stddef.h>       // size_t
+#include <time.h>         // time_t
+
+#include "sbenchfuncs.h"   // MAX_THRESHOLDS
+
+/** how the result is printed, set with "-O" */
+enum outputFormat {OUTPUT_TEXT, OUTPUT_JSON, OUTPUT_CSV, OUTPUT_OPENMETRICS};
+
+/** names of the EXIT_CODE_* */
+extern const char *sbenchStatusNames[];
+
+/** a value measured by a test */
+typedef struct {
+  /** like "time" or "p99_ms", also its nagios perfdata label */
+  char   name[48];
+  double value;
+  /** nagios unit of measure: "s", "ms", "%", "B", "c" or "" */
+  char   unit[4];
+  /** optional dimension, like the target of a survey ("" == none) */
+  char   labelName[16];
+  char   labelValue[256];
+  /** 1 == left out of the nagios perfdata, like the ones of each CPU */
+  int    detail;
+} metric;
+
+/** what a test did on an interval while it ran ("--sample-interval") */
+typedef struct {
+  /** end of the interval, seconds from the start of the test */
+  double t;
+  double opsPerSec;
+  double bytesPerSec;
+  double avgLatencyMs;
+  double maxLatencyMs;
+} sample_interval;
+
+/** everything about a test run */
+typedef struct {
+  /** type of test, like "cpu" */
+  const char *test;
+  /** name on the nagios status line, like "Mem" */
+  const char *name;
+  /** the "-p" params */
+  const char *params;
+  /** name of the step of a scenario ("-f"), NULL on a single test */
+  const char *step;
+  /** "-w" and "-c" thresholds */
+  double      warn[MAX_THRESHOLDS];
+  int         nWarn;
+  double      crit[MAX_THRESHOLDS];
+  int         nCrit;
+  char        host[256];
+  char        kernel[128];
+  long        nCpus;
+  time_t      timestamp;
+  /** EXIT_CODE_* */
+  int         status;
+  /** why the test failed (enum sbenchError), SBENCH_OK if it ran */
+  int         error;
+  /** status line, like "0.85 s" on "Mem Warning = 0.85 s| time=0.85" */
+  char        summary[512];
+  /** plain output, when there are no thresholds */
+  char       *text;
+  size_t      textLen;
+  metric     *metrics;
+  size_t      nMetrics;
+  size_t      size;
+  /** main value of each run of a repeated test ("-n", "-a") */
+  double     *samples;
+  size_t      nSamples;
+  /** latency of the operations of an open-loop test ("--rate"), NULL if none */
+  latencyHistogram *histogram;
+  /** time series of the test, NULL if it wasn't sampled */
+  sample_interval  *series;
+  size_t            nSeries;
+  /** first interval of the series after each step change of its ops/s */
+  size_t           *changes;
+  size_t            nChanges;
+} test_result;
+
+void sbenchInitResult(test_result *res, const char *test, const char *name, const char *params);
+void sbenchAddMetric(test_result *res, const char *name, double value, const char *unit);
+int  sbenchAddLabeledMetric(test_result *res, const char *name, double value, const char *unit,
+                            const char *labelName, const char *labelValue);
+void sbenchAddDetailMetric(test_result *res, const char *name, double value, const char *unit,
+                           const char *labelName, const char *labelValue);
+void sbenchAppendText(test_result *res, const char *fmt, ...);
+void sbenchAddOpenLoopLatency(test_result *res, double rate, latencyHistogram *h, latencyStats *ls);
+double sbenchMetricValue(test_result *res, const char *name);
+void sbenchEmitResult(test_result *res, enum outputFormat format, int nagios);
+int  sbenchEmitResults(test_result *res, size_t n, enum outputFormat format, int nagios);
+void sbenchFreeResult(test_result *res);
+
+#endif // SBENCHRESULT_H
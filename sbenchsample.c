@@ -0,0 +1,277 @@
+/*
+ * Simple Benchmarks: time series of what a test does while it runs,
+ * to see the moment its throughput falls, like when the burst credits
+ * of a cloud disk or a burstable CPU run out.
+ *
+ * Like the perf counters it's enabled for a test and then its threads
+ * count what they do on their own counters (sampleCount), that a
+ * sampler thread reads every interval without stopping them. The
+ * intervals of the runs of a repeated test follow one another. At the
+ * end the series and where its ops/s steps to another level are added
+ * to the result.
+ *
+ * @since 20161027
+ * @author zoquero@gmail.com
+ */
+
+#include <stdio.h>        // printf
+#include <stdlib.h>       // posix_memalign, realloc, free
+#include <string.h>       // memset
+#include <errno.h>        // ETIMEDOUT
+#include <time.h>         // clock_gettime
+#include <pthread.h>      // pthread_create, pthread_cond_timedwait
+
+#include "sbenchfuncs.h"
+#include "sbenchtime.h"
+#include "sbenchsample.h"
+
+/* intervals shorter than this part of one at the end of a run are dropped */
+#define SAMPLE_MIN_LAST 0.1
+
+/** seconds between samples, 0 == not sampling */
+static double           samplerInterval;
+static int              samplerVerbose;
+static sample_counters *counters;
+static unsigned int     nCounters;
+/** totals of all the threads on the previous sample */
+static uint64_t         prevCounts, prevOps, prevBytes, prevLatency;
+/** start of the run and instant of the previous sample */
+static uint64_t         runStart, prevSample;
+/** seconds sampled on the previous runs */
+static double           offset;
+static sample_interval *series;
+static size_t           nSeries, seriesSize;
+/** intervals with fewer than SAMPLE_MIN_COUNTS counts */
+static size_t           nCoarse;
+static pthread_t        sampler;
+static int              stopping;
+static pthread_mutex_t  samplerLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   samplerWake;
+
+
+/**
+  * Samples the tests from now on, every interval seconds, until
+  * sbenchAddSampleSeries. Without calling it sbenchSamplerStart does nothing.
+  */
+void sbenchSamplerEnable(double interval, int verbose) {
+  samplerInterval = interval;
+  samplerVerbose  = verbose;
+  offset          = 0;
+  nSeries         = 0;
+  nCoarse         = 0;
+}
+
+
+/**
+  * Adds what the threads did since the previous sample to the series.
+  * @param last if it's the end of the run, dropped if it's too short
+  */
+static void takeSample(int last) {
+  uint64_t now = timerRead(), counts = 0, ops = 0, bytes = 0, latency = 0, max = 0;
+  double   seconds = sbenchTimerElapsed(prevSample, now);
+  sample_interval *in;
+
+  for(unsigned int i = 0; i < nCounters; i++) {
+    uint64_t m = __atomic_exchange_n(&counters[i].latencyMax, 0, __ATOMIC_RELAXED);
+    counts  += __atomic_load_n(&counters[i].counts, __ATOMIC_RELAXED);
+    ops     += __atomic_load_n(&counters[i].ops, __ATOMIC_RELAXED);
+    bytes   += __atomic_load_n(&counters[i].bytes, __ATOMIC_RELAXED);
+    latency += __atomic_load_n(&counters[i].latencySum, __ATOMIC_RELAXED);
+    if(m > max)
+      max = m;
+  }
+  if(seconds <= 0 || (last && seconds < samplerInterval * SAMPLE_MIN_LAST))
+    return;
+
+  if(nSeries == seriesSize) {
+    size_t size = seriesSize == 0 ? 256 : seriesSize * 2;
+    // the next sample takes this interval too
+    if((in = (sample_interval *) realloc(series, size * sizeof(sample_interval))) == NULL) {
+      sbenchFailTest(SBENCH_ERR_MEMORY, "Can't allocate the time series of the test");
+      return;
+    }
+    series     = in;
+    seriesSize = size;
+  }
+  in = &series[nSeries++];
+  in->t            = offset + sbenchTimerElapsed(runStart, now);
+  in->opsPerSec    = (ops - prevOps) / seconds;
+  in->bytesPerSec  = (bytes - prevBytes) / seconds;
+  in->avgLatencyMs = ops > prevOps ? (latency - prevLatency) / 1E6 / (ops - prevOps) : 0;
+  in->maxLatencyMs = max / 1E6;
+  nCoarse         += counts - prevCounts < SAMPLE_MIN_COUNTS;
+  if(samplerVerbose)
+    printf("%.3fs: %.0f ops/s, %.0f B/s, avg %.3f ms, max %.3f ms\n", in->t,
+           in->opsPerSec, in->bytesPerSec, in->avgLatencyMs, in->maxLatencyMs);
+  prevCounts  = counts;
+  prevOps     = ops;
+  prevBytes   = bytes;
+  prevLatency = latency;
+  prevSample  = now;
+}
+
+
+static void *samplerRoutine(void *arg) {
+  struct timespec deadline;
+  long   step = (long) (samplerInterval * 1E9);
+
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+  pthread_mutex_lock(&samplerLock);
+  while(! stopping) {
+    deadline.tv_nsec += step % 1000000000L;
+    deadline.tv_sec  += step / 1000000000L + deadline.tv_nsec / 1000000000L;
+    deadline.tv_nsec %= 1000000000L;
+    while(! stopping && pthread_cond_timedwait(&samplerWake, &samplerLock, &deadline) != ETIMEDOUT)
+      ;
+    if(! stopping)
+      takeSample(0);
+  }
+  pthread_mutex_unlock(&samplerLock);
+  return NULL;
+}
+
+
+/**
+  * Starts sampling a run of a test, if it's enabled.
+  * @return the counters of each thread, to give to them, NULL if
+  *         it's not sampling or if it can't (see sbenchFailTest)
+  */
+sample_counters *sbenchSamplerStart(unsigned int nThreads) {
+  pthread_condattr_t attr;
+  void *mem;
+
+  if(samplerInterval <= 0)
+    return NULL;
+  if(posix_memalign(&mem, sizeof(sample_counters), nThreads * sizeof(sample_counters)) != 0) {
+    sbenchFailTest(SBENCH_ERR_MEMORY, "Can't allocate the counters of the sampler");
+    return NULL;
+  }
+  counters  = (sample_counters *) mem;
+  nCounters = nThreads;
+  memset(counters, 0, nThreads * sizeof(sample_counters));
+  prevCounts = prevOps = prevBytes = prevLatency = 0;
+  stopping  = 0;
+  runStart  = prevSample = timerRead();
+
+  // the deadlines of the samples are on the monotonic clock
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&samplerWake, &attr);
+  pthread_condattr_destroy(&attr);
+  if(pthread_create(&sampler, NULL, samplerRoutine, NULL) != 0) {
+    pthread_cond_destroy(&samplerWake);
+    free(counters);
+    counters  = NULL;
+    nCounters = 0;
+    sbenchFailTest(SBENCH_ERR_THREADS, "Can't create the sampler thread");
+    return NULL;
+  }
+  return counters;
+}
+
+
+/**
+  * Stops sampling the run, after its threads finish.
+  */
+void sbenchSamplerStop() {
+  if(counters == NULL)
+    return;
+  pthread_mutex_lock(&samplerLock);
+  stopping = 1;
+  pthread_cond_signal(&samplerWake);
+  pthread_mutex_unlock(&samplerLock);
+  pthread_join(sampler, NULL);
+  pthread_cond_destroy(&samplerWake);
+
+  takeSample(1);
+  offset += sbenchTimerElapsed(runStart, prevSample);
+  free(counters);
+  counters  = NULL;
+  nCounters = 0;
+}
+
+
+/**
+  * Adds the series to the result with its step changes, and stops
+  * sampling the next tests. If most intervals counted just a few
+  * times a count more or less is a big change of their ops/s, so
+  * the step changes aren't looked for.
+  */
+void sbenchAddSampleSeries(test_result *res) {
+  double *ops;
+  size_t  changes[SAMPLE_MAX_CHANGES];
+  int     bytes = 0, latency = 0;
+
+  if(samplerInterval <= 0)
+    return;
+  samplerInterval = 0;
+  if(nSeries == 0) {
+    sbenchAppendText(res, "no intervals sampled, the test is too short or it can't be sampled\n");
+    return;
+  }
+
+  res->series = (sample_interval *) malloc(nSeries * sizeof(sample_interval));
+  ops         = (double *) malloc(nSeries * sizeof(double));
+  if(res->series == NULL || ops == NULL) {
+    sbenchFailTest(SBENCH_ERR_MEMORY, "Can't allocate the time series of the result");
+    free(res->series);
+    free(ops);
+    res->series = NULL;
+    return;
+  }
+  memcpy(res->series, series, nSeries * sizeof(sample_interval));
+  res->nSeries = nSeries;
+  for(size_t i = 0; i < nSeries; i++) {
+    ops[i]   = series[i].opsPerSec;
+    bytes   |= series[i].bytesPerSec > 0;
+    latency |= series[i].avgLatencyMs > 0;
+  }
+  if(nCoarse * 2 <= nSeries) {
+    res->nChanges = sbenchDetectStepChanges(ops, nSeries, SAMPLE_MIN_SEGMENT, SAMPLE_MIN_CHANGE, changes, SAMPLE_MAX_CHANGES);
+    sbenchAddMetric(res, "step_changes", res->nChanges, "");
+  }
+
+  // the intervals, with what the test counts
+  for(size_t i = 0; i < nSeries; i++) {
+    sbenchAppendText(res, "%.3fs;%.0f ops/s", series[i].t, series[i].opsPerSec);
+    if(bytes)
+      sbenchAppendText(res, ";%.0f B/s", series[i].bytesPerSec);
+    if(latency)
+      sbenchAppendText(res, ";avg %.3f ms;max %.3f ms", series[i].avgLatencyMs, series[i].maxLatencyMs);
+    sbenchAppendText(res, "\n");
+  }
+
+  if(nCoarse * 2 > nSeries)
+    sbenchAppendText(res, "step changes not looked for: %zu of %zu intervals counted less than %d times, "
+                     "the series is too coarse, take a longer --sample-interval\n", nCoarse, nSeries, SAMPLE_MIN_COUNTS);
+  if(res->nChanges > 0) {
+    res->changes = (size_t *) malloc(res->nChanges * sizeof(size_t));
+    if(res->changes == NULL) {
+      sbenchFailTest(SBENCH_ERR_MEMORY, "Can't allocate the step changes of the result");
+      res->nChanges = 0;
+    }
+    else
+      memcpy(res->changes, changes, res->nChanges * sizeof(size_t));
+  }
+  for(size_t i = 0; i < res->nChanges; i++) {
+    // the levels between the changes around it
+    size_t from = i > 0 ? changes[i - 1] : 0, to = i + 1 < res->nChanges ? changes[i + 1] : nSeries;
+    double before = 0, after = 0;
+    for(size_t j = from; j < changes[i]; j++)
+      before += ops[j];
+    for(size_t j = changes[i]; j < to; j++)
+      after += ops[j];
+    before /= changes[i] - from;
+    after  /= to - changes[i];
+    sbenchAppendText(res, "step change at %.3fs: %.0f -> %.0f ops/s (%+.1f%%)\n", series[changes[i] - 1].t,
+                     before, after, before > 0 ? (after - before) / before * 100 : 0);
+    // the first one is the cliff
+    if(i == 0) {
+      sbenchAddMetric(res, "first_change_s",     series[changes[i] - 1].t, "s");
+      sbenchAddMetric(res, "ops_per_sec_before", before, "");
+      sbenchAddMetric(res, "ops_per_sec_after",  after,  "");
+      sbenchAddMetric(res, "change_percent",     before > 0 ? (after - before) / before * 100 : 0, "%");
+    }
+  }
+  free(ops);
+}
@@ -0,0 +1,61 @@
+/*
+ * Simple Benchmarks: time series of what a test does while it runs,
+ * to see the moment its throughput falls, like when the burst credits
+ * of a cloud disk or a burstable CPU run out.
+ *
+ * @since 20161027
+ * @author zoquero@gmail.com
+ */
+
+#ifndef SBENCHSAMPLE_H
+#define SBENCHSAMPLE_H
+
+#include <stdint.h>       // uint64_t
+
+#include "sbenchresult.h"  // test_result
+
+#define SAMPLE_MIN_INTERVAL    0.01 // seconds, "--sample-interval"
+#define SAMPLE_CPU_BATCH       1024 // calcs counted at once, a power of 2
+#define SAMPLE_MIN_SEGMENT     3    // intervals on each side of a step change
+#define SAMPLE_MIN_CHANGE      20   // percent of the ops/s that is a step change
+#define SAMPLE_MAX_CHANGES     8
+#define SAMPLE_MIN_COUNTS      50   // counts of an interval, fewer are quantized too coarsely for step changes
+
+/** what a thread did so far: written only by it and read by the
+    sampler, on its own cache line so that the threads don't share it */
+typedef struct sample_counters {
+  /** calls of sampleCount, the steps in which ops are counted */
+  uint64_t counts;
+  uint64_t ops;
+  uint64_t bytes;
+  /** sum of the latency of the operations in ns */
+  uint64_t latencySum;
+  /** since the last sample, the sampler takes it and leaves 0 */
+  uint64_t latencyMax;
+} __attribute__((aligned(64))) sample_counters;
+
+void sbenchSamplerEnable(double interval, int verbose);
+sample_counters *sbenchSamplerStart(unsigned int nThreads);
+void sbenchSamplerStop();
+void sbenchAddSampleSeries(test_result *res);
+
+/**
+  * Counts operations of a thread, without locks nor atomic read-modify-
+  * write instructions as each thread is the only writer of its counters:
+  * just relaxed stores, that the sampler reads whole.
+  * @param c counters of the thread, NULL if the test isn't sampled
+  * @param ns latency of the operations, 0 == not measured
+  */
+static inline void sampleCount(sample_counters *c, uint64_t ops, uint64_t bytes, uint64_t ns) {
+  if(c == NULL)
+    return;
+  __atomic_store_n(&c->counts,     __atomic_load_n(&c->counts, __ATOMIC_RELAXED) + 1,         __ATOMIC_RELAXED);
+  __atomic_store_n(&c->ops,        __atomic_load_n(&c->ops, __ATOMIC_RELAXED) + ops,          __ATOMIC_RELAXED);
+  __atomic_store_n(&c->bytes,      __atomic_load_n(&c->bytes, __ATOMIC_RELAXED) + bytes,      __ATOMIC_RELAXED);
+  __atomic_store_n(&c->latencySum, __atomic_load_n(&c->latencySum, __ATOMIC_RELAXED) + ns,    __ATOMIC_RELAXED);
+  // if the sampler takes it meanwhile this one goes to the next interval
+  if(ns > __atomic_load_n(&c->latencyMax, __ATOMIC_RELAXED))
+    __atomic_store_n(&c->latencyMax, ns, __ATOMIC_RELAXED);
+}
+
+#endif // SBENCHSAMPLE_H
@@ -0,0 +1,145 @@
+/*
+ * Simple Benchmarks: scheduling latency, like cyclictest, the clearest
+ * signature of a vCPU that the hypervisor doesn't run on time.
+ *
+ * Timer threads sleep until absolute deadlines every "interval" with
+ * clock_nanosleep and take how late they woke up. By default there's
+ * one pinned on each CPU that sbench can run on, so the lateness is of
+ * each CPU; with "-r" they run as SCHED_FIFO and only the hypervisor,
+ * interrupts and other realtime tasks delay them. When a wake up is so
+ * late that it misses the next deadlines they are skipped (overruns)
+ * instead of woken up at once, so one stall is counted once.
+ *
+ * @since 20161027
+ * @author zoquero@gmail.com
+ */
+
+#define _GNU_SOURCE       // CPU_SET, pthread_setaffinity_np
+#include <stdio.h>        // printf
+#include <stdlib.h>       // calloc, free
+#include <string.h>       // memset
+#include <errno.h>        // EINTR
+#include <time.h>         // clock_nanosleep
+#include <pthread.h>      // pthread_setaffinity_np
+#include <sched.h>        // sched_getaffinity
+
+#include "sbenchfuncs.h"
+#include "sbenchpool.h"
+#include "sbenchsched.h"
+
+const unsigned long sbenchSchedLatBounds[SCHED_LAT_BUCKETS - 1] = {10, 20, 50, 100, 200, 500, 1000, 2000, 5000, 10000};
+
+
+static uint64_t monotonicNs() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+/**
+  * A timer thread: wakes up on each deadline and takes how late it did.
+  */
+static void *schedLatStartupRoutine(void *arg) {
+  sched_lat_args *a = (sched_lat_args *) arg;
+  sched_params    p;
+  cpu_set_t       set, old;
+  struct timespec ts;
+  uint64_t        interval = a->intervalUs * 1000, next, end, now, late;
+  int             b;
+
+  if(a->cpu >= 0) {
+    // the pool keeps the thread for other tests, so it's unpinned afterwards
+    pthread_getaffinity_np(pthread_self(), sizeof(old), &old);
+    CPU_ZERO(&set);
+    CPU_SET(a->cpu, &set);
+    if(pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+      sbenchFailTest(SBENCH_ERR_THREADS, "Can't pin a timer thread on the CPU %d", a->cpu);
+      return NULL;
+    }
+  }
+  if(a->realtime == 1)
+    sbenchEnterRealTime(&p);
+
+  now  = monotonicNs();
+  next = now + interval;
+  end  = now + a->seconds * 1000000000ULL;
+  while(next <= end) {
+    ts.tv_sec  = next / 1000000000ULL;
+    ts.tv_nsec = next % 1000000000ULL;
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+      ;
+    now  = monotonicNs();
+    late = now > next ? now - next : 0;
+    sbenchHistogramAdd(&a->lateness, late);
+    for(b = 0; b < SCHED_LAT_BUCKETS - 1 && late > sbenchSchedLatBounds[b] * 1000; b++)
+      ;
+    a->buckets[b]++;
+    for(next += interval; next <= now; next += interval)
+      a->overruns++;
+  }
+
+  if(a->realtime == 1)
+    sbenchExitRealTime(p);
+  if(a->cpu >= 0)
+    pthread_setaffinity_np(pthread_self(), sizeof(old), &old);
+  if(a->verbose)
+    printf("timer thread on cpu %d: %lu wake ups, max %lu ns late\n", a->cpu,
+           (unsigned long) a->lateness.total, (unsigned long) a->lateness.max);
+  return NULL;
+}
+
+
+/**
+  * Scheduling latency: how late timer threads wake up from their
+  * deadlines every intervalUs for some seconds.
+  * @param nThreads timer threads not pinned, 0 == one pinned on each CPU
+  * @param sr return value, its threads are to free
+  * @return SBENCH_OK or why it failed
+  */
+int sbenchDoSchedLatTest(unsigned long seconds, unsigned long intervalUs, unsigned int nThreads, int verbose,
+                         int realtime, schedLatResponse *sr) {
+  cpu_set_t set;
+  int       pinned = nThreads == 0, cpu = 0;
+
+  sbenchClearTestFailure();
+  memset(sr, 0, sizeof(*sr));
+  if(seconds == 0 || intervalUs == 0)
+    return sbenchFailTest(SBENCH_ERR_PARAMS, "sched_lat needs seconds and an interval");
+  if(pinned) {
+    if(sched_getaffinity(0, sizeof(set), &set) != 0)
+      return sbenchFailTest(SBENCH_ERR_THREADS, "Can't get the CPUs that sbench can run on");
+    nThreads = CPU_COUNT(&set);
+  }
+  if((sr->threads = (sched_lat_args *) calloc(nThreads, sizeof(sched_lat_args))) == NULL)
+    return sbenchFailTest(SBENCH_ERR_MEMORY, "Can't allocate the arguments of %u threads", nThreads);
+  sr->nThreads = nThreads;
+
+  for(unsigned int i = 0; i < nThreads; i++) {
+    sched_lat_args *a = &sr->threads[i];
+    a->seconds    = seconds;
+    a->intervalUs = intervalUs;
+    a->verbose    = verbose;
+    a->realtime   = realtime;
+    a->cpu        = -1;
+    if(pinned) {
+      while(! CPU_ISSET(cpu, &set))
+        cpu++;
+      a->cpu = cpu++;
+    }
+  }
+  if(verbose)
+    printf("%u timer threads%s every %lu us for %lu s\n", nThreads, pinned ? ", one on each CPU," : "",
+           intervalUs, seconds);
+
+  if(sbenchRunOnThreads(schedLatStartupRoutine, sr->threads, sizeof(sched_lat_args), nThreads) != SBENCH_OK ||
+     sbenchTestFailure() != SBENCH_OK) {
+    free(sr->threads);
+    sr->threads = NULL;
+    return sbenchTestFailure();
+  }
+  for(unsigned int i = 0; i < nThreads; i++)
+    sbenchHistogramMerge(&sr->all, &sr->threads[i].lateness);
+  return SBENCH_OK;
+}
@@ -0,0 +1,50 @@
+/*
+ * Simple Benchmarks: scheduling latency, like cyclictest, the clearest
+ * signature of a vCPU that the hypervisor doesn't run on time.
+ *
+ * @since 20161027
+ * @author zoquero@gmail.com
+ */
+
+#ifndef SBENCHSCHED_H
+#define SBENCHSCHED_H
+
+#include <stdint.h>       // uint64_t
+
+#include "sbenchfuncs.h"   // latencyHistogram
+
+#define SCHED_LAT_BUCKETS 11 // of the histogram that is reported, the last one is the rest
+
+/** upper bounds of the buckets of the histogram that is reported, in us */
+extern const unsigned long sbenchSchedLatBounds[SCHED_LAT_BUCKETS - 1];
+
+/* arguments and results of each timer thread */
+typedef struct {
+  unsigned long    seconds;
+  /** in microseconds */
+  unsigned long    intervalUs;
+  /** CPU where it's pinned, -1 if it isn't */
+  int              cpu;
+  int              verbose;
+  int              realtime;
+  /** return values: how late it woke up, in ns */
+  latencyHistogram lateness;
+  /** wake ups on each bucket of sbenchSchedLatBounds */
+  uint64_t         buckets[SCHED_LAT_BUCKETS];
+  /** periods missed because it woke up later than the next one */
+  uint64_t         overruns;
+} sched_lat_args;
+
+/** sched_lat response */
+typedef struct {
+  unsigned int    nThreads;
+  /** one for each timer thread, to free */
+  sched_lat_args *threads;
+  /** all of them together */
+  latencyHistogram all;
+} schedLatResponse;
+
+int sbenchDoSchedLatTest(unsigned long seconds, unsigned long intervalUs, unsigned int nThreads, int verbose,
+                         int realtime, schedLatResponse *sr);
+
+#endif // SBENCHSCHED_H
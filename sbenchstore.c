@@ -0,0 +1,178 @@
+/*
+ * Simple Benchmarks: local store of the results of the tests,
+ * to compare a run with its baseline.
+ *
+ * The store is a file that is only appended to: a header and then
+ * fixed-size records, one per sample of the main value of a test.
+ * Each record has the signature of its test (a hash of its type,
+ * params and the fingerprint of the host), so that the samples of
+ * the same test on the same host are found by mapping the file
+ * and going through it, and a file can have many hosts and tests.
+ * A run is appended in a single write, under an exclusive lock.
+ *
+ * @since 20161027
+ * @author zoquero@gmail.com
+ */
+
+#include <stdio.h>        // snprintf, fopen
+#include <limits.h>       // PATH_MAX
+#include <stdlib.h>       // malloc, realloc
+#include <string.h>       // memcmp, strerror
+#include <errno.h>        // errno
+#include <unistd.h>       // write, close, gethostname, sysconf
+#include <fcntl.h>        // open
+#include <sys/file.h>     // flock
+#include <sys/mman.h>     // mmap
+#include <sys/stat.h>     // fstat
+#include <sys/utsname.h>  // uname
+
+#include "sbenchfuncs.h"
+#include "sbenchstore.h"
+
+
+/**
+  * What tells a host from another one and from itself after a change
+  * that makes it another baseline: name, kernel, CPU model, number of
+  * CPUs and memory.
+  */
+void sbenchHostFingerprint(char *buf, size_t size) {
+  struct utsname u;
+  char   host[256] = "unknown", model[256] = "", line[512];
+  unsigned long memKiB = 0;
+  FILE  *f;
+
+  gethostname(host, sizeof(host) - 1);
+  if(uname(&u) != 0)
+    strcpy(u.release, "");
+  if((f = fopen("/proc/cpuinfo", "r")) != NULL) {
+    while(fgets(line, sizeof(line), f) != NULL)
+      if(sscanf(line, "model name : %255[^\n]", model) == 1)
+        break;
+    fclose(f);
+  }
+  if((f = fopen("/proc/meminfo", "r")) != NULL) {
+    while(fgets(line, sizeof(line), f) != NULL)
+      if(sscanf(line, "MemTotal: %lu kB", &memKiB) == 1)
+        break;
+    fclose(f);
+  }
+  snprintf(buf, size, "%s;%s;%s;%ld cpus;%lu kB", host, u.release, model,
+           sysconf(_SC_NPROCESSORS_ONLN), memKiB);
+}
+
+
+/**
+  * 64-bit FNV-1a hash of what identifies a test.
+  */
+uint64_t sbenchStoreSignature(const char *key) {
+  uint64_t h = 14695981039346656037ULL;
+
+  for(; *key != '\0'; key++) {
+    h ^= (unsigned char) *key;
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+
+/**
+  * Appends the samples of a run to the store, creating it if needed.
+  */
+void sbenchStoreAppend(const char *path, uint64_t signature, time_t timestamp, double *values, size_t n, int status) {
+  store_header  header;
+  store_record *records;
+  struct stat   st;
+  char          msg[PATH_MAX + 100];
+  int           fd;
+
+  if((fd = open(path, O_WRONLY | O_APPEND | O_CREAT, 0644)) < 0) {
+    sprintf(msg, "Can't open the baseline store %.*s: %s", PATH_MAX, path, strerror(errno));
+    sbenchMyAbort(msg);
+  }
+  flock(fd, LOCK_EX);
+  if(fstat(fd, &st) == 0 && st.st_size == 0) {
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, STORE_MAGIC, sizeof(header.magic));
+    header.version    = STORE_VERSION;
+    header.recordSize = sizeof(store_record);
+    if(write(fd, &header, sizeof(header)) != sizeof(header)) {
+      sprintf(msg, "Can't write on the baseline store %.*s: %s", PATH_MAX, path, strerror(errno));
+      sbenchMyAbort(msg);
+    }
+  }
+
+  records = (store_record *) calloc(n, sizeof(store_record));
+  if(records == NULL)
+    sbenchMyAbort("Can't allocate the records of the baseline");
+  for(size_t i = 0; i < n; i++) {
+    records[i].signature = signature;
+    records[i].timestamp = timestamp;
+    records[i].value     = values[i];
+    records[i].status    = status;
+  }
+  if(write(fd, records, n * sizeof(store_record)) != (ssize_t) (n * sizeof(store_record))) {
+    sprintf(msg, "Can't write on the baseline store %.*s: %s", PATH_MAX, path, strerror(errno));
+    sbenchMyAbort(msg);
+  }
+  flock(fd, LOCK_UN);
+  close(fd);
+  free(records);
+}
+
+
+/**
+  * The samples of a test on the store, from the oldest to the newest.
+  * A store that doesn't exist yet has none.
+  * @param n return value, number of samples
+  * @return the samples, to be freed by the caller, NULL if there are none
+  */
+double *sbenchStoreLoad(const char *path, uint64_t signature, size_t *n) {
+  store_header *header;
+  store_record *records;
+  struct stat   st;
+  char          msg[PATH_MAX + 100];
+  double       *values = NULL;
+  size_t        nRecords, size = 0;
+  void         *map;
+  int           fd;
+
+  *n = 0;
+  if((fd = open(path, O_RDONLY)) < 0) {
+    if(errno == ENOENT)
+      return NULL;
+    sprintf(msg, "Can't open the baseline store %.*s: %s", PATH_MAX, path, strerror(errno));
+    sbenchMyAbort(msg);
+  }
+  if(fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(store_header)) {
+    close(fd);
+    return NULL;
+  }
+  if((map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+    sprintf(msg, "Can't map the baseline store %.*s: %s", PATH_MAX, path, strerror(errno));
+    sbenchMyAbort(msg);
+  }
+  close(fd);
+
+  header = (store_header *) map;
+  if(memcmp(header->magic, STORE_MAGIC, sizeof(header->magic)) != 0 ||
+     header->version != STORE_VERSION || header->recordSize != sizeof(store_record)) {
+    sprintf(msg, "%.*s isn't a baseline store of this version of sbench", PATH_MAX, path);
+    sbenchMyAbort(msg);
+  }
+  records  = (store_record *) ((char *) map + sizeof(store_header));
+  // a record being appended right now isn't complete yet
+  nRecords = (st.st_size - sizeof(store_header)) / sizeof(store_record);
+  for(size_t i = 0; i < nRecords; i++) {
+    if(records[i].signature != signature)
+      continue;
+    if(*n == size) {
+      size   = size == 0 ? 64 : size * 2;
+      values = (double *) realloc(values, size * sizeof(double));
+      if(values == NULL)
+        sbenchMyAbort("Can't allocate the samples of the baseline");
+    }
+    values[(*n)++] = records[i].value;
+  }
+  munmap(map, st.st_size);
+  return values;
+}
@@ -0,0 +1,45 @@
+/*
+ * Simple Benchmarks: local store of the results of the tests,
+ * to compare a run with its baseline.
+ *
+ * @since 20161027
+ * @author zoquero@gmail.com
+ */
+
+#ifndef SBENCHSTORE_H
+#define SBENCHSTORE_H
+
+#include <stdint.h>       // uint64_t
+#include <stddef.h>       // size_t
+#include <time.h>         // time_t
+
+#define BASELINE_STORE     "/var/lib/sbench/baseline.db"
+#define STORE_MAGIC        "SBENCHDB"
+#define STORE_VERSION      1
+
+/** first bytes of a store */
+typedef struct {
+  char     magic[8];
+  uint32_t version;
+  /** sizeof(store_record) */
+  uint32_t recordSize;
+} store_header;
+
+/** a sample of the main value of a test, fixed size so that
+    the store can be mapped as an array */
+typedef struct {
+  /** sbenchStoreSignature of the test */
+  uint64_t signature;
+  int64_t  timestamp;
+  double   value;
+  /** EXIT_CODE_* of its run */
+  int32_t  status;
+  uint32_t reserved;
+} store_record;
+
+void sbenchHostFingerprint(char *buf, size_t size);
+uint64_t sbenchStoreSignature(const char *key);
+void sbenchStoreAppend(const char *path, uint64_t signature, time_t timestamp, double *values, size_t n, int status);
+double *sbenchStoreLoad(const char *path, uint64_t signature, size_t *n);
+
+#endif // SBENCHSTORE_H
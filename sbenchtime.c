@@ -0,0 +1,190 @@
+/*
+ * Simple Benchmarks: the clock that times the tests.
+ *
+ * All the tests read the time through timerRead() and measure intervals
+ * with sbenchTimerElapsed(), that subtracts what reading the timer costs.
+ *
+ * @since 20161027
+ * @author zoquero@gmail.com
+ */
+
+#include <stdio.h>        // printf
+#include <stdlib.h>       // qsort
+#include <errno.h>        // EINTR
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>        // __get_cpuid
+#endif
+
+#include "sbenchtime.h"
+
+#define TIMER_OVERHEAD_SAMPLES  1000
+#define TSC_CALIBRATION_ROUNDS  5
+#define TSC_CALIBRATION_NS      20000000 // 20ms each round
+
+/** monotonic raw clock in ns until sbenchInitTimer says something else */
+timer_info sbenchTimer = {TIMER_MONOTONIC_RAW, 1E-9, 0};
+
+
+/**
+  * Ticks that two consecutive reads of the timer take, the minimum of
+  * many tries so that interrupts and preemptions don't count.
+  */
+static uint64_t measureTimerOverhead() {
+  uint64_t t0, t1, min = UINT64_MAX;
+
+  for(int i = 0; i < TIMER_OVERHEAD_SAMPLES; i++) {
+    t0 = timerRead();
+    t1 = timerRead();
+    if(t1 - t0 < min)
+      min = t1 - t0;
+  }
+  return min;
+}
+
+
+/**
+  * If the CPU has an invariant TSC: it ticks at a constant rate
+  * whatever the frequency and power state of the core is.
+  * CPUID.80000007H:EDX[8]
+  */
+static int hasInvariantTsc() {
+#if defined(__x86_64__) || defined(__i386__)
+  unsigned int eax, ebx, ecx, edx;
+
+  if(__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) == 0)
+    return 0;
+  return (edx >> 8) & 1;
+#else
+  return 0;
+#endif
+}
+
+
+static int compareTickLengths(const void *a, const void *b) {
+  double x = *(const double *) a, y = *(const double *) b;
+  return x < y ? -1 : x > y;
+}
+
+
+/**
+  * Length of a TSC tick in seconds, counting the ticks during some
+  * spins of the monotonic raw clock. The median of some rounds.
+  */
+static double calibrateTsc() {
+  double   rounds[TSC_CALIBRATION_ROUNDS];
+  uint64_t ns0, ns1, tsc0, tsc1;
+
+  for(int i = 0; i < TSC_CALIBRATION_ROUNDS; i++) {
+    sbenchTimer.source = TIMER_MONOTONIC_RAW;
+    ns0 = timerRead();
+    sbenchTimer.source = TIMER_TSC;
+    tsc0 = timerRead();
+    sbenchTimer.source = TIMER_MONOTONIC_RAW;
+    do {
+      ns1 = timerRead();
+    } while(ns1 - ns0 < TSC_CALIBRATION_NS);
+    sbenchTimer.source = TIMER_TSC;
+    tsc1 = timerRead();
+    rounds[i] = (ns1 - ns0) / 1E9 / (tsc1 - tsc0);
+  }
+  qsort(rounds, TSC_CALIBRATION_ROUNDS, sizeof(double), compareTickLengths);
+  return rounds[TSC_CALIBRATION_ROUNDS / 2];
+}
+
+
+/**
+  * Chooses the timer and measures its overhead. Without calling it
+  * the tests are timed with the monotonic raw clock and nothing is
+  * subtracted.
+  * @param useTsc use the TSC if it's invariant
+  * @return 0 if the timer requested is used, -1 if it fell back
+  *         to the monotonic raw clock
+  */
+int sbenchInitTimer(int useTsc, int verbose) {
+  int ret = 0;
+
+  sbenchTimer.source         = TIMER_MONOTONIC_RAW;
+  sbenchTimer.secondsPerTick = 1E-9;
+  if(useTsc) {
+    if(hasInvariantTsc()) {
+      sbenchTimer.secondsPerTick = calibrateTsc();
+      sbenchTimer.source         = TIMER_TSC;
+    }
+    else {
+      fprintf(stderr, "The TSC isn't invariant, using CLOCK_MONOTONIC_RAW\n");
+      ret = -1;
+    }
+  }
+  sbenchTimer.overheadTicks = measureTimerOverhead();
+
+  if(verbose) {
+    if(sbenchTimer.source == TIMER_TSC)
+      printf("Timer: TSC at %.3f MHz", 1E-6 / sbenchTimer.secondsPerTick);
+    else
+      printf("Timer: CLOCK_MONOTONIC_RAW");
+    printf(", overhead %.1f ns subtracted from each interval\n",
+           sbenchTimer.overheadTicks * sbenchTimer.secondsPerTick * 1E9);
+  }
+  return ret;
+}
+
+
+/**
+  * Seconds between two instants read with timerRead, without the
+  * overhead of reading the timer.
+  */
+double sbenchTimerElapsed(uint64_t start, uint64_t end) {
+  uint64_t ticks = end - start;
+
+  if(end < start)
+    return 0.;
+  ticks = ticks > sbenchTimer.overheadTicks ? ticks - sbenchTimer.overheadTicks : 0;
+  return ticks * sbenchTimer.secondsPerTick;
+}
+
+
+/**
+  * Current instant of the timer in seconds
+  */
+double sbenchMonotonicSeconds() {
+  return timerRead() * sbenchTimer.secondsPerTick;
+}
+
+
+/**
+  * Starts a schedule of rate operations per second from now.
+  * @param offsetSeconds delay of the first operation, so that
+  *        many threads sharing a rate don't go at once
+  */
+void sbenchPacerInit(pacer *p, double rate, double offsetSeconds) {
+  p->ticksPerOp = 1. / rate / sbenchTimer.secondsPerTick;
+  p->start      = timerRead() + (uint64_t) (offsetSeconds / sbenchTimer.secondsPerTick);
+  p->issued     = 0;
+}
+
+
+/**
+  * Waits for the token of the next operation: sleeping while it's far
+  * and spinning on the timer the last PACER_SPIN_NS, as the wakeup of a
+  * sleep isn't that precise. It doesn't wait if the operation is late.
+  * @return intended start of the operation, to measure its latency
+  *         from it and not from when it could really start
+  */
+uint64_t sbenchPacerWait(pacer *p) {
+  uint64_t due = p->start + (uint64_t) (p->issued++ * p->ticksPerOp);
+  uint64_t now = timerRead();
+  double   left;
+
+  if(now < due && (left = (due - now) * sbenchTimer.secondsPerTick) > PACER_SPIN_NS / 1E9) {
+    struct timespec t;
+    left -= PACER_SPIN_NS / 1E9;
+    t.tv_sec  = (time_t) left;
+    t.tv_nsec = (long) ((left - t.tv_sec) * 1E9);
+    while(clock_nanosleep(CLOCK_MONOTONIC, 0, &t, &t) == EINTR)
+      ;
+  }
+  while(timerRead() < due)
+    ;
+  return due;
+}
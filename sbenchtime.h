@@ -0,0 +1,65 @@
+/*
+ * Simple Benchmarks: the clock that times the tests.
+ *
+ * @since 20161027
+ * @author zoquero@gmail.com
+ */
+
+#ifndef SBENCHTIME_H
+#define SBENCHTIME_H
+
+#include <stdint.h>       // uint64_t
+#include <time.h>         // clock_gettime
+
+/** where the timer reads the time from */
+enum timerSource {TIMER_MONOTONIC_RAW, TIMER_TSC};
+
+/** the timer and what it costs to read it */
+typedef struct {
+  enum timerSource source;
+  /** length of a tick in seconds */
+  double           secondsPerTick;
+  /** ticks that two consecutive reads take, subtracted from each interval */
+  uint64_t         overheadTicks;
+} timer_info;
+
+extern timer_info sbenchTimer;
+
+/* closer than this to the due time a pacer spins instead of sleeping */
+#define PACER_SPIN_NS 50000
+
+/** open-loop schedule, a token bucket: the token of the i-th operation
+    arrives at start + i / rate whatever the previous ones took, so a
+    stall delays the next operations instead of omitting them */
+typedef struct {
+  uint64_t start;
+  double   ticksPerOp;
+  uint64_t issued;
+} pacer;
+
+int sbenchInitTimer(int useTsc, int verbose);
+double sbenchTimerElapsed(uint64_t start, uint64_t end);
+double sbenchMonotonicSeconds();
+void sbenchPacerInit(pacer *p, double rate, double offsetSeconds);
+uint64_t sbenchPacerWait(pacer *p);
+
+/**
+  * Current instant in ticks of the timer. The monotonic raw clock isn't
+  * slewed by NTP, the TSC is cheaper to read but it's only used if it's
+  * invariant (constant rate, doesn't stop on idle states).
+  */
+static inline uint64_t timerRead() {
+#if defined(__x86_64__) || defined(__i386__)
+  if(sbenchTimer.source == TIMER_TSC) {
+    uint32_t lo, hi;
+    // lfence: don't let rdtsc run before the previous instructions finish
+    __asm__ __volatile__("lfence\n\trdtsc" : "=a" (lo), "=d" (hi) :: "memory");
+    return ((uint64_t) hi << 32) | lo;
+  }
+#endif
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC_RAW, &t);
+  return (uint64_t) t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+#endif // SBENCHTIME_H